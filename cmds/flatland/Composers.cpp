@@ -126,6 +126,10 @@ public:
         return true;
     }
 
+    virtual bool isOpaque() const {
+        return false;
+    }
+
 protected:
     virtual bool setUp(GLHelper* /*helper*/) {
         return true;
@@ -158,6 +162,10 @@ Composer* opaque() {
             return mBlitter.blit(texName, texMatrix, x, y, w, h);
         }
 
+        virtual bool isOpaque() const {
+            return true;
+        }
+
         Blitter mBlitter;
     };
     return new OpaqueComp();
@@ -190,6 +198,10 @@ Composer* opaqueShrink() {
             return mBlitter.blit(texName, texMatrix, x, y, w, h);
         }
 
+        virtual bool isOpaque() const {
+            return true;
+        }
+
         Blitter mBlitter;
         bool mParity;
     };
@@ -50,6 +50,7 @@ public:
     virtual bool setUp(const LayerDesc& desc, GLHelper* helper) = 0;
     virtual void tearDown() = 0;
     virtual bool compose(GLuint texName, const sp<GLConsumer>& glc) = 0;
+    virtual bool isOpaque() const = 0;
 };
 
 Composer* nocomp();
@@ -37,7 +37,8 @@ GLHelper::GLHelper() :
 GLHelper::~GLHelper() {
 }
 
-bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders) {
+bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders,
+        bool depthBuffer) {
     bool result;
 
     mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
@@ -62,6 +63,7 @@ bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders) {
         EGL_GREEN_SIZE, 8,
         EGL_BLUE_SIZE, 8,
         EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, depthBuffer ? 16 : 0,
         EGL_NONE
     };
     result = eglChooseConfig(mDisplay, configAttribs, &mConfig, 1,
@@ -70,6 +72,10 @@ bool GLHelper::setUp(const ShaderDesc* shaderDescs, size_t numShaders) {
         fprintf(stderr, "eglChooseConfig error: %#x\n", eglGetError());
         return false;
     }
+    if (numConfigs == 0) {
+        fprintf(stderr, "no matching EGLConfig found\n");
+        return false;
+    }
 
     EGLint contextAttribs[] = {
         EGL_CONTEXT_CLIENT_VERSION, 2,
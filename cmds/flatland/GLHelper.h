@@ -45,7 +45,8 @@ public:
 
     ~GLHelper();
 
-    bool setUp(const ShaderDesc* shaderDescs, size_t numShaders);
+    bool setUp(const ShaderDesc* shaderDescs, size_t numShaders,
+            bool depthBuffer);
 
     void tearDown();
 
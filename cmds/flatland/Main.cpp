@@ -37,6 +37,7 @@ using namespace ::android;
 
 static uint32_t g_SleepBetweenSamplesMs = 0;
 static bool     g_PresentToWindow       = false;
+static bool     g_FrontToBack           = false;
 static size_t   g_BenchmarkNameLen      = 0;
 
 struct BenchmarkDesc {
@@ -202,6 +203,58 @@ static const BenchmarkDesc benchmarks[] = {
             },
         },
     },
+
+    { "16:10 App over Home",
+        2560, 1600, { 800, 1200, 1600, 2400 },
+        {
+            {   // Wallpaper
+                0, staticGradient, opaque,
+                0,    50,     2560,   1454,
+            },
+            {   // Launcher
+                0, staticGradient, blend,
+                0,    50,     2560,   1454,
+            },
+            {   // Activity
+                0, staticGradient, opaque,
+                0,    50,     2560,   1454,
+            },
+            {   // Status bar
+                0, staticGradient, opaque,
+                0,    0,      2560,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, opaque,
+                0,    1504,   2560,   96,
+            },
+        },
+    },
+
+    { "4:3 App over Home",
+        2048, 1536, { 1536 },
+        {
+            {   // Wallpaper
+                0, staticGradient, opaque,
+                0,    50,     2048,   1440,
+            },
+            {   // Launcher
+                0, staticGradient, blend,
+                0,    50,     2048,   1440,
+            },
+            {   // Activity
+                0, staticGradient, opaque,
+                0,    50,     2048,   1440,
+            },
+            {   // Status bar
+                0, staticGradient, opaque,
+                0,    0,      2048,   50,
+            },
+            {   // Navigation bar
+                0, staticGradient, opaque,
+                0,    1440,   2048,   96,
+            },
+        },
+    },
 };
 
 static const ShaderDesc shaders[] = {
@@ -358,6 +411,10 @@ public:
         return mComposer->compose(mTexName, mGLConsumer);
     }
 
+    bool isOpaque() const {
+        return mComposer->isOpaque();
+    }
+
 private:
     bool mFirstFrame;
 
@@ -398,7 +455,7 @@ public:
         uint32_t h = mDesc.runHeights[mInstance];
 
         mGLHelper = new GLHelper();
-        result = mGLHelper->setUp(shaders, NELEMS(shaders));
+        result = mGLHelper->setUp(shaders, NELEMS(shaders), g_FrontToBack);
         if (!result) {
             return false;
         }
@@ -533,13 +590,20 @@ private:
         }
 
         glClearColor(1.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        for (size_t i = 0; i < mNumLayers; i++) {
-            result = mLayers[i].compose();
+        if (g_FrontToBack) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            result = composeFrontToBack();
             if (!result) {
                 return false;
             }
+        } else {
+            glClear(GL_COLOR_BUFFER_BIT);
+            for (size_t i = 0; i < mNumLayers; i++) {
+                result = mLayers[i].compose();
+                if (!result) {
+                    return false;
+                }
+            }
         }
 
         result = mGLHelper->swapBuffers(surface);
@@ -556,6 +620,40 @@ private:
         return true;
     }
 
+    // Composes the opaque layers from the top down with the depth test, so
+    // that the pixels they hide in the layers below are rejected, then
+    // blends the other layers from the bottom up.  Each layer gets its own
+    // depth by collapsing the depth range, since all the layers are flat.
+    bool composeFrontToBack() {
+        bool result = true;
+
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        for (size_t i = mNumLayers; result && i-- > 0; ) {
+            if (mLayers[i].isOpaque()) {
+                float depth = float(mNumLayers - i) / float(mNumLayers + 1);
+                glDepthRangef(depth, depth);
+                result = mLayers[i].compose();
+            }
+        }
+
+        glDepthMask(GL_FALSE);
+        for (size_t i = 0; result && i < mNumLayers; i++) {
+            if (!mLayers[i].isOpaque()) {
+                float depth = float(mNumLayers - i) / float(mNumLayers + 1);
+                glDepthRangef(depth, depth);
+                result = mLayers[i].compose();
+            }
+        }
+
+        glDepthMask(GL_TRUE);
+        glDepthRangef(0.0f, 1.0f);
+        glDisable(GL_DEPTH_TEST);
+
+        return result;
+    }
+
     static size_t countLayers(const BenchmarkDesc& desc) {
         size_t i;
         for (i = 0; i < MAX_NUM_LAYERS; i++) {
@@ -729,6 +827,8 @@ static void showHelp(const char *cmd) {
     fprintf(stderr, "options include:\n"
                     "  -s N            sleep for N ms between samples\n"
                     "  -d              display the test frame to a window\n"
+                    "  -z              compose opaque layers front to back with\n"
+                    "                  a depth test\n"
                     "  --help          print this helpful message and exit\n"
             );
 }
@@ -747,7 +847,7 @@ int main(int argc, char** argv) {
             {     0,               0, 0,  0 }
         };
 
-        ret = getopt_long(argc, argv, "ds:",
+        ret = getopt_long(argc, argv, "ds:z",
                           long_options, &option_index);
 
         if (ret < 0) {
@@ -763,6 +863,10 @@ int main(int argc, char** argv) {
                 g_SleepBetweenSamplesMs = atoi(optarg);
             break;
 
+            case 'z':
+                g_FrontToBack = true;
+            break;
+
             case 0:
                 if (strcmp(long_options[option_index].name, "help")) {
                     showHelp(argv[0]);
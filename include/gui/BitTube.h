@@ -33,19 +33,42 @@ class BitTube : public RefBase
 {
 public:
 
+    // Transport is how the messages are carried from the sending end to the
+    // receiving end.
+    enum Transport {
+        // A SOCK_SEQPACKET socket pair: each send and receive is a syscall
+        // copying the messages
+        TRANSPORT_SOCKET = 0,
+
+        // A single-producer single-consumer ring in shared memory, with an
+        // eventfd to wake up the receiving end. Messages are copied in and out
+        // of the ring in user space, and the eventfd is only signaled when the
+        // receiving end has consumed everything that was sent before. There
+        // is no return channel: getSendFd() returns -1.
+        TRANSPORT_SHARED_MEMORY = 1,
+    };
+
     // creates a BitTube with a default (4KB) send buffer
     BitTube();
 
     // creates a BitTube with a a specified send and receive buffer size
     explicit BitTube(size_t bufsize);
 
+    // creates a BitTube with a default (4KB) buffer using the given transport
+    explicit BitTube(Transport transport);
+
     explicit BitTube(const Parcel& data);
     virtual ~BitTube();
 
     // check state after construction
     status_t initCheck() const;
 
-    // get receive file-descriptor
+    // get the transport used by this BitTube. The receiving end created from
+    // a Parcel uses whatever transport the sending end picked.
+    Transport getTransport() const;
+
+    // get receive file-descriptor. It becomes readable when messages are
+    // available, whatever the transport.
     int getFd() const;
 
     // get the send file-descriptor.
@@ -71,6 +94,12 @@ public:
 
 private:
     void init(size_t rcvbuf, size_t sndbuf);
+    void initSharedMemory(size_t size);
+
+    // shared memory transport implementation of write and read
+    ssize_t writeRing(void const* vaddr, size_t size);
+    ssize_t readRing(void* vaddr, size_t size);
+    void signalReceiver() const;
 
     // send a message. The write is guaranteed to send the whole message or fail.
     ssize_t write(void const* vaddr, size_t size);
@@ -82,6 +111,18 @@ private:
     int mSendFd;
     mutable int mReceiveFd;
 
+    Transport mTransport;
+
+    // shared memory transport state: the ashmem region holding the ring, its
+    // mapping, and the eventfd used as a doorbell (which is also mReceiveFd).
+    // The other end can write the whole region, so the capacity of the ring
+    // is kept here once validated rather than read back from the header.
+    struct RingHeader;
+    mutable int mRingFd;
+    RingHeader* mRing;
+    size_t mRingSize;
+    uint32_t mRingCapacity;
+
     static ssize_t sendObjects(const sp<BitTube>& tube,
             void const* events, size_t count, size_t objSize);
 
@@ -142,6 +142,25 @@ public:
     // Retrieve the sideband buffer stream, if any.
     virtual sp<NativeHandle> getSidebandStream() const;
 
+    // setPreallocationLimit sets the maximum number of bytes of buffer memory
+    // the BufferQueue may hold in order to allocate buffers ahead of
+    // dequeueBuffer. 0 (the default) disables preallocation.
+    virtual status_t setPreallocationLimit(size_t limit);
+
+    // setFrameTimelineEnabled turns recording of the per-frame timeline on
+    // or off. Enabling it discards any previously recorded frames.
+    virtual status_t setFrameTimelineEnabled(bool enabled);
+
+    // getFrameTimeline returns the most recent timeline records, oldest
+    // first.
+    virtual status_t getFrameTimeline(
+            Vector<BufferQueueTimeline::Record>* outRecords);
+
+    // getFrontBufferFence returns the acquire fence of the buffer that
+    // acquireBuffer would return given expectedPresent.
+    virtual status_t getFrontBufferFence(sp<Fence>* outFence,
+            nsecs_t expectedPresent);
+
     // dump our state in a String
     virtual void dump(String8& result, const char* prefix) const;
 
@@ -165,6 +184,12 @@ public:
     // End functions required for backwards compatibility
 
 private:
+    // acquireBufferLocked does the work of acquireBuffer with mCore->mMutex
+    // held; waking the producers and tracing are left to the caller, so
+    // that they happen after the lock is released.
+    status_t acquireBufferLocked(BufferItem* outBuffer,
+            nsecs_t expectedPresent);
+
     sp<BufferQueueCore> mCore;
 
     // This references mCore->mSlots. Lock mCore->mMutex while accessing.
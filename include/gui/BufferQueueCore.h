@@ -18,6 +18,7 @@
 #define ANDROID_GUI_BUFFERQUEUECORE_H
 
 #include <gui/BufferQueueDefs.h>
+#include <gui/BufferQueueTimeline.h>
 #include <gui/BufferSlot.h>
 
 #include <utils/Condition.h>
@@ -123,6 +124,29 @@ private:
     // waitWhileAllocatingLocked blocks until mIsAllocating is false.
     void waitWhileAllocatingLocked() const;
 
+    // setPreallocationLimitLocked sets the number of bytes of buffer memory
+    // the preallocation thread may keep allocated in this BufferQueue. A limit
+    // of 0 disables preallocation. The thread is started the first time a
+    // non-zero limit is set.
+    void setPreallocationLimitLocked(size_t limit);
+
+    // recordDequeueLocked updates the predicted buffer width, height, format
+    // and usage from a dequeueBuffer call, and wakes the preallocation thread
+    // once the same parameters have been seen PREALLOCATION_CONFIDENCE times
+    // in a row.
+    void recordDequeueLocked(uint32_t width, uint32_t height, uint32_t format,
+            uint32_t usage, bool async);
+
+    // findSlotToPreallocateLocked returns true and sets outSlot if there is a
+    // FREE slot whose buffer does not match the predicted parameters and
+    // replacing it would keep the queue within mPreallocationLimit.
+    bool findSlotToPreallocateLocked(int* outSlot) const;
+
+    // matchesPredictionLocked returns true if buffer is non-NULL and could be
+    // returned by dequeueBuffer for the predicted parameters without being
+    // reallocated.
+    bool matchesPredictionLocked(const sp<GraphicBuffer>& buffer) const;
+
     // mAllocator is the connection to SurfaceFlinger that is used to allocate
     // new GraphicBuffer objects.
     sp<IGraphicBufferAlloc> mAllocator;
@@ -188,6 +212,13 @@ private:
     // synchronous mode.
     mutable Condition mDequeueCondition;
 
+    // mDequeueWaiters is the number of threads currently blocked on
+    // mDequeueCondition. The frequent slot transitions (queue, cancel,
+    // acquire and release) use it to skip the broadcast when nobody is
+    // waiting, and otherwise broadcast only after mMutex has been released so
+    // that the woken producer doesn't immediately block on the mutex again.
+    int mDequeueWaiters;
+
     // mUseAsyncBuffer indicates whether an extra buffer is used in async mode
     // to prevent dequeueBuffer from blocking.
     bool mUseAsyncBuffer;
@@ -246,6 +277,54 @@ private:
     // mIsAllocatingCondition is a condition variable used by producers to wait until mIsAllocating
     // becomes false.
     mutable Condition mIsAllocatingCondition;
+
+    // Preallocator is the thread that allocates buffers matching the
+    // predicted dequeueBuffer parameters into FREE slots ahead of time, so
+    // that dequeueBuffer doesn't have to allocate them synchronously.
+    class Preallocator;
+    sp<Preallocator> mPreallocator;
+
+    // The number of consecutive dequeueBuffer calls with identical parameters
+    // required before the preallocation thread acts on a prediction.
+    enum { PREALLOCATION_CONFIDENCE = 2 };
+
+    // mPreallocationLimit is the maximum number of bytes of buffer memory the
+    // preallocation thread may keep allocated. It is set by the consumer via
+    // setPreallocationLimit and defaults to 0, which disables preallocation.
+    size_t mPreallocationLimit;
+
+    // mPreallocationCondition is signaled when the preallocation thread may
+    // have work to do: the prediction became confident, a dequeueBuffer call
+    // had to allocate, or the limit changed.
+    mutable Condition mPreallocationCondition;
+
+    // mPredicted* hold the parameters of the most recent dequeueBuffer call,
+    // after default size, format and consumer usage bits have been applied.
+    // mPredictionCount is the number of consecutive dequeueBuffer calls that
+    // used these parameters.
+    uint32_t mPredictedWidth;
+    uint32_t mPredictedHeight;
+    uint32_t mPredictedFormat;
+    uint32_t mPredictedUsage;
+    bool mPredictedAsync;
+    int mPredictionCount;
+
+    // mPreallocatedBufferCount counts buffers installed by the preallocation
+    // thread, mDequeueAllocationsAvoided counts dequeueBuffer calls that were
+    // satisfied by one of those buffers, and mDequeueAllocationCount counts
+    // dequeueBuffer calls that still had to allocate.
+    uint64_t mPreallocatedBufferCount;
+    uint64_t mDequeueAllocationsAvoided;
+    uint64_t mDequeueAllocationCount;
+
+    // mTimelineEnabled indicates whether the lifecycle of each frame is
+    // recorded in mTimeline. It is set by the consumer via
+    // setFrameTimelineEnabled and defaults to false.
+    bool mTimelineEnabled;
+
+    // mTimeline holds the lifecycle of the most recent frames. It is written
+    // with mMutex held, but can be read without it.
+    BufferQueueTimeline mTimeline;
 }; // class BufferQueueCore
 
 } // namespace android
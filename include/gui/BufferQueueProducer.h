@@ -124,6 +124,13 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output);
 
+    // See IGraphicBufferProducer::queueAndDequeueBuffer
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, uint32_t width,
+            uint32_t height, uint32_t format, uint32_t usage,
+            status_t* outDequeueResult);
+
     // cancelBuffer returns a dequeued buffer to the BufferQueue, but doesn't
     // queue it for use by the consumer.
     //
@@ -179,11 +186,17 @@ private:
 
     // waitForFreeSlotThenRelock finds the oldest slot in the FREE state. It may
     // block if there are no available slots and we are not in non-blocking
-    // mode (producer and consumer controlled by the application). If it blocks,
-    // it will release mCore->mMutex while blocked so that other operations on
-    // the BufferQueue may succeed.
+    // mode (producer and consumer controlled by the application) and canBlock
+    // is true. If it blocks, it will release mCore->mMutex while blocked so
+    // that other operations on the BufferQueue may succeed.
     status_t waitForFreeSlotThenRelock(const char* caller, bool async,
-            int* found, status_t* returnFlags) const;
+            int* found, status_t* returnFlags, bool canBlock) const;
+
+    // dequeueBufferInternal implements dequeueBuffer. If canBlock is false it
+    // returns WOULD_BLOCK instead of waiting for a free slot.
+    status_t dequeueBufferInternal(int *outSlot, sp<Fence>* outFence,
+            bool async, uint32_t width, uint32_t height, uint32_t format,
+            uint32_t usage, bool canBlock);
 
     sp<BufferQueueCore> mCore;
 
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_BUFFERQUEUETIMELINE_H
+#define ANDROID_GUI_BUFFERQUEUETIMELINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <gui/BufferQueueDefs.h>
+
+#include <utils/StrongPointer.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class Fence;
+class String8;
+
+// BufferQueueTimeline records when each frame going through a BufferQueue
+// was dequeued, queued, acquired and released, along with the signal times of
+// its acquire and release fences.
+//
+// All the on*() methods must be called with the BufferQueueCore mutex held,
+// which makes the BufferQueue the only writer. getRecords() and dump() don't
+// need the mutex and never block the writer: they retry if the ring changed
+// while they were copying it.
+class BufferQueueTimeline {
+public:
+    enum { NUM_RECORDS = 64 };
+
+    // Values of the fence time fields that aren't signal times
+    enum {
+        FENCE_TIME_UNKNOWN = 0,   // the fence hasn't been looked at yet
+        FENCE_TIME_INVALID = -1,  // there was no fence
+    };
+    // The fence hadn't signaled yet (INT64_MAX, as returned by
+    // Fence::getSignalTime)
+    static const nsecs_t FENCE_TIME_PENDING;
+
+    // Record holds the lifecycle of one frame. Times are in the
+    // SYSTEM_TIME_MONOTONIC time base, and are 0 for the steps the frame
+    // hasn't gone through yet. The layout is fixed since records are sent
+    // over binder as raw memory.
+    struct Record {
+        uint64_t frameNumber;
+        int32_t slot;
+
+        // Number of buffers in the queue right after this one was queued
+        int32_t queueDepth;
+
+        // When dequeueBuffer returned the slot, and how long it was blocked
+        // waiting for a free slot before that
+        nsecs_t dequeueTime;
+        nsecs_t dequeueWaitTime;
+
+        nsecs_t queueTime;
+
+        // Signal time of the fence passed to queueBuffer
+        nsecs_t acquireFenceTime;
+
+        nsecs_t acquireTime;
+
+        // When releaseBuffer was called, or when the frame was dropped
+        nsecs_t releaseTime;
+
+        // Signal time of the fence passed to releaseBuffer, sampled when the
+        // slot is queued again
+        nsecs_t releaseFenceTime;
+
+        uint32_t dropped;
+        uint32_t reserved;
+    };
+
+    BufferQueueTimeline();
+    ~BufferQueueTimeline();
+
+    // reset discards all the records and per-slot state.
+    void reset();
+
+    void onDequeued(int slot, nsecs_t waitTime);
+    void onQueued(uint64_t frameNumber, int slot, size_t queueDepth);
+    void onAcquired(uint64_t frameNumber, int slot,
+            const sp<Fence>& acquireFence);
+    void onDropped(uint64_t frameNumber);
+    void onReleased(uint64_t frameNumber, int slot,
+            const sp<Fence>& releaseFence);
+
+    // getRecords copies up to maxCount of the most recent records into
+    // outRecords, oldest first, and returns the number of records copied.
+    size_t getRecords(Record* outRecords, size_t maxCount) const;
+
+    // dump appends a summary of the recorded frames: queue depth, producer
+    // starvation (time blocked in dequeueBuffer) and consumer latency (time
+    // from queue to acquire).
+    void dump(String8& result, const char* prefix) const;
+
+private:
+    BufferQueueTimeline(const BufferQueueTimeline&);
+    BufferQueueTimeline& operator=(const BufferQueueTimeline&);
+
+    // Returns the record for frameNumber, or NULL if it isn't in the ring
+    Record* findRecord(uint64_t frameNumber);
+
+    void beginWrite();
+    void endWrite();
+
+    // State used by the writer to complete records as the buffers move
+    // through the queue. It is only accessed with the BufferQueueCore mutex
+    // held.
+    struct SlotState {
+        SlotState();
+        nsecs_t dequeueTime;
+        nsecs_t dequeueWaitTime;
+        uint64_t acquireFrameNumber;
+        sp<Fence> acquireFence;
+        uint64_t releaseFrameNumber;
+        sp<Fence> releaseFence;
+    };
+    SlotState mSlotStates[BufferQueueDefs::NUM_BUFFER_SLOTS];
+
+    // mSequence is odd while the writer is modifying mRecords or
+    // mNewestFrameNumber.
+    volatile int32_t mSequence;
+
+    // Frame n is stored in mRecords[n % NUM_RECORDS]
+    uint64_t mNewestFrameNumber;
+    Record mRecords[NUM_RECORDS];
+};
+
+}; // namespace android
+
+#endif // ANDROID_GUI_BUFFERQUEUETIMELINE_H
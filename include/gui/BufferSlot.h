@@ -39,7 +39,8 @@ struct BufferSlot {
       mEglFence(EGL_NO_SYNC_KHR),
       mAcquireCalled(false),
       mNeedsCleanupOnRelease(false),
-      mAttachedByConsumer(false) {
+      mAttachedByConsumer(false),
+      mPreallocated(false) {
     }
 
     // mGraphicBuffer points to the buffer allocated for this slot or is NULL
@@ -135,6 +136,12 @@ struct BufferSlot {
     // If so, it needs to set the BUFFER_NEEDS_REALLOCATION flag when dequeued
     // to prevent the producer from using a stale cached buffer.
     bool mAttachedByConsumer;
+
+    // Indicates whether the buffer was allocated ahead of time by the
+    // BufferQueue's preallocation thread and has not been dequeued yet. Like
+    // mAttachedByConsumer, it causes the BUFFER_NEEDS_REALLOCATION flag to be
+    // set when the slot is dequeued.
+    bool mPreallocated;
 };
 
 } // namespace android
@@ -64,6 +64,23 @@ class CpuConsumer : public ConsumerBase
         uint32_t    chromaStep;
     };
 
+    // LockStats holds the counters reported by getLockStats
+    struct LockStats {
+        // Number of buffers returned by lockNextBuffer, and how many of them
+        // had been mapped ahead of time by the prefetch thread
+        uint64_t buffersLocked;
+        uint64_t buffersPrefetched;
+
+        // Time spent in lockNextBuffer
+        nsecs_t totalLockTime;
+        nsecs_t maxLockTime;
+
+        // Time the prefetch thread spent waiting for acquire fences and
+        // mapping buffers
+        nsecs_t totalFenceWaitTime;
+        nsecs_t totalPrefetchMapTime;
+    };
+
     // Create a new CPU consumer. The maxLockedBuffers parameter specifies
     // how many buffers can be locked for user access at the same time.
     CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
@@ -104,12 +121,47 @@ class CpuConsumer : public ConsumerBase
     // lockNextBuffer.
     status_t unlockBuffer(const LockedBuffer &nativeBuffer);
 
+    // setPrefetchDepth enables pipelined locking. Up to depth buffers are
+    // acquired ahead of lockNextBuffer on a helper thread, which waits for
+    // their fences and maps them, so that lockNextBuffer can return them
+    // without blocking. Prefetched buffers count toward maxLockedBuffers. A
+    // depth of 0, the default, disables prefetching; buffers that were
+    // already prefetched are still returned first. Returns BAD_VALUE if depth
+    // is larger than maxLockedBuffers.
+    status_t setPrefetchDepth(uint32_t depth);
+
+    // getLockStats returns the lock latency counters
+    void getLockStats(LockStats* outStats) const;
+
+  protected:
+    // Signals the prefetch thread in addition to calling the listener
+    virtual void onFrameAvailable();
+
+    virtual void dumpLocked(String8& result, const char* prefix) const;
+
   private:
+    class Prefetcher;
+
+
     // Maximum number of buffers that can be locked at a time
     uint32_t mMaxLockedBuffers;
 
     status_t releaseAcquiredBufferLocked(int lockedIdx);
 
+    // Maps buffer for reading, after waiting for fenceFd if it isn't -1. It
+    // doesn't touch any member, so mMutex doesn't need to be held.
+    status_t lockForRead(const sp<GraphicBuffer>& buffer,
+            const Rect& crop, int fenceFd, void** outPointer,
+            android_ycbcr* outYCbCr) const;
+
+    // Records a mapped buffer as locked by the user and fills out nativeBuffer
+    void addLockedBufferLocked(const BufferQueue::BufferItem& item,
+            const sp<GraphicBuffer>& buffer, void* bufferPointer,
+            const android_ycbcr& ycbcr, LockedBuffer* nativeBuffer);
+
+    // Returns whether the prefetch thread should acquire another buffer
+    bool canPrefetchLocked() const;
+
     virtual void freeBufferLocked(int slotIndex);
 
     // Tracking for buffers acquired by the user
@@ -131,6 +183,37 @@ class CpuConsumer : public ConsumerBase
     // Count of currently locked buffers
     uint32_t mCurrentLockedBuffers;
 
+    // A buffer acquired and mapped by the prefetch thread but not yet
+    // returned by lockNextBuffer
+    struct PrefetchedBuffer {
+        BufferQueue::BufferItem mItem;
+        sp<GraphicBuffer> mGraphicBuffer;
+        void *mBufferPointer;
+        android_ycbcr mYCbCr;
+    };
+
+    // Prefetched buffers in acquisition order
+    Vector<PrefetchedBuffer> mPrefetchedBuffers;
+
+    // Maximum number of buffers to prefetch (see setPrefetchDepth)
+    uint32_t mPrefetchDepth;
+
+    // Number of buffers the prefetch thread has acquired but not yet mapped
+    uint32_t mPrefetchesInFlight;
+
+    // mFramesPending is set when a frame is queued and cleared when the
+    // prefetch thread finds the queue empty
+    bool mFramesPending;
+
+    // mPrefetchCondition wakes the prefetch thread, and
+    // mPrefetchDoneCondition is broadcast when it has mapped a buffer
+    Condition mPrefetchCondition;
+    Condition mPrefetchDoneCondition;
+
+    sp<Prefetcher> mPrefetcher;
+
+    LockStats mLockStats;
+
 };
 
 } // namespace android
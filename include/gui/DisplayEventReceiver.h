@@ -54,6 +54,20 @@ public:
 
         struct VSync {
             uint32_t count;
+
+            // number of older vsync events of the same display that were
+            // discarded in favor of this one when coalescing is enabled,
+            // see setVsyncCoalescing(). Always 0 otherwise.
+            uint32_t missed;
+
+            // predicted time of the next hardware vsync following this
+            // event, from SurfaceFlinger's vsync model, or 0 if unknown
+            nsecs_t expectedVsync __attribute__((aligned(8)));
+
+            // predicted time at which SurfaceFlinger will next latch buffers
+            // for composition: a buffer queued before then is displayed at
+            // the following refresh. 0 if unknown.
+            nsecs_t deadline __attribute__((aligned(8)));
         };
 
         struct Hotplug {
@@ -105,6 +119,21 @@ public:
     static ssize_t getEvents(const sp<BitTube>& dataChannel,
             Event* events, size_t count);
 
+    /*
+     * setVsyncCoalescing() enables or disables vsync coalescing, which is
+     * disabled by default. When enabled, getEvents() drains the queue and
+     * only returns the most recent vsync event of each display, with
+     * Event::VSync::missed set to the number of older vsync events that
+     * were discarded. Other events are all returned, in order.
+     */
+    void setVsyncCoalescing(bool enabled);
+
+    /*
+     * coalesceVsyncEvents() applies vsync coalescing to the first count
+     * events of the array, in place, and returns the number of events left.
+     */
+    static size_t coalesceVsyncEvents(Event* events, size_t count);
+
     /*
      * sendEvents write events to the queue and returns how many events were
      * written.
@@ -129,6 +158,7 @@ public:
 private:
     sp<IDisplayEventConnection> mEventConnection;
     sp<BitTube> mDataChannel;
+    bool mCoalesceVsync;
 };
 
 // ----------------------------------------------------------------------------
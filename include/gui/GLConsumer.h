@@ -286,9 +286,9 @@ private:
         EglImage(sp<GraphicBuffer> graphicBuffer);
 
         // createIfNeeded creates an EGLImage if required (we haven't created
-        // one yet, or the EGLDisplay or crop-rect has changed).
+        // one yet, or the EGLDisplay has changed). The image covers the whole
+        // buffer; the crop is applied by the texture transform matrix.
         status_t createIfNeeded(EGLDisplay display,
-                                const Rect& cropRect,
                                 bool forceCreate = false);
 
         // This calls glEGLImageTargetTexture2DOES to bind the image to the
@@ -307,7 +307,7 @@ private:
 
         // createImage creates a new EGLImage from a GraphicBuffer.
         EGLImageKHR createImage(EGLDisplay dpy,
-                const sp<GraphicBuffer>& graphicBuffer, const Rect& crop);
+                const sp<GraphicBuffer>& graphicBuffer);
 
         // Disallow copying
         EglImage(const EglImage& rhs);
@@ -321,15 +321,30 @@ private:
 
         // mEGLDisplay is the EGLDisplay that was used to create mEglImage.
         EGLDisplay mEglDisplay;
-
-        // mCropRect is the crop rectangle passed to EGL when mEglImage
-        // was created.
-        Rect mCropRect;
     };
 
+    // getEglImageLocked returns the cached EglImage for graphicBuffer if
+    // there is one, or a new one.
+    //
+    // This method must be called with mMutex locked.
+    sp<EglImage> getEglImageLocked(const sp<GraphicBuffer>& graphicBuffer);
+
+    // cacheEglImageLocked keeps an EglImage whose buffer is no longer in a
+    // slot, so that it can be reused if the buffer comes back (e.g. when
+    // buffers are detached and attached again).
+    //
+    // This method must be called with mMutex locked.
+    void cacheEglImageLocked(const sp<EglImage>& image);
+
+    // pruneEglImageCacheLocked drops the cached EglImages whose buffer
+    // isn't referenced anywhere else anymore.
+    //
+    // This method must be called with mMutex locked.
+    void pruneEglImageCacheLocked();
+
     // freeBufferLocked frees up the given buffer slot. If the slot has been
     // initialized this will release the reference to the GraphicBuffer in that
-    // slot and destroy the EGLImage in that slot.  Otherwise it has no effect.
+    // slot and move its EGLImage to the cache.  Otherwise it has no effect.
     //
     // This method must be called with mMutex locked.
     virtual void freeBufferLocked(int slotIndex);
@@ -479,6 +494,18 @@ private:
     // mode and releaseTexImage() has been called
     static sp<GraphicBuffer> sReleasedTexImageBuffer;
     sp<EglImage> mReleasedTexImage;
+
+    // The maximum number of EglImages kept for buffers that aren't in a slot
+    enum { MAX_CACHED_EGL_IMAGES = 4 };
+
+    // mCachedEglImages holds the EglImages of buffers that left their slot,
+    // least recently cached first. Images are looked up by GraphicBuffer ID
+    // when a buffer is acquired from a slot for the first time.
+    Vector<sp<EglImage> > mCachedEglImages;
+
+    // Number of EglImages reused and created when acquiring a new buffer
+    uint64_t mEglImageCacheHits;
+    uint64_t mEglImageCacheMisses;
 };
 
 // ----------------------------------------------------------------------------
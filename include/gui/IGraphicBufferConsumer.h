@@ -23,8 +23,10 @@
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
 #include <utils/Timers.h>
+#include <utils/Vector.h>
 
 #include <binder/IInterface.h>
+#include <gui/BufferQueueTimeline.h>
 #include <ui/Rect.h>
 
 #include <EGL/egl.h>
@@ -303,6 +305,52 @@ public:
     // Retrieve the sideband buffer stream, if any.
     virtual sp<NativeHandle> getSidebandStream() const = 0;
 
+    // setPreallocationLimit enables allocation of buffers ahead of time. When
+    // enabled, the BufferQueue learns the width, height, format and usage of
+    // the buffers the producer dequeues and allocates matching buffers into
+    // FREE slots on a background thread, so that dequeueBuffer doesn't have
+    // to allocate them. limit is the maximum number of bytes of buffer memory
+    // that may be allocated in the BufferQueue for this to happen; 0 (the
+    // default) disables preallocation.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned.
+    virtual status_t setPreallocationLimit(size_t limit) = 0;
+
+    // setFrameTimelineEnabled turns recording of the lifecycle of each frame
+    // going through the BufferQueue on or off. When enabled, the times at
+    // which each frame is dequeued, queued, acquired and released, as well as
+    // the signal times of its fences, are kept for the last
+    // BufferQueueTimeline::NUM_RECORDS frames. A summary is included in
+    // dump(). Enabling it discards any previously recorded frames; it is
+    // disabled by default.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned.
+    virtual status_t setFrameTimelineEnabled(bool enabled) = 0;
+
+    // getFrameTimeline returns the recorded timeline, oldest frame first.
+    // Reading the timeline never blocks the producer or the consumer.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * BAD_VALUE - outRecords was NULL.
+    virtual status_t getFrameTimeline(
+            Vector<BufferQueueTimeline::Record>* outRecords) = 0;
+
+    // getFrontBufferFence returns the acquire fence of the buffer that
+    // acquireBuffer would return if it were called with the same
+    // expectedPresent, i.e. the buffer at the front of the queue once the
+    // buffers acquireBuffer would drop are skipped. This lets a consumer
+    // hold off acquiring a buffer the producer hasn't finished rendering
+    // into.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned.
+    // * NO_BUFFER_AVAILABLE - no buffer is queued.
+    // * BAD_VALUE - outFence was NULL.
+    virtual status_t getFrontBufferFence(sp<Fence>* outFence,
+            nsecs_t expectedPresent) = 0;
+
     // dump state into a string
     virtual void dump(String8& result, const char* prefix) const = 0;
 
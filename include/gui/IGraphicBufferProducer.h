@@ -348,6 +348,28 @@ public:
     virtual status_t queueBuffer(int slot,
             const QueueBufferInput& input, QueueBufferOutput* output) = 0;
 
+    // queueAndDequeueBuffer combines a queueBuffer call with the dequeueBuffer
+    // call that usually follows it, saving a round-trip when the producer is
+    // in another process.
+    //
+    // The buffer in slot is queued exactly as with queueBuffer, and the
+    // return value is the result of that. If it succeeds, the next buffer is
+    // dequeued as with dequeueBuffer, using the given width, height, format
+    // and usage and the async flag from input. Unlike dequeueBuffer this
+    // never blocks waiting for a free slot: if none is available right away
+    // the dequeue fails with WOULD_BLOCK, and the client should call
+    // dequeueBuffer later as usual.
+    //
+    // The result of the dequeue (the flags or error dequeueBuffer would have
+    // returned) is stored in outDequeueResult; outSlot and outFence are only
+    // valid if it isn't negative. If the queue fails, no buffer is dequeued
+    // and outDequeueResult is set to the same error.
+    virtual status_t queueAndDequeueBuffer(int slot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, uint32_t width,
+            uint32_t height, uint32_t format, uint32_t usage,
+            status_t* outDequeueResult) = 0;
+
     // cancelBuffer indicates that the client does not wish to fill in the
     // buffer associated with slot and transfers ownership of the slot back to
     // the server.
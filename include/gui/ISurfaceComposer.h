@@ -147,6 +147,22 @@ public:
             bool useIdentityTransform,
             Rotation rotation = eRotateNone) = 0;
 
+    /* Capture the specified screen without waiting for it. The request is
+     * queued and this returns immediately; the capture is rendered at the
+     * next refresh and queued to producer along with a fence that signals
+     * when rendering completes. The connection to producer is kept between
+     * captures so its buffers are reused. Returns WOULD_BLOCK if too many
+     * captures are pending. The producer must be served by a binder thread
+     * pool. Requires READ_FRAME_BUFFER permission, and fails if there is a
+     * secure window on screen.
+     */
+    virtual status_t captureScreenAsync(const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform,
+            Rotation rotation = eRotateNone) = 0;
+
     /* Clears the frame statistics for animations.
      *
      * Requires the ACCESS_SURFACE_FLINGER permission.
@@ -185,6 +201,7 @@ public:
         GET_ANIMATION_FRAME_STATS,
         SET_POWER_MODE,
         GET_DISPLAY_STATS,
+        CAPTURE_SCREEN_ASYNC,
     };
 
     virtual status_t onTransact(uint32_t code, const Parcel& data,
@@ -77,6 +77,15 @@ public:
      * Requires ACCESS_SURFACE_FLINGER permission
      */
     virtual status_t getLayerFrameStats(const sp<IBinder>& handle, FrameStats* outStats) const = 0;
+
+    /*
+     * Returns frame time percentiles and the jank count for the most recent
+     * frames of a layer, a compact alternative to getLayerFrameStats.
+     *
+     * Requires ACCESS_SURFACE_FLINGER permission
+     */
+    virtual status_t getLayerFrameStatsSummary(const sp<IBinder>& handle,
+            FrameStatsSummary* outSummary) const = 0;
 };
 
 // ----------------------------------------------------------------------------
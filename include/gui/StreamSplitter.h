@@ -18,17 +18,18 @@
 #define ANDROID_GUI_STREAMSPLITTER_H
 
 #include <gui/IConsumerListener.h>
+#include <gui/IGraphicBufferConsumer.h>
 #include <gui/IProducerListener.h>
 
 #include <utils/Condition.h>
 #include <utils/KeyedVector.h>
 #include <utils/Mutex.h>
 #include <utils/StrongPointer.h>
+#include <utils/Timers.h>
 
 namespace android {
 
 class GraphicBuffer;
-class IGraphicBufferConsumer;
 class IGraphicBufferProducer;
 
 // StreamSplitter is an autonomous class that manages one input BufferQueue
@@ -39,6 +40,35 @@ class IGraphicBufferProducer;
 // again only once all of the outputs have released it.
 class StreamSplitter : public BnConsumerListener {
 public:
+    // OutputPolicy controls what happens to an output that is still holding
+    // on to a previous buffer when a new one is queued to the input.
+    enum OutputPolicy {
+        // The output receives every buffer. Buffers only go back to the input
+        // once all the outputs have released them, so a slow output slows
+        // down the input and every other output. This is the default.
+        POLICY_BLOCK,
+
+        // The output holds at most one buffer. Buffers that arrive while it
+        // is holding one are not sent to it.
+        POLICY_SKIP_WHEN_BUSY,
+
+        // Like POLICY_SKIP_WHEN_BUSY, but the newest buffer that arrived while
+        // the output was busy is kept and sent to it as soon as it releases
+        // the previous one. Older ones are dropped.
+        POLICY_DROP_OLDEST,
+    };
+
+    // OutputStats holds the counters kept for each output. Latencies are
+    // measured from the time a buffer is queued to the output until the output
+    // releases it.
+    struct OutputStats {
+        uint64_t framesQueued;
+        uint64_t framesDropped;
+        uint64_t framesReleased;
+        nsecs_t totalLatency;
+        nsecs_t maxLatency;
+    };
+
     // createSplitter creates a new splitter, outSplitter, using inputQueue as
     // the input BufferQueue. Output BufferQueues must be added using addOutput
     // before queueing any buffers to the input.
@@ -57,11 +87,20 @@ public:
     // output is abandoned by its consumer, the splitter will abandon its input
     // queue (see onAbandoned).
     //
+    // policy controls whether a slow output can hold back the other outputs
+    // (see OutputPolicy).
+    //
     // A return value other than NO_ERROR means that an error has occurred and
     // outputQueue has not been added to the splitter. BAD_VALUE is returned if
-    // outputQueue is NULL. See IGraphicBufferProducer::connect for explanations
-    // of other error codes.
-    status_t addOutput(const sp<IGraphicBufferProducer>& outputQueue);
+    // outputQueue is NULL or policy is invalid. See
+    // IGraphicBufferProducer::connect for explanations of other error codes.
+    status_t addOutput(const sp<IGraphicBufferProducer>& outputQueue,
+            OutputPolicy policy = POLICY_BLOCK);
+
+    // getOutputStats returns the counters of an output added with addOutput.
+    // BAD_VALUE is returned if outputQueue isn't one of the outputs.
+    status_t getOutputStats(const sp<IGraphicBufferProducer>& outputQueue,
+            OutputStats* outStats) const;
 
     // setName sets the consumer name of the input queue
     void setName(const String8& name);
@@ -139,6 +178,17 @@ private:
         // Only called while mMutex is held
         size_t incrementReleaseCountLocked() { return ++mReleaseCount; }
 
+        // Number of POLICY_BLOCK outputs still holding the buffer. While it is
+        // non-zero the buffer counts toward MAX_OUTSTANDING_BUFFERS.
+        // Only called while mMutex is held
+        size_t getBlockingHolderCountLocked() const {
+            return mBlockingHolderCount;
+        }
+        void incrementBlockingHolderCountLocked() { ++mBlockingHolderCount; }
+        size_t decrementBlockingHolderCountLocked() {
+            return --mBlockingHolderCount;
+        }
+
     private:
         // Only destroy through LightRefBase
         friend LightRefBase<BufferTracker>;
@@ -151,14 +201,48 @@ private:
         sp<GraphicBuffer> mBuffer; // One instance that holds this native handle
         sp<Fence> mMergedFence;
         size_t mReleaseCount;
+        size_t mBlockingHolderCount;
     };
 
+    // Output holds the state of one output BufferQueue
+    struct Output {
+        Output();
+
+        sp<IGraphicBufferProducer> producer;
+        OutputPolicy policy;
+
+        // Time at which each buffer currently held by the output was queued
+        // to it, keyed by GraphicBuffer ID
+        KeyedVector<uint64_t, nsecs_t> queueTimes;
+
+        // The buffer waiting for the output to release its current one when
+        // policy is POLICY_DROP_OLDEST, or NULL
+        sp<BufferTracker> pendingTracker;
+        IGraphicBufferConsumer::BufferItem pendingItem;
+
+        OutputStats stats;
+    };
+
+    // Attaches the buffer to the output and queues it. Returns false if the
+    // output has been abandoned, in which case it is done with the buffer.
+    // This must be called with mMutex locked.
+    bool queueToOutputLocked(Output& output, const sp<BufferTracker>& tracker,
+            const IGraphicBufferConsumer::BufferItem& item);
+
+    // Called whenever an output is done with a buffer, whether it released it
+    // or never received it. Once every output is done with it, the buffer is
+    // returned to the input. This must be called with mMutex locked.
+    void releaseFromOutputLocked(const sp<BufferTracker>& tracker);
+
     // Only called from createSplitter
     StreamSplitter(const sp<IGraphicBufferConsumer>& inputQueue);
 
     // Must be accessed through RefBase
     virtual ~StreamSplitter();
 
+    // The number of buffers held by POLICY_BLOCK outputs above which
+    // onFrameAvailable stops acquiring from the input. Outputs with other
+    // policies hold at most two buffers each and don't count toward it.
     static const int MAX_OUTSTANDING_BUFFERS = 2;
 
     // mIsAbandoned is set to true when an output dies. Once the StreamSplitter
@@ -167,11 +251,11 @@ private:
     // communicate with it further.
     bool mIsAbandoned;
 
-    Mutex mMutex;
+    mutable Mutex mMutex;
     Condition mReleaseCondition;
     int mOutstandingBuffers;
     sp<IGraphicBufferConsumer> mInput;
-    Vector<sp<IGraphicBufferProducer> > mOutputs;
+    Vector<Output> mOutputs;
 
     // Map of GraphicBuffer IDs (GraphicBuffer::getId()) to buffer tracking
     // objects (which are mostly for counting how many outputs have released the
@@ -183,10 +183,47 @@ private:
     int getSlotFromBufferLocked(android_native_buffer_t* buffer) const;
 
     struct BufferSlot {
+        BufferSlot() : postedFrame(0) {}
         sp<GraphicBuffer> buffer;
-        Region dirtyRegion;
+
+        // postedFrame is the value of mPostCount when the buffer was last
+        // posted by unlockAndPost, or 0 if its content isn't known.
+        uint64_t postedFrame;
+    };
+
+    // DequeueParams holds the arguments passed to
+    // IGraphicBufferProducer::dequeueBuffer.
+    struct DequeueParams {
+        DequeueParams() : width(0), height(0), format(0), usage(0),
+                async(false) {}
+        bool operator==(const DequeueParams& rhs) const {
+            return width == rhs.width && height == rhs.height &&
+                    format == rhs.format && usage == rhs.usage &&
+                    async == rhs.async;
+        }
+        bool operator!=(const DequeueParams& rhs) const {
+            return !(*this == rhs);
+        }
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t usage;
+        bool async;
     };
 
+    // getDequeueParamsLocked returns the arguments the next dequeueBuffer
+    // will pass to the producer.
+    DequeueParams getDequeueParamsLocked() const;
+
+    // canPrefetchLocked returns whether queueBuffer should dequeue the next
+    // buffer in the same transaction, i.e. whether the next dequeue is
+    // predictable.
+    bool canPrefetchLocked() const;
+
+    // cancelPrefetchedBufferLocked returns the buffer that was dequeued ahead
+    // of time by queueBuffer, if any, to the BufferQueue.
+    void cancelPrefetchedBufferLocked();
+
     // mSurfaceTexture is the interface to the surface texture server. All
     // operations on the surface texture client ultimately translate into
     // interactions with the server using this interface.
@@ -274,6 +311,24 @@ private:
     // one buffer behind the producer.
     mutable bool mConsumerRunningBehind;
 
+    // mLastDequeueParams are the arguments of the last dequeueBuffer, and
+    // mDequeueRepeated is set if they were the same as the ones of the
+    // dequeue before it. queueBuffer only prefetches the next buffer when
+    // mDequeueRepeated is set and the parameters haven't changed since.
+    DequeueParams mLastDequeueParams;
+    bool mDequeueRepeated;
+
+    // mPrefetchedSlot is the slot of the buffer dequeued by queueBuffer
+    // through IGraphicBufferProducer::queueAndDequeueBuffer, or -1 if there
+    // is none. mPrefetchedFence and mPrefetchedResult are the fence and the
+    // flags returned with it, and mPrefetchedParams the arguments it was
+    // dequeued with. The next dequeueBuffer hands it out without a
+    // transaction if its arguments match.
+    int mPrefetchedSlot;
+    sp<Fence> mPrefetchedFence;
+    status_t mPrefetchedResult;
+    DequeueParams mPrefetchedParams;
+
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables of Surface objects. It must be locked whenever the
     // member variables are accessed.
@@ -285,7 +340,15 @@ private:
     bool                        mConnectedToCpu;
 
     // must be accessed from lock/unlock thread only
-    Region mDirtyRegion;
+    enum { MAX_DAMAGE_HISTORY = 8 };
+
+    // mDamageHistory[n % MAX_DAMAGE_HISTORY] is the region redrawn by the
+    // n-th frame posted by unlockAndPost, which mPostCount counts. lock uses
+    // it to copy back only the area that changed since the back buffer was
+    // last posted.
+    Region mDamageHistory[MAX_DAMAGE_HISTORY];
+    Region mLockedDirtyRegion;
+    uint64_t mPostCount;
 };
 
 }; // namespace android
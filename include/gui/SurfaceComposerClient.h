@@ -138,6 +138,8 @@ public:
 
     status_t clearLayerFrameStats(const sp<IBinder>& token) const;
     status_t getLayerFrameStats(const sp<IBinder>& token, FrameStats* outStats) const;
+    status_t getLayerFrameStatsSummary(const sp<IBinder>& token,
+            FrameStatsSummary* outSummary) const;
 
     static status_t clearAnimationFrameStats();
     static status_t getAnimationFrameStats(FrameStats* outStats);
@@ -187,6 +189,15 @@ public:
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform);
 
+    // same as capture, but returns as soon as the capture is queued. The
+    // captured frame is queued to producer with a fence at the next refresh.
+    static status_t captureAsync(
+            const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform);
+
 private:
     mutable sp<CpuConsumer> mCpuConsumer;
     mutable sp<IGraphicBufferProducer> mProducer;
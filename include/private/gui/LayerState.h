@@ -65,6 +65,9 @@ struct layer_state_t {
         crop.makeInvalid();
     }
 
+    // write and read only carry the fields flagged in what; read leaves the
+    // other fields at their default values, except transparentRegion, which
+    // keeps its previous contents unless eTransparentRegionChanged is set.
     status_t    write(Parcel& output) const;
     status_t    read(const Parcel& input);
 
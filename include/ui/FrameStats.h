@@ -58,6 +58,49 @@ public:
     status_t unflatten(void const* buffer, size_t size);
 };
 
+/*
+ * A compact summary of the recent frame times of a layer, computed on demand
+ * from a FrameStatsRing. Clients that only need percentiles should fetch this
+ * rather than the raw timestamps in FrameStats.
+ */
+class FrameStatsSummary : public LightFlattenable<FrameStatsSummary> {
+public:
+    FrameStatsSummary();
+
+    /*
+     * Approximate refresh time, in nanoseconds.
+     */
+    nsecs_t refreshPeriodNano;
+
+    /*
+     * The number of frame times the summary was computed from.
+     */
+    uint32_t frameCount;
+
+    /*
+     * The number of frames that stayed on screen for at least one and a half
+     * refresh periods, i.e. the frames following a missed vsync. Frame
+     * times are measured from present fences, which jitter, so the
+     * threshold sits halfway between one and two periods.
+     */
+    uint32_t jankCount;
+
+    /*
+     * Frame time percentiles and maximum, in nanoseconds. A frame time is the
+     * interval between the actual present times of two consecutive frames.
+     */
+    nsecs_t p50FrameTimeNano;
+    nsecs_t p90FrameTimeNano;
+    nsecs_t p99FrameTimeNano;
+    nsecs_t maxFrameTimeNano;
+
+    // LightFlattenable
+    bool isFixedSize() const;
+    size_t getFlattenedSize() const;
+    status_t flatten(void* buffer, size_t size) const;
+    status_t unflatten(void const* buffer, size_t size);
+};
+
 }; // namespace android
 
 #endif // ANDROID_UI_FRAME_STATS_H
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_FRAME_STATS_RING_H
+#define ANDROID_UI_FRAME_STATS_RING_H
+
+#include <stdint.h>
+
+#include <utils/Timers.h>
+
+namespace android {
+
+class FrameStatsSummary;
+
+// FrameStatsRing is a fixed-size ring of frame times. It supports a single
+// writer (callers must serialize calls to push() and reset()) and any number
+// of concurrent readers, which never block the writer: a reader that races
+// with the writer simply ignores the records that were overwritten while it
+// was copying them.
+class FrameStatsRing {
+public:
+    enum { NUM_FRAME_RECORDS = 128 };
+
+    FrameStatsRing();
+
+    // push records the time in nanoseconds a frame stayed on screen.
+    void push(nsecs_t frameTime);
+
+    // reset discards all the records pushed so far.
+    void reset();
+
+    // getSummary computes the frame time percentiles and jank count over the
+    // records currently in the ring. A frame is counted as jank if it stayed
+    // on screen for at least one and a half refresh periods. This may be
+    // called concurrently with push().
+    void getSummary(nsecs_t refreshPeriod, FrameStatsSummary* outSummary) const;
+
+private:
+    // mWriteStart and mWriteEnd count the records the writer has started and
+    // finished writing. Record n lives in mFrameTimes[n % NUM_FRAME_RECORDS],
+    // so once mWriteStart goes past n + NUM_FRAME_RECORDS record n is gone.
+    volatile int32_t mWriteStart;
+    volatile int32_t mWriteEnd;
+
+    // mResetPoint is the first record that is still valid after reset().
+    volatile int32_t mResetPoint;
+
+    nsecs_t mFrameTimes[NUM_FRAME_RECORDS];
+};
+
+}; // namespace android
+
+#endif // ANDROID_UI_FRAME_STATS_RING_H
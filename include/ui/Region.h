@@ -28,6 +28,7 @@
 namespace android {
 // ---------------------------------------------------------------------------
 
+class Parcel;
 class SharedBuffer;
 class String8;
 
@@ -143,6 +144,12 @@ public:
             status_t    flatten(void* buffer, size_t size) const;
             status_t    unflatten(void const* buffer, size_t size);
 
+            // wire-compatible with Parcel::write/read(LightFlattenable),
+            // the rects are read in-place from the parcel's data and the
+            // existing storage is reused when possible.
+            status_t    writeToParcel(Parcel* parcel) const;
+            status_t    readFromParcel(const Parcel* parcel);
+
     void        dump(String8& out, const char* what, uint32_t flags=0) const;
     void        dump(const char* what, uint32_t flags=0) const;
 
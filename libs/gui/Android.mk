@@ -11,6 +11,7 @@ LOCAL_SRC_FILES:= \
 	BufferQueueConsumer.cpp \
 	BufferQueueCore.cpp \
 	BufferQueueProducer.cpp \
+	BufferQueueTimeline.cpp \
 	BufferSlot.cpp \
 	ConsumerBase.cpp \
 	CpuConsumer.cpp \
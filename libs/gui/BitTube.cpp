@@ -15,12 +15,18 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <cutils/ashmem.h>
+#include <cutils/atomic.h>
+
 #include <utils/Errors.h>
 
 #include <binder/Parcel.h>
@@ -34,28 +40,122 @@ namespace android {
 // we really need.  So we make it smaller.
 static const size_t DEFAULT_SOCKET_BUFFER_SIZE = 4 * 1024;
 
+// The ring header lives at the start of the shared memory region, followed by
+// the ring itself. Each message is stored as its size followed by its payload,
+// padded to 4 bytes. The positions are byte counts that wrap around at 2^32;
+// each one is only written by one end, which keeps the ring lock-free.
+struct BitTube::RingHeader {
+    // Written by the sending end
+    volatile int32_t writePos;
+    int32_t padding0[15];
+
+    // Written by the receiving end
+    volatile int32_t readPos;
+    int32_t padding1[15];
+
+    // Size of the ring, a power of 2
+    uint32_t capacity;
+    int32_t padding2[15];
+};
+
+static inline uint32_t getRingRecordSize(size_t payloadSize) {
+    return sizeof(uint32_t) + ((payloadSize + 3) & ~3);
+}
+
+static inline uint8_t* getRingData(void* header, size_t headerSize) {
+    return reinterpret_cast<uint8_t*>(header) + headerSize;
+}
 
 BitTube::BitTube()
-    : mSendFd(-1), mReceiveFd(-1)
+    : mSendFd(-1), mReceiveFd(-1), mTransport(TRANSPORT_SOCKET),
+      mRingFd(-1), mRing(NULL), mRingSize(0), mRingCapacity(0)
 {
     init(DEFAULT_SOCKET_BUFFER_SIZE, DEFAULT_SOCKET_BUFFER_SIZE);
 }
 
 BitTube::BitTube(size_t bufsize)
-    : mSendFd(-1), mReceiveFd(-1)
+    : mSendFd(-1), mReceiveFd(-1), mTransport(TRANSPORT_SOCKET),
+      mRingFd(-1), mRing(NULL), mRingSize(0), mRingCapacity(0)
 {
     init(bufsize, bufsize);
 }
 
+BitTube::BitTube(Transport transport)
+    : mSendFd(-1), mReceiveFd(-1), mTransport(transport),
+      mRingFd(-1), mRing(NULL), mRingSize(0), mRingCapacity(0)
+{
+    if (transport == TRANSPORT_SHARED_MEMORY) {
+        initSharedMemory(DEFAULT_SOCKET_BUFFER_SIZE);
+    } else {
+        init(DEFAULT_SOCKET_BUFFER_SIZE, DEFAULT_SOCKET_BUFFER_SIZE);
+    }
+}
+
 BitTube::BitTube(const Parcel& data)
-    : mSendFd(-1), mReceiveFd(-1)
+    : mSendFd(-1), mReceiveFd(-1), mTransport(TRANSPORT_SOCKET),
+      mRingFd(-1), mRing(NULL), mRingSize(0), mRingCapacity(0)
 {
+    mTransport = Transport(data.readInt32());
+    if (mTransport == TRANSPORT_SOCKET) {
+        mReceiveFd = dup(data.readFileDescriptor());
+        if (mReceiveFd < 0) {
+            mReceiveFd = -errno;
+            ALOGE("BitTube(Parcel): can't dup filedescriptor (%s)",
+                    strerror(-mReceiveFd));
+        }
+        return;
+    }
+
+    if (mTransport != TRANSPORT_SHARED_MEMORY) {
+        ALOGE("BitTube(Parcel): unknown transport %d", mTransport);
+        mReceiveFd = -EINVAL;
+        return;
+    }
+
+    mRingFd = dup(data.readFileDescriptor());
     mReceiveFd = dup(data.readFileDescriptor());
-    if (mReceiveFd < 0) {
-        mReceiveFd = -errno;
+    const size_t size = size_t(data.readInt32());
+    if (mRingFd < 0 || mReceiveFd < 0) {
         ALOGE("BitTube(Parcel): can't dup filedescriptor (%s)",
-                strerror(-mReceiveFd));
+                strerror(errno));
+        if (mReceiveFd >= 0) {
+            close(mReceiveFd);
+        }
+        mReceiveFd = -errno;
+        return;
+    }
+
+    // Don't trust the size sent along with the region
+    const int regionSize = ashmem_get_size_region(mRingFd);
+    if (regionSize < 0 || size_t(regionSize) != size ||
+            size <= sizeof(RingHeader)) {
+        ALOGE("BitTube(Parcel): invalid ring size %zu (region %d)", size,
+                regionSize);
+        close(mReceiveFd);
+        mReceiveFd = -EINVAL;
+        return;
+    }
+
+    void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mRingFd, 0);
+    if (ring == MAP_FAILED) {
+        ALOGE("BitTube(Parcel): can't map the ring (%s)", strerror(errno));
+        close(mReceiveFd);
+        mReceiveFd = -errno;
+        return;
     }
+    mRing = reinterpret_cast<RingHeader*>(ring);
+    mRingSize = size;
+
+    const uint32_t capacity = mRing->capacity;
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+            capacity > size - sizeof(RingHeader)) {
+        ALOGE("BitTube(Parcel): invalid ring capacity %u", capacity);
+        close(mReceiveFd);
+        mReceiveFd = -EINVAL;
+        return;
+    }
+    mRingCapacity = capacity;
 }
 
 BitTube::~BitTube()
@@ -65,6 +165,12 @@ BitTube::~BitTube()
 
     if (mReceiveFd >= 0)
         close(mReceiveFd);
+
+    if (mRing != NULL)
+        munmap(mRing, mRingSize);
+
+    if (mRingFd >= 0)
+        close(mRingFd);
 }
 
 void BitTube::init(size_t rcvbuf, size_t sndbuf) {
@@ -86,6 +192,41 @@ void BitTube::init(size_t rcvbuf, size_t sndbuf) {
     }
 }
 
+void BitTube::initSharedMemory(size_t size) {
+    uint32_t capacity = 256;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    const size_t pageSize = size_t(getpagesize());
+    const size_t regionSize = (sizeof(RingHeader) + capacity + pageSize - 1) &
+            ~(pageSize - 1);
+
+    mRingFd = ashmem_create_region("BitTube", regionSize);
+    if (mRingFd < 0) {
+        mReceiveFd = -errno;
+        ALOGE("BitTube: ashmem creation failed (%s)", strerror(-mReceiveFd));
+        return;
+    }
+
+    void* ring = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+            mRingFd, 0);
+    if (ring == MAP_FAILED) {
+        mReceiveFd = -errno;
+        ALOGE("BitTube: can't map the ring (%s)", strerror(-mReceiveFd));
+        return;
+    }
+    mRing = reinterpret_cast<RingHeader*>(ring);
+    mRingSize = regionSize;
+    mRing->capacity = capacity;
+    mRingCapacity = capacity;
+
+    mReceiveFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mReceiveFd < 0) {
+        mReceiveFd = -errno;
+        ALOGE("BitTube: eventfd creation failed (%s)", strerror(-mReceiveFd));
+    }
+}
+
 status_t BitTube::initCheck() const
 {
     if (mReceiveFd < 0) {
@@ -94,6 +235,11 @@ status_t BitTube::initCheck() const
     return NO_ERROR;
 }
 
+BitTube::Transport BitTube::getTransport() const
+{
+    return mTransport;
+}
+
 int BitTube::getFd() const
 {
     return mReceiveFd;
@@ -106,6 +252,10 @@ int BitTube::getSendFd() const
 
 ssize_t BitTube::write(void const* vaddr, size_t size)
 {
+    if (mTransport == TRANSPORT_SHARED_MEMORY) {
+        return writeRing(vaddr, size);
+    }
+
     ssize_t err, len;
     do {
         len = ::send(mSendFd, vaddr, size, MSG_DONTWAIT | MSG_NOSIGNAL);
@@ -117,6 +267,10 @@ ssize_t BitTube::write(void const* vaddr, size_t size)
 
 ssize_t BitTube::read(void* vaddr, size_t size)
 {
+    if (mTransport == TRANSPORT_SHARED_MEMORY) {
+        return readRing(vaddr, size);
+    }
+
     ssize_t err, len;
     do {
         len = ::recv(mReceiveFd, vaddr, size, MSG_DONTWAIT);
@@ -130,11 +284,152 @@ ssize_t BitTube::read(void* vaddr, size_t size)
     return err == 0 ? len : -err;
 }
 
+void BitTube::signalReceiver() const
+{
+    const uint64_t value = 1;
+    ssize_t len;
+    do {
+        len = ::write(mReceiveFd, &value, sizeof(value));
+    } while (len < 0 && errno == EINTR);
+}
+
+ssize_t BitTube::writeRing(void const* vaddr, size_t size)
+{
+    if (mRing == NULL || mReceiveFd < 0)
+        return -EPIPE;
+
+    // The receiving end lives in another process; only trust the capacity
+    // validated when the ring was set up, and every position masked with it
+    const uint32_t capacity = mRingCapacity;
+    if (mRing->capacity != capacity) {
+        ALOGE("BitTube: corrupted ring (capacity=%u expected=%u)",
+                mRing->capacity, capacity);
+        return -EBADMSG;
+    }
+    const uint32_t recordSize = getRingRecordSize(size);
+    if (recordSize > capacity)
+        return -EMSGSIZE;
+
+    // Only this end writes writePos, so a plain load is fine
+    const uint32_t writePos = uint32_t(mRing->writePos);
+    const uint32_t used = writePos -
+            uint32_t(android_atomic_acquire_load(&mRing->readPos));
+    if (used > capacity || capacity - used < recordSize)
+        return -EAGAIN;
+
+    uint8_t* data = getRingData(mRing, sizeof(RingHeader));
+    const uint32_t header = uint32_t(size);
+    const uint8_t* chunks[2] = { reinterpret_cast<const uint8_t*>(&header),
+            reinterpret_cast<const uint8_t*>(vaddr) };
+    const size_t chunkSizes[2] = { sizeof(header), size };
+    uint32_t pos = writePos;
+    for (size_t c = 0; c < 2; c++) {
+        const size_t offset = pos & (capacity - 1);
+        const size_t first = chunkSizes[c] < capacity - offset ?
+                chunkSizes[c] : capacity - offset;
+        memcpy(data + offset, chunks[c], first);
+        memcpy(data, chunks[c] + first, chunkSizes[c] - first);
+        pos += chunkSizes[c];
+    }
+
+    android_atomic_release_store(int32_t(writePos + recordSize),
+            &mRing->writePos);
+
+    // Only ring the doorbell if the receiving end had consumed everything
+    // sent before this message. Otherwise it hasn't drained the ring yet and
+    // will see this message too, since it re-checks the ring after updating
+    // readPos. The barrier orders the writePos store with the readPos load.
+    android_memory_barrier();
+    if (uint32_t(android_atomic_acquire_load(&mRing->readPos)) == writePos) {
+        signalReceiver();
+    }
+    return size;
+}
+
+ssize_t BitTube::readRing(void* vaddr, size_t size)
+{
+    if (mRing == NULL || mReceiveFd < 0)
+        return -EPIPE;
+
+    // Reset the doorbell first, so that a message sent from now on signals it
+    // again
+    uint64_t value;
+    ssize_t len;
+    do {
+        len = ::read(mReceiveFd, &value, sizeof(value));
+    } while (len < 0 && errno == EINTR);
+
+    // The sending end lives in another process; don't trust the ring, and
+    // mask the positions with the capacity validated when it was set up
+    const uint32_t capacity = mRingCapacity;
+    const uint32_t readPos = uint32_t(mRing->readPos);
+    const uint32_t writePos =
+            uint32_t(android_atomic_acquire_load(&mRing->writePos));
+    const uint32_t used = writePos - readPos;
+    if (used == 0) {
+        return 0;
+    }
+    if (mRing->capacity != capacity || used > capacity) {
+        ALOGE("BitTube: corrupted ring (read=%u write=%u capacity=%u)",
+                readPos, writePos, mRing->capacity);
+        android_atomic_release_store(int32_t(writePos), &mRing->readPos);
+        return -EBADMSG;
+    }
+
+    uint8_t* data = getRingData(mRing, sizeof(RingHeader));
+    uint32_t header = 0;
+    size_t offset = readPos & (capacity - 1);
+    size_t first = sizeof(header) < capacity - offset ?
+            sizeof(header) : capacity - offset;
+    memcpy(&header, data + offset, first);
+    memcpy(reinterpret_cast<uint8_t*>(&header) + first, data,
+            sizeof(header) - first);
+
+    const uint32_t recordSize = getRingRecordSize(header);
+    if (header > capacity || recordSize > used) {
+        ALOGE("BitTube: corrupted ring (read=%u write=%u size=%u)",
+                readPos, writePos, header);
+        android_atomic_release_store(int32_t(writePos), &mRing->readPos);
+        return -EBADMSG;
+    }
+
+    // Like SOCK_SEQPACKET, excess data is silently discarded
+    const size_t copySize = header < size ? header : size;
+    offset = (readPos + sizeof(header)) & (capacity - 1);
+    first = copySize < capacity - offset ? copySize : capacity - offset;
+    memcpy(vaddr, data + offset, first);
+    memcpy(reinterpret_cast<uint8_t*>(vaddr) + first, data, copySize - first);
+
+    const uint32_t newReadPos = readPos + recordSize;
+    android_atomic_release_store(int32_t(newReadPos), &mRing->readPos);
+
+    // If more messages are waiting, make sure the doorbell stays signaled
+    // (see writeRing)
+    android_memory_barrier();
+    if (uint32_t(android_atomic_acquire_load(&mRing->writePos)) != newReadPos) {
+        signalReceiver();
+    }
+    return copySize;
+}
+
 status_t BitTube::writeToParcel(Parcel* reply) const
 {
     if (mReceiveFd < 0)
         return -EINVAL;
 
+    reply->writeInt32(mTransport);
+    if (mTransport == TRANSPORT_SHARED_MEMORY) {
+        // This end keeps the ring and the eventfd to send messages
+        status_t result = reply->writeDupFileDescriptor(mRingFd);
+        if (result == NO_ERROR) {
+            result = reply->writeDupFileDescriptor(mReceiveFd);
+        }
+        if (result == NO_ERROR) {
+            result = reply->writeInt32(int32_t(mRingSize));
+        }
+        return result;
+    }
+
     status_t result = reply->writeDupFileDescriptor(mReceiveFd);
     close(mReceiveFd);
     mReceiveFd = -1;
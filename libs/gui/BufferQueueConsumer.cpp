@@ -38,8 +38,35 @@ BufferQueueConsumer::~BufferQueueConsumer() {}
 status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         nsecs_t expectedPresent) {
     ATRACE_CALL();
-    Mutex::Autolock lock(mCore->mMutex);
 
+    bool wakeProducers;
+    size_t queueSize;
+    { // Autolock scope
+        Mutex::Autolock lock(mCore->mMutex);
+        status_t result = acquireBufferLocked(outBuffer, expectedPresent);
+        if (result != NO_ERROR) {
+            return result;
+        }
+
+        // We might have freed a slot while dropping old buffers, or the
+        // producer may be blocked waiting for the number of buffers in the
+        // queue to decrease.
+        wakeProducers = mCore->mDequeueWaiters > 0;
+        queueSize = mCore->mQueue.size();
+    } // Autolock scope
+
+    ATRACE_BUFFER_INDEX(outBuffer->mBuf);
+    ATRACE_INT(mConsumerName.string(), queueSize);
+
+    if (wakeProducers) {
+        mCore->mDequeueCondition.broadcast();
+    }
+
+    return NO_ERROR;
+}
+
+status_t BufferQueueConsumer::acquireBufferLocked(BufferItem* outBuffer,
+        nsecs_t expectedPresent) {
     // Check that the consumer doesn't currently have the maximum number of
     // buffers acquired. We allow the max buffer count to be exceeded by one
     // buffer so that the consumer can successfully set up the newly acquired
@@ -121,6 +148,9 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
                 // Front buffer is still in mSlots, so mark the slot as free
                 mSlots[front->mSlot].mBufferState = BufferSlot::FREE;
             }
+            if (mCore->mTimelineEnabled) {
+                mCore->mTimeline.onDropped(front->mFrameNumber);
+            }
             mCore->mQueue.erase(front);
             front = mCore->mQueue.begin();
         }
@@ -145,7 +175,6 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
     int slot = front->mSlot;
     *outBuffer = *front;
-    ATRACE_BUFFER_INDEX(slot);
 
     BQ_LOGV("acquireBuffer: acquiring { slot=%d/%" PRIu64 " buffer=%p }",
             slot, front->mFrameNumber, front->mGraphicBuffer->handle);
@@ -157,6 +186,11 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
         mSlots[slot].mFence = Fence::NO_FENCE;
     }
 
+    if (mCore->mTimelineEnabled) {
+        mCore->mTimeline.onAcquired(front->mFrameNumber, slot,
+                front->mFence);
+    }
+
     // If the buffer has previously been acquired by the consumer, set
     // mGraphicBuffer to NULL to avoid unnecessarily remapping this buffer
     // on the consumer side
@@ -166,13 +200,6 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
 
     mCore->mQueue.erase(front);
 
-    // We might have freed a slot while dropping old buffers, or the producer
-    // may be blocked waiting for the number of buffers in the queue to
-    // decrease.
-    mCore->mDequeueCondition.broadcast();
-
-    ATRACE_INT(mCore->mConsumerName.string(), mCore->mQueue.size());
-
     return NO_ERROR;
 }
 
@@ -286,6 +313,7 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
     }
 
     sp<IProducerListener> listener;
+    bool wakeProducers = false;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
 
@@ -313,6 +341,9 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
             mSlots[slot].mBufferState = BufferSlot::FREE;
             listener = mCore->mConnectedProducerListener;
             BQ_LOGV("releaseBuffer: releasing slot %d", slot);
+            if (mCore->mTimelineEnabled) {
+                mCore->mTimeline.onReleased(frameNumber, slot, releaseFence);
+            }
         } else if (mSlots[slot].mNeedsCleanupOnRelease) {
             BQ_LOGV("releaseBuffer: releasing a stale buffer slot %d "
                     "(state = %d)", slot, mSlots[slot].mBufferState);
@@ -324,9 +355,13 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
             return BAD_VALUE;
         }
 
-        mCore->mDequeueCondition.broadcast();
+        wakeProducers = mCore->mDequeueWaiters > 0;
     } // Autolock scope
 
+    if (wakeProducers) {
+        mCore->mDequeueCondition.broadcast();
+    }
+
     // Call back without lock held
     if (listener != NULL) {
         listener->onBufferReleased();
@@ -516,6 +551,94 @@ sp<NativeHandle> BufferQueueConsumer::getSidebandStream() const {
     return mCore->mSidebandStream;
 }
 
+status_t BufferQueueConsumer::setPreallocationLimit(size_t limit) {
+    ATRACE_CALL();
+    BQ_LOGV("setPreallocationLimit: %zu", limit);
+    Mutex::Autolock lock(mCore->mMutex);
+
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("setPreallocationLimit: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+
+    mCore->setPreallocationLimitLocked(limit);
+    return NO_ERROR;
+}
+
+status_t BufferQueueConsumer::setFrameTimelineEnabled(bool enabled) {
+    ATRACE_CALL();
+    BQ_LOGV("setFrameTimelineEnabled: %d", enabled);
+    Mutex::Autolock lock(mCore->mMutex);
+
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("setFrameTimelineEnabled: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+
+    if (enabled && !mCore->mTimelineEnabled) {
+        mCore->mTimeline.reset();
+    }
+    mCore->mTimelineEnabled = enabled;
+    return NO_ERROR;
+}
+
+status_t BufferQueueConsumer::getFrameTimeline(
+        Vector<BufferQueueTimeline::Record>* outRecords) {
+    ATRACE_CALL();
+
+    if (outRecords == NULL) {
+        BQ_LOGE("getFrameTimeline: outRecords must not be NULL");
+        return BAD_VALUE;
+    }
+
+    // The timeline can be read without holding mMutex
+    outRecords->resize(BufferQueueTimeline::NUM_RECORDS);
+    size_t count = mCore->mTimeline.getRecords(outRecords->editArray(),
+            BufferQueueTimeline::NUM_RECORDS);
+    outRecords->resize(count);
+    return NO_ERROR;
+}
+
+status_t BufferQueueConsumer::getFrontBufferFence(sp<Fence>* outFence,
+        nsecs_t expectedPresent) {
+    ATRACE_CALL();
+
+    if (outFence == NULL) {
+        BQ_LOGE("getFrontBufferFence: outFence must not be NULL");
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mCore->mMutex);
+
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("getFrontBufferFence: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+
+    if (mCore->mQueue.empty()) {
+        return NO_BUFFER_AVAILABLE;
+    }
+
+    // Skip the buffers acquireBuffer would drop, see acquireBufferLocked
+    size_t front = 0;
+    if (expectedPresent != 0) {
+        const nsecs_t MAX_REASONABLE_NSEC = 1000000000ULL; // 1 second
+        while (front + 1 < mCore->mQueue.size() &&
+                !mCore->mQueue[front].mIsAutoTimestamp) {
+            nsecs_t desiredPresent = mCore->mQueue[front + 1].mTimestamp;
+            if (desiredPresent < expectedPresent - MAX_REASONABLE_NSEC ||
+                    desiredPresent > expectedPresent) {
+                break;
+            }
+            front++;
+        }
+    }
+
+    const sp<Fence>& fence(mCore->mQueue[front].mFence);
+    *outFence = fence != NULL ? fence : Fence::NO_FENCE;
+    return NO_ERROR;
+}
+
 void BufferQueueConsumer::dump(String8& result, const char* prefix) const {
     mCore->dump(result, prefix);
 }
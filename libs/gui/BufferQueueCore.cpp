@@ -30,11 +30,98 @@
 #include <gui/ISurfaceComposer.h>
 #include <private/gui/ComposerService.h>
 
+#include <ui/PixelFormat.h>
+
+#include <utils/Thread.h>
+
 template <typename T>
 static inline T max(T a, T b) { return a > b ? a : b; }
 
 namespace android {
 
+// Returns an estimate of the memory used by a buffer. Formats without a
+// well-defined bytes-per-pixel value (e.g. YUV) are assumed to use 4.
+static size_t getBufferBytes(uint32_t stride, uint32_t height,
+        uint32_t format) {
+    ssize_t bpp = bytesPerPixel(static_cast<PixelFormat>(format));
+    if (bpp <= 0) {
+        bpp = 4;
+    }
+    return static_cast<size_t>(stride) * height * static_cast<size_t>(bpp);
+}
+
+class BufferQueueCore::Preallocator : public Thread {
+public:
+    Preallocator(BufferQueueCore* core) : Thread(false), mCore(core) {}
+
+private:
+    virtual bool threadLoop() {
+        Mutex::Autolock lock(mCore->mMutex);
+
+        int slot = BufferQueueCore::INVALID_BUFFER_SLOT;
+        while (!exitPending() && !mCore->findSlotToPreallocateLocked(&slot)) {
+            mCore->mPreallocationCondition.wait(mCore->mMutex);
+        }
+        if (exitPending()) {
+            return false;
+        }
+
+        const uint32_t width = mCore->mPredictedWidth;
+        const uint32_t height = mCore->mPredictedHeight;
+        const uint32_t format = mCore->mPredictedFormat;
+        const uint32_t usage = mCore->mPredictedUsage;
+        const sp<GraphicBuffer> previous(mCore->mSlots[slot].mGraphicBuffer);
+
+        // Allocate without holding the lock so that the producer and consumer
+        // can keep making progress in the meantime.
+        mCore->mMutex.unlock();
+        status_t error = NO_ERROR;
+        sp<GraphicBuffer> buffer(mCore->mAllocator->createGraphicBuffer(
+                width, height, format, usage, &error));
+        mCore->mMutex.lock();
+
+        if (buffer == NULL) {
+            ALOGE("[%s] Preallocator: createGraphicBuffer failed (%d)",
+                    mCore->mConsumerName.string(), error);
+            // Don't retry until dequeueBuffer has confirmed the prediction
+            // again.
+            mCore->mPredictionCount = 0;
+            return true;
+        }
+
+        // Only install the buffer if nothing touched the slot or the
+        // prediction while the lock was released. Otherwise the buffer is
+        // simply dropped.
+        BufferSlot& target(mCore->mSlots[slot]);
+        if (exitPending() || mCore->mIsAbandoned ||
+                target.mBufferState != BufferSlot::FREE ||
+                target.mGraphicBuffer != previous ||
+                width != mCore->mPredictedWidth ||
+                height != mCore->mPredictedHeight ||
+                format != mCore->mPredictedFormat ||
+                usage != mCore->mPredictedUsage) {
+            ALOGV("[%s] Preallocator: slot %d changed while allocating",
+                    mCore->mConsumerName.string(), slot);
+            return true;
+        }
+
+        mCore->freeBufferLocked(slot);
+        target.mGraphicBuffer = buffer;
+        target.mFrameNumber = 0;
+        target.mRequestBufferCalled = false;
+        target.mAttachedByConsumer = false;
+        target.mPreallocated = true;
+        ++mCore->mPreallocatedBufferCount;
+        ALOGV("[%s] Preallocator: installed %ux%u buffer in slot %d",
+                mCore->mConsumerName.string(), width, height, slot);
+        return true;
+    }
+
+    // mCore is not reference counted since the thread is stopped by the
+    // BufferQueueCore destructor.
+    BufferQueueCore* mCore;
+};
+
 static String8 getUniqueName() {
     static volatile int32_t counter = 0;
     return String8::format("unnamed-%d-%d", getpid(),
@@ -55,6 +142,7 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     mQueue(),
     mOverrideMaxBufferCount(0),
     mDequeueCondition(),
+    mDequeueWaiters(0),
     mUseAsyncBuffer(true),
     mDequeueBufferCannotBlock(false),
     mDefaultBufferFormat(PIXEL_FORMAT_RGBA_8888),
@@ -66,7 +154,21 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     mFrameCounter(0),
     mTransformHint(0),
     mIsAllocating(false),
-    mIsAllocatingCondition()
+    mIsAllocatingCondition(),
+    mPreallocator(),
+    mPreallocationLimit(0),
+    mPreallocationCondition(),
+    mPredictedWidth(0),
+    mPredictedHeight(0),
+    mPredictedFormat(0),
+    mPredictedUsage(0),
+    mPredictedAsync(false),
+    mPredictionCount(0),
+    mPreallocatedBufferCount(0),
+    mDequeueAllocationsAvoided(0),
+    mDequeueAllocationCount(0),
+    mTimelineEnabled(false),
+    mTimeline()
 {
     if (allocator == NULL) {
         sp<ISurfaceComposer> composer(ComposerService::getComposerService());
@@ -77,7 +179,16 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     }
 }
 
-BufferQueueCore::~BufferQueueCore() {}
+BufferQueueCore::~BufferQueueCore() {
+    if (mPreallocator != NULL) {
+        { // Autolock scope
+            Mutex::Autolock lock(mMutex);
+            mPreallocator->requestExit();
+            mPreallocationCondition.broadcast();
+        } // Autolock scope
+        mPreallocator->requestExitAndWait();
+    }
+}
 
 void BufferQueueCore::dump(String8& result, const char* prefix) const {
     Mutex::Autolock lock(mMutex);
@@ -101,6 +212,19 @@ void BufferQueueCore::dump(String8& result, const char* prefix) const {
             mDefaultWidth, mDefaultHeight, mDefaultBufferFormat, mTransformHint,
             mQueue.size(), fifo.string());
 
+    if (mPreallocationLimit > 0) {
+        result.appendFormat("%s-Preallocation limit=%zu, predicted=[%ux%u:%X,"
+                "%#x], preallocated=%" PRIu64 ", dequeue allocations avoided=%"
+                PRIu64 ", dequeue allocations=%" PRIu64 "\n", prefix,
+                mPreallocationLimit, mPredictedWidth, mPredictedHeight,
+                mPredictedFormat, mPredictedUsage, mPreallocatedBufferCount,
+                mDequeueAllocationsAvoided, mDequeueAllocationCount);
+    }
+
+    if (mTimelineEnabled) {
+        mTimeline.dump(result, prefix);
+    }
+
     // Trim the free buffers so as to not spam the dump
     int maxBufferCount = 0;
     for (int s = BufferQueueDefs::NUM_BUFFER_SLOTS - 1; s >= 0; --s) {
@@ -120,6 +244,10 @@ void BufferQueueCore::dump(String8& result, const char* prefix) const {
                 s, buffer.get(),
                 BufferSlot::bufferStateName(slot.mBufferState));
 
+        if (slot.mPreallocated) {
+            result.append(" (preallocated)");
+        }
+
         if (buffer != NULL) {
             result.appendFormat(", %p [%4ux%4u:%4u,%3X]", buffer->handle,
                     buffer->width, buffer->height, buffer->stride,
@@ -196,6 +324,7 @@ void BufferQueueCore::freeBufferLocked(int slot) {
     mSlots[slot].mBufferState = BufferSlot::FREE;
     mSlots[slot].mFrameNumber = UINT32_MAX;
     mSlots[slot].mAcquireCalled = false;
+    mSlots[slot].mPreallocated = false;
 
     // Destroy fence as BufferQueue now takes ownership
     if (mSlots[slot].mEglFence != EGL_NO_SYNC_KHR) {
@@ -235,4 +364,90 @@ void BufferQueueCore::waitWhileAllocatingLocked() const {
     }
 }
 
+void BufferQueueCore::setPreallocationLimitLocked(size_t limit) {
+    mPreallocationLimit = limit;
+    if (limit > 0 && mPreallocator == NULL) {
+        mPreallocator = new Preallocator(this);
+        mPreallocator->run(String8::format("BQPrealloc-%s",
+                mConsumerName.string()).string());
+    }
+    mPreallocationCondition.broadcast();
+}
+
+void BufferQueueCore::recordDequeueLocked(uint32_t width, uint32_t height,
+        uint32_t format, uint32_t usage, bool async) {
+    if (width == mPredictedWidth && height == mPredictedHeight &&
+            format == mPredictedFormat && usage == mPredictedUsage &&
+            async == mPredictedAsync) {
+        if (mPredictionCount < PREALLOCATION_CONFIDENCE) {
+            ++mPredictionCount;
+            if (mPredictionCount == PREALLOCATION_CONFIDENCE &&
+                    mPreallocationLimit > 0) {
+                mPreallocationCondition.broadcast();
+            }
+        }
+        return;
+    }
+
+    mPredictedWidth = width;
+    mPredictedHeight = height;
+    mPredictedFormat = format;
+    mPredictedUsage = usage;
+    mPredictedAsync = async;
+    mPredictionCount = 1;
+}
+
+bool BufferQueueCore::matchesPredictionLocked(
+        const sp<GraphicBuffer>& buffer) const {
+    // This mirrors the reallocation check in dequeueBuffer
+    return (buffer != NULL) &&
+            (static_cast<uint32_t>(buffer->width) == mPredictedWidth) &&
+            (static_cast<uint32_t>(buffer->height) == mPredictedHeight) &&
+            (static_cast<uint32_t>(buffer->format) == mPredictedFormat) &&
+            ((static_cast<uint32_t>(buffer->usage) & mPredictedUsage) ==
+                    mPredictedUsage);
+}
+
+bool BufferQueueCore::findSlotToPreallocateLocked(int* outSlot) const {
+    if (mPreallocationLimit == 0 || mIsAbandoned || mIsAllocating ||
+            mConnectedApi == NO_CONNECTED_API ||
+            mPredictionCount < PREALLOCATION_CONFIDENCE) {
+        return false;
+    }
+
+    const int maxBufferCount = getMaxBufferCountLocked(mPredictedAsync);
+    size_t allocatedBytes = 0;
+    size_t candidateBytes = 0;
+    int candidate = INVALID_BUFFER_SLOT;
+    for (int s = 0; s < maxBufferCount; ++s) {
+        const BufferSlot& slot(mSlots[s]);
+        size_t bytes = 0;
+        if (slot.mGraphicBuffer != NULL) {
+            bytes = getBufferBytes(slot.mGraphicBuffer->stride,
+                    slot.mGraphicBuffer->height, slot.mGraphicBuffer->format);
+            allocatedBytes += bytes;
+        }
+        if (candidate == INVALID_BUFFER_SLOT &&
+                slot.mBufferState == BufferSlot::FREE &&
+                !matchesPredictionLocked(slot.mGraphicBuffer)) {
+            candidate = s;
+            candidateBytes = bytes;
+        }
+    }
+
+    if (candidate == INVALID_BUFFER_SLOT) {
+        return false;
+    }
+
+    // The stride isn't known until the buffer is allocated, so use the width
+    const size_t neededBytes = getBufferBytes(mPredictedWidth,
+            mPredictedHeight, mPredictedFormat);
+    if (allocatedBytes - candidateBytes + neededBytes > mPreallocationLimit) {
+        return false;
+    }
+
+    *outSlot = candidate;
+    return true;
+}
+
 } // namespace android
@@ -127,7 +127,7 @@ status_t BufferQueueProducer::setBufferCount(int bufferCount) {
 }
 
 status_t BufferQueueProducer::waitForFreeSlotThenRelock(const char* caller,
-        bool async, int* found, status_t* returnFlags) const {
+        bool async, int* found, status_t* returnFlags, bool canBlock) const {
     bool tryAgain = true;
     while (tryAgain) {
         if (mCore->mIsAbandoned) {
@@ -236,7 +236,12 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(const char* caller,
                     (acquiredCount <= mCore->mMaxAcquiredBufferCount)) {
                 return WOULD_BLOCK;
             }
+            if (!canBlock) {
+                return WOULD_BLOCK;
+            }
+            ++mCore->mDequeueWaiters;
             mCore->mDequeueCondition.wait(mCore->mMutex);
+            --mCore->mDequeueWaiters;
         }
     } // while (tryAgain)
 
@@ -247,26 +252,37 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         sp<android::Fence> *outFence, bool async,
         uint32_t width, uint32_t height, uint32_t format, uint32_t usage) {
     ATRACE_CALL();
-    { // Autolock scope
-        Mutex::Autolock lock(mCore->mMutex);
-        mConsumerName = mCore->mConsumerName;
-    } // Autolock scope
-
-    BQ_LOGV("dequeueBuffer: async=%s w=%u h=%u format=%#x, usage=%#x",
-            async ? "true" : "false", width, height, format, usage);
+    return dequeueBufferInternal(outSlot, outFence, async, width, height,
+            format, usage, true);
+}
 
-    if ((width && !height) || (!width && height)) {
-        BQ_LOGE("dequeueBuffer: invalid size: w=%u h=%u", width, height);
-        return BAD_VALUE;
-    }
+status_t BufferQueueProducer::dequeueBufferInternal(int *outSlot,
+        sp<android::Fence> *outFence, bool async,
+        uint32_t width, uint32_t height, uint32_t format, uint32_t usage,
+        bool canBlock) {
 
     status_t returnFlags = NO_ERROR;
     EGLDisplay eglDisplay = EGL_NO_DISPLAY;
     EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
     bool attachedByConsumer = false;
+    bool preallocated = false;
+
+    // Holds the buffer being replaced by a reallocation so that it is
+    // released after mMutex has been dropped
+    sp<GraphicBuffer> staleBuffer;
 
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        mConsumerName = mCore->mConsumerName;
+
+        BQ_LOGV("dequeueBuffer: async=%s w=%u h=%u format=%#x, usage=%#x",
+                async ? "true" : "false", width, height, format, usage);
+
+        if ((width && !height) || (!width && height)) {
+            BQ_LOGE("dequeueBuffer: invalid size: w=%u h=%u", width, height);
+            return BAD_VALUE;
+        }
+
         mCore->waitWhileAllocatingLocked();
 
         if (format == 0) {
@@ -276,9 +292,10 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         // Enable the usage bits the consumer requested
         usage |= mCore->mConsumerUsageBits;
 
+        const nsecs_t waitStart = mCore->mTimelineEnabled ? systemTime() : 0;
         int found;
         status_t status = waitForFreeSlotThenRelock("dequeueBuffer", async,
-                &found, &returnFlags);
+                &found, &returnFlags, canBlock);
         if (status != NO_ERROR) {
             return status;
         }
@@ -292,6 +309,11 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         *outSlot = found;
         ATRACE_BUFFER_INDEX(found);
 
+        if (mCore->mTimelineEnabled) {
+            mCore->mTimeline.onDequeued(found,
+                    waitStart ? systemTime() - waitStart : 0);
+        }
+
         attachedByConsumer = mSlots[found].mAttachedByConsumer;
 
         const bool useDefaultSize = !width && !height;
@@ -300,6 +322,8 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
             height = mCore->mDefaultHeight;
         }
 
+        mCore->recordDequeueLocked(width, height, format, usage, async);
+
         mSlots[found].mBufferState = BufferSlot::DEQUEUED;
 
         const sp<GraphicBuffer>& buffer(mSlots[found].mGraphicBuffer);
@@ -310,13 +334,27 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
                 ((static_cast<uint32_t>(buffer->usage) & usage) != usage))
         {
             mSlots[found].mAcquireCalled = false;
+            staleBuffer = mSlots[found].mGraphicBuffer;
             mSlots[found].mGraphicBuffer = NULL;
             mSlots[found].mRequestBufferCalled = false;
             mSlots[found].mEglDisplay = EGL_NO_DISPLAY;
             mSlots[found].mEglFence = EGL_NO_SYNC_KHR;
             mSlots[found].mFence = Fence::NO_FENCE;
+            mSlots[found].mPreallocated = false;
 
             returnFlags |= BUFFER_NEEDS_REALLOCATION;
+
+            ++mCore->mDequeueAllocationCount;
+            if (mCore->mPreallocationLimit > 0) {
+                // Other FREE slots are likely stale as well
+                mCore->mPreallocationCondition.broadcast();
+            }
+        } else if (mSlots[found].mPreallocated) {
+            // The producer hasn't seen this buffer yet, so it must call
+            // requestBuffer even though no allocation is needed
+            preallocated = true;
+            mSlots[found].mPreallocated = false;
+            ++mCore->mDequeueAllocationsAvoided;
         }
 
         if (CC_UNLIKELY(mSlots[found].mFence == NULL)) {
@@ -355,7 +393,7 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         } // Autolock scope
     }
 
-    if (attachedByConsumer) {
+    if (attachedByConsumer || preallocated) {
         returnFlags |= BUFFER_NEEDS_REALLOCATION;
     }
 
@@ -479,7 +517,7 @@ status_t BufferQueueProducer::attachBuffer(int* outSlot,
     // unlikely that buffers which we are attaching to a BufferQueue will
     // be asynchronous (droppable), but it may not be impossible.
     status_t status = waitForFreeSlotThenRelock("attachBuffer(P)", false,
-            &found, &returnFlags);
+            &found, &returnFlags, true);
     if (status != NO_ERROR) {
         return status;
     }
@@ -542,6 +580,8 @@ status_t BufferQueueProducer::queueBuffer(int slot,
     }
 
     sp<IConsumerListener> listener;
+    bool wakeProducers = false;
+    size_t queueSize = 0;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
 
@@ -632,6 +672,9 @@ status_t BufferQueueProducer::queueBuffer(int slot,
                     // the first in line to be dequeued again
                     mSlots[front->mSlot].mFrameNumber = 0;
                 }
+                if (mCore->mTimelineEnabled) {
+                    mCore->mTimeline.onDropped(front->mFrameNumber);
+                }
                 // Overwrite the droppable buffer with the incoming one
                 *front = item;
             } else {
@@ -641,14 +684,22 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         }
 
         mCore->mBufferHasBeenQueued = true;
-        mCore->mDequeueCondition.broadcast();
+        wakeProducers = mCore->mDequeueWaiters > 0;
 
+        queueSize = mCore->mQueue.size();
+        if (mCore->mTimelineEnabled) {
+            mCore->mTimeline.onQueued(mCore->mFrameCounter, slot, queueSize);
+        }
         output->inflate(mCore->mDefaultWidth, mCore->mDefaultHeight,
-                mCore->mTransformHint, mCore->mQueue.size());
-
-        ATRACE_INT(mCore->mConsumerName.string(), mCore->mQueue.size());
+                mCore->mTransformHint, queueSize);
     } // Autolock scope
 
+    ATRACE_INT(mConsumerName.string(), queueSize);
+
+    if (wakeProducers) {
+        mCore->mDequeueCondition.broadcast();
+    }
+
     // Call back without lock held
     if (listener != NULL) {
         listener->onFrameAvailable();
@@ -657,33 +708,71 @@ status_t BufferQueueProducer::queueBuffer(int slot,
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, uint32_t width, uint32_t height,
+        uint32_t format, uint32_t usage, status_t* outDequeueResult) {
+    ATRACE_CALL();
+
+    status_t result = queueBuffer(slot, input, output);
+    if (result != NO_ERROR) {
+        *outDequeueResult = result;
+        return result;
+    }
+
+    int64_t timestamp;
+    bool isAutoTimestamp;
+    Rect crop;
+    int scalingMode;
+    uint32_t transform;
+    uint32_t stickyTransform;
+    bool async;
+    sp<Fence> fence;
+    input.deflate(&timestamp, &isAutoTimestamp, &crop, &scalingMode, &transform,
+            &async, &fence, &stickyTransform);
+
+    // Don't block here: the caller only wants the next buffer if it is
+    // available right away, and will dequeue it normally otherwise
+    *outDequeueResult = dequeueBufferInternal(outSlot, outFence, async, width,
+            height, format, usage, false);
+    return NO_ERROR;
+}
+
 void BufferQueueProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     ATRACE_CALL();
     BQ_LOGV("cancelBuffer: slot %d", slot);
-    Mutex::Autolock lock(mCore->mMutex);
 
-    if (mCore->mIsAbandoned) {
-        BQ_LOGE("cancelBuffer: BufferQueue has been abandoned");
-        return;
-    }
+    bool wakeProducers = false;
+    { // Autolock scope
+        Mutex::Autolock lock(mCore->mMutex);
 
-    if (slot < 0 || slot >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
-        BQ_LOGE("cancelBuffer: slot index %d out of range [0, %d)",
-                slot, BufferQueueDefs::NUM_BUFFER_SLOTS);
-        return;
-    } else if (mSlots[slot].mBufferState != BufferSlot::DEQUEUED) {
-        BQ_LOGE("cancelBuffer: slot %d is not owned by the producer "
-                "(state = %d)", slot, mSlots[slot].mBufferState);
-        return;
-    } else if (fence == NULL) {
-        BQ_LOGE("cancelBuffer: fence is NULL");
-        return;
-    }
+        if (mCore->mIsAbandoned) {
+            BQ_LOGE("cancelBuffer: BufferQueue has been abandoned");
+            return;
+        }
 
-    mSlots[slot].mBufferState = BufferSlot::FREE;
-    mSlots[slot].mFrameNumber = 0;
-    mSlots[slot].mFence = fence;
-    mCore->mDequeueCondition.broadcast();
+        if (slot < 0 || slot >= BufferQueueDefs::NUM_BUFFER_SLOTS) {
+            BQ_LOGE("cancelBuffer: slot index %d out of range [0, %d)",
+                    slot, BufferQueueDefs::NUM_BUFFER_SLOTS);
+            return;
+        } else if (mSlots[slot].mBufferState != BufferSlot::DEQUEUED) {
+            BQ_LOGE("cancelBuffer: slot %d is not owned by the producer "
+                    "(state = %d)", slot, mSlots[slot].mBufferState);
+            return;
+        } else if (fence == NULL) {
+            BQ_LOGE("cancelBuffer: fence is NULL");
+            return;
+        }
+
+        mSlots[slot].mBufferState = BufferSlot::FREE;
+        mSlots[slot].mFrameNumber = 0;
+        mSlots[slot].mFence = fence;
+        wakeProducers = mCore->mDequeueWaiters > 0;
+    } // Autolock scope
+
+    if (wakeProducers) {
+        mCore->mDequeueCondition.broadcast();
+    }
 }
 
 int BufferQueueProducer::query(int what, int *outValue) {
@@ -0,0 +1,303 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BufferQueueTimeline"
+//#define LOG_NDEBUG 0
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <inttypes.h>
+#include <sched.h>
+#include <string.h>
+
+#include <cutils/atomic.h>
+
+#include <gui/BufferQueueTimeline.h>
+
+#include <ui/Fence.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+namespace android {
+
+const nsecs_t BufferQueueTimeline::FENCE_TIME_PENDING = INT64_MAX;
+
+// The number of times a reader retries copying the ring before giving up
+static const int MAX_READ_ATTEMPTS = 8;
+
+static nsecs_t getFenceTime(const sp<Fence>& fence) {
+    if (fence == NULL || !fence->isValid()) {
+        return BufferQueueTimeline::FENCE_TIME_INVALID;
+    }
+    nsecs_t signalTime = fence->getSignalTime();
+    return signalTime < 0 ?
+            nsecs_t(BufferQueueTimeline::FENCE_TIME_INVALID) : signalTime;
+}
+
+BufferQueueTimeline::SlotState::SlotState() :
+        dequeueTime(0),
+        dequeueWaitTime(0),
+        acquireFrameNumber(0),
+        acquireFence(),
+        releaseFrameNumber(0),
+        releaseFence() {
+}
+
+BufferQueueTimeline::BufferQueueTimeline() :
+        mSequence(0),
+        mNewestFrameNumber(0) {
+    memset(mRecords, 0, sizeof(mRecords));
+}
+
+BufferQueueTimeline::~BufferQueueTimeline() {
+}
+
+void BufferQueueTimeline::beginWrite() {
+    // only the writer modifies mSequence, so a plain load is fine here
+    android_atomic_release_store(mSequence + 1, &mSequence);
+    android_memory_barrier();
+}
+
+void BufferQueueTimeline::endWrite() {
+    android_atomic_release_store(mSequence + 1, &mSequence);
+}
+
+BufferQueueTimeline::Record* BufferQueueTimeline::findRecord(
+        uint64_t frameNumber) {
+    if (frameNumber == 0) {
+        return NULL;
+    }
+    Record& record(mRecords[frameNumber % NUM_RECORDS]);
+    return record.frameNumber == frameNumber ? &record : NULL;
+}
+
+void BufferQueueTimeline::reset() {
+    for (int s = 0; s < BufferQueueDefs::NUM_BUFFER_SLOTS; ++s) {
+        mSlotStates[s] = SlotState();
+    }
+    beginWrite();
+    memset(mRecords, 0, sizeof(mRecords));
+    endWrite();
+}
+
+void BufferQueueTimeline::onDequeued(int slot, nsecs_t waitTime) {
+    SlotState& state(mSlotStates[slot]);
+    state.dequeueTime = systemTime();
+    state.dequeueWaitTime = waitTime;
+}
+
+void BufferQueueTimeline::onQueued(uint64_t frameNumber, int slot,
+        size_t queueDepth) {
+    SlotState& state(mSlotStates[slot]);
+
+    // The producer has had to wait for the release fence of the previous
+    // frame in this slot before queueing this one, so it has most likely
+    // signaled by now.
+    nsecs_t releaseFenceTime = FENCE_TIME_UNKNOWN;
+    if (state.releaseFence != NULL) {
+        releaseFenceTime = getFenceTime(state.releaseFence);
+        state.releaseFence.clear();
+    }
+
+    beginWrite();
+    Record* previous = findRecord(state.releaseFrameNumber);
+    if (previous != NULL) {
+        previous->releaseFenceTime = releaseFenceTime;
+    }
+
+    Record& record(mRecords[frameNumber % NUM_RECORDS]);
+    memset(&record, 0, sizeof(record));
+    record.frameNumber = frameNumber;
+    record.slot = slot;
+    record.queueDepth = static_cast<int32_t>(queueDepth);
+    record.dequeueTime = state.dequeueTime;
+    record.dequeueWaitTime = state.dequeueWaitTime;
+    record.queueTime = systemTime();
+    if (frameNumber > mNewestFrameNumber) {
+        mNewestFrameNumber = frameNumber;
+    }
+    endWrite();
+
+    state.dequeueTime = 0;
+    state.dequeueWaitTime = 0;
+    state.releaseFrameNumber = 0;
+}
+
+void BufferQueueTimeline::onAcquired(uint64_t frameNumber, int slot,
+        const sp<Fence>& acquireFence) {
+    // The acquire fence is resolved on release, by which time the consumer
+    // has waited for it
+    SlotState& state(mSlotStates[slot]);
+    state.acquireFrameNumber = frameNumber;
+    state.acquireFence = acquireFence;
+
+    beginWrite();
+    Record* record = findRecord(frameNumber);
+    if (record != NULL) {
+        record->acquireTime = systemTime();
+    }
+    endWrite();
+}
+
+void BufferQueueTimeline::onDropped(uint64_t frameNumber) {
+    beginWrite();
+    Record* record = findRecord(frameNumber);
+    if (record != NULL) {
+        record->dropped = 1;
+        record->releaseTime = systemTime();
+    }
+    endWrite();
+}
+
+void BufferQueueTimeline::onReleased(uint64_t frameNumber, int slot,
+        const sp<Fence>& releaseFence) {
+    SlotState& state(mSlotStates[slot]);
+    nsecs_t acquireFenceTime = FENCE_TIME_UNKNOWN;
+    if (state.acquireFrameNumber == frameNumber) {
+        acquireFenceTime = getFenceTime(state.acquireFence);
+    }
+    state.acquireFrameNumber = 0;
+    state.acquireFence.clear();
+    state.releaseFrameNumber = frameNumber;
+    state.releaseFence = releaseFence;
+
+    beginWrite();
+    Record* record = findRecord(frameNumber);
+    if (record != NULL) {
+        record->releaseTime = systemTime();
+        record->acquireFenceTime = acquireFenceTime;
+    }
+    endWrite();
+}
+
+size_t BufferQueueTimeline::getRecords(Record* outRecords,
+        size_t maxCount) const {
+    Record records[NUM_RECORDS];
+    uint64_t newest = 0;
+    bool consistent = false;
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS && !consistent;
+            ++attempt) {
+        const int32_t before = android_atomic_acquire_load(&mSequence);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(records, mRecords, sizeof(records));
+        newest = mNewestFrameNumber;
+        android_memory_barrier();
+        consistent = android_atomic_acquire_load(&mSequence) == before;
+    }
+    if (!consistent) {
+        ALOGW("getRecords: the timeline kept changing while being read");
+        return 0;
+    }
+
+    // Walk back from the newest frame, skipping frames that are missing
+    // because they were never queued (e.g. after a reset)
+    size_t count = 0;
+    Record* end = outRecords + maxCount;
+    for (uint64_t n = newest; n > 0 && newest - n < NUM_RECORDS &&
+            count < maxCount; --n) {
+        const Record& record(records[n % NUM_RECORDS]);
+        if (record.frameNumber == n) {
+            *(end - ++count) = record;
+        }
+    }
+    if (count < maxCount) {
+        memmove(outRecords, end - count, count * sizeof(Record));
+    }
+    return count;
+}
+
+void BufferQueueTimeline::dump(String8& result, const char* prefix) const {
+    Record records[NUM_RECORDS];
+    const size_t count = getRecords(records, NUM_RECORDS);
+
+    size_t queued = 0;
+    size_t acquired = 0;
+    size_t dropped = 0;
+    int64_t totalDepth = 0;
+    int32_t maxDepth = 0;
+    nsecs_t totalWait = 0;
+    nsecs_t maxWait = 0;
+    nsecs_t totalLatency = 0;
+    nsecs_t maxLatency = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const Record& record(records[i]);
+        ++queued;
+        totalDepth += record.queueDepth;
+        maxDepth = record.queueDepth > maxDepth ? record.queueDepth : maxDepth;
+        totalWait += record.dequeueWaitTime;
+        maxWait = record.dequeueWaitTime > maxWait ?
+                record.dequeueWaitTime : maxWait;
+        if (record.dropped) {
+            ++dropped;
+        } else if (record.acquireTime != 0) {
+            ++acquired;
+            nsecs_t latency = record.acquireTime - record.queueTime;
+            totalLatency += latency;
+            maxLatency = latency > maxLatency ? latency : maxLatency;
+        }
+    }
+
+    result.appendFormat("%s-Timeline frames=%zu dropped=%zu "
+            "queue-depth avg=%.2f max=%d, dequeue-wait avg=%.3fms "
+            "max=%.3fms, queue-to-acquire avg=%.3fms max=%.3fms\n",
+            prefix, queued, dropped,
+            queued ? double(totalDepth) / queued : 0.0, maxDepth,
+            queued ? totalWait / 1000000.0 / queued : 0.0,
+            maxWait / 1000000.0,
+            acquired ? totalLatency / 1000000.0 / acquired : 0.0,
+            maxLatency / 1000000.0);
+
+    // Show the most recent frames relative to their dequeue time
+    const size_t DUMPED_RECORDS = 8;
+    for (size_t i = count > DUMPED_RECORDS ? count - DUMPED_RECORDS : 0;
+            i < count; ++i) {
+        const Record& record(records[i]);
+        const nsecs_t base = record.dequeueTime ?
+                record.dequeueTime : record.queueTime;
+        result.appendFormat("%s  #%" PRIu64 " slot=%02d depth=%d "
+                "wait=%" PRId64 "us queue=+%" PRId64 "us",
+                prefix, record.frameNumber, record.slot, record.queueDepth,
+                record.dequeueWaitTime / 1000,
+                (record.queueTime - base) / 1000);
+        if (record.acquireTime) {
+            result.appendFormat(" acquire=+%" PRId64 "us",
+                    (record.acquireTime - base) / 1000);
+        }
+        if (record.releaseTime) {
+            result.appendFormat(" %s=+%" PRId64 "us",
+                    record.dropped ? "drop" : "release",
+                    (record.releaseTime - base) / 1000);
+        }
+        if (record.acquireFenceTime > 0 &&
+                record.acquireFenceTime != FENCE_TIME_PENDING) {
+            result.appendFormat(" acquire-fence=+%" PRId64 "us",
+                    (record.acquireFenceTime - base) / 1000);
+        }
+        if (record.releaseFenceTime > 0 &&
+                record.releaseFenceTime != FENCE_TIME_PENDING) {
+            result.appendFormat(" release-fence=+%" PRId64 "us",
+                    (record.releaseFenceTime - base) / 1000);
+        }
+        result.append("\n");
+    }
+}
+
+}; // namespace android
@@ -18,8 +18,12 @@
 #define LOG_TAG "CpuConsumer"
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <inttypes.h>
+#include <string.h>
+
 #include <cutils/compiler.h>
 #include <utils/Log.h>
+#include <utils/Trace.h>
 #include <gui/CpuConsumer.h>
 
 #define CC_LOGV(x, ...) ALOGV("[%s] "x, mName.string(), ##__VA_ARGS__)
@@ -30,12 +34,88 @@
 
 namespace android {
 
+// Prefetcher acquires and maps buffers ahead of lockNextBuffer while
+// prefetching is enabled
+class CpuConsumer::Prefetcher : public Thread {
+public:
+    Prefetcher(CpuConsumer* consumer) : Thread(false), mConsumer(consumer) {}
+
+private:
+    virtual bool threadLoop() {
+        BufferQueue::BufferItem item;
+        sp<GraphicBuffer> buffer;
+        { // Autolock scope
+            Mutex::Autolock _l(mConsumer->mMutex);
+            while (!exitPending() && !mConsumer->canPrefetchLocked()) {
+                mConsumer->mPrefetchCondition.wait(mConsumer->mMutex);
+            }
+            if (exitPending()) {
+                return false;
+            }
+
+            status_t err = mConsumer->acquireBufferLocked(&item, 0);
+            if (err != OK) {
+                if (err != BufferQueue::NO_BUFFER_AVAILABLE) {
+                    ALOGE("[%s] Prefetcher: error acquiring buffer: %s (%d)",
+                            mConsumer->mName.string(), strerror(-err), err);
+                }
+                mConsumer->mFramesPending = false;
+                return true;
+            }
+            buffer = mConsumer->mSlots[item.mBuf].mGraphicBuffer;
+            ++mConsumer->mPrefetchesInFlight;
+        } // Autolock scope
+
+        // Wait for the producer and map the buffer without holding the lock,
+        // so that lockNextBuffer can keep returning the buffers that are
+        // already mapped
+        ATRACE_NAME("CpuConsumer prefetch");
+        const nsecs_t start = systemTime();
+        if (item.mFence != NULL) {
+            item.mFence->waitForever("CpuConsumer::Prefetcher");
+        }
+        const nsecs_t fenceTime = systemTime();
+
+        PrefetchedBuffer prefetched;
+        prefetched.mItem = item;
+        prefetched.mGraphicBuffer = buffer;
+        prefetched.mBufferPointer = NULL;
+        prefetched.mYCbCr = android_ycbcr();
+        status_t err = mConsumer->lockForRead(buffer, item.mCrop, -1,
+                &prefetched.mBufferPointer, &prefetched.mYCbCr);
+        const nsecs_t end = systemTime();
+
+        Mutex::Autolock _l(mConsumer->mMutex);
+        --mConsumer->mPrefetchesInFlight;
+        if (err == OK) {
+            mConsumer->mPrefetchedBuffers.push_back(prefetched);
+            mConsumer->mLockStats.totalFenceWaitTime += fenceTime - start;
+            mConsumer->mLockStats.totalPrefetchMapTime += end - fenceTime;
+        } else if (buffer == mConsumer->mSlots[item.mBuf].mGraphicBuffer) {
+            // There is no way to report the error, so drop the frame
+            mConsumer->releaseBufferLocked(item.mBuf, buffer, EGL_NO_DISPLAY,
+                    EGL_NO_SYNC_KHR);
+        }
+        mConsumer->mPrefetchDoneCondition.broadcast();
+        return true;
+    }
+
+    // mConsumer is not reference counted since the thread is stopped by the
+    // CpuConsumer destructor.
+    CpuConsumer* mConsumer;
+};
+
 CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
         uint32_t maxLockedBuffers, bool controlledByApp) :
     ConsumerBase(bq, controlledByApp),
     mMaxLockedBuffers(maxLockedBuffers),
-    mCurrentLockedBuffers(0)
+    mCurrentLockedBuffers(0),
+    mPrefetchDepth(0),
+    mPrefetchesInFlight(0),
+    mFramesPending(false)
 {
+    memset(&mLockStats, 0, sizeof(mLockStats));
+
     // Create tracking entries for locked buffers
     mAcquiredBuffers.insertAt(0, maxLockedBuffers);
 
@@ -44,6 +124,21 @@ CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
 }
 
 CpuConsumer::~CpuConsumer() {
+    if (mPrefetcher != NULL) {
+        { // Autolock scope
+            Mutex::Autolock _l(mMutex);
+            mPrefetcher->requestExit();
+            mPrefetchCondition.broadcast();
+        } // Autolock scope
+        mPrefetcher->requestExitAndWait();
+    }
+
+    // The BufferQueue has been abandoned by now, so only unmap the buffers
+    // that were never handed out
+    for (size_t i = 0; i < mPrefetchedBuffers.size(); i++) {
+        mPrefetchedBuffers[i].mGraphicBuffer->unlock();
+    }
+
     // ConsumerBase destructor does all the work.
 }
 
@@ -67,6 +162,84 @@ status_t CpuConsumer::setDefaultBufferFormat(uint32_t defaultFormat)
     return mConsumer->setDefaultBufferFormat(defaultFormat);
 }
 
+status_t CpuConsumer::setPrefetchDepth(uint32_t depth) {
+    Mutex::Autolock _l(mMutex);
+    if (depth > mMaxLockedBuffers) {
+        CC_LOGE("setPrefetchDepth: depth %u exceeds the max locked buffers %u",
+                depth, mMaxLockedBuffers);
+        return BAD_VALUE;
+    }
+
+    mPrefetchDepth = depth;
+    if (depth > 0) {
+        if (mPrefetcher == NULL) {
+            mPrefetcher = new Prefetcher(this);
+            mPrefetcher->run(String8::format("CpuConsumer %s prefetch",
+                    mName.string()));
+        }
+        // Frames may already be waiting in the queue
+        mFramesPending = true;
+        mPrefetchCondition.signal();
+    }
+    return OK;
+}
+
+void CpuConsumer::getLockStats(LockStats* outStats) const {
+    Mutex::Autolock _l(mMutex);
+    *outStats = mLockStats;
+}
+
+void CpuConsumer::onFrameAvailable() {
+    { // Autolock scope
+        Mutex::Autolock _l(mMutex);
+        mFramesPending = true;
+        mPrefetchCondition.signal();
+    } // Autolock scope
+    ConsumerBase::onFrameAvailable();
+}
+
+bool CpuConsumer::canPrefetchLocked() const {
+    const uint32_t prefetched = mPrefetchedBuffers.size() +
+            mPrefetchesInFlight;
+    return !mAbandoned && mFramesPending && prefetched < mPrefetchDepth &&
+            prefetched + mCurrentLockedBuffers < mMaxLockedBuffers;
+}
+
+status_t CpuConsumer::lockForRead(const sp<GraphicBuffer>& buffer,
+        const Rect& crop, int fenceFd, void** outPointer,
+        android_ycbcr* outYCbCr) const {
+    status_t err;
+    if (buffer->getPixelFormat() == HAL_PIXEL_FORMAT_YCbCr_420_888) {
+        if (fenceFd >= 0) {
+            err = buffer->lockAsyncYCbCr(GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    crop, outYCbCr, fenceFd);
+        } else {
+            err = buffer->lockYCbCr(GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    crop, outYCbCr);
+        }
+        if (err != OK) {
+            CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
+                    strerror(-err), err);
+            return err;
+        }
+        *outPointer = outYCbCr->y;
+    } else {
+        if (fenceFd >= 0) {
+            err = buffer->lockAsync(GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    crop, outPointer, fenceFd);
+        } else {
+            err = buffer->lock(GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    crop, outPointer);
+        }
+        if (err != OK) {
+            CC_LOGE("Unable to lock buffer for CPU reading: %s (%d)",
+                    strerror(-err), err);
+            return err;
+        }
+    }
+    return OK;
+}
+
 status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     status_t err;
 
@@ -80,78 +253,62 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     BufferQueue::BufferItem b;
 
     Mutex::Autolock _l(mMutex);
+    const nsecs_t start = systemTime();
 
-    err = acquireBufferLocked(&b, 0);
-    if (err != OK) {
-        if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
-            return BAD_VALUE;
-        } else {
-            CC_LOGE("Error acquiring buffer: %s (%d)", strerror(err), err);
-            return err;
-        }
+    // Prefetched buffers were acquired before anything still in the queue, so
+    // they must be returned first, including the ones still being mapped
+    while (mPrefetchedBuffers.isEmpty() && mPrefetchesInFlight > 0) {
+        mPrefetchDoneCondition.wait(mMutex);
     }
-
-    int buf = b.mBuf;
-
-    void *bufferPointer = NULL;
-    android_ycbcr ycbcr = android_ycbcr();
-
-    if (b.mFence.get()) {
-        if (mSlots[buf].mGraphicBuffer->getPixelFormat() ==
-                HAL_PIXEL_FORMAT_YCbCr_420_888) {
-            err = mSlots[buf].mGraphicBuffer->lockAsyncYCbCr(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &ycbcr,
-                b.mFence->dup());
-
-            if (err != OK) {
-                CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
-                        strerror(-err), err);
-                return err;
-            }
-            bufferPointer = ycbcr.y;
-        } else {
-            err = mSlots[buf].mGraphicBuffer->lockAsync(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &bufferPointer,
-                b.mFence->dup());
-
-            if (err != OK) {
-                CC_LOGE("Unable to lock buffer for CPU reading: %s (%d)",
-                        strerror(-err), err);
+    if (!mPrefetchedBuffers.isEmpty()) {
+        const PrefetchedBuffer& prefetched(mPrefetchedBuffers[0]);
+        addLockedBufferLocked(prefetched.mItem, prefetched.mGraphicBuffer,
+                prefetched.mBufferPointer, prefetched.mYCbCr, nativeBuffer);
+        mPrefetchedBuffers.removeAt(0);
+        mLockStats.buffersPrefetched++;
+    } else {
+        err = acquireBufferLocked(&b, 0);
+        if (err != OK) {
+            if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
+                return BAD_VALUE;
+            } else {
+                CC_LOGE("Error acquiring buffer: %s (%d)", strerror(err), err);
                 return err;
             }
         }
-    } else {
-        if (mSlots[buf].mGraphicBuffer->getPixelFormat() ==
-                HAL_PIXEL_FORMAT_YCbCr_420_888) {
-            err = mSlots[buf].mGraphicBuffer->lockYCbCr(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &ycbcr);
 
-            if (err != OK) {
-                CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
-                        strerror(-err), err);
-                return err;
-            }
-            bufferPointer = ycbcr.y;
-        } else {
-            err = mSlots[buf].mGraphicBuffer->lock(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &bufferPointer);
+        int buf = b.mBuf;
 
-            if (err != OK) {
-                CC_LOGE("Unable to lock buffer for CPU reading: %s (%d)",
-                        strerror(-err), err);
-                return err;
-            }
+        void *bufferPointer = NULL;
+        android_ycbcr ycbcr = android_ycbcr();
+
+        err = lockForRead(mSlots[buf].mGraphicBuffer, b.mCrop,
+                b.mFence.get() ? b.mFence->dup() : -1, &bufferPointer,
+                &ycbcr);
+        if (err != OK) {
+            return err;
         }
+
+        addLockedBufferLocked(b, mSlots[buf].mGraphicBuffer, bufferPointer,
+                ycbcr, nativeBuffer);
     }
 
+    const nsecs_t lockTime = systemTime() - start;
+    mLockStats.buffersLocked++;
+    mLockStats.totalLockTime += lockTime;
+    if (lockTime > mLockStats.maxLockTime) {
+        mLockStats.maxLockTime = lockTime;
+    }
+
+    // Keep the pipeline full
+    mPrefetchCondition.signal();
+
+    return OK;
+}
+
+void CpuConsumer::addLockedBufferLocked(const BufferQueue::BufferItem& b,
+        const sp<GraphicBuffer>& buffer, void* bufferPointer,
+        const android_ycbcr& ycbcr, LockedBuffer* nativeBuffer) {
     size_t lockedIdx = 0;
     for (; lockedIdx < mMaxLockedBuffers; lockedIdx++) {
         if (mAcquiredBuffers[lockedIdx].mSlot ==
@@ -162,18 +319,18 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     assert(lockedIdx < mMaxLockedBuffers);
 
     AcquiredBuffer &ab = mAcquiredBuffers.editItemAt(lockedIdx);
-    ab.mSlot = buf;
+    ab.mSlot = b.mBuf;
     ab.mBufferPointer = bufferPointer;
-    ab.mGraphicBuffer = mSlots[buf].mGraphicBuffer;
+    ab.mGraphicBuffer = buffer;
 
     nativeBuffer->data   =
             reinterpret_cast<uint8_t*>(bufferPointer);
-    nativeBuffer->width  = mSlots[buf].mGraphicBuffer->getWidth();
-    nativeBuffer->height = mSlots[buf].mGraphicBuffer->getHeight();
-    nativeBuffer->format = mSlots[buf].mGraphicBuffer->getPixelFormat();
+    nativeBuffer->width  = buffer->getWidth();
+    nativeBuffer->height = buffer->getHeight();
+    nativeBuffer->format = buffer->getPixelFormat();
     nativeBuffer->stride = (ycbcr.y != NULL) ?
             ycbcr.ystride :
-            mSlots[buf].mGraphicBuffer->getStride();
+            buffer->getStride();
 
     nativeBuffer->crop        = b.mCrop;
     nativeBuffer->transform   = b.mTransform;
@@ -187,8 +344,6 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     nativeBuffer->chromaStep   = ycbcr.chroma_step;
 
     mCurrentLockedBuffers++;
-
-    return OK;
 }
 
 status_t CpuConsumer::unlockBuffer(const LockedBuffer &nativeBuffer) {
@@ -243,6 +398,9 @@ status_t CpuConsumer::releaseAcquiredBufferLocked(int lockedIdx) {
     ab.mGraphicBuffer.clear();
 
     mCurrentLockedBuffers--;
+
+    // Room was made for another prefetched buffer
+    mPrefetchCondition.signal();
     return OK;
 }
 
@@ -250,4 +408,21 @@ void CpuConsumer::freeBufferLocked(int slotIndex) {
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
+void CpuConsumer::dumpLocked(String8& result, const char* prefix) const {
+    result.appendFormat("%slocked=%u/%u prefetch-depth=%u prefetched=%zu "
+            "in-flight=%u\n", prefix, mCurrentLockedBuffers, mMaxLockedBuffers,
+            mPrefetchDepth, mPrefetchedBuffers.size(), mPrefetchesInFlight);
+    const LockStats& stats(mLockStats);
+    result.appendFormat("%slockNextBuffer: %" PRIu64 " buffers (%" PRIu64
+            " prefetched), avg %.3fms max %.3fms; prefetch: fence wait "
+            "%.3fms, map %.3fms\n", prefix, stats.buffersLocked,
+            stats.buffersPrefetched,
+            stats.buffersLocked ?
+                    stats.totalLockTime / 1000000.0 / stats.buffersLocked : 0.0,
+            stats.maxLockTime / 1000000.0,
+            stats.totalFenceWaitTime / 1000000.0,
+            stats.totalPrefetchMapTime / 1000000.0);
+    ConsumerBase::dumpLocked(result, prefix);
+}
+
 } // namespace android
@@ -31,7 +31,8 @@ namespace android {
 
 // ---------------------------------------------------------------------------
 
-DisplayEventReceiver::DisplayEventReceiver() {
+DisplayEventReceiver::DisplayEventReceiver()
+    : mCoalesceVsync(false) {
     sp<ISurfaceComposer> sf(ComposerService::getComposerService());
     if (sf != NULL) {
         mEventConnection = sf->createDisplayEventConnection();
@@ -77,9 +78,53 @@ status_t DisplayEventReceiver::requestNextVsync() {
 }
 
 
+void DisplayEventReceiver::setVsyncCoalescing(bool enabled) {
+    mCoalesceVsync = enabled;
+}
+
 ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
         size_t count) {
-    return DisplayEventReceiver::getEvents(mDataChannel, events, count);
+    if (!mCoalesceVsync) {
+        return DisplayEventReceiver::getEvents(mDataChannel, events, count);
+    }
+
+    // Keep reading into the room left after coalescing, so that a backlog
+    // of vsync events collapses into one per display
+    size_t n = 0;
+    while (n < count) {
+        ssize_t size = DisplayEventReceiver::getEvents(mDataChannel,
+                events + n, count - n);
+        if (size < 0) {
+            return n ? ssize_t(n) : size;
+        }
+        if (size == 0) {
+            break;
+        }
+        n = coalesceVsyncEvents(events, n + size);
+    }
+    return n;
+}
+
+size_t DisplayEventReceiver::coalesceVsyncEvents(Event* events,
+        size_t count) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        Event event(events[i]);
+        if (event.header.type == DISPLAY_EVENT_VSYNC) {
+            for (size_t j = 0; j < n; j++) {
+                if (events[j].header.type == DISPLAY_EVENT_VSYNC &&
+                        events[j].header.id == event.header.id) {
+                    event.vsync.missed += events[j].vsync.missed + 1;
+                    memmove(events + j, events + j + 1,
+                            (n - j - 1) * sizeof(Event));
+                    n--;
+                    break;
+                }
+            }
+        }
+        events[n++] = event;
+    }
+    return n;
 }
 
 ssize_t DisplayEventReceiver::getEvents(const sp<BitTube>& dataChannel,
@@ -21,6 +21,8 @@
 #define GL_GLEXT_PROTOTYPES
 #define EGL_EGLEXT_PROTOTYPES
 
+#include <inttypes.h>
+
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -41,9 +43,6 @@
 #include <utils/String8.h>
 #include <utils/Trace.h>
 
-EGLAPI const char* eglQueryStringImplementationANDROID(EGLDisplay dpy, EGLint name);
-#define CROP_EXT_STR "EGL_ANDROID_image_crop"
-
 namespace android {
 
 // Macros for including the GLConsumer name in log messages
@@ -92,30 +91,6 @@ static void mtxMul(float out[16], const float a[16], const float b[16]);
 Mutex GLConsumer::sStaticInitLock;
 sp<GraphicBuffer> GLConsumer::sReleasedTexImageBuffer;
 
-static bool hasEglAndroidImageCropImpl() {
-    EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    const char* exts = eglQueryStringImplementationANDROID(dpy, EGL_EXTENSIONS);
-    size_t cropExtLen = strlen(CROP_EXT_STR);
-    size_t extsLen = strlen(exts);
-    bool equal = !strcmp(CROP_EXT_STR, exts);
-    bool atStart = !strncmp(CROP_EXT_STR " ", exts, cropExtLen+1);
-    bool atEnd = (cropExtLen+1) < extsLen &&
-            !strcmp(" " CROP_EXT_STR, exts + extsLen - (cropExtLen+1));
-    bool inMiddle = strstr(exts, " " CROP_EXT_STR " ");
-    return equal || atStart || atEnd || inMiddle;
-}
-
-static bool hasEglAndroidImageCrop() {
-    // Only compute whether the extension is present once the first time this
-    // function is called.
-    static bool hasIt = hasEglAndroidImageCropImpl();
-    return hasIt;
-}
-
-static bool isEglImageCroppable(const Rect& crop) {
-    return hasEglAndroidImageCrop() && (crop.left == 0 && crop.top == 0);
-}
-
 GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t tex,
         uint32_t texTarget, bool useFenceSync, bool isControlledByApp) :
     ConsumerBase(bq, isControlledByApp),
@@ -133,7 +108,9 @@ GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t tex,
     mEglDisplay(EGL_NO_DISPLAY),
     mEglContext(EGL_NO_CONTEXT),
     mCurrentTexture(BufferQueue::INVALID_BUFFER_SLOT),
-    mAttached(true)
+    mAttached(true),
+    mEglImageCacheHits(0),
+    mEglImageCacheMisses(0)
 {
     ST_LOGV("GLConsumer");
 
@@ -160,7 +137,9 @@ GLConsumer::GLConsumer(const sp<IGraphicBufferConsumer>& bq, uint32_t texTarget,
     mEglDisplay(EGL_NO_DISPLAY),
     mEglContext(EGL_NO_CONTEXT),
     mCurrentTexture(BufferQueue::INVALID_BUFFER_SLOT),
-    mAttached(false)
+    mAttached(false),
+    mEglImageCacheHits(0),
+    mEglImageCacheMisses(0)
 {
     ST_LOGV("GLConsumer");
 
@@ -228,7 +207,12 @@ status_t GLConsumer::updateTexImage() {
     }
 
     // Bind the new buffer to the GL texture, and wait until it's ready.
-    return bindTextureImageLocked();
+    err = bindTextureImageLocked();
+
+    // Buffers freed since the last update may have been dropped by the
+    // BufferQueue meanwhile
+    pruneEglImageCacheLocked();
+    return err;
 }
 
 
@@ -339,16 +323,63 @@ status_t GLConsumer::acquireBufferLocked(BufferQueue::BufferItem *item,
     }
 
     // If item->mGraphicBuffer is not null, this buffer has not been acquired
-    // before, so any prior EglImage created is using a stale buffer. This
-    // replaces any old EglImage with a new one (using the new buffer).
+    // from this slot before, so any prior EglImage in the slot is using a
+    // stale buffer. This replaces it with the EglImage for the new buffer,
+    // which may have been cached if the buffer was in a slot before.
     if (item->mGraphicBuffer != NULL) {
         int slot = item->mBuf;
-        mEglSlots[slot].mEglImage = new EglImage(item->mGraphicBuffer);
+        const sp<EglImage>& current(mEglSlots[slot].mEglImage);
+        if (current != NULL && current->graphicBuffer()->getId() ==
+                item->mGraphicBuffer->getId()) {
+            mEglImageCacheHits++;
+        } else {
+            if (current != NULL) {
+                cacheEglImageLocked(current);
+            }
+            mEglSlots[slot].mEglImage =
+                    getEglImageLocked(item->mGraphicBuffer);
+        }
     }
 
     return NO_ERROR;
 }
 
+sp<GLConsumer::EglImage> GLConsumer::getEglImageLocked(
+        const sp<GraphicBuffer>& graphicBuffer) {
+    const uint64_t id = graphicBuffer->getId();
+    for (size_t i = 0; i < mCachedEglImages.size(); i++) {
+        if (mCachedEglImages[i]->graphicBuffer()->getId() == id) {
+            sp<EglImage> image(mCachedEglImages[i]);
+            mCachedEglImages.removeAt(i);
+            mEglImageCacheHits++;
+            return image;
+        }
+    }
+    mEglImageCacheMisses++;
+    return new EglImage(graphicBuffer);
+}
+
+void GLConsumer::cacheEglImageLocked(const sp<EglImage>& image) {
+    pruneEglImageCacheLocked();
+    if (image->graphicBuffer()->getStrongCount() == 1) {
+        return;
+    }
+    if (mCachedEglImages.size() >= MAX_CACHED_EGL_IMAGES) {
+        mCachedEglImages.removeAt(0);
+    }
+    mCachedEglImages.push_back(image);
+}
+
+void GLConsumer::pruneEglImageCacheLocked() {
+    // Drop the images of buffers that nothing else references anymore, since
+    // they can't come back
+    for (size_t i = mCachedEglImages.size(); i > 0; i--) {
+        if (mCachedEglImages[i - 1]->graphicBuffer()->getStrongCount() == 1) {
+            mCachedEglImages.removeAt(i - 1);
+        }
+    }
+}
+
 status_t GLConsumer::releaseBufferLocked(int buf,
         sp<GraphicBuffer> graphicBuffer,
         EGLDisplay display, EGLSyncKHR eglFence) {
@@ -389,7 +420,7 @@ status_t GLConsumer::updateAndReleaseLocked(const BufferQueue::BufferItem& item)
     // ConsumerBase.
     // We may have to do this even when item.mGraphicBuffer == NULL (which
     // means the buffer was previously acquired).
-    err = mEglSlots[buf].mEglImage->createIfNeeded(mEglDisplay, item.mCrop);
+    err = mEglSlots[buf].mEglImage->createIfNeeded(mEglDisplay);
     if (err != NO_ERROR) {
         ST_LOGW("updateAndRelease: unable to createImage on display=%p slot=%d",
                 mEglDisplay, buf);
@@ -461,8 +492,7 @@ status_t GLConsumer::bindTextureImageLocked() {
         return NO_INIT;
     }
 
-    status_t err = mCurrentTextureImage->createIfNeeded(mEglDisplay,
-                                                        mCurrentCrop);
+    status_t err = mCurrentTextureImage->createIfNeeded(mEglDisplay);
     if (err != NO_ERROR) {
         ST_LOGW("bindTextureImage: can't create image on display=%p slot=%d",
                 mEglDisplay, mCurrentTexture);
@@ -477,7 +507,6 @@ status_t GLConsumer::bindTextureImageLocked() {
     if ((error = glGetError()) != GL_NO_ERROR) {
         glBindTexture(mTexTarget, mTexName);
         status_t err = mCurrentTextureImage->createIfNeeded(mEglDisplay,
-                                                            mCurrentCrop,
                                                             true);
         if (err != NO_ERROR) {
             ST_LOGW("bindTextureImage: can't create image on display=%p slot=%d",
@@ -781,8 +810,10 @@ void GLConsumer::computeCurrentTransformMatrixLocked() {
         ST_LOGD("computeCurrentTransformMatrixLocked: mCurrentTextureImage is NULL");
     }
 
+    // The EGLImages don't depend on the crop, so that they can be reused when
+    // it changes. It is always applied here instead.
     float mtxBeforeFlipV[16];
-    if (!isEglImageCroppable(mCurrentCrop)) {
+    {
         Rect cropRect = mCurrentCrop;
         float tx = 0.0f, ty = 0.0f, sx = 1.0f, sy = 1.0f;
         float bufferWidth = buf->getWidth();
@@ -836,10 +867,6 @@ void GLConsumer::computeCurrentTransformMatrixLocked() {
         };
 
         mtxMul(mtxBeforeFlipV, crop, xform);
-    } else {
-        for (int i = 0; i < 16; i++) {
-            mtxBeforeFlipV[i] = xform[i];
-        }
     }
 
     // SurfaceFlinger expects the top of its window textures to be at a Y
@@ -988,7 +1015,14 @@ void GLConsumer::freeBufferLocked(int slotIndex) {
     if (slotIndex == mCurrentTexture) {
         mCurrentTexture = BufferQueue::INVALID_BUFFER_SLOT;
     }
-    mEglSlots[slotIndex].mEglImage.clear();
+    // Keep the image around in case the buffer comes back into a slot
+    if (mEglSlots[slotIndex].mEglImage != NULL) {
+        sp<EglImage> image(mEglSlots[slotIndex].mEglImage);
+        mEglSlots[slotIndex].mEglImage.clear();
+        ConsumerBase::freeBufferLocked(slotIndex);
+        cacheEglImageLocked(image);
+        return;
+    }
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
@@ -996,6 +1030,8 @@ void GLConsumer::abandonLocked() {
     ST_LOGV("abandonLocked");
     mCurrentTextureImage.clear();
     ConsumerBase::abandonLocked();
+    // freeing the slots above cached their images
+    mCachedEglImages.clear();
 }
 
 void GLConsumer::setName(const String8& name) {
@@ -1028,6 +1064,10 @@ void GLConsumer::dumpLocked(String8& result, const char* prefix) const
        prefix, mTexName, mCurrentTexture, prefix, mCurrentCrop.left,
        mCurrentCrop.top, mCurrentCrop.right, mCurrentCrop.bottom,
        mCurrentTransform);
+    result.appendFormat(
+       "%sEglImage cache: %zu cached, %" PRIu64 " hits, %" PRIu64 " misses\n",
+       prefix, mCachedEglImages.size(), mEglImageCacheHits,
+       mEglImageCacheMisses);
 
     ConsumerBase::dumpLocked(result, prefix);
 }
@@ -1069,13 +1109,11 @@ GLConsumer::EglImage::~EglImage() {
 }
 
 status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
-                                              const Rect& cropRect,
                                               bool forceCreation) {
     // If there's an image and it's no longer valid, destroy it.
     bool haveImage = mEglImage != EGL_NO_IMAGE_KHR;
     bool displayInvalid = mEglDisplay != eglDisplay;
-    bool cropInvalid = hasEglAndroidImageCrop() && mCropRect != cropRect;
-    if (haveImage && (displayInvalid || cropInvalid || forceCreation)) {
+    if (haveImage && (displayInvalid || forceCreation)) {
         if (!eglDestroyImageKHR(mEglDisplay, mEglImage)) {
            ALOGE("createIfNeeded: eglDestroyImageKHR failed");
         }
@@ -1086,14 +1124,12 @@ status_t GLConsumer::EglImage::createIfNeeded(EGLDisplay eglDisplay,
     // If there's no image, create one.
     if (mEglImage == EGL_NO_IMAGE_KHR) {
         mEglDisplay = eglDisplay;
-        mCropRect = cropRect;
-        mEglImage = createImage(mEglDisplay, mGraphicBuffer, mCropRect);
+        mEglImage = createImage(mEglDisplay, mGraphicBuffer);
     }
 
     // Fail if we can't create a valid image.
     if (mEglImage == EGL_NO_IMAGE_KHR) {
         mEglDisplay = EGL_NO_DISPLAY;
-        mCropRect.makeInvalid();
         const sp<GraphicBuffer>& buffer = mGraphicBuffer;
         ALOGE("Failed to create image. size=%ux%u st=%u usage=0x%x fmt=%d",
             buffer->getWidth(), buffer->getHeight(), buffer->getStride(),
@@ -1109,26 +1145,12 @@ void GLConsumer::EglImage::bindToTextureTarget(uint32_t texTarget) {
 }
 
 EGLImageKHR GLConsumer::EglImage::createImage(EGLDisplay dpy,
-        const sp<GraphicBuffer>& graphicBuffer, const Rect& crop) {
+        const sp<GraphicBuffer>& graphicBuffer) {
     EGLClientBuffer cbuf = (EGLClientBuffer)graphicBuffer->getNativeBuffer();
     EGLint attrs[] = {
         EGL_IMAGE_PRESERVED_KHR,        EGL_TRUE,
-        EGL_IMAGE_CROP_LEFT_ANDROID,    crop.left,
-        EGL_IMAGE_CROP_TOP_ANDROID,     crop.top,
-        EGL_IMAGE_CROP_RIGHT_ANDROID,   crop.right,
-        EGL_IMAGE_CROP_BOTTOM_ANDROID,  crop.bottom,
         EGL_NONE,
     };
-    if (!crop.isValid()) {
-        // No crop rect to set, so terminate the attrib array before the crop.
-        attrs[2] = EGL_NONE;
-    } else if (!isEglImageCroppable(crop)) {
-        // The crop rect is not at the origin, so we can't set the crop on the
-        // EGLImage because that's not allowed by the EGL_ANDROID_image_crop
-        // extension.  In the future we can add a layered extension that
-        // removes this restriction if there is hardware that can support it.
-        attrs[2] = EGL_NONE;
-    }
     EGLImageKHR image = eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
             EGL_NATIVE_BUFFER_ANDROID, cbuf, attrs);
     if (image == EGL_NO_IMAGE_KHR) {
@@ -15,6 +15,7 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 #include <sys/types.h>
 
 #include <utils/Errors.h>
@@ -204,6 +205,10 @@ enum {
     SET_TRANSFORM_HINT,
     GET_SIDEBAND_STREAM,
     DUMP,
+    SET_PREALLOCATION_LIMIT,
+    SET_FRAME_TIMELINE_ENABLED,
+    GET_FRAME_TIMELINE,
+    GET_FRONT_BUFFER_FENCE,
 };
 
 
@@ -405,6 +410,82 @@ public:
         return stream;
     }
 
+    virtual status_t setPreallocationLimit(size_t limit) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
+        data.writeInt64(static_cast<int64_t>(limit));
+        status_t result = remote()->transact(SET_PREALLOCATION_LIMIT, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        return reply.readInt32();
+    }
+
+    virtual status_t setFrameTimelineEnabled(bool enabled) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
+        data.writeInt32(enabled);
+        status_t result = remote()->transact(SET_FRAME_TIMELINE_ENABLED, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        return reply.readInt32();
+    }
+
+    virtual status_t getFrameTimeline(
+            Vector<BufferQueueTimeline::Record>* outRecords) {
+        if (outRecords == NULL) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
+        status_t result = remote()->transact(GET_FRAME_TIMELINE, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        size_t count = static_cast<size_t>(reply.readInt32());
+        if (count > BufferQueueTimeline::NUM_RECORDS) {
+            return BAD_VALUE;
+        }
+        const size_t size = count * sizeof(BufferQueueTimeline::Record);
+        const void* records = reply.readInplace(size);
+        if (records == NULL) {
+            return BAD_VALUE;
+        }
+        outRecords->resize(count);
+        memcpy(outRecords->editArray(), records, size);
+        return NO_ERROR;
+    }
+
+    virtual status_t getFrontBufferFence(sp<Fence>* outFence,
+            nsecs_t expectedPresent) {
+        if (outFence == NULL) {
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
+        data.writeInt64(expectedPresent);
+        status_t result = remote()->transact(GET_FRONT_BUFFER_FENCE, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        result = reply.readInt32();
+        if (result != NO_ERROR) {
+            return result;
+        }
+        sp<Fence> fence = new Fence();
+        result = reply.read(*fence);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        *outFence = fence;
+        return NO_ERROR;
+    }
+
     virtual void dump(String8& result, const char* prefix) const {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
@@ -546,6 +627,43 @@ status_t BnGraphicBufferConsumer::onTransact(
             reply->writeString8(result);
             return NO_ERROR;
         }
+        case SET_PREALLOCATION_LIMIT: {
+            CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
+            size_t limit = static_cast<size_t>(data.readInt64());
+            status_t result = setPreallocationLimit(limit);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
+        case SET_FRAME_TIMELINE_ENABLED: {
+            CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
+            bool enabled = data.readInt32();
+            status_t result = setFrameTimelineEnabled(enabled);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
+        case GET_FRAME_TIMELINE: {
+            CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
+            Vector<BufferQueueTimeline::Record> records;
+            status_t result = getFrameTimeline(&records);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeInt32(records.size());
+                reply->write(records.array(),
+                        records.size() * sizeof(BufferQueueTimeline::Record));
+            }
+            return NO_ERROR;
+        }
+        case GET_FRONT_BUFFER_FENCE: {
+            CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
+            sp<Fence> fence;
+            int64_t expectedPresent = data.readInt64();
+            status_t result = getFrontBufferFence(&fence, expectedPresent);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->write(*fence);
+            }
+            return NO_ERROR;
+        }
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
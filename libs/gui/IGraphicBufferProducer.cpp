@@ -46,6 +46,7 @@ enum {
     DISCONNECT,
     SET_SIDEBAND_STREAM,
     ALLOCATE_BUFFERS,
+    QUEUE_AND_DEQUEUE_BUFFER,
 };
 
 class BpGraphicBufferProducer : public BpInterface<IGraphicBufferProducer>
@@ -184,6 +185,36 @@ public:
         return result;
     }
 
+    virtual status_t queueAndDequeueBuffer(int buf,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage, status_t* outDequeueResult) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        data.writeInt32(buf);
+        data.write(input);
+        data.writeInt32(w);
+        data.writeInt32(h);
+        data.writeInt32(format);
+        data.writeInt32(usage);
+        status_t result = remote()->transact(QUEUE_AND_DEQUEUE_BUFFER, data,
+                &reply);
+        if (result != NO_ERROR) {
+            *outDequeueResult = result;
+            return result;
+        }
+        memcpy(output, reply.readInplace(sizeof(*output)), sizeof(*output));
+        *outSlot = reply.readInt32();
+        bool nonNull = reply.readInt32();
+        if (nonNull) {
+            *outFence = new Fence();
+            reply.read(**outFence);
+        }
+        *outDequeueResult = reply.readInt32();
+        result = reply.readInt32();
+        return result;
+    }
+
     virtual void cancelBuffer(int buf, const sp<Fence>& fence) {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
@@ -361,6 +392,31 @@ status_t BnGraphicBufferProducer::onTransact(
             reply->writeInt32(result);
             return NO_ERROR;
         } break;
+        case QUEUE_AND_DEQUEUE_BUFFER: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+            int buf = data.readInt32();
+            QueueBufferInput input(data);
+            uint32_t w      = data.readInt32();
+            uint32_t h      = data.readInt32();
+            uint32_t format = data.readInt32();
+            uint32_t usage  = data.readInt32();
+            QueueBufferOutput* const output =
+                    reinterpret_cast<QueueBufferOutput *>(
+                            reply->writeInplace(sizeof(QueueBufferOutput)));
+            int slot = -1;
+            sp<Fence> fence;
+            status_t dequeueResult = NO_ERROR;
+            status_t result = queueAndDequeueBuffer(buf, input, output, &slot,
+                    &fence, w, h, format, usage, &dequeueResult);
+            reply->writeInt32(slot);
+            reply->writeInt32(fence != NULL);
+            if (fence != NULL) {
+                reply->write(*fence);
+            }
+            reply->writeInt32(dequeueResult);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        } break;
         case CANCEL_BUFFER: {
             CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
             int buf = data.readInt32();
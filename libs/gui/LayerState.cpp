@@ -22,43 +22,98 @@
 
 namespace android {
 
+// Only the fields flagged in what are sent: most transactions, e.g. during
+// animations, change one or two properties of a handful of layers.
+
 status_t layer_state_t::write(Parcel& output) const
 {
     output.writeStrongBinder(surface);
     output.writeInt32(what);
-    output.writeFloat(x);
-    output.writeFloat(y);
-    output.writeInt32(z);
-    output.writeInt32(w);
-    output.writeInt32(h);
-    output.writeInt32(layerStack);
-    output.writeFloat(alpha);
-    output.writeInt32(flags);
-    output.writeInt32(mask);
-    *reinterpret_cast<layer_state_t::matrix22_t *>(
-            output.writeInplace(sizeof(layer_state_t::matrix22_t))) = matrix;
-    output.write(crop);
-    output.write(transparentRegion);
+    if (what & ePositionChanged) {
+        output.writeFloat(x);
+        output.writeFloat(y);
+    }
+    if (what & eLayerChanged) {
+        output.writeInt32(z);
+    }
+    if (what & eSizeChanged) {
+        output.writeInt32(w);
+        output.writeInt32(h);
+    }
+    if (what & eLayerStackChanged) {
+        output.writeInt32(layerStack);
+    }
+    if (what & eAlphaChanged) {
+        output.writeFloat(alpha);
+    }
+    if (what & (eVisibilityChanged | eOpacityChanged)) {
+        output.writeInt32(flags);
+        output.writeInt32(mask);
+    }
+    if (what & eMatrixChanged) {
+        *reinterpret_cast<layer_state_t::matrix22_t *>(
+                output.writeInplace(sizeof(layer_state_t::matrix22_t))) = matrix;
+    }
+    if (what & eCropChanged) {
+        output.write(crop);
+    }
+    if (what & eTransparentRegionChanged) {
+        transparentRegion.writeToParcel(&output);
+    }
     return NO_ERROR;
 }
 
 status_t layer_state_t::read(const Parcel& input)
 {
+    // the fields that weren't sent get their default values, so nothing is
+    // left over from a previous read. The exception is transparentRegion:
+    // resetting it would free its storage, which readFromParcel() reuses
+    // when the next state that sends it is read into this one.
     surface = input.readStrongBinder();
     what = input.readInt32();
-    x = input.readFloat();
-    y = input.readFloat();
-    z = input.readInt32();
-    w = input.readInt32();
-    h = input.readInt32();
-    layerStack = input.readInt32();
-    alpha = input.readFloat();
-    flags = input.readInt32();
-    mask = input.readInt32();
-    matrix = *reinterpret_cast<layer_state_t::matrix22_t const *>(
-            input.readInplace(sizeof(layer_state_t::matrix22_t)));
-    input.read(crop);
-    input.read(transparentRegion);
+    x = y = 0;
+    z = w = h = layerStack = 0;
+    alpha = 0;
+    flags = mask = reserved = 0;
+    matrix.dsdx = matrix.dtdy = 1.0f;
+    matrix.dsdy = matrix.dtdx = 0.0f;
+    crop.makeInvalid();
+    if (what & ePositionChanged) {
+        x = input.readFloat();
+        y = input.readFloat();
+    }
+    if (what & eLayerChanged) {
+        z = input.readInt32();
+    }
+    if (what & eSizeChanged) {
+        w = input.readInt32();
+        h = input.readInt32();
+    }
+    if (what & eLayerStackChanged) {
+        layerStack = input.readInt32();
+    }
+    if (what & eAlphaChanged) {
+        alpha = input.readFloat();
+    }
+    if (what & (eVisibilityChanged | eOpacityChanged)) {
+        flags = input.readInt32();
+        mask = input.readInt32();
+    }
+    if (what & eMatrixChanged) {
+        layer_state_t::matrix22_t const* m =
+                reinterpret_cast<layer_state_t::matrix22_t const *>(
+                        input.readInplace(sizeof(layer_state_t::matrix22_t)));
+        if (m == NULL) {
+            return BAD_VALUE;
+        }
+        matrix = *m;
+    }
+    if (what & eCropChanged) {
+        input.read(crop);
+    }
+    if (what & eTransparentRegionChanged) {
+        transparentRegion.readFromParcel(&input);
+    }
     return NO_ERROR;
 }
 
@@ -15,6 +15,7 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 
 #define LOG_TAG "StreamSplitter"
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
@@ -59,9 +60,9 @@ StreamSplitter::StreamSplitter(const sp<IGraphicBufferConsumer>& inputQueue)
 
 StreamSplitter::~StreamSplitter() {
     mInput->consumerDisconnect();
-    Vector<sp<IGraphicBufferProducer> >::iterator output = mOutputs.begin();
+    Vector<Output>::iterator output = mOutputs.begin();
     for (; output != mOutputs.end(); ++output) {
-        (*output)->disconnect(NATIVE_WINDOW_API_CPU);
+        output->producer->disconnect(NATIVE_WINDOW_API_CPU);
     }
 
     if (mBuffers.size() > 0) {
@@ -70,11 +71,16 @@ StreamSplitter::~StreamSplitter() {
 }
 
 status_t StreamSplitter::addOutput(
-        const sp<IGraphicBufferProducer>& outputQueue) {
+        const sp<IGraphicBufferProducer>& outputQueue, OutputPolicy policy) {
     if (outputQueue == NULL) {
         ALOGE("addOutput: outputQueue must not be NULL");
         return BAD_VALUE;
     }
+    if (policy != POLICY_BLOCK && policy != POLICY_SKIP_WHEN_BUSY &&
+            policy != POLICY_DROP_OLDEST) {
+        ALOGE("addOutput: invalid policy %d", policy);
+        return BAD_VALUE;
+    }
 
     Mutex::Autolock lock(mMutex);
 
@@ -88,11 +94,33 @@ status_t StreamSplitter::addOutput(
         return status;
     }
 
-    mOutputs.push_back(outputQueue);
+    Output output;
+    output.producer = outputQueue;
+    output.policy = policy;
+    mOutputs.push_back(output);
 
     return NO_ERROR;
 }
 
+status_t StreamSplitter::getOutputStats(
+        const sp<IGraphicBufferProducer>& outputQueue,
+        OutputStats* outStats) const {
+    if (outStats == NULL) {
+        ALOGE("getOutputStats: outStats must not be NULL");
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    Vector<Output>::const_iterator output = mOutputs.begin();
+    for (; output != mOutputs.end(); ++output) {
+        if (output->producer == outputQueue) {
+            *outStats = output->stats;
+            return NO_ERROR;
+        }
+    }
+    return BAD_VALUE;
+}
+
 void StreamSplitter::setName(const String8 &name) {
     Mutex::Autolock lock(mMutex);
     mInput->setConsumerName(name);
@@ -102,13 +130,14 @@ void StreamSplitter::onFrameAvailable() {
     ATRACE_CALL();
     Mutex::Autolock lock(mMutex);
 
-    // The current policy is that if any one consumer is consuming buffers too
-    // slowly, the splitter will stall the rest of the outputs by not acquiring
-    // any more buffers from the input. This will cause back pressure on the
-    // input queue, slowing down its producer.
+    // If any POLICY_BLOCK output is consuming buffers too slowly, the splitter
+    // will stall the rest of the outputs by not acquiring any more buffers
+    // from the input. This will cause back pressure on the input queue,
+    // slowing down its producer. Outputs with other policies never cause this
+    // since they drop buffers instead.
 
     // If there are too many outstanding buffers, we block until a buffer is
-    // released back to the input in onBufferReleased
+    // released by the blocking outputs in onBufferReleasedByOutput
     while (mOutstandingBuffers >= MAX_OUTSTANDING_BUFFERS) {
         mReleaseCondition.wait(mMutex);
 
@@ -120,7 +149,6 @@ void StreamSplitter::onFrameAvailable() {
             return;
         }
     }
-    ++mOutstandingBuffers;
 
     // Acquire and detach the buffer from the input
     IGraphicBufferConsumer::BufferItem bufferItem;
@@ -136,51 +164,78 @@ void StreamSplitter::onFrameAvailable() {
             "detaching buffer from input failed (%d)", status);
 
     // Initialize our reference count for this buffer
-    mBuffers.add(bufferItem.mGraphicBuffer->getId(),
-            new BufferTracker(bufferItem.mGraphicBuffer));
-
-    IGraphicBufferProducer::QueueBufferInput queueInput(
-            bufferItem.mTimestamp, bufferItem.mIsAutoTimestamp,
-            bufferItem.mCrop, bufferItem.mScalingMode,
-            bufferItem.mTransform, bufferItem.mIsDroppable,
-            bufferItem.mFence);
+    sp<BufferTracker> tracker(new BufferTracker(bufferItem.mGraphicBuffer));
+    mBuffers.add(bufferItem.mGraphicBuffer->getId(), tracker);
 
-    // Attach and queue the buffer to each of the outputs
-    Vector<sp<IGraphicBufferProducer> >::iterator output = mOutputs.begin();
+    // Attach and queue the buffer to each of the outputs that can take it
+    Vector<Output>::iterator output = mOutputs.begin();
     for (; output != mOutputs.end(); ++output) {
-        int slot;
-        status = (*output)->attachBuffer(&slot, bufferItem.mGraphicBuffer);
-        if (status == NO_INIT) {
-            // If we just discovered that this output has been abandoned, note
-            // that, increment the release count so that we still release this
-            // buffer eventually, and move on to the next output
-            onAbandonedLocked();
-            mBuffers.editValueFor(bufferItem.mGraphicBuffer->getId())->
-                    incrementReleaseCountLocked();
-            continue;
+        const bool busy = !output->queueTimes.isEmpty();
+        if (output->policy == POLICY_BLOCK || !busy) {
+            if (!queueToOutputLocked(*output, tracker, bufferItem)) {
+                releaseFromOutputLocked(tracker);
+            }
+        } else if (output->policy == POLICY_DROP_OLDEST) {
+            // Replace the buffer waiting for this output, if any
+            if (output->pendingTracker != NULL) {
+                ++output->stats.framesDropped;
+                sp<BufferTracker> dropped(output->pendingTracker);
+                output->pendingTracker = tracker;
+                releaseFromOutputLocked(dropped);
+            } else {
+                output->pendingTracker = tracker;
+            }
+            output->pendingItem = bufferItem;
         } else {
-            LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-                    "attaching buffer to output failed (%d)", status);
+            ++output->stats.framesDropped;
+            releaseFromOutputLocked(tracker);
         }
+    }
 
-        IGraphicBufferProducer::QueueBufferOutput queueOutput;
-        status = (*output)->queueBuffer(slot, queueInput, &queueOutput);
-        if (status == NO_INIT) {
-            // If we just discovered that this output has been abandoned, note
-            // that, increment the release count so that we still release this
-            // buffer eventually, and move on to the next output
-            onAbandonedLocked();
-            mBuffers.editValueFor(bufferItem.mGraphicBuffer->getId())->
-                    incrementReleaseCountLocked();
-            continue;
-        } else {
-            LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
-                    "queueing buffer to output failed (%d)", status);
-        }
+    if (tracker->getBlockingHolderCountLocked() > 0) {
+        ++mOutstandingBuffers;
+    }
+}
+
+bool StreamSplitter::queueToOutputLocked(Output& output,
+        const sp<BufferTracker>& tracker,
+        const IGraphicBufferConsumer::BufferItem& item) {
+    int slot;
+    status_t status = output.producer->attachBuffer(&slot, item.mGraphicBuffer);
+    if (status == NO_INIT) {
+        // If we just discovered that this output has been abandoned, note
+        // that and let the caller move on to the next output
+        onAbandonedLocked();
+        return false;
+    } else {
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                "attaching buffer to output failed (%d)", status);
+    }
+
+    IGraphicBufferProducer::QueueBufferInput queueInput(
+            item.mTimestamp, item.mIsAutoTimestamp, item.mCrop,
+            item.mScalingMode, item.mTransform, item.mIsDroppable,
+            item.mFence);
+    IGraphicBufferProducer::QueueBufferOutput queueOutput;
+    status = output.producer->queueBuffer(slot, queueInput, &queueOutput);
+    if (status == NO_INIT) {
+        onAbandonedLocked();
+        return false;
+    } else {
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                "queueing buffer to output failed (%d)", status);
+    }
 
-        ALOGV("queued buffer %#" PRIx64 " to output %p",
-                bufferItem.mGraphicBuffer->getId(), output->get());
+    output.queueTimes.add(item.mGraphicBuffer->getId(),
+            systemTime(SYSTEM_TIME_MONOTONIC));
+    ++output.stats.framesQueued;
+    if (output.policy == POLICY_BLOCK) {
+        tracker->incrementBlockingHolderCountLocked();
     }
+
+    ALOGV("queued buffer %#" PRIx64 " to output %p",
+            item.mGraphicBuffer->getId(), output.producer.get());
+    return true;
 }
 
 void StreamSplitter::onBufferReleasedByOutput(
@@ -204,15 +259,66 @@ void StreamSplitter::onBufferReleasedByOutput(
     ALOGV("detached buffer %#" PRIx64 " from output %p",
           buffer->getId(), from.get());
 
-    const sp<BufferTracker>& tracker = mBuffers.editValueFor(buffer->getId());
+    sp<BufferTracker> tracker(mBuffers.valueFor(buffer->getId()));
 
     // Merge the release fence of the incoming buffer so that the fence we send
     // back to the input includes all of the outputs' fences
     tracker->mergeFence(fence);
 
+    Output* output = NULL;
+    for (size_t i = 0; i < mOutputs.size(); ++i) {
+        if (mOutputs[i].producer == from) {
+            output = &mOutputs.editItemAt(i);
+            break;
+        }
+    }
+    LOG_ALWAYS_FATAL_IF(output == NULL, "buffer released by unknown output");
+
+    ssize_t index = output->queueTimes.indexOfKey(buffer->getId());
+    if (index >= 0) {
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) -
+                output->queueTimes.valueAt(index);
+        output->queueTimes.removeItemsAt(index);
+        ++output->stats.framesReleased;
+        output->stats.totalLatency += latency;
+        if (latency > output->stats.maxLatency) {
+            output->stats.maxLatency = latency;
+        }
+    }
+
+    // Once no blocking output holds the buffer anymore, allow a blocked
+    // onFrameAvailable call to proceed
+    bool wakeInput = false;
+    if (output->policy == POLICY_BLOCK &&
+            tracker->decrementBlockingHolderCountLocked() == 0) {
+        --mOutstandingBuffers;
+        wakeInput = true;
+    }
+
+    releaseFromOutputLocked(tracker);
+
+    // Send the newest buffer that arrived while this output was busy
+    if (output->pendingTracker != NULL) {
+        sp<BufferTracker> pending(output->pendingTracker);
+        output->pendingTracker.clear();
+        if (!queueToOutputLocked(*output, pending, output->pendingItem)) {
+            releaseFromOutputLocked(pending);
+        }
+        output->pendingItem = IGraphicBufferConsumer::BufferItem();
+    }
+
+    if (wakeInput) {
+        mReleaseCondition.signal();
+    }
+}
+
+void StreamSplitter::releaseFromOutputLocked(
+        const sp<BufferTracker>& tracker) {
+    const uint64_t id = tracker->getBuffer()->getId();
+
     // Check to see if this is the last outstanding reference to this buffer
     size_t releaseCount = tracker->incrementReleaseCountLocked();
-    ALOGV("buffer %#" PRIx64 " reference count %zu (of %zu)", buffer->getId(),
+    ALOGV("buffer %#" PRIx64 " reference count %zu (of %zu)", id,
             releaseCount, mOutputs.size());
     if (releaseCount < mOutputs.size()) {
         return;
@@ -221,13 +327,13 @@ void StreamSplitter::onBufferReleasedByOutput(
     // If we've been abandoned, we can't return the buffer to the input, so just
     // stop tracking it and move on
     if (mIsAbandoned) {
-        mBuffers.removeItem(buffer->getId());
+        mBuffers.removeItem(id);
         return;
     }
 
     // Attach and release the buffer back to the input
     int consumerSlot;
-    status = mInput->attachBuffer(&consumerSlot, tracker->getBuffer());
+    status_t status = mInput->attachBuffer(&consumerSlot, tracker->getBuffer());
     LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
             "attaching buffer to input failed (%d)", status);
 
@@ -236,15 +342,11 @@ void StreamSplitter::onBufferReleasedByOutput(
     LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
             "releasing buffer to input failed (%d)", status);
 
-    ALOGV("released buffer %#" PRIx64 " to input", buffer->getId());
+    ALOGV("released buffer %#" PRIx64 " to input", id);
 
     // We no longer need to track the buffer once it has been returned to the
     // input
-    mBuffers.removeItem(buffer->getId());
-
-    // Notify any waiting onFrameAvailable calls
-    --mOutstandingBuffers;
-    mReleaseCondition.signal();
+    mBuffers.removeItem(id);
 }
 
 void StreamSplitter::onAbandonedLocked() {
@@ -273,7 +375,8 @@ void StreamSplitter::OutputListener::binderDied(const wp<IBinder>& /* who */) {
 }
 
 StreamSplitter::BufferTracker::BufferTracker(const sp<GraphicBuffer>& buffer)
-      : mBuffer(buffer), mMergedFence(Fence::NO_FENCE), mReleaseCount(0) {}
+      : mBuffer(buffer), mMergedFence(Fence::NO_FENCE), mReleaseCount(0),
+        mBlockingHolderCount(0) {}
 
 StreamSplitter::BufferTracker::~BufferTracker() {}
 
@@ -281,4 +384,10 @@ void StreamSplitter::BufferTracker::mergeFence(const sp<Fence>& with) {
     mMergedFence = Fence::merge(String8("StreamSplitter"), mMergedFence, with);
 }
 
+StreamSplitter::Output::Output()
+      : producer(), policy(POLICY_BLOCK), queueTimes(), pendingTracker(),
+        pendingItem() {
+    memset(&stats, 0, sizeof(stats));
+}
+
 } // namespace android
@@ -18,6 +18,12 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 //#define LOG_NDEBUG 0
 
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <android/native_window.h>
 
 #include <binder/Parcel.h>
@@ -77,6 +83,10 @@ Surface::Surface(
     mConnectedToCpu = false;
     mProducerControlledByApp = controlledByApp;
     mSwapIntervalZero = false;
+    mDequeueRepeated = false;
+    mPrefetchedSlot = -1;
+    mPrefetchedResult = NO_ERROR;
+    mPostCount = 0;
 }
 
 Surface::~Surface() {
@@ -193,37 +203,51 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     ATRACE_CALL();
     ALOGV("Surface::dequeueBuffer");
 
-    int reqW;
-    int reqH;
-    bool swapIntervalZero;
-    uint32_t reqFormat;
-    uint32_t reqUsage;
+    DequeueParams params;
+    int buf = -1;
+    sp<Fence> fence;
+    status_t result = NO_ERROR;
+    bool prefetched = false;
 
     {
         Mutex::Autolock lock(mMutex);
 
-        reqW = mReqWidth ? mReqWidth : mUserWidth;
-        reqH = mReqHeight ? mReqHeight : mUserHeight;
-
-        swapIntervalZero = mSwapIntervalZero;
-        reqFormat = mReqFormat;
-        reqUsage = mReqUsage;
+        params = getDequeueParamsLocked();
+
+        // Hand out the buffer dequeued along with the last queueBuffer if it
+        // was dequeued with the same arguments
+        if (mPrefetchedSlot >= 0) {
+            if (mPrefetchedParams == params) {
+                buf = mPrefetchedSlot;
+                fence = mPrefetchedFence;
+                result = mPrefetchedResult;
+                prefetched = true;
+                mPrefetchedSlot = -1;
+                mPrefetchedFence.clear();
+            } else {
+                cancelPrefetchedBufferLocked();
+            }
+        }
     } // Drop the lock so that we can still touch the Surface while blocking in IGBP::dequeueBuffer
 
-    int buf = -1;
-    sp<Fence> fence;
-    status_t result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence, swapIntervalZero,
-            reqW, reqH, reqFormat, reqUsage);
+    if (!prefetched) {
+        result = mGraphicBufferProducer->dequeueBuffer(&buf, &fence,
+                params.async, params.width, params.height, params.format,
+                params.usage);
+    }
 
     if (result < 0) {
         ALOGV("dequeueBuffer: IGraphicBufferProducer::dequeueBuffer(%d, %d, %d, %d, %d)"
-             "failed: %d", swapIntervalZero, reqW, reqH, reqFormat, reqUsage,
-             result);
+             "failed: %d", params.async, params.width, params.height,
+             params.format, params.usage, result);
         return result;
     }
 
     Mutex::Autolock lock(mMutex);
 
+    mDequeueRepeated = (params == mLastDequeueParams);
+    mLastDequeueParams = params;
+
     sp<GraphicBuffer>& gbuf(mSlots[buf].buffer);
 
     // this should never happen
@@ -240,6 +264,7 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
             mGraphicBufferProducer->cancelBuffer(buf, fence);
             return result;
         }
+        mSlots[buf].postedFrame = 0;
     }
 
     if (fence->isValid()) {
@@ -258,6 +283,47 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     return OK;
 }
 
+Surface::DequeueParams Surface::getDequeueParamsLocked() const {
+    DequeueParams params;
+    params.width = mReqWidth ? mReqWidth : mUserWidth;
+    params.height = mReqHeight ? mReqHeight : mUserHeight;
+    params.format = mReqFormat;
+    params.usage = mReqUsage;
+    params.async = mSwapIntervalZero;
+    return params;
+}
+
+bool Surface::canPrefetchLocked() const {
+    if (!mDequeueRepeated || mPrefetchedSlot >= 0) {
+        return false;
+    }
+    const DequeueParams params(getDequeueParamsLocked());
+    // Buffers that take the default size could be resized by the consumer
+    // between the prefetch and the dequeue, so only prefetch those with an
+    // explicit size
+    return params.width != 0 && params.height != 0 &&
+            params == mLastDequeueParams;
+}
+
+void Surface::cancelPrefetchedBufferLocked() {
+    if (mPrefetchedSlot < 0) {
+        return;
+    }
+    // The flags returned with the prefetched buffer still apply to the
+    // buffers cached here even though it is never handed out
+    if (mPrefetchedResult & IGraphicBufferProducer::RELEASE_ALL_BUFFERS) {
+        freeAllBuffers();
+    }
+    if (mPrefetchedResult & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+        mSlots[mPrefetchedSlot].buffer = 0;
+        mSlots[mPrefetchedSlot].postedFrame = 0;
+    }
+    mGraphicBufferProducer->cancelBuffer(mPrefetchedSlot, mPrefetchedFence);
+    mPrefetchedSlot = -1;
+    mPrefetchedFence.clear();
+    mPrefetchedResult = NO_ERROR;
+}
+
 int Surface::cancelBuffer(android_native_buffer_t* buffer,
         int fenceFd) {
     ATRACE_CALL();
@@ -320,7 +386,26 @@ int Surface::queueBuffer(android_native_buffer_t* buffer, int fenceFd) {
     IGraphicBufferProducer::QueueBufferInput input(timestamp, isAutoTimestamp,
             crop, mScalingMode, mTransform ^ mStickyTransform, mSwapIntervalZero,
             fence, mStickyTransform);
-    status_t err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    status_t err;
+    if (canPrefetchLocked()) {
+        // The next dequeue is expected to use the same arguments as the last
+        // one, so get the buffer now and save a transaction
+        const DequeueParams params(mLastDequeueParams);
+        int slot = -1;
+        sp<Fence> nextFence;
+        status_t dequeueResult = NO_ERROR;
+        err = mGraphicBufferProducer->queueAndDequeueBuffer(i, input, &output,
+                &slot, &nextFence, params.width, params.height, params.format,
+                params.usage, &dequeueResult);
+        if (err == OK && dequeueResult >= 0) {
+            mPrefetchedSlot = slot;
+            mPrefetchedFence = nextFence;
+            mPrefetchedResult = dequeueResult;
+            mPrefetchedParams = params;
+        }
+    } else {
+        err = mGraphicBufferProducer->queueBuffer(i, input, &output);
+    }
     if (err != OK)  {
         ALOGE("queueBuffer: error queuing buffer to SurfaceTexture, %d", err);
     }
@@ -576,6 +661,8 @@ int Surface::disconnect(int api) {
     ATRACE_CALL();
     ALOGV("Surface::disconnect");
     Mutex::Autolock lock(mMutex);
+    cancelPrefetchedBufferLocked();
+    mDequeueRepeated = false;
     freeAllBuffers();
     int err = mGraphicBufferProducer->disconnect(api);
     if (!err) {
@@ -628,6 +715,10 @@ int Surface::setBufferCount(int bufferCount)
     ALOGV("Surface::setBufferCount");
     Mutex::Autolock lock(mMutex);
 
+    // The BufferQueue refuses to change the buffer count while a buffer is
+    // dequeued
+    cancelPrefetchedBufferLocked();
+
     status_t err = mGraphicBufferProducer->setBufferCount(bufferCount);
     ALOGE_IF(err, "IGraphicBufferProducer::setBufferCount(%d) returned %s",
             bufferCount, strerror(-err));
@@ -734,17 +825,58 @@ int Surface::setBuffersTimestamp(int64_t timestamp)
 void Surface::freeAllBuffers() {
     for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
         mSlots[i].buffer = 0;
+        mSlots[i].postedFrame = 0;
     }
 }
 
 // ----------------------------------------------------------------------
 // the lock/unlock APIs must be used from the same thread
 
+// Rects of the same band that are closer than this are copied as a single
+// span. The gap is either going to be redrawn or already identical in both
+// buffers, so copying it is harmless and cheaper than an extra memcpy per row.
+static const size_t MAX_COALESCED_GAP = 64;
+
+// Above this many bytes the copy-back bypasses the cache: the copied area
+// isn't touched again by the CPU before the buffer is composited.
+static const size_t STREAMING_COPY_THRESHOLD = 256 * 1024;
+
+#if defined(__SSE2__)
+static void streamRow(uint8_t* d, uint8_t const* s, size_t size)
+{
+    size_t head = (16 - (uintptr_t(d) & 15)) & 15;
+    if (head > size) {
+        head = size;
+    }
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    while (size >= 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 32));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), e);
+        d += 64;
+        s += 64;
+        size -= 64;
+    }
+    memcpy(d, s, size);
+}
+#endif
+
 static status_t copyBlt(
         const sp<GraphicBuffer>& dst,
         const sp<GraphicBuffer>& src,
         const Region& reg)
 {
+    ATRACE_CALL();
+
     // src and dst with, height and format must be identical. no verification
     // is done here.
     status_t err;
@@ -763,10 +895,23 @@ static status_t copyBlt(
         const size_t dbpr = dst->stride * bpp;
         const size_t sbpr = src->stride * bpp;
 
+#if defined(__SSE2__)
+        size_t total = 0;
+        for (Region::const_iterator it(head); it != tail; ++it) {
+            total += it->width() * it->height() * bpp;
+        }
+        const bool streaming = total >= STREAMING_COPY_THRESHOLD;
+#endif
+
         while (head != tail) {
-            const Rect& r(*head++);
+            Rect r(*head++);
             ssize_t h = r.height();
             if (h <= 0) continue;
+            while (head != tail && head->top == r.top &&
+                    head->bottom == r.bottom &&
+                    size_t(head->left - r.right) * bpp <= MAX_COALESCED_GAP) {
+                r.right = (head++)->right;
+            }
             size_t size = r.width() * bpp;
             uint8_t const * s = src_bits + (r.left + src->stride * r.top) * bpp;
             uint8_t       * d = dst_bits + (r.left + dst->stride * r.top) * bpp;
@@ -775,11 +920,24 @@ static status_t copyBlt(
                 h = 1;
             }
             do {
+#if defined(__SSE2__)
+                if (streaming) {
+                    streamRow(d, s, size);
+                } else {
+                    memcpy(d, s, size);
+                }
+#else
                 memcpy(d, s, size);
+#endif
                 d += dbpr;
                 s += sbpr;
             } while (--h > 0);
         }
+#if defined(__SSE2__)
+        if (streaming) {
+            _mm_sfence();
+        }
+#endif
     }
 
     if (src_bits)
@@ -791,8 +949,6 @@ static status_t copyBlt(
     return err;
 }
 
-// ----------------------------------------------------------------------------
-
 status_t Surface::lock(
         ANativeWindow_Buffer* outBuffer, ARect* inOutDirtyBounds)
 {
@@ -833,34 +989,39 @@ status_t Surface::lock(
                 backBuffer->height == frontBuffer->height &&
                 backBuffer->format == frontBuffer->format);
 
+        uint64_t postedFrame = 0;
+        { // scope for the lock
+            Mutex::Autolock lock(mMutex);
+            int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
+            if (backBufferSlot >= 0) {
+                postedFrame = mSlots[backBufferSlot].postedFrame;
+            }
+        }
+
         if (canCopyBack) {
-            // copy the area that is invalid and not repainted this round
-            const Region copyback(mDirtyRegion.subtract(newDirtyRegion));
+            // the back buffer holds the frame it was last posted with: copy
+            // the area the frames posted since then redrew, and that isn't
+            // repainted this round. Copy everything if that frame is unknown
+            // or too old to be in the damage history.
+            Region copyback;
+            if (postedFrame == 0 ||
+                    mPostCount - postedFrame > MAX_DAMAGE_HISTORY) {
+                copyback.set(bounds);
+            } else {
+                for (uint64_t f = postedFrame + 1; f <= mPostCount; f++) {
+                    copyback.orSelf(mDamageHistory[f % MAX_DAMAGE_HISTORY]);
+                }
+            }
+            copyback.subtractSelf(newDirtyRegion);
             if (!copyback.isEmpty())
                 copyBlt(backBuffer, frontBuffer, copyback);
         } else {
             // if we can't copy-back anything, modify the user's dirty
             // region to make sure they redraw the whole buffer
             newDirtyRegion.set(bounds);
-            mDirtyRegion.clear();
-            Mutex::Autolock lock(mMutex);
-            for (size_t i=0 ; i<NUM_BUFFER_SLOTS ; i++) {
-                mSlots[i].dirtyRegion.clear();
-            }
-        }
-
-
-        { // scope for the lock
-            Mutex::Autolock lock(mMutex);
-            int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
-            if (backBufferSlot >= 0) {
-                Region& dirtyRegion(mSlots[backBufferSlot].dirtyRegion);
-                mDirtyRegion.subtract(dirtyRegion);
-                dirtyRegion = newDirtyRegion;
-            }
         }
 
-        mDirtyRegion.orSelf(newDirtyRegion);
+        mLockedDirtyRegion = newDirtyRegion;
         if (inOutDirtyBounds) {
             *inOutDirtyBounds = newDirtyRegion.getBounds();
         }
@@ -902,6 +1063,16 @@ status_t Surface::unlockAndPost()
     ALOGE_IF(err, "queueBuffer (handle=%p) failed (%s)",
             mLockedBuffer->handle, strerror(-err));
 
+    { // scope for the lock
+        Mutex::Autolock lock(mMutex);
+        mPostCount++;
+        mDamageHistory[mPostCount % MAX_DAMAGE_HISTORY] = mLockedDirtyRegion;
+        int slot(getSlotFromBufferLocked(mLockedBuffer.get()));
+        if (slot >= 0) {
+            mSlots[slot].postedFrame = mPostCount;
+        }
+    }
+
     mPostedBuffer = mLockedBuffer;
     mLockedBuffer = 0;
     return err;
@@ -7,11 +7,14 @@ LOCAL_MODULE := libgui_test
 LOCAL_MODULE_TAGS := tests
 
 LOCAL_SRC_FILES := \
+    BitTube_test.cpp \
     BufferQueue_test.cpp \
     CpuConsumer_test.cpp \
+    DisplayEventReceiver_test.cpp \
     FillBuffer.cpp \
     GLTest.cpp \
     IGraphicBufferProducer_test.cpp \
+    LayerState_test.cpp \
     MultiTextureConsumer_test.cpp \
     SRGB_test.cpp \
     StreamSplitter_test.cpp \
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BitTube_test"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <binder/Parcel.h>
+
+#include <gui/BitTube.h>
+
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class BitTubeTest : public ::testing::Test {
+
+protected:
+    BitTubeTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~BitTubeTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    // Creates a pair of BitTubes the way EventThread and its clients do:
+    // the receiving end is sent through a Parcel.
+    void createTubes(BitTube::Transport transport) {
+        mSender = new BitTube(transport);
+        ASSERT_EQ(NO_ERROR, mSender->initCheck());
+        Parcel parcel;
+        ASSERT_EQ(NO_ERROR, mSender->writeToParcel(&parcel));
+        parcel.setDataPosition(0);
+        mReceiver = new BitTube(parcel);
+        ASSERT_EQ(NO_ERROR, mReceiver->initCheck());
+        ASSERT_EQ(transport, mReceiver->getTransport());
+    }
+
+    static bool isReadable(int fd) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+    }
+
+    sp<BitTube> mSender;
+    sp<BitTube> mReceiver;
+};
+
+struct TestEvent {
+    nsecs_t timestamp;
+    uint32_t id;
+    uint32_t padding;
+};
+
+static void testSendAndReceive(const sp<BitTube>& sender,
+        const sp<BitTube>& receiver) {
+    TestEvent events[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+        events[i].timestamp = nsecs_t(i) * 1000;
+        events[i].id = i;
+    }
+    ASSERT_EQ(3, BitTube::sendObjects(sender, events, 3));
+    ASSERT_EQ(1, BitTube::sendObjects(sender, events, 1));
+
+    TestEvent received[4];
+    ASSERT_EQ(3, BitTube::recvObjects(receiver, received, 4));
+    for (uint32_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(i, received[i].id);
+        EXPECT_EQ(nsecs_t(i) * 1000, received[i].timestamp);
+    }
+    ASSERT_EQ(1, BitTube::recvObjects(receiver, received, 4));
+    EXPECT_EQ(0U, received[0].id);
+
+    // Nothing left to read
+    EXPECT_EQ(0, BitTube::recvObjects(receiver, received, 4));
+}
+
+TEST_F(BitTubeTest, SocketSendAndReceive) {
+    ASSERT_NO_FATAL_FAILURE(createTubes(BitTube::TRANSPORT_SOCKET));
+    ASSERT_NO_FATAL_FAILURE(testSendAndReceive(mSender, mReceiver));
+}
+
+TEST_F(BitTubeTest, SharedMemorySendAndReceive) {
+    ASSERT_NO_FATAL_FAILURE(createTubes(BitTube::TRANSPORT_SHARED_MEMORY));
+    ASSERT_NO_FATAL_FAILURE(testSendAndReceive(mSender, mReceiver));
+    EXPECT_EQ(-1, mReceiver->getSendFd());
+}
+
+TEST_F(BitTubeTest, SharedMemorySignalsOnlyWhenDataIsAvailable) {
+    ASSERT_NO_FATAL_FAILURE(createTubes(BitTube::TRANSPORT_SHARED_MEMORY));
+    const int fd = mReceiver->getFd();
+    EXPECT_FALSE(isReadable(fd));
+
+    TestEvent event = { 0, 0, 0 };
+    ASSERT_EQ(1, BitTube::sendObjects(mSender, &event, 1));
+    ASSERT_EQ(1, BitTube::sendObjects(mSender, &event, 1));
+    EXPECT_TRUE(isReadable(fd));
+
+    // The second message is still pending, so the fd stays readable
+    ASSERT_EQ(1, BitTube::recvObjects(mReceiver, &event, 1));
+    EXPECT_TRUE(isReadable(fd));
+
+    ASSERT_EQ(1, BitTube::recvObjects(mReceiver, &event, 1));
+    EXPECT_FALSE(isReadable(fd));
+}
+
+TEST_F(BitTubeTest, SharedMemoryFullRingReturnsEAGAIN) {
+    ASSERT_NO_FATAL_FAILURE(createTubes(BitTube::TRANSPORT_SHARED_MEMORY));
+
+    TestEvent event = { 0, 0, 0 };
+    uint32_t sent = 0;
+    ssize_t result;
+    while ((result = BitTube::sendObjects(mSender, &event, 1)) == 1) {
+        event.id = ++sent;
+        ASSERT_LT(sent, 4096U);
+    }
+    EXPECT_EQ(-EAGAIN, result);
+    EXPECT_GT(sent, 0U);
+
+    // Freeing up room lets the sender continue, and nothing was lost
+    TestEvent received;
+    ASSERT_EQ(1, BitTube::recvObjects(mReceiver, &received, 1));
+    EXPECT_EQ(0U, received.id);
+    ASSERT_EQ(1, BitTube::sendObjects(mSender, &event, 1));
+    for (uint32_t i = 1; i <= sent; ++i) {
+        ASSERT_EQ(1, BitTube::recvObjects(mReceiver, &received, 1));
+        EXPECT_EQ(i, received.id);
+    }
+    EXPECT_EQ(0, BitTube::recvObjects(mReceiver, &received, 1));
+}
+
+TEST_F(BitTubeTest, SharedMemoryRejectsCorruptedRingHeader) {
+    ASSERT_NO_FATAL_FAILURE(createTubes(BitTube::TRANSPORT_SHARED_MEMORY));
+
+    // Map the ring the way the other process would
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, mSender->writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    ASSERT_EQ(int32_t(BitTube::TRANSPORT_SHARED_MEMORY), parcel.readInt32());
+    const int ringFd = parcel.readFileDescriptor();
+    parcel.readFileDescriptor();
+    const size_t size = size_t(parcel.readInt32());
+    void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ringFd, 0);
+    ASSERT_NE(MAP_FAILED, ring);
+
+    // writePos, readPos and capacity each start a 64-byte line
+    volatile int32_t* writePos = reinterpret_cast<int32_t*>(ring);
+    volatile uint32_t* capacity =
+            reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(ring) + 128);
+    const uint32_t realCapacity = *capacity;
+
+    TestEvent event = { 0, 0, 0 };
+    *capacity = 0x80000000;
+    EXPECT_EQ(-EBADMSG, BitTube::sendObjects(mSender, &event, 1));
+    *capacity = realCapacity;
+    ASSERT_EQ(1, BitTube::sendObjects(mSender, &event, 1));
+
+    *capacity = 0x80000000;
+    EXPECT_EQ(-EBADMSG, BitTube::recvObjects(mReceiver, &event, 1));
+    *capacity = realCapacity;
+
+    // A write position far past the ring is rejected without reading it
+    *writePos += 0x10000000;
+    EXPECT_EQ(-EBADMSG, BitTube::recvObjects(mReceiver, &event, 1));
+
+    munmap(ring, size);
+}
+
+// Receives events the way a Looper-based client does: it waits for the fd to
+// become readable, then drains the tube.
+class ReceiverThread : public Thread {
+public:
+    ReceiverThread(const sp<BitTube>& tube, uint32_t eventCount)
+        : mTube(tube), mEventsLeft(eventCount), mWakeups(0),
+          mTotalLatency(0), mMaxLatency(0), mErrors(0) {}
+
+    uint32_t getWakeups() const { return mWakeups; }
+    nsecs_t getTotalLatency() const { return mTotalLatency; }
+    nsecs_t getMaxLatency() const { return mMaxLatency; }
+    int getErrors() const { return mErrors; }
+
+private:
+    virtual bool threadLoop() {
+        struct pollfd pfd = { mTube->getFd(), POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) != 1) {
+            ++mErrors;
+            return false;
+        }
+        ++mWakeups;
+
+        TestEvent events[16];
+        ssize_t n;
+        while ((n = BitTube::recvObjects(mTube, events, 16)) > 0) {
+            const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            for (ssize_t i = 0; i < n; ++i) {
+                const nsecs_t latency = now - events[i].timestamp;
+                mTotalLatency += latency;
+                mMaxLatency = latency > mMaxLatency ? latency : mMaxLatency;
+            }
+            mEventsLeft -= n;
+        }
+        if (n < 0) {
+            ++mErrors;
+        }
+        return mEventsLeft > 0 && mErrors == 0;
+    }
+
+    sp<BitTube> mTube;
+    uint32_t mEventsLeft;
+    uint32_t mWakeups;
+    nsecs_t mTotalLatency;
+    nsecs_t mMaxLatency;
+    int mErrors;
+};
+
+static void runBenchmark(const char* name, const sp<BitTube>& sender,
+        const sp<BitTube>& receiver, uint32_t eventCount, nsecs_t interval) {
+    sp<ReceiverThread> receiverThread(new ReceiverThread(receiver,
+            eventCount));
+    ASSERT_EQ(OK, receiverThread->run("BitTubeReceiver"));
+
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (uint32_t i = 0; i < eventCount; ++i) {
+        if (interval) {
+            const nsecs_t target = start + nsecs_t(i) * interval;
+            while (systemTime(SYSTEM_TIME_MONOTONIC) < target) {
+                sched_yield();
+            }
+        }
+        TestEvent event = { systemTime(SYSTEM_TIME_MONOTONIC), i, 0 };
+        ssize_t result;
+        while ((result = BitTube::sendObjects(sender, &event, 1)) == -EAGAIN) {
+            sched_yield();
+        }
+        ASSERT_EQ(1, result);
+    }
+    receiverThread->join();
+    const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    EXPECT_EQ(0, receiverThread->getErrors());
+    printf("[          ] %s: %u events in %.1f ms (%.0f events/s), "
+            "%u wakeups, latency avg=%.2f us max=%.2f us\n",
+            name, eventCount, elapsed / 1000000.0,
+            eventCount * 1000000000.0 / elapsed,
+            receiverThread->getWakeups(),
+            receiverThread->getTotalLatency() / 1000.0 / eventCount,
+            receiverThread->getMaxLatency() / 1000.0);
+}
+
+TEST_F(BitTubeTest, TransportBenchmark) {
+    const uint32_t EVENT_COUNT = 100000;
+    const uint32_t PACED_EVENT_COUNT = 2000;
+    const nsecs_t PACED_INTERVAL = us2ns(500);
+
+    const BitTube::Transport transports[] = {
+        BitTube::TRANSPORT_SOCKET,
+        BitTube::TRANSPORT_SHARED_MEMORY,
+    };
+    const char* names[] = { "socket", "shared memory" };
+    for (size_t t = 0; t < 2; ++t) {
+        // Throughput: the sender floods the tube
+        ASSERT_NO_FATAL_FAILURE(createTubes(transports[t]));
+        ASSERT_NO_FATAL_FAILURE(runBenchmark(names[t], mSender, mReceiver,
+                EVENT_COUNT, 0));
+
+        // Wakeup latency: the receiver is idle when each event is sent
+        ASSERT_NO_FATAL_FAILURE(createTubes(transports[t]));
+        ASSERT_NO_FATAL_FAILURE(runBenchmark(names[t], mSender, mReceiver,
+                PACED_EVENT_COUNT, PACED_INTERVAL));
+    }
+}
+
+} // namespace android
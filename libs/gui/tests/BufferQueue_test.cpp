@@ -17,6 +17,10 @@
 #define LOG_TAG "BufferQueue_test"
 //#define LOG_NDEBUG 0
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <gui/BufferQueue.h>
 #include <gui/IProducerListener.h>
 
@@ -27,6 +31,7 @@
 #include <binder/ProcessState.h>
 
 #include <utils/String8.h>
+#include <utils/Timers.h>
 #include <utils/threads.h>
 
 #include <gtest/gtest.h>
@@ -62,6 +67,47 @@ protected:
         BufferQueue::createBufferQueue(&mProducer, &mConsumer);
     }
 
+    // Runs one dequeue/queue/acquire/release cycle and returns the flags
+    // returned by dequeueBuffer in outFlags.
+    void cycleBuffer(uint32_t w, uint32_t h, int* outFlags) {
+        int slot;
+        sp<Fence> fence;
+        sp<GraphicBuffer> buffer;
+        int flags = mProducer->dequeueBuffer(&slot, &fence, false, w, h, 0,
+                GRALLOC_USAGE_SW_WRITE_OFTEN);
+        ASSERT_GE(flags, 0);
+        if (flags & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+            ASSERT_EQ(w, buffer->getWidth());
+            ASSERT_EQ(h, buffer->getHeight());
+        }
+
+        IGraphicBufferProducer::QueueBufferOutput output;
+        IGraphicBufferProducer::QueueBufferInput input(0, false,
+                Rect(0, 0, 1, 1), NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false,
+                Fence::NO_FENCE);
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+
+        IGraphicBufferConsumer::BufferItem item;
+        ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+        ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+        *outFlags = flags;
+    }
+
+    // Polls the consumer dump for up to a second until it contains str.
+    bool waitForDump(const char* str) {
+        for (int i = 0; i < 100; ++i) {
+            String8 result;
+            mConsumer->dump(result, "");
+            if (strstr(result.string(), str) != NULL) {
+                return true;
+            }
+            usleep(10000);
+        }
+        return false;
+    }
+
     sp<IGraphicBufferProducer> mProducer;
     sp<IGraphicBufferConsumer> mConsumer;
 };
@@ -358,4 +404,239 @@ TEST_F(BufferQueueTest, MoveFromConsumerToProducer) {
     ASSERT_EQ(OK, item.mGraphicBuffer->unlock());
 }
 
+TEST_F(BufferQueueTest, GetFrontBufferFence) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    sp<Fence> frontFence;
+    ASSERT_EQ(BAD_VALUE, mConsumer->getFrontBufferFence(NULL, 0));
+    ASSERT_EQ(IGraphicBufferConsumer::NO_BUFFER_AVAILABLE,
+            mConsumer->getFrontBufferFence(&frontFence, 0));
+
+    int slot;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+    ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+            mProducer->dequeueBuffer(&slot, &fence, false, 0, 0, 0,
+                    GRALLOC_USAGE_SW_WRITE_OFTEN));
+    ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+    IGraphicBufferProducer::QueueBufferInput input(0, false, Rect(0, 0, 1, 1),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false, Fence::NO_FENCE);
+    ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+
+    // The front buffer's fence is returned without acquiring the buffer
+    ASSERT_EQ(OK, mConsumer->getFrontBufferFence(&frontFence, 0));
+    ASSERT_TRUE(frontFence != NULL);
+    EXPECT_FALSE(frontFence->isValid());
+
+    IGraphicBufferConsumer::BufferItem item;
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, static_cast<nsecs_t>(0)));
+    EXPECT_EQ(slot, item.mBuf);
+    ASSERT_EQ(IGraphicBufferConsumer::NO_BUFFER_AVAILABLE,
+            mConsumer->getFrontBufferFence(&frontFence, 0));
+}
+
+TEST_F(BufferQueueTest, GetFrontBufferFenceSkipsDroppedBuffers) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    // The first buffer has a fence, the second one doesn't; the fence fd
+    // only needs to be distinguishable from no fence
+    const nsecs_t timestamps[2] = { 1000000000, 1500000000 };
+    const sp<Fence> fences[2] = { new Fence(open("/dev/null", O_RDONLY)),
+            Fence::NO_FENCE };
+    ASSERT_TRUE(fences[0]->isValid());
+    for (int i = 0; i < 2; i++) {
+        int slot;
+        sp<Fence> fence;
+        sp<GraphicBuffer> buffer;
+        ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+                mProducer->dequeueBuffer(&slot, &fence, false, 0, 0, 0,
+                        GRALLOC_USAGE_SW_WRITE_OFTEN));
+        ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        IGraphicBufferProducer::QueueBufferInput input(timestamps[i], false,
+                Rect(0, 0, 1, 1), NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false,
+                fences[i]);
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+    }
+
+    // Without an expected present time nothing is dropped
+    sp<Fence> frontFence;
+    ASSERT_EQ(OK, mConsumer->getFrontBufferFence(&frontFence, 0));
+    EXPECT_TRUE(frontFence->isValid());
+
+    // Once the second buffer is due, acquireBuffer drops the first one
+    const nsecs_t expectedPresent = 2000000000;
+    ASSERT_EQ(OK, mConsumer->getFrontBufferFence(&frontFence,
+            expectedPresent));
+    EXPECT_FALSE(frontFence->isValid());
+
+    IGraphicBufferConsumer::BufferItem item;
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, expectedPresent));
+    EXPECT_EQ(timestamps[1], item.mTimestamp);
+}
+
+TEST_F(BufferQueueTest, PreallocatesPredictedBuffers) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    ASSERT_EQ(OK, mConsumer->setDefaultMaxBufferCount(3));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    // Fill all three slots with 1x1 buffers
+    int flags;
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_NO_FATAL_FAILURE(cycleBuffer(1, 1, &flags));
+    }
+    ASSERT_EQ(OK, mConsumer->setPreallocationLimit(1024 * 1024));
+
+    // Two dequeues at a new size make the prediction confident, which lets
+    // the background thread replace the remaining stale buffer
+    ASSERT_NO_FATAL_FAILURE(cycleBuffer(16, 16, &flags));
+    ASSERT_NO_FATAL_FAILURE(cycleBuffer(16, 16, &flags));
+    ASSERT_TRUE(waitForDump("preallocated=1,"));
+
+    // The next dequeue gets the preallocated buffer. The producer still has
+    // to request it, but no allocation happens on the dequeue path.
+    ASSERT_NO_FATAL_FAILURE(cycleBuffer(16, 16, &flags));
+    ASSERT_TRUE(flags & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION);
+    ASSERT_TRUE(waitForDump("dequeue allocations avoided=1,"));
+}
+
+TEST_F(BufferQueueTest, FrameTimelineRecordsLifecycle) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    ASSERT_EQ(OK, mConsumer->setFrameTimelineEnabled(true));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    const int FRAME_COUNT = 3;
+    int flags;
+    for (int i = 0; i < FRAME_COUNT; ++i) {
+        ASSERT_NO_FATAL_FAILURE(cycleBuffer(1, 1, &flags));
+    }
+
+    Vector<BufferQueueTimeline::Record> records;
+    ASSERT_EQ(OK, mConsumer->getFrameTimeline(&records));
+    ASSERT_EQ(size_t(FRAME_COUNT), records.size());
+    for (int i = 0; i < FRAME_COUNT; ++i) {
+        const BufferQueueTimeline::Record& record(records[i]);
+        EXPECT_EQ(uint64_t(i + 1), record.frameNumber);
+        EXPECT_EQ(0u, record.dropped);
+        EXPECT_LT(0, record.dequeueTime);
+        EXPECT_LE(record.dequeueTime, record.queueTime);
+        EXPECT_LE(record.queueTime, record.acquireTime);
+        EXPECT_LE(record.acquireTime, record.releaseTime);
+    }
+
+    ASSERT_TRUE(waitForDump("-Timeline frames=3 dropped=0"));
+}
+
+// Consumer listener that lets a thread block until a frame is available
+struct FrameWaitingConsumer : public BnConsumerListener {
+    FrameWaitingConsumer() : mPendingFrames(0) {}
+
+    virtual void onFrameAvailable() {
+        Mutex::Autolock lock(mMutex);
+        ++mPendingFrames;
+        mCondition.signal();
+    }
+    virtual void onBuffersReleased() {}
+    virtual void onSidebandStreamChanged() {}
+
+    void waitForFrame() {
+        Mutex::Autolock lock(mMutex);
+        while (mPendingFrames == 0) {
+            mCondition.wait(mMutex);
+        }
+        --mPendingFrames;
+    }
+
+    Mutex mMutex;
+    Condition mCondition;
+    int mPendingFrames;
+};
+
+// Acquires and immediately releases frameCount buffers
+class AcquireReleaseThread : public Thread {
+public:
+    AcquireReleaseThread(const sp<IGraphicBufferConsumer>& consumer,
+            const sp<FrameWaitingConsumer>& listener, int frameCount)
+        : mConsumer(consumer), mListener(listener),
+          mFramesLeft(frameCount), mErrors(0) {}
+
+    int getErrors() const { return mErrors; }
+
+private:
+    virtual bool threadLoop() {
+        mListener->waitForFrame();
+        IGraphicBufferConsumer::BufferItem item;
+        if (mConsumer->acquireBuffer(&item, 0) != OK ||
+                mConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+                        EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                        Fence::NO_FENCE) != OK) {
+            ++mErrors;
+        }
+        return --mFramesLeft > 0;
+    }
+
+    sp<IGraphicBufferConsumer> mConsumer;
+    sp<FrameWaitingConsumer> mListener;
+    int mFramesLeft;
+    int mErrors;
+};
+
+TEST_F(BufferQueueTest, ProducerConsumerThroughputBenchmark) {
+    const int FRAME_COUNT = 20000;
+
+    createBufferQueue();
+    sp<FrameWaitingConsumer> listener(new FrameWaitingConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(listener, false));
+    ASSERT_EQ(OK, mConsumer->setDefaultMaxBufferCount(3));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    sp<AcquireReleaseThread> consumerThread(
+            new AcquireReleaseThread(mConsumer, listener, FRAME_COUNT));
+    ASSERT_EQ(OK, consumerThread->run("BQThroughputConsumer"));
+
+    IGraphicBufferProducer::QueueBufferInput input(0, false,
+            Rect(0, 0, 1, 1), NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false,
+            Fence::NO_FENCE);
+    const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < FRAME_COUNT; ++i) {
+        int slot;
+        sp<Fence> fence;
+        int flags = mProducer->dequeueBuffer(&slot, &fence, false, 0, 0, 0,
+                GRALLOC_USAGE_SW_WRITE_OFTEN);
+        ASSERT_GE(flags, 0);
+        if (flags & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        }
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+    }
+    consumerThread->join();
+    const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    EXPECT_EQ(0, consumerThread->getErrors());
+    printf("[          ] %d frames in %.1f ms (%.0f frames/s, %.2f us/frame)\n",
+            FRAME_COUNT, elapsed / 1000000.0,
+            FRAME_COUNT * 1000000000.0 / elapsed,
+            elapsed / 1000.0 / FRAME_COUNT);
+}
+
 } // namespace android
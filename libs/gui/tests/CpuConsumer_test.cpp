@@ -614,6 +614,56 @@ TEST_P(CpuConsumerTest, FromCpuManyInQueue) {
     }
 }
 
+// Locks queued frames in order through the prefetch pipeline.
+TEST_P(CpuConsumerTest, FromCpuManyInQueuePrefetched) {
+    status_t err;
+    CpuConsumerTestParams params = GetParam();
+
+    const int numInQueue = 5;
+    // Set up
+
+    ASSERT_NO_FATAL_FAILURE(configureANW(mANW, params, numInQueue));
+    ASSERT_EQ(OK, mCC->setPrefetchDepth(params.maxLockedBuffers));
+    ASSERT_EQ(BAD_VALUE, mCC->setPrefetchDepth(params.maxLockedBuffers + 1));
+
+    // Produce
+
+    const int64_t time[numInQueue] = { 1L, 2L, 3L, 4L, 5L};
+    uint32_t stride[numInQueue];
+
+    for (int i = 0; i < numInQueue; i++) {
+        ALOGV("Producing frame %d", i);
+        ASSERT_NO_FATAL_FAILURE(produceOneFrame(mANW, params, time[i],
+                        &stride[i]));
+    }
+
+    // Consume, in order, whether the buffers were prefetched or not
+
+    for (int i = 0; i < numInQueue; i++) {
+        ALOGV("Consuming frame %d", i);
+        CpuConsumer::LockedBuffer b;
+        err = mCC->lockNextBuffer(&b);
+        ASSERT_NO_ERROR(err, "getNextBuffer error: ");
+
+        ASSERT_TRUE(b.data != NULL);
+        EXPECT_EQ(params.width,  b.width);
+        EXPECT_EQ(params.height, b.height);
+        EXPECT_EQ(params.format, b.format);
+        EXPECT_EQ(stride[i], b.stride);
+        EXPECT_EQ(time[i], b.timestamp);
+
+        checkAnyBuffer(b, GetParam().format);
+
+        mCC->unlockBuffer(b);
+    }
+
+    CpuConsumer::LockStats stats;
+    mCC->getLockStats(&stats);
+    EXPECT_EQ(uint64_t(numInQueue), stats.buffersLocked);
+    EXPECT_GE(stats.buffersLocked, stats.buffersPrefetched);
+    EXPECT_LE(stats.totalLockTime / numInQueue, stats.maxLockTime);
+}
+
 // This test is disabled because the HAL_PIXEL_FORMAT_RAW_SENSOR format is not
 // supported on all devices.
 TEST_P(CpuConsumerTest, FromCpuLockMax) {
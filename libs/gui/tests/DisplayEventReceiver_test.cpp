@@ -0,0 +1,113 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DisplayEventReceiver_test"
+//#define LOG_NDEBUG 0
+
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gui/DisplayEventReceiver.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class DisplayEventReceiverTest : public ::testing::Test {
+
+protected:
+    DisplayEventReceiverTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~DisplayEventReceiverTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+};
+
+static DisplayEventReceiver::Event makeVsync(uint32_t id, uint32_t count) {
+    DisplayEventReceiver::Event event;
+    memset(&event, 0, sizeof(event));
+    event.header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+    event.header.id = id;
+    event.header.timestamp = count * 16666667LL;
+    event.vsync.count = count;
+    return event;
+}
+
+TEST_F(DisplayEventReceiverTest, CoalescingKeepsLatestVsyncPerDisplay) {
+    DisplayEventReceiver::Event events[6];
+    events[0] = makeVsync(0, 1);
+    events[1] = makeVsync(1, 1);
+    events[2] = makeVsync(0, 2);
+    memset(&events[3], 0, sizeof(events[3]));
+    events[3].header.type = DisplayEventReceiver::DISPLAY_EVENT_HOTPLUG;
+    events[3].hotplug.connected = true;
+    events[4] = makeVsync(0, 3);
+    events[5] = makeVsync(1, 2);
+
+    ASSERT_EQ(3U, DisplayEventReceiver::coalesceVsyncEvents(events, 6));
+    EXPECT_EQ(uint32_t(DisplayEventReceiver::DISPLAY_EVENT_HOTPLUG),
+            events[0].header.type);
+    EXPECT_EQ(0U, events[1].header.id);
+    EXPECT_EQ(3U, events[1].vsync.count);
+    EXPECT_EQ(2U, events[1].vsync.missed);
+    EXPECT_EQ(1U, events[2].header.id);
+    EXPECT_EQ(2U, events[2].vsync.count);
+    EXPECT_EQ(1U, events[2].vsync.missed);
+}
+
+TEST_F(DisplayEventReceiverTest, CoalescingAccumulatesMissedCounts) {
+    DisplayEventReceiver::Event events[2];
+    events[0] = makeVsync(0, 4);
+    events[0].vsync.missed = 3;
+    events[1] = makeVsync(0, 5);
+
+    ASSERT_EQ(1U, DisplayEventReceiver::coalesceVsyncEvents(events, 2));
+    EXPECT_EQ(5U, events[0].vsync.count);
+    EXPECT_EQ(4U, events[0].vsync.missed);
+}
+
+TEST_F(DisplayEventReceiverTest, SlowReceiverGetsLatestVsyncWithPrediction) {
+    DisplayEventReceiver receiver;
+    ASSERT_EQ(NO_ERROR, receiver.initCheck());
+    receiver.setVsyncCoalescing(true);
+    ASSERT_EQ(NO_ERROR, receiver.setVsyncRate(1));
+
+    // Fall behind by several refreshes
+    usleep(100000);
+
+    DisplayEventReceiver::Event events[8];
+    ssize_t n = receiver.getEvents(events, 8);
+    ASSERT_EQ(1, n);
+    ASSERT_EQ(uint32_t(DisplayEventReceiver::DISPLAY_EVENT_VSYNC),
+            events[0].header.type);
+    EXPECT_GT(events[0].vsync.missed, 0U);
+    if (events[0].vsync.expectedVsync != 0) {
+        EXPECT_GT(events[0].vsync.expectedVsync, events[0].header.timestamp);
+        EXPECT_GT(events[0].vsync.deadline, events[0].header.timestamp);
+    }
+    ASSERT_EQ(NO_ERROR, receiver.setVsyncRate(0));
+}
+
+} // namespace android
@@ -367,6 +367,64 @@ TEST_F(IGraphicBufferProducerTest, Queue_Succeeds) {
     EXPECT_EQ(BAD_VALUE, mProducer->queueBuffer(dequeuedSlot, input, &output));
 }
 
+TEST_F(IGraphicBufferProducerTest, QueueAndDequeue_Succeeds) {
+    ASSERT_NO_FATAL_FAILURE(ConnectProducer());
+
+    int slot = -1;
+    sp<Fence> fence;
+    status_t flags = mProducer->dequeueBuffer(&slot, &fence,
+            QUEUE_BUFFER_INPUT_ASYNC, DEFAULT_WIDTH, DEFAULT_HEIGHT,
+            DEFAULT_FORMAT, TEST_PRODUCER_USAGE_BITS);
+    ASSERT_LE(OK, flags);
+
+    IGraphicBufferProducer::QueueBufferInput input = CreateBufferInput();
+    IGraphicBufferProducer::QueueBufferOutput output;
+
+    // Nothing consumes the queued buffers, so the dequeue half of the
+    // transaction eventually runs out of free slots. It must report that
+    // rather than block.
+    bool wouldBlock = false;
+    for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS && !wouldBlock; ++i) {
+        if (flags & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            ASSERT_OK(mProducer->requestBuffer(slot, &buffer));
+        }
+
+        int nextSlot = -1;
+        sp<Fence> nextFence;
+        status_t dequeueResult = NO_ERROR;
+        ASSERT_OK(mProducer->queueAndDequeueBuffer(slot, input, &output,
+                &nextSlot, &nextFence, DEFAULT_WIDTH, DEFAULT_HEIGHT,
+                DEFAULT_FORMAT, TEST_PRODUCER_USAGE_BITS, &dequeueResult));
+
+        uint32_t width;
+        uint32_t height;
+        uint32_t transformHint;
+        uint32_t numPendingBuffers;
+        output.deflate(&width, &height, &transformHint, &numPendingBuffers);
+        EXPECT_EQ(uint32_t(i + 1), numPendingBuffers);
+
+        if (dequeueResult == WOULD_BLOCK) {
+            wouldBlock = true;
+        } else {
+            ASSERT_LE(OK, dequeueResult);
+            EXPECT_NE(slot, nextSlot);
+            slot = nextSlot;
+            flags = dequeueResult;
+        }
+    }
+    EXPECT_TRUE(wouldBlock);
+
+    // Queueing a buffer that isn't dequeued fails both halves
+    int nextSlot = -1;
+    sp<Fence> nextFence;
+    status_t dequeueResult = NO_ERROR;
+    EXPECT_EQ(BAD_VALUE, mProducer->queueAndDequeueBuffer(slot, input, &output,
+            &nextSlot, &nextFence, DEFAULT_WIDTH, DEFAULT_HEIGHT,
+            DEFAULT_FORMAT, TEST_PRODUCER_USAGE_BITS, &dequeueResult));
+    EXPECT_EQ(BAD_VALUE, dequeueResult);
+}
+
 TEST_F(IGraphicBufferProducerTest, Queue_ReturnsError) {
     ASSERT_NO_FATAL_FAILURE(ConnectProducer());
 
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LayerState_test"
+//#define LOG_NDEBUG 0
+
+#include <binder/Parcel.h>
+
+#include <private/gui/LayerState.h>
+
+#include <utils/Timers.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+class LayerStateTest : public ::testing::Test {
+
+protected:
+    LayerStateTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~LayerStateTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+};
+
+static const uint32_t ALL_CHANGES =
+        layer_state_t::ePositionChanged |
+        layer_state_t::eLayerChanged |
+        layer_state_t::eSizeChanged |
+        layer_state_t::eAlphaChanged |
+        layer_state_t::eMatrixChanged |
+        layer_state_t::eTransparentRegionChanged |
+        layer_state_t::eVisibilityChanged |
+        layer_state_t::eLayerStackChanged |
+        layer_state_t::eCropChanged |
+        layer_state_t::eOpacityChanged;
+
+static layer_state_t makeState(uint32_t what) {
+    layer_state_t state;
+    state.what = what;
+    state.x = 12.5f;
+    state.y = -3.0f;
+    state.z = 21000;
+    state.w = 640;
+    state.h = 480;
+    state.layerStack = 2;
+    state.alpha = 0.5f;
+    state.flags = layer_state_t::eLayerHidden;
+    state.mask = layer_state_t::eLayerHidden | layer_state_t::eLayerOpaque;
+    state.matrix.dsdx = 0.0f;
+    state.matrix.dtdx = 1.0f;
+    state.matrix.dsdy = -1.0f;
+    state.matrix.dtdy = 0.0f;
+    state.crop = Rect(10, 20, 30, 40);
+    state.transparentRegion.orSelf(Rect(0, 0, 8, 8));
+    state.transparentRegion.orSelf(Rect(32, 32, 64, 64));
+    return state;
+}
+
+TEST_F(LayerStateTest, AllFieldsRoundTrip) {
+    const layer_state_t in(makeState(ALL_CHANGES));
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, in.write(parcel));
+    parcel.setDataPosition(0);
+
+    layer_state_t out;
+    ASSERT_EQ(NO_ERROR, out.read(parcel));
+    EXPECT_EQ(parcel.dataSize(), parcel.dataPosition());
+    EXPECT_EQ(ALL_CHANGES, out.what);
+    EXPECT_EQ(in.x, out.x);
+    EXPECT_EQ(in.y, out.y);
+    EXPECT_EQ(in.z, out.z);
+    EXPECT_EQ(in.w, out.w);
+    EXPECT_EQ(in.h, out.h);
+    EXPECT_EQ(in.layerStack, out.layerStack);
+    EXPECT_EQ(in.alpha, out.alpha);
+    EXPECT_EQ(in.flags, out.flags);
+    EXPECT_EQ(in.mask, out.mask);
+    EXPECT_EQ(in.matrix.dsdx, out.matrix.dsdx);
+    EXPECT_EQ(in.matrix.dtdx, out.matrix.dtdx);
+    EXPECT_EQ(in.matrix.dsdy, out.matrix.dsdy);
+    EXPECT_EQ(in.matrix.dtdy, out.matrix.dtdy);
+    EXPECT_EQ(in.crop, out.crop);
+    EXPECT_TRUE(in.transparentRegion.subtract(out.transparentRegion).isEmpty());
+    EXPECT_TRUE(out.transparentRegion.subtract(in.transparentRegion).isEmpty());
+}
+
+TEST_F(LayerStateTest, OnlyFlaggedFieldsAreSent) {
+    const layer_state_t in(makeState(layer_state_t::ePositionChanged));
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, in.write(parcel));
+    parcel.setDataPosition(0);
+
+    // Reading into a state that was used before must not leave stale values
+    layer_state_t out(makeState(ALL_CHANGES));
+    ASSERT_EQ(NO_ERROR, out.read(parcel));
+    EXPECT_EQ(parcel.dataSize(), parcel.dataPosition());
+    EXPECT_EQ(uint32_t(layer_state_t::ePositionChanged), out.what);
+    EXPECT_EQ(in.x, out.x);
+    EXPECT_EQ(in.y, out.y);
+
+    const layer_state_t defaults;
+    EXPECT_EQ(defaults.z, out.z);
+    EXPECT_EQ(defaults.w, out.w);
+    EXPECT_EQ(defaults.alpha, out.alpha);
+    EXPECT_EQ(defaults.matrix.dsdx, out.matrix.dsdx);
+    EXPECT_FALSE(out.crop.isValid());
+    EXPECT_TRUE(out.transparentRegion.isEmpty());
+}
+
+TEST_F(LayerStateTest, VisibilityAndOpacityShareFlags) {
+    const layer_state_t in(makeState(layer_state_t::eOpacityChanged));
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, in.write(parcel));
+    parcel.setDataPosition(0);
+
+    layer_state_t out;
+    ASSERT_EQ(NO_ERROR, out.read(parcel));
+    EXPECT_EQ(in.flags, out.flags);
+    EXPECT_EQ(in.mask, out.mask);
+}
+
+// Prints the size and serialization cost of an animation-style transaction,
+// where a few layers move every frame, against one sending every field.
+TEST_F(LayerStateTest, TransactionSizeBenchmark) {
+    const size_t LAYER_COUNT = 8;
+    const int ITERATIONS = 10000;
+    const uint32_t cases[] = {
+        layer_state_t::ePositionChanged,
+        layer_state_t::ePositionChanged | layer_state_t::eAlphaChanged,
+        layer_state_t::eMatrixChanged,
+        ALL_CHANGES,
+    };
+    const char* names[] = {
+        "position",
+        "position+alpha",
+        "matrix",
+        "all fields",
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const layer_state_t state(makeState(cases[c]));
+        layer_state_t out;
+        size_t size = 0;
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < ITERATIONS; i++) {
+            Parcel parcel;
+            for (size_t l = 0; l < LAYER_COUNT; l++) {
+                ASSERT_EQ(NO_ERROR, state.write(parcel));
+            }
+            parcel.setDataPosition(0);
+            for (size_t l = 0; l < LAYER_COUNT; l++) {
+                ASSERT_EQ(NO_ERROR, out.read(parcel));
+            }
+            size = parcel.dataSize();
+        }
+        const nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        printf("[          ] %-15s %zu layers: %4zu bytes/transaction, "
+                "%.2f us to write and read\n", names[c], LAYER_COUNT, size,
+                elapsed / 1000.0 / ITERATIONS);
+    }
+}
+
+} // namespace android
@@ -203,6 +203,93 @@ TEST_F(StreamSplitterTest, OneInputMultipleOutputs) {
     ASSERT_EQ(1, allocator->getAllocCount());
 }
 
+TEST_F(StreamSplitterTest, SlowOutputDoesNotStallOthers) {
+    const int NUM_FRAMES = 5;
+
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer);
+
+    // The fast output (e.g. a preview) releases every frame right away, while
+    // the slow one (e.g. an encoder) holds on to its first frame
+    sp<IGraphicBufferProducer> fastProducer;
+    sp<IGraphicBufferConsumer> fastConsumer;
+    BufferQueue::createBufferQueue(&fastProducer, &fastConsumer);
+    ASSERT_EQ(OK, fastConsumer->consumerConnect(new DummyListener, false));
+
+    sp<IGraphicBufferProducer> slowProducer;
+    sp<IGraphicBufferConsumer> slowConsumer;
+    BufferQueue::createBufferQueue(&slowProducer, &slowConsumer);
+    ASSERT_EQ(OK, slowConsumer->consumerConnect(new DummyListener, false));
+
+    sp<StreamSplitter> splitter;
+    status_t status = StreamSplitter::createSplitter(inputConsumer, &splitter);
+    ASSERT_EQ(OK, status);
+    ASSERT_EQ(OK, splitter->addOutput(fastProducer));
+    ASSERT_EQ(OK, splitter->addOutput(slowProducer,
+            StreamSplitter::POLICY_DROP_OLDEST));
+
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+
+    // With the slow output blocking, the splitter would stop acquiring from
+    // the input after MAX_OUTSTANDING_BUFFERS frames and this would hang
+    for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+        int slot;
+        sp<Fence> fence;
+        sp<GraphicBuffer> buffer;
+        status_t result = inputProducer->dequeueBuffer(&slot, &fence, false,
+                0, 0, 0, GRALLOC_USAGE_SW_WRITE_OFTEN);
+        ASSERT_LE(OK, result);
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            ASSERT_EQ(OK, inputProducer->requestBuffer(slot, &buffer));
+        }
+
+        IGraphicBufferProducer::QueueBufferInput qbInput(frame + 1, false,
+                Rect(0, 0, 1, 1), NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, false,
+                Fence::NO_FENCE);
+        ASSERT_EQ(OK, inputProducer->queueBuffer(slot, qbInput, &qbOutput));
+
+        IGraphicBufferConsumer::BufferItem item;
+        ASSERT_EQ(OK, fastConsumer->acquireBuffer(&item, 0));
+        ASSERT_EQ(frame + 1, item.mTimestamp);
+        ASSERT_EQ(OK, fastConsumer->releaseBuffer(item.mBuf,
+                item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                Fence::NO_FENCE));
+    }
+
+    StreamSplitter::OutputStats stats;
+    ASSERT_EQ(OK, splitter->getOutputStats(fastProducer, &stats));
+    EXPECT_EQ(uint64_t(NUM_FRAMES), stats.framesQueued);
+    EXPECT_EQ(0U, stats.framesDropped);
+    EXPECT_EQ(uint64_t(NUM_FRAMES), stats.framesReleased);
+
+    // The slow output got the first frame, the last one is waiting for it and
+    // the ones in between were dropped
+    ASSERT_EQ(OK, splitter->getOutputStats(slowProducer, &stats));
+    EXPECT_EQ(1U, stats.framesQueued);
+    EXPECT_EQ(uint64_t(NUM_FRAMES - 2), stats.framesDropped);
+    EXPECT_EQ(0U, stats.framesReleased);
+
+    IGraphicBufferConsumer::BufferItem item;
+    ASSERT_EQ(OK, slowConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(1, item.mTimestamp);
+    ASSERT_EQ(OK, slowConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+
+    // Releasing the first frame sends the newest one
+    ASSERT_EQ(OK, slowConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(NUM_FRAMES, item.mTimestamp);
+    ASSERT_EQ(OK, slowConsumer->releaseBuffer(item.mBuf, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+
+    ASSERT_EQ(OK, splitter->getOutputStats(slowProducer, &stats));
+    EXPECT_EQ(2U, stats.framesQueued);
+    EXPECT_EQ(2U, stats.framesReleased);
+    EXPECT_LE(stats.totalLatency / 2, stats.maxLatency);
+}
+
 TEST_F(StreamSplitterTest, OutputAbandonment) {
     sp<IGraphicBufferProducer> inputProducer;
     sp<IGraphicBufferConsumer> inputConsumer;
@@ -21,12 +21,15 @@
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
 #include <gui/BufferItemConsumer.h>
+#include <gui/CpuConsumer.h>
 #include <ui/Rect.h>
 #include <utils/String8.h>
 
 #include <private/gui/ComposerService.h>
 #include <binder/ProcessState.h>
 
+#include "FrameWaiter.h"
+
 namespace android {
 
 class SurfaceTest : public ::testing::Test {
@@ -128,6 +131,31 @@ TEST_F(SurfaceTest, ScreenshotsOfProtectedBuffersSucceed) {
             64, 64, 0, 0x7fffffff, false));
 }
 
+TEST_F(SurfaceTest, AsyncScreenshotIsQueuedToProducer) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<CpuConsumer> cpuConsumer = new CpuConsumer(consumer, 1);
+    sp<FrameWaiter> fw(new FrameWaiter);
+    cpuConsumer->setFrameAvailableListener(fw);
+    sp<ISurfaceComposer> sf(ComposerService::getComposerService());
+    sp<IBinder> display(sf->getBuiltInDisplay(ISurfaceComposer::eDisplayIdMain));
+
+    // The same producer is used twice, so that the second capture reuses
+    // the output of the first one
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(NO_ERROR, sf->captureScreenAsync(display, producer, Rect(),
+                64, 64, 0, 0x7fffffff, false));
+        fw->waitForFrame();
+
+        CpuConsumer::LockedBuffer buf;
+        ASSERT_EQ(NO_ERROR, cpuConsumer->lockNextBuffer(&buf));
+        EXPECT_EQ(64U, buf.width);
+        EXPECT_EQ(64U, buf.height);
+        ASSERT_EQ(NO_ERROR, cpuConsumer->unlockBuffer(buf));
+    }
+}
+
 TEST_F(SurfaceTest, ConcreteTypeIsSurface) {
     sp<ANativeWindow> anw(mSurface);
     int result = -123;
@@ -155,4 +183,115 @@ TEST_F(SurfaceTest, QueryConsumerUsage) {
     ASSERT_EQ(TEST_USAGE_FLAGS, flags);
 }
 
+// Once the dequeues repeat with an explicit size, queueBuffer dequeues the
+// next buffer ahead of time. The buffers must not be reallocated when that
+// happens, and a size change must not hand out a buffer dequeued with the
+// old size. Surfaces using the consumer's default size are never prefetched,
+// so they aren't covered here.
+TEST_F(SurfaceTest, DequeueAfterSetBuffersDimensionsDoesNotReallocate) {
+    const int MAX_BUFFERS = 3;
+    const int FRAMES = 10;
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<BufferItemConsumer> c = new BufferItemConsumer(consumer,
+            GRALLOC_USAGE_SW_READ_OFTEN);
+    ASSERT_EQ(NO_ERROR, consumer->setDefaultMaxBufferCount(MAX_BUFFERS));
+    sp<Surface> s = new Surface(producer);
+    sp<ANativeWindow> anw(s);
+    ASSERT_EQ(NO_ERROR, native_window_api_connect(anw.get(),
+            NATIVE_WINDOW_API_CPU));
+    ASSERT_EQ(NO_ERROR, native_window_set_usage(anw.get(),
+            GRALLOC_USAGE_SW_WRITE_OFTEN));
+    ASSERT_EQ(NO_ERROR, native_window_set_buffers_format(anw.get(),
+            HAL_PIXEL_FORMAT_RGBA_8888));
+
+    const int sizes[2][2] = { { 64, 32 }, { 32, 64 } };
+    for (int i = 0; i < 2; i++) {
+        const int width = sizes[i][0];
+        const int height = sizes[i][1];
+        ASSERT_EQ(NO_ERROR, native_window_set_buffers_dimensions(anw.get(),
+                width, height));
+
+        // every allocation gives a new buffer, so reallocations show up as
+        // more distinct buffers than there are slots
+        ANativeWindowBuffer* seen[FRAMES];
+        int numSeen = 0;
+        for (int frame = 0; frame < FRAMES; frame++) {
+            ANativeWindowBuffer* buffer;
+            ASSERT_EQ(NO_ERROR, native_window_dequeue_buffer_and_wait(
+                    anw.get(), &buffer));
+            EXPECT_EQ(width, buffer->width);
+            EXPECT_EQ(height, buffer->height);
+            int j = 0;
+            while (j < numSeen && seen[j] != buffer) {
+                j++;
+            }
+            if (j == numSeen) {
+                seen[numSeen++] = buffer;
+            }
+            ASSERT_EQ(NO_ERROR, anw->queueBuffer(anw.get(), buffer, -1));
+
+            BufferItemConsumer::BufferItem item;
+            ASSERT_EQ(NO_ERROR, c->acquireBuffer(&item, 0));
+            ASSERT_EQ(NO_ERROR, c->releaseBuffer(item));
+        }
+        EXPECT_LE(numSeen, MAX_BUFFERS);
+    }
+
+    ASSERT_EQ(NO_ERROR, native_window_api_disconnect(anw.get(),
+            NATIVE_WINDOW_API_CPU));
+}
+
+// The content of the band a frame redraws, for the lock copy-back test: frame
+// 0 fills the whole buffer, then frame n redraws band n
+static uint32_t getCopyBackTestPixel(int band, int frame) {
+    return (band >= 1 && band <= frame ? band + 1 : 1) * 0x01010101;
+}
+
+TEST_F(SurfaceTest, LockCopiesBackContentOutsideDirtyRegion) {
+    const int SIZE = 64;
+    const int BAND_HEIGHT = 8;
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    sp<CpuConsumer> cpuConsumer = new CpuConsumer(consumer, 1);
+    ASSERT_EQ(NO_ERROR, cpuConsumer->setDefaultBufferSize(SIZE, SIZE));
+    ASSERT_EQ(NO_ERROR, cpuConsumer->setDefaultBufferFormat(
+            PIXEL_FORMAT_RGBA_8888));
+    sp<Surface> s = new Surface(producer);
+
+    for (int frame = 0; frame < SIZE / BAND_HEIGHT; frame++) {
+        ANativeWindow_Buffer buffer;
+        ARect dirty = { 0, frame * BAND_HEIGHT, SIZE,
+                (frame + 1) * BAND_HEIGHT };
+        ASSERT_EQ(NO_ERROR, s->lock(&buffer, frame ? &dirty : NULL));
+
+        // Redraw whatever lock asked for
+        const int top = frame ? dirty.top : 0;
+        const int bottom = frame ? dirty.bottom : SIZE;
+        for (int y = top; y < bottom; y++) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(buffer.bits) +
+                    y * buffer.stride;
+            for (int x = 0; x < SIZE; x++) {
+                row[x] = getCopyBackTestPixel(y / BAND_HEIGHT, frame);
+            }
+        }
+        ASSERT_EQ(NO_ERROR, s->unlockAndPost());
+
+        CpuConsumer::LockedBuffer posted;
+        ASSERT_EQ(NO_ERROR, cpuConsumer->lockNextBuffer(&posted));
+        for (int y = 0; y < SIZE; y++) {
+            const uint32_t* row = reinterpret_cast<const uint32_t*>(
+                    posted.data) + y * posted.stride;
+            for (int x = 0; x < SIZE; x++) {
+                ASSERT_EQ(getCopyBackTestPixel(y / BAND_HEIGHT, frame),
+                        row[x]) << "frame " << frame << " at " << x << ","
+                        << y;
+            }
+        }
+        ASSERT_EQ(NO_ERROR, cpuConsumer->unlockBuffer(posted));
+    }
+}
+
 }
@@ -81,4 +81,56 @@ status_t FrameStats::unflatten(void const* buffer, size_t size) {
     return NO_ERROR;
 }
 
+// ----------------------------------------------------------------------------
+
+FrameStatsSummary::FrameStatsSummary() :
+        refreshPeriodNano(0),
+        frameCount(0),
+        jankCount(0),
+        p50FrameTimeNano(0),
+        p90FrameTimeNano(0),
+        p99FrameTimeNano(0),
+        maxFrameTimeNano(0) {
+}
+
+bool FrameStatsSummary::isFixedSize() const {
+    return true;
+}
+
+size_t FrameStatsSummary::getFlattenedSize() const {
+    return 5 * sizeof(nsecs_t) + 2 * sizeof(uint32_t);
+}
+
+status_t FrameStatsSummary::flatten(void* buffer, size_t size) const {
+    if (size < getFlattenedSize()) {
+        return NO_MEMORY;
+    }
+
+    FlattenableUtils::write(buffer, size, refreshPeriodNano);
+    FlattenableUtils::write(buffer, size, p50FrameTimeNano);
+    FlattenableUtils::write(buffer, size, p90FrameTimeNano);
+    FlattenableUtils::write(buffer, size, p99FrameTimeNano);
+    FlattenableUtils::write(buffer, size, maxFrameTimeNano);
+    FlattenableUtils::write(buffer, size, frameCount);
+    FlattenableUtils::write(buffer, size, jankCount);
+
+    return NO_ERROR;
+}
+
+status_t FrameStatsSummary::unflatten(void const* buffer, size_t size) {
+    if (size < getFlattenedSize()) {
+        return NO_MEMORY;
+    }
+
+    FlattenableUtils::read(buffer, size, refreshPeriodNano);
+    FlattenableUtils::read(buffer, size, p50FrameTimeNano);
+    FlattenableUtils::read(buffer, size, p90FrameTimeNano);
+    FlattenableUtils::read(buffer, size, p99FrameTimeNano);
+    FlattenableUtils::read(buffer, size, maxFrameTimeNano);
+    FlattenableUtils::read(buffer, size, frameCount);
+    FlattenableUtils::read(buffer, size, jankCount);
+
+    return NO_ERROR;
+}
+
 } // namespace android
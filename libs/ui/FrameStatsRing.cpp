@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <cutils/atomic.h>
+
+#include <ui/FrameStats.h>
+#include <ui/FrameStatsRing.h>
+
+namespace android {
+
+static int compareFrameTimes(const void* lhs, const void* rhs) {
+    nsecs_t l = *reinterpret_cast<const nsecs_t*>(lhs);
+    nsecs_t r = *reinterpret_cast<const nsecs_t*>(rhs);
+    return l < r ? -1 : (l > r ? 1 : 0);
+}
+
+// returns the p-th percentile of count sorted values, using the
+// nearest-rank method.
+static nsecs_t percentile(const nsecs_t* sorted, size_t count, size_t p) {
+    size_t rank = (p * count + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+FrameStatsRing::FrameStatsRing() :
+        mWriteStart(0),
+        mWriteEnd(0),
+        mResetPoint(0) {
+    for (size_t i = 0; i < NUM_FRAME_RECORDS; i++) {
+        mFrameTimes[i] = 0;
+    }
+}
+
+void FrameStatsRing::push(nsecs_t frameTime) {
+    // only the writer modifies the counters, so plain loads are fine here
+    int32_t n = mWriteEnd;
+
+    // announce the record we're about to clobber before touching it, so
+    // that readers racing with us know to discard it.
+    android_atomic_release_store(n + 1, &mWriteStart);
+    android_memory_barrier();
+    mFrameTimes[uint32_t(n) % NUM_FRAME_RECORDS] = frameTime;
+    android_atomic_release_store(n + 1, &mWriteEnd);
+}
+
+void FrameStatsRing::reset() {
+    android_atomic_release_store(mWriteEnd, &mResetPoint);
+}
+
+void FrameStatsRing::getSummary(nsecs_t refreshPeriod,
+        FrameStatsSummary* outSummary) const {
+    nsecs_t frameTimes[NUM_FRAME_RECORDS];
+
+    const int32_t resetPoint = android_atomic_acquire_load(&mResetPoint);
+    const int32_t end = android_atomic_acquire_load(&mWriteEnd);
+    for (size_t i = 0; i < NUM_FRAME_RECORDS; i++) {
+        frameTimes[i] = mFrameTimes[i];
+    }
+    android_memory_barrier();
+    const int32_t start = android_atomic_acquire_load(&mWriteStart);
+
+    // records older than start - NUM_FRAME_RECORDS may have been overwritten
+    // while we were copying them. The counters are compared as differences so
+    // that they can safely wrap around.
+    uint32_t count = uint32_t(end - resetPoint);
+    uint32_t overwritten = uint32_t(start - end);
+    if (count + overwritten > NUM_FRAME_RECORDS) {
+        count = overwritten >= NUM_FRAME_RECORDS ?
+                0 : NUM_FRAME_RECORDS - overwritten;
+    }
+
+    // gather the valid records at the front of the array
+    nsecs_t sorted[NUM_FRAME_RECORDS];
+    for (uint32_t i = 0; i < count; i++) {
+        sorted[i] = frameTimes[uint32_t(end - count + i) % NUM_FRAME_RECORDS];
+    }
+
+    outSummary->refreshPeriodNano = refreshPeriod;
+    outSummary->frameCount = count;
+    outSummary->jankCount = 0;
+    outSummary->p50FrameTimeNano = 0;
+    outSummary->p90FrameTimeNano = 0;
+    outSummary->p99FrameTimeNano = 0;
+    outSummary->maxFrameTimeNano = 0;
+    if (count == 0) {
+        return;
+    }
+
+    qsort(sorted, count, sizeof(nsecs_t), compareFrameTimes);
+
+    if (refreshPeriod > 0) {
+        // a frame is jank if it stayed on screen for 1.5 refresh periods or
+        // more, i.e. it rounds to two or more
+        const nsecs_t jankThreshold = refreshPeriod + refreshPeriod / 2;
+        for (uint32_t i = 0; i < count; i++) {
+            if (sorted[i] >= jankThreshold) {
+                outSummary->jankCount = count - i;
+                break;
+            }
+        }
+    }
+
+    outSummary->p50FrameTimeNano = percentile(sorted, count, 50);
+    outSummary->p90FrameTimeNano = percentile(sorted, count, 90);
+    outSummary->p99FrameTimeNano = percentile(sorted, count, 99);
+    outSummary->maxFrameTimeNano = sorted[count - 1];
+}
+
+}; // namespace android
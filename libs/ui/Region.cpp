@@ -23,6 +23,8 @@
 #include <utils/String8.h>
 #include <utils/CallStack.h>
 
+#include <binder/Parcel.h>
+
 #include <ui/Rect.h>
 #include <ui/Region.h>
 #include <ui/Point.h>
@@ -100,7 +102,7 @@ static void reverseRectsResolvingJunctions(const Rect* begin, const Rect* end,
     do {
         dst.add(*current);
         current--;
-    } while (current->top == lastTop && current >= begin);
+    } while (current >= begin && current->top == lastTop);
 
     unsigned int beginLastSpan = -1;
     unsigned int endLastSpan = -1;
@@ -127,42 +129,43 @@ static void reverseRectsResolvingJunctions(const Rect* begin, const Rect* end,
         int right = current->right;
 
         for (unsigned int prevIndex = beginLastSpan; prevIndex <= endLastSpan; prevIndex++) {
-            const Rect* prev = &dst[prevIndex];
+            // copied, since adding to dst may reallocate it
+            const Rect prev(dst[prevIndex]);
             if (spanDirection == direction_RTL) {
                 // iterating over previous span RTL, quit if it's too far left
-                if (prev->right <= left) break;
+                if (prev.right <= left) break;
 
-                if (prev->right > left && prev->right < right) {
-                    dst.add(Rect(prev->right, top, right, bottom));
-                    right = prev->right;
+                if (prev.right > left && prev.right < right) {
+                    dst.add(Rect(prev.right, top, right, bottom));
+                    right = prev.right;
                 }
 
-                if (prev->left > left && prev->left < right) {
-                    dst.add(Rect(prev->left, top, right, bottom));
-                    right = prev->left;
+                if (prev.left > left && prev.left < right) {
+                    dst.add(Rect(prev.left, top, right, bottom));
+                    right = prev.left;
                 }
 
                 // if an entry in the previous span is too far right, nothing further left in the
                 // current span will need it
-                if (prev->left >= right) {
+                if (prev.left >= right) {
                     beginLastSpan = prevIndex;
                 }
             } else {
                 // iterating over previous span LTR, quit if it's too far right
-                if (prev->left >= right) break;
+                if (prev.left >= right) break;
 
-                if (prev->left > left && prev->left < right) {
-                    dst.add(Rect(left, top, prev->left, bottom));
-                    left = prev->left;
+                if (prev.left > left && prev.left < right) {
+                    dst.add(Rect(left, top, prev.left, bottom));
+                    left = prev.left;
                 }
 
-                if (prev->right > left && prev->right < right) {
-                    dst.add(Rect(left, top, prev->right, bottom));
-                    left = prev->right;
+                if (prev.right > left && prev.right < right) {
+                    dst.add(Rect(left, top, prev.right, bottom));
+                    left = prev.right;
                 }
                 // if an entry in the previous span is too far left, nothing further right in the
                 // current span will need it
-                if (prev->right <= left) {
+                if (prev.right <= left) {
                     beginLastSpan = prevIndex;
                 }
             }
@@ -748,32 +751,103 @@ status_t Region::flatten(void* buffer, size_t size) const {
     return NO_ERROR;
 }
 
-status_t Region::unflatten(void const* buffer, size_t size) {
-    Region result;
-    if (size >= sizeof(Rect)) {
-        Rect const* rects = reinterpret_cast<Rect const*>(buffer);
-        size_t count = size / sizeof(Rect);
-        if (count > 0) {
-            result.mStorage.clear();
-            ssize_t err = result.mStorage.insertAt(0, count);
-            if (err < 0) {
-                return status_t(err);
+// Checks flattened rects -- a single rect, or the spans followed by the
+// bounds -- the same way validate() checks a Region, but straight from the
+// buffer and without logging, since every region received over binder goes
+// through it.
+static bool isValidFlattenedRegion(Rect const* rects, size_t count) {
+    if (count == 2) {
+        // mStorage size of 2 is never valid (see validate())
+        return false;
+    }
+    const size_t numRects = count == 1 ? 1 : count - 1;
+    const int32_t maxValue = region_operator<Rect>::max_value;
+    Rect b(rects[0]);
+    for (size_t i = 0; i < numRects; i++) {
+        const Rect& cur(rects[i]);
+        if (!cur.isValid() || cur.right > maxValue || cur.bottom > maxValue) {
+            return false;
+        }
+        if (i == 0) {
+            continue;
+        }
+        const Rect& prev(rects[i - 1]);
+        if (!(prev < cur)) {
+            return false;
+        }
+        if (cur.top == prev.top) {
+            if (cur.bottom != prev.bottom || cur.left < prev.right) {
+                return false;
             }
-            memcpy(result.mStorage.editArray(), rects, count*sizeof(Rect));
+        } else if (cur.top < prev.bottom) {
+            return false;
         }
+        b.left   = b.left   < cur.left   ? b.left   : cur.left;
+        b.top    = b.top    < cur.top    ? b.top    : cur.top;
+        b.right  = b.right  > cur.right  ? b.right  : cur.right;
+        b.bottom = b.bottom > cur.bottom ? b.bottom : cur.bottom;
     }
-#if VALIDATE_REGIONS
-    validate(result, "Region::unflatten");
-#endif
+    return b == rects[count - 1];
+}
 
-    if (!result.validate(result, "Region::unflatten", true)) {
+status_t Region::unflatten(void const* buffer, size_t size) {
+    size_t count = size / sizeof(Rect);
+    if (count == 0) {
+        clear();
+        return NO_ERROR;
+    }
+    Rect const* rects = reinterpret_cast<Rect const*>(buffer);
+    if (!isValidFlattenedRegion(rects, count)) {
         ALOGE("Region::unflatten() failed, invalid region");
         return BAD_VALUE;
     }
-    mStorage = result.mStorage;
+
+    // resize() only reallocates if our storage is shared or too small,
+    // so unflattening into the same Region repeatedly doesn't allocate.
+    ssize_t err = mStorage.resize(count);
+    if (err < 0) {
+        return status_t(err);
+    }
+    memcpy(mStorage.editArray(), rects, count*sizeof(Rect));
     return NO_ERROR;
 }
 
+status_t Region::writeToParcel(Parcel* parcel) const {
+    // same wire format as Parcel::write(const LightFlattenable<T>&)
+    size_t size = getFlattenedSize();
+    status_t err = parcel->writeInt32(int32_t(size));
+    if (err != NO_ERROR) {
+        return err;
+    }
+    void* buffer = parcel->writeInplace(size);
+    if (buffer == NULL) {
+        return NO_MEMORY;
+    }
+    return flatten(buffer, size);
+}
+
+status_t Region::readFromParcel(const Parcel* parcel) {
+    // same wire format as Parcel::read(LightFlattenable<T>&), but the rects
+    // are copied straight out of the parcel's data into our storage.
+    int32_t size;
+    status_t err = parcel->readInt32(&size);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if (size < 0 || size_t(size) % sizeof(Rect)) {
+        return BAD_VALUE;
+    }
+    if (size == 0) {
+        clear();
+        return NO_ERROR;
+    }
+    void const* buffer = parcel->readInplace(size_t(size));
+    if (buffer == NULL) {
+        return NO_MEMORY;
+    }
+    return unflatten(buffer, size_t(size));
+}
+
 // ----------------------------------------------------------------------------
 
 Region::const_iterator Region::begin() const {
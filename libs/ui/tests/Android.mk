@@ -4,11 +4,13 @@ include $(CLEAR_VARS)
 
 # Build the unit tests.
 test_src_files := \
+    FrameStatsRing_test.cpp \
     Region_test.cpp \
     vec_test.cpp \
     mat_test.cpp
 
 shared_libraries := \
+    libbinder \
     libutils \
     libui
 
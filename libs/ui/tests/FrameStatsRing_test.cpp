@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FrameStatsRingTest"
+
+#include <ui/FrameStats.h>
+#include <ui/FrameStatsRing.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+static const nsecs_t kPeriod = 16666667;
+
+class FrameStatsRingTest : public testing::Test {
+};
+
+TEST_F(FrameStatsRingTest, Empty) {
+    FrameStatsRing ring;
+    FrameStatsSummary summary;
+    ring.getSummary(kPeriod, &summary);
+    EXPECT_EQ(kPeriod, summary.refreshPeriodNano);
+    EXPECT_EQ(0U, summary.frameCount);
+    EXPECT_EQ(0U, summary.jankCount);
+    EXPECT_EQ(0, summary.p99FrameTimeNano);
+}
+
+TEST_F(FrameStatsRingTest, Percentiles) {
+    FrameStatsRing ring;
+    // 100 frames of 1..100 tenths of a period, frames 15..100 are >= 1.5 periods
+    for (int i = 1; i <= 100; i++) {
+        ring.push(i * kPeriod / 10);
+    }
+    FrameStatsSummary summary;
+    ring.getSummary(kPeriod, &summary);
+    EXPECT_EQ(100U, summary.frameCount);
+    EXPECT_EQ(86U, summary.jankCount);
+    EXPECT_EQ(50 * kPeriod / 10, summary.p50FrameTimeNano);
+    EXPECT_EQ(90 * kPeriod / 10, summary.p90FrameTimeNano);
+    EXPECT_EQ(99 * kPeriod / 10, summary.p99FrameTimeNano);
+    EXPECT_EQ(100 * kPeriod / 10, summary.maxFrameTimeNano);
+}
+
+TEST_F(FrameStatsRingTest, WrapsAndResets) {
+    FrameStatsRing ring;
+    for (int i = 0; i < 3 * FrameStatsRing::NUM_FRAME_RECORDS; i++) {
+        ring.push(i < 2 * FrameStatsRing::NUM_FRAME_RECORDS ? 4 * kPeriod : kPeriod);
+    }
+    FrameStatsSummary summary;
+    ring.getSummary(kPeriod, &summary);
+    // only the most recent records are kept
+    EXPECT_EQ(uint32_t(FrameStatsRing::NUM_FRAME_RECORDS), summary.frameCount);
+    EXPECT_EQ(0U, summary.jankCount);
+    EXPECT_EQ(kPeriod, summary.maxFrameTimeNano);
+
+    ring.reset();
+    ring.getSummary(kPeriod, &summary);
+    EXPECT_EQ(0U, summary.frameCount);
+
+    ring.push(2 * kPeriod);
+    ring.getSummary(kPeriod, &summary);
+    EXPECT_EQ(1U, summary.frameCount);
+    EXPECT_EQ(1U, summary.jankCount);
+}
+
+TEST_F(FrameStatsRingTest, SummaryFlattenRoundTrip) {
+    FrameStatsSummary in;
+    in.refreshPeriodNano = kPeriod;
+    in.frameCount = 120;
+    in.jankCount = 3;
+    in.p50FrameTimeNano = kPeriod;
+    in.p90FrameTimeNano = kPeriod + 1;
+    in.p99FrameTimeNano = 2 * kPeriod;
+    in.maxFrameTimeNano = 5 * kPeriod;
+
+    uint8_t buffer[64];
+    ASSERT_LE(in.getFlattenedSize(), sizeof(buffer));
+    ASSERT_EQ(NO_ERROR, in.flatten(buffer, in.getFlattenedSize()));
+
+    FrameStatsSummary out;
+    ASSERT_EQ(NO_ERROR, out.unflatten(buffer, in.getFlattenedSize()));
+    EXPECT_EQ(in.refreshPeriodNano, out.refreshPeriodNano);
+    EXPECT_EQ(in.frameCount, out.frameCount);
+    EXPECT_EQ(in.jankCount, out.jankCount);
+    EXPECT_EQ(in.p50FrameTimeNano, out.p50FrameTimeNano);
+    EXPECT_EQ(in.p90FrameTimeNano, out.p90FrameTimeNano);
+    EXPECT_EQ(in.p99FrameTimeNano, out.p99FrameTimeNano);
+    EXPECT_EQ(in.maxFrameTimeNano, out.maxFrameTimeNano);
+}
+
+}; // namespace android
@@ -16,9 +16,13 @@
 
 #define LOG_TAG "RegionTest"
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <binder/Parcel.h>
 #include <ui/Region.h>
 #include <ui/Rect.h>
+#include <utils/Timers.h>
 #include <gtest/gtest.h>
 
 namespace android {
@@ -152,5 +156,145 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+#define TJUNCTION_LARGE_ITER_MAX 200
+#define TJUNCTION_LARGE_CELLS 32
+
+// Regions of overlapping random rects split into many more rects than the
+// grid above, so that adding them reallocates the output more than once.
+TEST_F(RegionTest, RandomLarge_TJunction) {
+    srandom(12345);
+    for (int iter = 0; iter < TJUNCTION_LARGE_ITER_MAX; iter++) {
+        Region r;
+        for (int i = 0; i < TJUNCTION_LARGE_CELLS * 4; i++) {
+            int left = random() % (TJUNCTION_LARGE_CELLS * 16);
+            int top = random() % (TJUNCTION_LARGE_CELLS * 16);
+            r.orSelf(Rect(left, top, left + 1 + random() % 64, top + 1 + random() % 64));
+        }
+        checkTJunctionFreeFromRegion(r);
+    }
+}
+
+static Region makeRandomRegion(int cells) {
+    Region r;
+    for (int i = 0; i < cells; i++) {
+        for (int j = 0; j < cells; j++) {
+            if (random() % 2) {
+                r.orSelf(Rect(i * 8, j * 8, i * 8 + 8, j * 8 + 8));
+            }
+        }
+    }
+    return r;
+}
+
+TEST_F(RegionTest, Parcel_RoundTrip) {
+    srandom(12345);
+    Region empty;
+    Region rect(Rect(10, 20, 30, 40));
+    Region complex(makeRandomRegion(16));
+
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, empty.writeToParcel(&parcel));
+    ASSERT_EQ(NO_ERROR, rect.writeToParcel(&parcel));
+    ASSERT_EQ(NO_ERROR, complex.writeToParcel(&parcel));
+    ASSERT_EQ(NO_ERROR, parcel.write(complex));
+    parcel.setDataPosition(0);
+
+    // readFromParcel reuses the same Region for each read
+    Region r(complex);
+    ASSERT_EQ(NO_ERROR, r.readFromParcel(&parcel));
+    EXPECT_TRUE(r.isEmpty());
+    ASSERT_EQ(NO_ERROR, r.readFromParcel(&parcel));
+    EXPECT_TRUE(r.isRect());
+    EXPECT_EQ(Rect(10, 20, 30, 40), r.getBounds());
+    ASSERT_EQ(NO_ERROR, r.readFromParcel(&parcel));
+    EXPECT_TRUE((r ^ complex).isEmpty());
+
+    // and is wire-compatible with Parcel::read(LightFlattenable)
+    Region other;
+    ASSERT_EQ(NO_ERROR, parcel.read(other));
+    EXPECT_TRUE((other ^ complex).isEmpty());
+}
+
+TEST_F(RegionTest, Unflatten_RejectsInvalidSize) {
+    Rect rects[2] = { Rect(0, 0, 1, 1), Rect(0, 0, 1, 1) };
+    Region r(Rect(5, 5));
+    EXPECT_EQ(BAD_VALUE, r.unflatten(rects, sizeof(rects)));
+}
+
+TEST_F(RegionTest, Unflatten_RejectsMalformedRegions) {
+    const Region valid(makeRandomRegion(8));
+    size_t count;
+    Rect const* array = valid.getArray(&count);
+    ASSERT_GT(count, 2U);
+
+    // the flattened form is the spans followed by the bounds
+    Vector<Rect> rects;
+    rects.appendArray(array, count);
+    rects.add(valid.getBounds());
+
+    Region r(Rect(5, 5));
+    ASSERT_EQ(NO_ERROR, r.unflatten(rects.array(), rects.size() * sizeof(Rect)));
+    EXPECT_TRUE((r ^ valid).isEmpty());
+
+    // unsorted spans
+    Vector<Rect> unsorted(rects);
+    unsorted.editItemAt(0) = rects[1];
+    unsorted.editItemAt(1) = rects[0];
+    r = Region(Rect(5, 5));
+    EXPECT_EQ(BAD_VALUE, r.unflatten(unsorted.array(),
+            unsorted.size() * sizeof(Rect)));
+    EXPECT_EQ(Rect(5, 5), r.getBounds());
+
+    // overlapping spans
+    Vector<Rect> overlapping(rects);
+    overlapping.editItemAt(1) = rects[0];
+    EXPECT_EQ(BAD_VALUE, r.unflatten(overlapping.array(),
+            overlapping.size() * sizeof(Rect)));
+
+    // wrong bounds
+    Vector<Rect> badBounds(rects);
+    badBounds.editTop().right++;
+    EXPECT_EQ(BAD_VALUE, r.unflatten(badBounds.array(),
+            badBounds.size() * sizeof(Rect)));
+
+    // an inverted single rect
+    Rect inverted(10, 10, 0, 0);
+    EXPECT_EQ(BAD_VALUE, r.unflatten(&inverted, sizeof(inverted)));
+}
+
+#define ROUND_TRIP_ITER_MAX 10000
+
+TEST_F(RegionTest, Parcel_RoundTripBenchmark) {
+    srandom(12345);
+    const Region original(makeRandomRegion(16));
+    size_t count;
+    original.getArray(&count);
+
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, original.writeToParcel(&parcel));
+
+    Region reused;
+    nsecs_t start = systemTime();
+    for (int iter = 0; iter < ROUND_TRIP_ITER_MAX; iter++) {
+        parcel.setDataPosition(0);
+        ASSERT_EQ(NO_ERROR, reused.readFromParcel(&parcel));
+    }
+    nsecs_t inPlace = systemTime() - start;
+
+    start = systemTime();
+    for (int iter = 0; iter < ROUND_TRIP_ITER_MAX; iter++) {
+        parcel.setDataPosition(0);
+        Region fresh;
+        ASSERT_EQ(NO_ERROR, parcel.read(fresh));
+    }
+    nsecs_t fresh = systemTime() - start;
+
+    EXPECT_TRUE((reused ^ original).isEmpty());
+    printf("[          ] region of %zu rects, %d round-trips: "
+            "readFromParcel %" PRId64 " us, Parcel::read %" PRId64 " us\n",
+            count, ROUND_TRIP_ITER_MAX,
+            int64_t(ns2us(inPlace)), int64_t(ns2us(fresh)));
+}
+
 }; // namespace android
 
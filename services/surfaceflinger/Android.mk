@@ -10,14 +10,19 @@ LOCAL_SRC_FILES:= \
     DispSync.cpp \
     EventControlThread.cpp \
     EventThread.cpp \
+    FlatteningCache.cpp \
     FrameTracker.cpp \
+    HwcCommitThread.cpp \
     Layer.cpp \
     LayerDim.cpp \
     MessageQueue.cpp \
     MonitoredProducer.cpp \
+    PhaseOffsetTuner.cpp \
+    ScreenCaptureThread.cpp \
     SurfaceFlinger.cpp \
     SurfaceFlingerConsumer.cpp \
     Transform.cpp \
+    VisibleRegionCache.cpp \
     DisplayHardware/FramebufferSurface.cpp \
     DisplayHardware/HWComposer.cpp \
     DisplayHardware/PowerHAL.cpp \
@@ -173,5 +173,15 @@ status_t Client::getLayerFrameStats(const sp<IBinder>& handle, FrameStats* outSt
     return NO_ERROR;
 }
 
+status_t Client::getLayerFrameStatsSummary(const sp<IBinder>& handle,
+        FrameStatsSummary* outSummary) const {
+    sp<Layer> layer = getLayerUser(handle);
+    if (layer == NULL) {
+        return NAME_NOT_FOUND;
+    }
+    layer->getFrameStatsSummary(outSummary);
+    return NO_ERROR;
+}
+
 // ---------------------------------------------------------------------------
 }; // namespace android
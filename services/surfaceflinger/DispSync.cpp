@@ -185,6 +185,24 @@ public:
         return BAD_VALUE;
     }
 
+    status_t changePhaseOffset(const sp<DispSync::Callback>& callback,
+            nsecs_t phase) {
+        Mutex::Autolock lock(mMutex);
+
+        for (size_t i = 0; i < mEventListeners.size(); i++) {
+            if (mEventListeners[i].mCallback == callback) {
+                // computeListenerNextEventTimeLocked skips the events within
+                // half a period of the last one, so keeping mLastEventTime
+                // prevents the listener from firing again in this cycle
+                mEventListeners.editItemAt(i).mPhase = phase;
+                mCond.signal();
+                return NO_ERROR;
+            }
+        }
+
+        return BAD_VALUE;
+    }
+
     // This method is only here to handle the kIgnorePresentFences case.
     bool hasAnyEventListeners() {
         Mutex::Autolock lock(mMutex);
@@ -401,6 +419,12 @@ status_t DispSync::removeEventListener(const sp<Callback>& callback) {
     return mThread->removeEventListener(callback);
 }
 
+status_t DispSync::changePhaseOffset(const sp<Callback>& callback,
+        nsecs_t phase) {
+    Mutex::Autolock lock(mMutex);
+    return mThread->changePhaseOffset(callback, phase);
+}
+
 void DispSync::setPeriod(nsecs_t period) {
     Mutex::Autolock lock(mMutex);
     mPeriod = period;
@@ -507,6 +531,20 @@ nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
     return (((now - mPhase) / mPeriod) + periodOffset + 1) * mPeriod + mPhase;
 }
 
+nsecs_t DispSync::computeNextEventTime(nsecs_t after, nsecs_t phase) const {
+    Mutex::Autolock lock(mMutex);
+    if (mPeriod == 0) {
+        return 0;
+    }
+    const nsecs_t first = mPhase + phase;
+    nsecs_t periods = (after - first) / mPeriod;
+    if (first + periods * mPeriod > after) {
+        // the division rounded towards zero from a negative value
+        periods--;
+    }
+    return first + (periods + 1) * mPeriod;
+}
+
 void DispSync::dump(String8& result) const {
     Mutex::Autolock lock(mMutex);
     result.appendFormat("present fences are %s\n",
@@ -121,12 +121,23 @@ public:
     // DispSync object.
     status_t removeEventListener(const sp<Callback>& callback);
 
+    // changePhaseOffset moves an already-registered event callback to a new
+    // phase offset.  The callback isn't called twice for the same refresh
+    // cycle as long as the phase moves by less than half a period.
+    status_t changePhaseOffset(const sp<Callback>& callback, nsecs_t phase);
+
     // computeNextRefresh computes when the next refresh is expected to begin.
     // The periodOffset value can be used to move forward or backward; an
     // offset of zero is the next refresh, -1 is the previous refresh, 1 is
     // the refresh after next. etc.
     nsecs_t computeNextRefresh(int periodOffset) const;
 
+    // computeNextEventTime computes the first time after the given time at
+    // which an event with the given phase offset from the refresh is expected,
+    // i.e. when a listener added with that phase would fire. It returns 0 if
+    // the refresh period isn't known yet.
+    nsecs_t computeNextEventTime(nsecs_t after, nsecs_t phase) const;
+
     // dump appends human-readable debug info to the result string.
     void dump(String8& result) const;
 
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -70,6 +71,17 @@ DisplayDevice::DisplayDevice(
       mFlags(),
       mPageFlipCount(),
       mIsSecure(isSecure),
+      mHasBufferAge(false),
+      mCompositionSignature(0),
+      mBufferAgeFrames(0),
+      mBufferAgeFullFrames(0),
+      mRepaintedPixels(0),
+      mComposedFrames(0),
+      mGlesFrames(0),
+      mTotalComposeTime(0),
+      mMaxComposeTime(0),
+      mTotalPostLatency(0),
+      mMaxPostLatency(0),
       mSecureLayerVisible(false),
       mLayerStack(NO_LAYER_STACK),
       mOrientation(),
@@ -108,6 +120,14 @@ DisplayDevice::DisplayDevice(
     mSurface = surface;
     mFormat  = format;
     mPageFlipCount = 0;
+
+    // with EGL_EXT_buffer_age we only need to redraw what changed since the
+    // back buffer was last displayed. Virtual displays are excluded since
+    // their consumer may hand back buffers it has written to.
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.buffer_age", value, "1");
+    mHasBufferAge = atoi(value) && mType < DisplayDevice::DISPLAY_VIRTUAL &&
+            RenderEngine::hasEglExtension(display, "EGL_EXT_buffer_age");
     mViewport.makeInvalid();
     mFrame.makeInvalid();
 
@@ -181,6 +201,7 @@ uint32_t DisplayDevice::getPageFlipCount() const {
 }
 
 status_t DisplayDevice::compositionComplete() const {
+    mFlinger->getRenderEngine().flushBatch();
     return mDisplaySurface->compositionComplete();
 }
 
@@ -238,6 +259,14 @@ void DisplayDevice::swapBuffers(HWComposer& hwc) const {
     if (hwc.initCheck() != NO_ERROR ||
             (hwc.hasGlesComposition(mHwcDisplayId) &&
              (hwc.supportsFramebufferTarget() || mType >= DISPLAY_VIRTUAL))) {
+        // the frame we're swapping becomes the front buffer
+        for (size_t i = MAX_DAMAGE_HISTORY - 1; i > 0; i--) {
+            mDamageHistory[i] = mDamageHistory[i - 1];
+        }
+        mDamageHistory[0] = mPendingDamage;
+        mPendingDamage.clear();
+
+        mFlinger->getRenderEngine().endFrame();
         EGLBoolean success = eglSwapBuffers(mDisplay, mSurface);
         if (!success) {
             EGLint error = eglGetError();
@@ -259,12 +288,72 @@ void DisplayDevice::swapBuffers(HWComposer& hwc) const {
     }
 }
 
+void DisplayDevice::addDamage(const Region& damage) const {
+    mPendingDamage.orSelf(damage);
+}
+
+void DisplayDevice::setCompositionSignature(uint32_t signature) const {
+    if (signature != mCompositionSignature) {
+        // layers moved between HWC and GLES, which changes the framebuffer
+        // in ways the dirty region doesn't capture
+        mCompositionSignature = signature;
+        mPendingDamage.set(getBounds());
+    }
+}
+
+Region DisplayDevice::getBufferAgeRepaintRegion() const {
+    const Rect bounds(getBounds());
+    EGLint age = 0;
+    if (!eglQuerySurface(mDisplay, mSurface, EGL_BUFFER_AGE_EXT, &age)) {
+        age = 0;
+    }
+
+    // A buffer of age N holds the frame that was swapped N swaps ago, so
+    // it misses the last N-1 swapped frames and what changed since then.
+    // An age of 0 means the content is undefined.
+    Region repaint;
+    if (age <= 0 || age > MAX_DAMAGE_HISTORY + 1) {
+        repaint.set(bounds);
+        mBufferAgeFullFrames++;
+    } else {
+        repaint = mPendingDamage;
+        for (EGLint i = 0; i < age - 1; i++) {
+            repaint.orSelf(mDamageHistory[i]);
+        }
+        // we can only scissor to a rectangle
+        Rect r;
+        repaint.getBounds().intersect(bounds, &r);
+        repaint.set(r);
+    }
+
+    const Rect r(repaint.getBounds());
+    mRepaintedPixels += uint64_t(r.getWidth()) * uint64_t(r.getHeight());
+    mBufferAgeFrames++;
+    return repaint;
+}
+
 void DisplayDevice::onSwapBuffersCompleted(HWComposer& hwc) const {
     if (hwc.initCheck() == NO_ERROR) {
         mDisplaySurface->onFrameCommitted();
     }
 }
 
+void DisplayDevice::onFrameComposed(nsecs_t composeTime, nsecs_t postLatency,
+        bool usedGles) const {
+    mComposedFrames++;
+    if (usedGles) {
+        mGlesFrames++;
+    }
+    mTotalComposeTime += composeTime;
+    if (composeTime > mMaxComposeTime) {
+        mMaxComposeTime = composeTime;
+    }
+    mTotalPostLatency += postLatency;
+    if (postLatency > mMaxPostLatency) {
+        mMaxPostLatency = postLatency;
+    }
+}
+
 uint32_t DisplayDevice::getFlags() const
 {
     return mFlags;
@@ -274,6 +363,7 @@ EGLBoolean DisplayDevice::makeCurrent(EGLDisplay dpy, EGLContext ctx) const {
     EGLBoolean result = EGL_TRUE;
     EGLSurface sur = eglGetCurrentSurface(EGL_DRAW);
     if (sur != mSurface) {
+        mFlinger->getRenderEngine().flushBatch();
         result = eglMakeCurrent(dpy, mSurface, mSurface, ctx);
         if (result == EGL_TRUE) {
             if (mType >= DisplayDevice::DISPLAY_VIRTUAL)
@@ -429,6 +519,9 @@ void DisplayDevice::setProjection(int orientation,
     const int w = mDisplayWidth;
     const int h = mDisplayHeight;
 
+    // the flattened layers were rendered with the previous projection
+    mFlatteningCache.invalidate();
+
     Transform R;
     DisplayDevice::orientationToTransfrom(orientation, w, h, &R);
 
@@ -510,6 +603,34 @@ void DisplayDevice::dump(String8& result) const {
         tr[0][1], tr[1][1], tr[2][1],
         tr[0][2], tr[1][2], tr[2][2]);
 
+    if (mHasBufferAge) {
+        const uint64_t fullPixels =
+                uint64_t(mDisplayWidth) * uint64_t(mDisplayHeight);
+        const uint64_t totalPixels = fullPixels * mBufferAgeFrames;
+        const uint64_t savedPixels = totalPixels - mRepaintedPixels;
+        result.appendFormat(
+            "   buffer age: %" PRIu64 " frames (%" PRIu64 " full), "
+            "%.0f pixels saved per frame (%.1f%%)\n",
+            mBufferAgeFrames, mBufferAgeFullFrames,
+            mBufferAgeFrames ? double(savedPixels) / mBufferAgeFrames : 0.0,
+            totalPixels ? 100.0 * savedPixels / totalPixels : 0.0);
+    }
+
+    mVisibleRegionCache.dump(result);
+    mFlatteningCache.dump(result);
+
+    if (mComposedFrames) {
+        result.appendFormat(
+            "   frame timing: %" PRIu64 " frames (%" PRIu64 " with GLES), "
+            "compose avg=%.3fms max=%.3fms, posted avg=%.3fms max=%.3fms "
+            "after the refresh started\n",
+            mComposedFrames, mGlesFrames,
+            mTotalComposeTime / 1000000.0 / mComposedFrames,
+            mMaxComposeTime / 1000000.0,
+            mTotalPostLatency / 1000000.0 / mComposedFrames,
+            mMaxPostLatency / 1000000.0);
+    }
+
     String8 surfaceDump;
     mDisplaySurface->dump(surfaceDump);
     result.append(surfaceDump);
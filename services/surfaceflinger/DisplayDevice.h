@@ -31,7 +31,9 @@
 
 #include <hardware/hwcomposer_defs.h>
 
+#include "FlatteningCache.h"
 #include "Transform.h"
+#include "VisibleRegionCache.h"
 
 struct ANativeWindow;
 
@@ -108,6 +110,8 @@ public:
     const Vector< sp<Layer> >& getVisibleLayersSortedByZ() const;
     bool                    getSecureLayerVisible() const;
     Region                  getDirtyRegion(bool repaintEverything) const;
+    VisibleRegionCache&     getVisibleRegionCache() { return mVisibleRegionCache; }
+    FlatteningCache&        getFlatteningCache() const { return mFlatteningCache; }
 
     void                    setLayerStack(uint32_t stack);
     void                    setDisplaySize(const int newWidth, const int newHeight);
@@ -134,9 +138,28 @@ public:
     void swapBuffers(HWComposer& hwc) const;
     status_t compositionComplete() const;
 
+    // Partial composition with EGL_EXT_buffer_age. addDamage records a
+    // region of the display (in screen space) that changed this frame; it's
+    // kept for the last MAX_DAMAGE_HISTORY swaps. getBufferAgeRepaintRegion
+    // returns the area of the back buffer that must be redrawn for it to be
+    // up to date, which is the whole display if its age is unknown. It must
+    // be called with the display's surface current.
+    // setCompositionSignature damages the whole display when the signature
+    // of the layers composed with GLES changed since the previous frame.
+    bool hasBufferAge() const { return mHasBufferAge; }
+    void addDamage(const Region& damage) const;
+    void setCompositionSignature(uint32_t signature) const;
+    Region getBufferAgeRepaintRegion() const;
+
     // called after h/w composer has completed its set() call
     void onSwapBuffersCompleted(HWComposer& hwc) const;
 
+    // onFrameComposed records how long this display took to compose and
+    // how long after the start of the refresh its frame was posted, either
+    // to h/w composer or to its surface. dump() shows the averages.
+    void onFrameComposed(nsecs_t composeTime, nsecs_t postLatency,
+            bool usedGles) const;
+
     Rect getBounds() const {
         return Rect(mDisplayWidth, mDisplayHeight);
     }
@@ -193,6 +216,28 @@ private:
     mutable uint32_t mPageFlipCount;
     String8         mDisplayName;
     bool            mIsSecure;
+    bool            mHasBufferAge;
+
+    /*
+     * Damage history for EGL_EXT_buffer_age, only accessed from the main
+     * thread. mDamageHistory[0] is what changed in the most recently
+     * swapped frame, mPendingDamage what changed since then.
+     */
+    enum { MAX_DAMAGE_HISTORY = 4 };
+    mutable Region  mDamageHistory[MAX_DAMAGE_HISTORY];
+    mutable Region  mPendingDamage;
+    mutable uint32_t mCompositionSignature;
+    mutable uint64_t mBufferAgeFrames;
+    mutable uint64_t mBufferAgeFullFrames;
+    mutable uint64_t mRepaintedPixels;
+
+    // per-frame composition timing, only written from the main thread
+    mutable uint64_t mComposedFrames;
+    mutable uint64_t mGlesFrames;
+    mutable nsecs_t mTotalComposeTime;
+    mutable nsecs_t mMaxComposeTime;
+    mutable nsecs_t mTotalPostLatency;
+    mutable nsecs_t mMaxPostLatency;
 
     /*
      * Can only accessed from the main thread, these members
@@ -202,6 +247,13 @@ private:
     // list of visible layers on that display
     Vector< sp<Layer> > mVisibleLayersSortedByZ;
 
+    // visible regions of the layers on our layer stack
+    VisibleRegionCache mVisibleRegionCache;
+
+    // static layers GLES composes from an offscreen image; it's updated
+    // while composing, hence mutable
+    mutable FlatteningCache mFlatteningCache;
+
     // Whether we have a visible secure layer on this display
     bool mSecureLayerVisible;
 
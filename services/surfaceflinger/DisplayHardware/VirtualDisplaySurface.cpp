@@ -468,6 +468,17 @@ status_t VirtualDisplaySurface::queueBuffer(int pslot,
     return NO_ERROR;
 }
 
+status_t VirtualDisplaySurface::queueAndDequeueBuffer(int pslot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, uint32_t w, uint32_t h,
+        uint32_t format, uint32_t usage, status_t* outDequeueResult) {
+    // The next dequeue depends on the composition of the next frame, so
+    // only the queue part is performed here.
+    status_t result = queueBuffer(pslot, input, output);
+    *outDequeueResult = result != NO_ERROR ? result : WOULD_BLOCK;
+    return result;
+}
+
 void VirtualDisplaySurface::cancelBuffer(int pslot, const sp<Fence>& fence) {
     if (mDisplayId < 0)
         return mSource[SOURCE_SINK]->cancelBuffer(mapProducer2SourceSlot(SOURCE_SINK, pslot), fence);
@@ -107,6 +107,10 @@ private:
     virtual status_t attachBuffer(int* slot, const sp<GraphicBuffer>& buffer);
     virtual status_t queueBuffer(int pslot,
             const QueueBufferInput& input, QueueBufferOutput* output);
+    virtual status_t queueAndDequeueBuffer(int pslot,
+            const QueueBufferInput& input, QueueBufferOutput* output,
+            int* outSlot, sp<Fence>* outFence, uint32_t w, uint32_t h,
+            uint32_t format, uint32_t usage, status_t* outDequeueResult);
     virtual void cancelBuffer(int pslot, const sp<Fence>& fence);
     virtual int query(int what, int* value);
     virtual status_t connect(const sp<IProducerListener>& listener,
@@ -17,9 +17,11 @@
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/types.h>
 
 #include <cutils/compiler.h>
+#include <cutils/properties.h>
 
 #include <gui/BitTube.h>
 #include <gui/IDisplayEventConnection.h>
@@ -38,6 +40,22 @@ namespace android {
 // time to wait between VSYNC requests before sending a VSYNC OFF power hint: 40msec.
 const long vsyncHintOffDelay = 40000000;
 
+// Connections use the shared memory transport when debug.sf.shm_event_channel
+// is set. The receiving end finds out which transport is used when it
+// unparcels the channel, so clients don't need to know about it.
+static sp<BitTube> createDataChannel() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.shm_event_channel", value, "0");
+    if (atoi(value)) {
+        sp<BitTube> channel(new BitTube(BitTube::TRANSPORT_SHARED_MEMORY));
+        if (channel->initCheck() == NO_ERROR) {
+            return channel;
+        }
+        ALOGW("can't create a shared memory event channel, using a socket");
+    }
+    return new BitTube();
+}
+
 static void vsyncOffCallback(union sigval val) {
     EventThread *ev = (EventThread *)val.sival_ptr;
     ev->sendVsyncHintOff();
@@ -56,6 +74,9 @@ EventThread::EventThread(const sp<VSyncSource>& src)
         mVSyncEvent[i].header.id = 0;
         mVSyncEvent[i].header.timestamp = 0;
         mVSyncEvent[i].vsync.count =  0;
+        mVSyncEvent[i].vsync.missed = 0;
+        mVSyncEvent[i].vsync.expectedVsync = 0;
+        mVSyncEvent[i].vsync.deadline = 0;
     }
     struct sigevent se;
     se.sigev_notify = SIGEV_THREAD;
@@ -145,15 +166,23 @@ void EventThread::onScreenAcquired() {
     }
 }
 
-void EventThread::onVSyncEvent(nsecs_t timestamp) {
+void EventThread::onVSyncEvent(nsecs_t timestamp, nsecs_t nextVsync,
+        nsecs_t deadline) {
     Mutex::Autolock _l(mLock);
     mVSyncEvent[0].header.type = DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
     mVSyncEvent[0].header.id = 0;
     mVSyncEvent[0].header.timestamp = timestamp;
     mVSyncEvent[0].vsync.count++;
+    mVSyncEvent[0].vsync.missed = 0;
+    mVSyncEvent[0].vsync.expectedVsync = nextVsync;
+    mVSyncEvent[0].vsync.deadline = deadline;
     mCondition.broadcast();
 }
 
+void EventThread::setPhaseOffset(nsecs_t phaseOffset, nsecs_t deadlineOffset) {
+    mVSyncSource->setPhaseOffset(phaseOffset, deadlineOffset);
+}
+
 void EventThread::onHotplugReceived(int type, bool connected) {
     ALOGE_IF(type >= DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES,
             "received hotplug event for an invalid display (id=%d)", type);
@@ -317,6 +346,8 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     mVSyncEvent[0].header.id = DisplayDevice::DISPLAY_PRIMARY;
                     mVSyncEvent[0].header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
                     mVSyncEvent[0].vsync.count++;
+                    mVSyncEvent[0].vsync.expectedVsync = 0;
+                    mVSyncEvent[0].vsync.deadline = 0;
                 }
             } else {
                 // Nobody is interested in vsync, so we just want to sleep.
@@ -376,7 +407,7 @@ void EventThread::dump(String8& result) const {
 
 EventThread::Connection::Connection(
         const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(new BitTube())
+    : count(-1), mEventThread(eventThread), mChannel(createDataChannel())
 {
 }
 
@@ -45,12 +45,21 @@ public:
     class Callback: public virtual RefBase {
     public:
         virtual ~Callback() {}
-        virtual void onVSyncEvent(nsecs_t when) = 0;
+        // when is the time of the event. nextVsync and deadline are the
+        // predictions sent along with it (see DisplayEventReceiver::Event),
+        // or 0 if the source can't predict them.
+        virtual void onVSyncEvent(nsecs_t when, nsecs_t nextVsync,
+                nsecs_t deadline) = 0;
     };
 
     virtual ~VSyncSource() {}
     virtual void setVSyncEnabled(bool enable) = 0;
     virtual void setCallback(const sp<Callback>& callback) = 0;
+    // moves the events to phaseOffset, and the deadline sent along with
+    // them to deadlineOffset, from the refresh; sources that don't support
+    // it ignore it
+    virtual void setPhaseOffset(nsecs_t /* phaseOffset */,
+            nsecs_t /* deadlineOffset */) { }
 };
 
 class EventThread : public Thread, private VSyncSource::Callback {
@@ -93,6 +102,10 @@ public:
     // called when receiving a hotplug event
     void onHotplugReceived(int type, bool connected);
 
+    // called from main thread when the phase offsets of the vsync events
+    // change
+    void setPhaseOffset(nsecs_t phaseOffset, nsecs_t deadlineOffset);
+
     Vector< sp<EventThread::Connection> > waitForEvent(
             DisplayEventReceiver::Event* event);
 
@@ -103,7 +116,8 @@ private:
     virtual bool        threadLoop();
     virtual void        onFirstRef();
 
-    virtual void onVSyncEvent(nsecs_t timestamp);
+    virtual void onVSyncEvent(nsecs_t timestamp, nsecs_t nextVsync,
+            nsecs_t deadline);
 
     void removeDisplayEventConnection(const wp<Connection>& connection);
     void enableVSyncLocked();
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <utils/String8.h>
+
+#include "FlatteningCache.h"
+
+#include "RenderEngine/RenderEngine.h"
+
+namespace android {
+
+// flattening a single layer doesn't save anything
+static const size_t MIN_FLATTENED_LAYERS = 2;
+
+// the target is freed after this many compositions without using it
+static const uint32_t MAX_IDLE_COMPOSITIONS = 60;
+
+FlatteningCache::Input::Input()
+    : id(0), generation(0), flattenable(false) {
+}
+
+FlatteningCache::FlatteningCache()
+    : mThreshold(0),
+      mEngine(NULL),
+      mTexName(0),
+      mFbName(0),
+      mWidth(0),
+      mHeight(0),
+      mIdleCompositions(0),
+      mCompositions(0),
+      mHits(0),
+      mRenders(0),
+      mLayersFlattened(0) {
+}
+
+FlatteningCache::~FlatteningCache() {
+    releaseTarget();
+}
+
+void FlatteningCache::setThreshold(uint32_t frames) {
+    if (frames != mThreshold) {
+        mThreshold = frames;
+        mFlattened.clear();
+    }
+}
+
+size_t FlatteningCache::update(const Vector<Input>& inputs, bool* outRender) {
+    *outRender = false;
+    mCompositions++;
+
+    // count how many compositions each layer has been unchanged for
+    const size_t count = inputs.size();
+    Vector<Entry> layers;
+    layers.setCapacity(count);
+    for (size_t i = 0; i < count; i++) {
+        Entry entry;
+        entry.id = inputs[i].id;
+        entry.generation = inputs[i].generation;
+        entry.unchangedFrames = 0;
+        if (i < mLayers.size() && isSameLayer(inputs[i], mLayers[i]) &&
+                mLayers[i].unchangedFrames < UINT32_MAX) {
+            entry.unchangedFrames = mLayers[i].unchangedFrames + 1;
+        }
+        layers.add(entry);
+    }
+    mLayers = layers;
+
+    size_t run = 0;
+    if (mThreshold) {
+        while (run < count && inputs[run].flattenable &&
+                mLayers[run].unchangedFrames >= mThreshold) {
+            run++;
+        }
+    }
+
+    // the target can be used as long as none of its layers changed and no
+    // other layer became eligible
+    const size_t flattened = mFlattened.size();
+    bool valid = flattened && flattened <= count && run <= flattened;
+    for (size_t i = 0; valid && i < flattened; i++) {
+        valid = inputs[i].flattenable && isSameLayer(inputs[i], mFlattened[i]);
+    }
+    if (valid) {
+        mIdleCompositions = 0;
+        mHits++;
+        mLayersFlattened += flattened;
+        return flattened;
+    }
+
+    mFlattened.clear();
+    if (run < MIN_FLATTENED_LAYERS) {
+        onIdleComposition();
+        return 0;
+    }
+
+    mFlattened.appendArray(mLayers.array(), run);
+    mIdleCompositions = 0;
+    mRenders++;
+    mLayersFlattened += run;
+    *outRender = true;
+    return run;
+}
+
+void FlatteningCache::onHwcComposition() {
+    // the layers are drawn by h/w composer, the target's image is stale
+    mFlattened.clear();
+    onIdleComposition();
+}
+
+void FlatteningCache::onIdleComposition() {
+    if (mTexName && ++mIdleCompositions > MAX_IDLE_COMPOSITIONS) {
+        releaseTarget();
+    }
+}
+
+void FlatteningCache::invalidate() {
+    mLayers.clear();
+    mFlattened.clear();
+}
+
+void FlatteningCache::setTarget(RenderEngine& engine, uint32_t width,
+        uint32_t height, uint32_t texName, uint32_t fbName) {
+    releaseTarget();
+    mEngine = &engine;
+    mTexName = texName;
+    mFbName = fbName;
+    mWidth = width;
+    mHeight = height;
+}
+
+void FlatteningCache::releaseTarget() {
+    invalidate();
+    if (mEngine) {
+        mEngine->deleteOffscreenTarget(mTexName, mFbName);
+    }
+    mEngine = NULL;
+    mTexName = 0;
+    mFbName = 0;
+    mWidth = 0;
+    mHeight = 0;
+    mIdleCompositions = 0;
+}
+
+bool FlatteningCache::isSameLayer(const Input& input, const Entry& entry) {
+    return input.id == entry.id && input.generation == entry.generation;
+}
+
+void FlatteningCache::dump(String8& result) const {
+    // the target is RGBA 8888
+    const size_t bytes = size_t(mWidth) * mHeight * 4;
+    result.appendFormat("   flattening: %zu layers flattened, target %ux%u "
+            "(%zu KiB)\n", mFlattened.size(), mWidth, mHeight, bytes / 1024);
+    result.appendFormat("      %" PRIu64 " of %" PRIu64 " compositions used "
+            "the target (%.1f%%), %" PRIu64 " renders, "
+            "%.1f layers per use\n",
+            mHits, mCompositions,
+            mCompositions ? 100.0 * mHits / mCompositions : 0.0,
+            mRenders,
+            mHits + mRenders ?
+                    double(mLayersFlattened) / (mHits + mRenders) : 0.0);
+}
+
+}; // namespace android
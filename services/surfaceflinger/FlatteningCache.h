@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FLATTENINGCACHE_H
+#define ANDROID_FLATTENINGCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Vector.h>
+
+namespace android {
+
+class RenderEngine;
+class String8;
+
+// FlatteningCache decides when the bottom layers of a display that GLES
+// composes can be drawn from a single offscreen image instead of one by
+// one. Once a run of at least two bottom layers has been unchanged for a
+// number of compositions, the run is rendered once into the offscreen
+// target and the image is drawn in place of the layers until one of them
+// changes.
+//
+// This class is *NOT* thread-safe; SurfaceFlinger keeps one per display and
+// only uses it on the main thread, with its GL context current.
+class FlatteningCache {
+public:
+    struct Input {
+        Input();
+
+        // identifies the layer; a new layer must never reuse an id
+        int32_t id;
+
+        // changes whenever what the layer draws may have changed
+        uint32_t generation;
+
+        // whether GLES composes the layer and its content may be copied
+        // into the offscreen target
+        bool flattenable;
+    };
+
+    FlatteningCache();
+    ~FlatteningCache();
+
+    // setThreshold sets how many consecutive compositions a layer must be
+    // unchanged before it is flattened; 0 disables the cache.
+    void setThreshold(uint32_t frames);
+
+    // update is called at each GLES composition of the display with its
+    // layers, bottom-most first. It returns how many of the bottom layers
+    // must be drawn from the offscreen target, 0 if none. *outRender is set
+    // if those layers must first be rendered into the target.
+    size_t update(const Vector<Input>& inputs, bool* outRender);
+
+    // onHwcComposition is called instead of update at each composition of
+    // the display that h/w composer does entirely, so that a target left
+    // unused meanwhile is still freed.
+    void onHwcComposition();
+
+    // invalidate forgets the content of the target and how long the layers
+    // have been unchanged; used when the projection of the display changes.
+    void invalidate();
+
+    // setTarget hands the offscreen target over to the cache, which
+    // deletes it with engine when it's released.
+    void setTarget(RenderEngine& engine, uint32_t width, uint32_t height,
+            uint32_t texName, uint32_t fbName);
+
+    // releaseTarget invalidates the cache and frees the offscreen target
+    void releaseTarget();
+
+    bool hasTarget(uint32_t width, uint32_t height) const {
+        return mTexName && mWidth == width && mHeight == height;
+    }
+    uint32_t getTextureName() const { return mTexName; }
+    uint32_t getFramebufferName() const { return mFbName; }
+
+    void dump(String8& result) const;
+
+private:
+    struct Entry {
+        int32_t id;
+        uint32_t generation;
+        uint32_t unchangedFrames;
+    };
+
+    // counts a composition that didn't use the target, and frees it after
+    // too many in a row
+    void onIdleComposition();
+
+    static bool isSameLayer(const Input& input, const Entry& entry);
+
+    uint32_t mThreshold;
+
+    // the layers of the last composition, and the ones in the target
+    Vector<Entry> mLayers;
+    Vector<Entry> mFlattened;
+
+    RenderEngine* mEngine;
+    uint32_t mTexName;
+    uint32_t mFbName;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mIdleCompositions;
+
+    uint64_t mCompositions;
+    uint64_t mHits;
+    uint64_t mRenders;
+    uint64_t mLayersFlattened;
+};
+
+}; // namespace android
+
+#endif // ANDROID_FLATTENINGCACHE_H
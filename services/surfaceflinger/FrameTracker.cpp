@@ -111,6 +111,7 @@ void FrameTracker::clearStats() {
         mFrameRecords[i].actualPresentFence.clear();
     }
     mNumFences = 0;
+    mFrameTimes.reset();
     mFrameRecords[mOffset].desiredPresentTime = INT64_MAX;
     mFrameRecords[mOffset].frameReadyTime = INT64_MAX;
     mFrameRecords[mOffset].actualPresentTime = INT64_MAX;
@@ -142,6 +143,15 @@ void FrameTracker::getStats(FrameStats* outStats) const {
     }
 }
 
+void FrameTracker::getSummary(FrameStatsSummary* outSummary) const {
+    nsecs_t displayPeriod;
+    {
+        Mutex::Autolock lock(mMutex);
+        displayPeriod = mDisplayPeriod;
+    }
+    mFrameTimes.getSummary(displayPeriod, outSummary);
+}
+
 void FrameTracker::logAndResetStats(const String8& name) {
     Mutex::Autolock lock(mMutex);
     logStatsLocked(name);
@@ -184,6 +194,7 @@ void FrameTracker::processFencesLocked() const {
 
 void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
     int* numFrames = const_cast<int*>(mNumFrames);
+    FrameStatsRing& frameTimes = const_cast<FrameStatsRing&>(mFrameTimes);
 
     if (mDisplayPeriod > 0 && isFrameValidLocked(newFrameIdx)) {
         size_t prevFrameIdx = (newFrameIdx+NUM_FRAME_RECORDS-1) %
@@ -196,6 +207,7 @@ void FrameTracker::updateStatsLocked(size_t newFrameIdx) const {
                     mFrameRecords[prevFrameIdx].actualPresentTime;
 
             nsecs_t duration = newPresentTime - prevPresentTime;
+            frameTimes.push(duration);
             int numPeriods = int((duration + mDisplayPeriod/2) /
                     mDisplayPeriod);
 
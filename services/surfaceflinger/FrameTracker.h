@@ -23,6 +23,8 @@
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
 
+#include <ui/FrameStatsRing.h>
+
 namespace android {
 
 class String8;
@@ -84,6 +86,11 @@ public:
     // getStats gets the tracked frame stats.
     void getStats(FrameStats* outStats) const;
 
+    // getSummary computes frame time percentiles and the jank count over
+    // the most recent frames. The frame times are read without blocking the
+    // composition thread.
+    void getSummary(FrameStatsSummary* outSummary) const;
+
     // logAndResetStats dumps the current statistics to the binary event log
     // and then resets the accumulated statistics to their initial values.
     void logAndResetStats(const String8& name);
@@ -151,6 +158,11 @@ private:
     // all frames with duration greater than 2^(NUM_FRAME_BUCKETS-1).
     int32_t mNumFrames[NUM_FRAME_BUCKETS];
 
+    // mFrameTimes holds the duration of the most recent frames, as computed
+    // by updateStatsLocked. All writes happen with mMutex held, reads don't
+    // need it.
+    FrameStatsRing mFrameTimes;
+
     // mDisplayPeriod is the display refresh period of the display for which
     // this FrameTracker is gathering information.
     nsecs_t mDisplayPeriod;
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "DisplayDevice.h"
+#include "HwcCommitThread.h"
+#include "Layer.h"
+#include "SurfaceFlinger.h"
+
+#include "DisplayHardware/HWComposer.h"
+
+namespace android {
+
+HwcCommitThread::HwcCommitThread(const sp<SurfaceFlinger>& flinger,
+        HWComposer& hwc)
+    : mFlinger(flinger),
+      mHwc(hwc),
+      mCommitQueued(false),
+      mCommitPending(false),
+      mResult(NO_ERROR),
+      mCommitTime(0),
+      mCommits(0),
+      mSynchronousCommits(0),
+      mTotalCommitTime(0),
+      mMaxCommitTime(0),
+      mTotalWaitTime(0),
+      mTotalSynchronousTime(0) {
+}
+
+HwcCommitThread::~HwcCommitThread() {
+}
+
+void HwcCommitThread::queueCommit(const Vector<Display>& displays) {
+    Mutex::Autolock lock(mMutex);
+    LOG_ALWAYS_FATAL_IF(mCommitPending,
+            "queueCommit called before the previous commit completed");
+    mDisplays = displays;
+    mCommitQueued = true;
+    mCommitPending = true;
+    mCondition.broadcast();
+}
+
+status_t HwcCommitThread::waitForCommit(nsecs_t* outCommitTime) {
+    Mutex::Autolock lock(mMutex);
+    if (mCommitPending) {
+        ATRACE_NAME("waitForHwcCommit");
+        const nsecs_t start = systemTime();
+        while (mCommitPending) {
+            mCondition.wait(mMutex);
+        }
+        mTotalWaitTime += systemTime() - start;
+    }
+    if (outCommitTime) {
+        *outCommitTime = mCommitTime;
+    }
+    return mResult;
+}
+
+bool HwcCommitThread::isCommitPending() const {
+    Mutex::Autolock lock(mMutex);
+    return mCommitPending;
+}
+
+bool HwcCommitThread::threadLoop() {
+    Vector<Display> displays;
+    {
+        Mutex::Autolock lock(mMutex);
+        while (!mCommitQueued) {
+            mCondition.wait(mMutex);
+        }
+        mCommitQueued = false;
+        displays = mDisplays;
+        mDisplays.clear();
+    }
+
+    const nsecs_t start = systemTime();
+    status_t err;
+    {
+        ATRACE_NAME("HwcCommit");
+        err = mHwc.commit();
+        onFrameCommitted(mHwc, displays);
+        displays.clear();
+    }
+    const nsecs_t end = systemTime();
+    const nsecs_t duration = end - start;
+
+    {
+        Mutex::Autolock lock(mMutex);
+        mResult = err;
+        mCommitTime = end;
+        mCommitPending = false;
+        mCommits++;
+        mTotalCommitTime += duration;
+        if (duration > mMaxCommitTime) {
+            mMaxCommitTime = duration;
+        }
+        mCondition.broadcast();
+    }
+
+    mFlinger->onHwcCommitCompleted();
+    return true;
+}
+
+void HwcCommitThread::onFrameCommitted(HWComposer& hwc,
+        const Vector<Display>& displays) {
+    for (size_t dpy=0 ; dpy<displays.size() ; dpy++) {
+        const sp<const DisplayDevice>& hw(displays[dpy].hw);
+        const Vector< sp<Layer> >& currentLayers(displays[dpy].layers);
+        hw->onSwapBuffersCompleted(hwc);
+        const size_t count = currentLayers.size();
+        int32_t id = hw->getHwcDisplayId();
+        if (id >=0 && hwc.initCheck() == NO_ERROR) {
+            HWComposer::LayerListIterator cur = hwc.begin(id);
+            const HWComposer::LayerListIterator end = hwc.end(id);
+            for (size_t i = 0; cur != end && i < count; ++i, ++cur) {
+                currentLayers[i]->onLayerDisplayed(hw, &*cur);
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                currentLayers[i]->onLayerDisplayed(hw, NULL);
+            }
+        }
+    }
+}
+
+void HwcCommitThread::onSynchronousCommit(nsecs_t duration) {
+    Mutex::Autolock lock(mMutex);
+    mSynchronousCommits++;
+    mTotalSynchronousTime += duration;
+}
+
+void HwcCommitThread::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    // the main thread only waited for part of each commit, the rest of the
+    // commit overlapped with the work it did in the meantime
+    const nsecs_t overlap = mTotalCommitTime - mTotalWaitTime;
+    result.appendFormat("H/W composer commit thread: %" PRIu64 " commits "
+            "(%" PRIu64 " synchronous)\n", mCommits, mSynchronousCommits);
+    result.appendFormat("  commit avg=%.3fms max=%.3fms, main thread waited "
+            "avg=%.3fms, overlap %.1f%%, synchronous avg=%.3fms\n",
+            mCommits ? mTotalCommitTime / 1000000.0 / mCommits : 0.0,
+            mMaxCommitTime / 1000000.0,
+            mCommits ? mTotalWaitTime / 1000000.0 / mCommits : 0.0,
+            mTotalCommitTime ? 100.0 * overlap / mTotalCommitTime : 0.0,
+            mSynchronousCommits ?
+                    mTotalSynchronousTime / 1000000.0 / mSynchronousCommits :
+                    0.0);
+}
+
+}; // namespace android
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HWCCOMMITTHREAD_H
+#define ANDROID_HWCCOMMITTHREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class DisplayDevice;
+class HWComposer;
+class Layer;
+class String8;
+class SurfaceFlinger;
+
+// HwcCommitThread commits the composed frame to h/w composer and hands the
+// release fences back to the display surfaces and the layers, so that the
+// main thread doesn't block while the HAL's set() runs. The main thread
+// queues the commit at the end of a refresh and must call waitForCommit()
+// before it touches h/w composer or latches buffers again, since the
+// release fences of the previous frame must be set first. Each completed
+// commit is reported to the main thread with a message, so that the
+// post-composition work runs even when no other frame follows.
+class HwcCommitThread : public Thread {
+public:
+    struct Display {
+        sp<const DisplayDevice> hw;
+        Vector< sp<Layer> > layers;
+    };
+
+    HwcCommitThread(const sp<SurfaceFlinger>& flinger, HWComposer& hwc);
+    virtual ~HwcCommitThread();
+
+    // queueCommit starts committing the current frame of displays
+    void queueCommit(const Vector<Display>& displays);
+
+    // waitForCommit blocks until the queued commit, if any, completed and
+    // returns its result. *outCommitTime, if given, is set to when the last
+    // commit completed.
+    status_t waitForCommit(nsecs_t* outCommitTime = NULL);
+
+    // isCommitPending returns true while the queued commit, if any, hasn't
+    // completed
+    bool isCommitPending() const;
+
+    // onFrameCommitted passes the release fences of the frame h/w composer
+    // just committed on to the display surfaces and the layers. The main
+    // thread uses it directly when it commits the frame itself.
+    static void onFrameCommitted(HWComposer& hwc,
+            const Vector<Display>& displays);
+
+    // onSynchronousCommit records the duration of a commit done on the
+    // main thread, so that dump() shows how often commits aren't
+    // pipelined
+    void onSynchronousCommit(nsecs_t duration);
+
+    void dump(String8& result) const;
+
+private:
+    virtual bool threadLoop();
+
+    sp<SurfaceFlinger> mFlinger;
+    HWComposer& mHwc;
+
+    mutable Mutex mMutex;
+    Condition mCondition;
+
+    // protected by mMutex
+    Vector<Display> mDisplays;
+    bool mCommitQueued;
+    bool mCommitPending;
+    status_t mResult;
+    nsecs_t mCommitTime;
+    uint64_t mCommits;
+    uint64_t mSynchronousCommits;
+    nsecs_t mTotalCommitTime;
+    nsecs_t mMaxCommitTime;
+    nsecs_t mTotalWaitTime;
+    nsecs_t mTotalSynchronousTime;
+};
+
+}; // namespace android
+
+#endif // ANDROID_HWCCOMMITTHREAD_H
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <math.h>
+#include <inttypes.h>
 
 #include <cutils/compiler.h>
 #include <cutils/native_handle.h>
@@ -73,6 +74,10 @@ Layer::Layer(SurfaceFlinger* flinger, const sp<Client>& client,
         mCurrentOpacity(true),
         mRefreshPending(false),
         mFrameLatencyNeeded(false),
+        mContentGeneration(0),
+        mFrontBufferDeferred(false),
+        mDeferredFrames(0),
+        mDeferredLatches(0),
         mFiltering(false),
         mNeedsFiltering(false),
         mMesh(Mesh::TRIANGLE_FAN, 4, 2, 2),
@@ -778,6 +783,14 @@ bool Layer::isFixedSize() const {
     return mCurrentScalingMode != NATIVE_WINDOW_SCALING_MODE_FREEZE;
 }
 
+bool Layer::isFlattenable() const {
+    // protected content must not be copied, and sideband streams aren't
+    // drawn by GLES at all. The flattened image is blended as premultiplied
+    // alpha, which only matches drawing the layers for premultiplied ones.
+    return mActiveBuffer != 0 && mSidebandStream == NULL && !isProtected() &&
+            mPremultipliedAlpha;
+}
+
 bool Layer::isCropped() const {
     return !mCurrentCrop.isEmpty();
 }
@@ -909,6 +922,7 @@ uint32_t Layer::doTransaction(uint32_t flags) {
 
 void Layer::commitTransaction() {
     mDrawingState = mCurrentState;
+    mContentGeneration++;
 }
 
 uint32_t Layer::getTransactionFlags(uint32_t flags) {
@@ -1042,6 +1056,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
     if (android_atomic_acquire_cas(true, false, &mSidebandStreamChanged) == 0) {
         // mSidebandStreamChanged was true
         mSidebandStream = mSurfaceFlingerConsumer->getSidebandStream();
+        mContentGeneration++;
         recomputeVisibleRegions = true;
 
         const State& s(getDrawingState());
@@ -1060,6 +1075,24 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
             return outDirtyRegion;
         }
 
+        // Don't latch a buffer the producer is still rendering into: the
+        // composition would have to wait for its fence, and could make
+        // every layer miss the refresh. The previous buffer stays on screen
+        // and we try again at the next refresh.
+        if (!mFlinger->mLatchUnsignaledBuffers &&
+                !mSurfaceFlingerConsumer->isFrontBufferReady(
+                        mFlinger->mPrimaryDispSync)) {
+            ATRACE_NAME("frontBufferNotReady");
+            if (!mFrontBufferDeferred) {
+                mFrontBufferDeferred = true;
+                mDeferredFrames++;
+            }
+            mDeferredLatches++;
+            mFlinger->signalLayerUpdate();
+            return outDirtyRegion;
+        }
+        mFrontBufferDeferred = false;
+
         // Capture the old state of the layer for comparisons later
         const State& s(getDrawingState());
         const bool oldOpacity = isOpaque(s);
@@ -1197,6 +1230,7 @@ Region Layer::latchBuffer(bool& recomputeVisibleRegions)
 
         // update the active buffer
         mActiveBuffer = mSurfaceFlingerConsumer->getCurrentBuffer();
+        mContentGeneration++;
         if (mActiveBuffer == NULL) {
             // this can only happen if the very first buffer was rejected.
             return outDirtyRegion;
@@ -1322,6 +1356,13 @@ void Layer::dump(String8& result, Colorizer& colorizer) const
             mFormat, w0, h0, s0,f0,
             mQueuedFrames, mRefreshPending);
 
+    if (mDeferredFrames) {
+        result.appendFormat("      "
+                "unsignaled buffers: %" PRIu64 " frames latched late "
+                "(%" PRIu64 " refreshes deferred)\n",
+                mDeferredFrames, mDeferredLatches);
+    }
+
     if (mSurfaceFlingerConsumer != 0) {
         mSurfaceFlingerConsumer->dump(result, "            ");
     }
@@ -1343,6 +1384,10 @@ void Layer::getFrameStats(FrameStats* outStats) const {
     mFrameTracker.getStats(outStats);
 }
 
+void Layer::getFrameStatsSummary(FrameStatsSummary* outSummary) const {
+    mFrameTracker.getSummary(outSummary);
+}
+
 // ---------------------------------------------------------------------------
 
 Layer::LayerCleaner::LayerCleaner(const sp<SurfaceFlinger>& flinger,
@@ -184,6 +184,12 @@ public:
      */
     virtual bool isFixedSize() const;
 
+    /*
+     * isFlattenable - true if what the layer draws may be cached in an
+     * offscreen image, see FlatteningCache
+     */
+    virtual bool isFlattenable() const;
+
 protected:
     /*
      * onDraw - draws the surface.
@@ -286,6 +292,12 @@ public:
      */
     bool hasQueuedFrame() const { return mQueuedFrames > 0 || mSidebandStreamChanged; }
 
+    /*
+     * Returns a number that changes whenever what the layer draws may have
+     * changed: when a buffer is latched or a transaction is committed.
+     */
+    uint32_t getContentGeneration() const { return mContentGeneration; }
+
     // -----------------------------------------------------------------------
 
     void clearWithOpenGL(const sp<const DisplayDevice>& hw, const Region& clip) const;
@@ -306,6 +318,7 @@ public:
     void clearFrameStats();
     void logFrameStats();
     void getFrameStats(FrameStats* outStats) const;
+    void getFrameStatsSummary(FrameStatsSummary* outSummary) const;
 
 protected:
     // constant
@@ -382,6 +395,14 @@ private:
     bool mCurrentOpacity;
     bool mRefreshPending;
     bool mFrameLatencyNeeded;
+    uint32_t mContentGeneration;
+    // Whether the front buffer wasn't latched because its acquire fence
+    // hadn't signaled, and how often that happened: mDeferredFrames counts
+    // the frames latched later instead of stalling the composition,
+    // mDeferredLatches the refreshes that skipped them.
+    bool mFrontBufferDeferred;
+    uint64_t mDeferredFrames;
+    uint64_t mDeferredLatches;
     // Whether filtering is forced on or not
     bool mFiltering;
     // Whether filtering is needed b/c of the drawingstate
@@ -40,6 +40,7 @@ public:
     virtual bool isSecure() const         { return false; }
     virtual bool isFixedSize() const      { return true; }
     virtual bool isVisible() const;
+    virtual bool isFlattenable() const    { return true; }
 };
 
 // ---------------------------------------------------------------------------
@@ -87,6 +87,7 @@ void MessageQueue::Handler::handleMessage(const Message& message) {
 // ---------------------------------------------------------------------------
 
 MessageQueue::MessageQueue()
+    : mVsyncTimestamp(0)
 {
 }
 
@@ -185,6 +186,7 @@ int MessageQueue::eventReceiver(int /*fd*/, int /*events*/) {
     while ((n = DisplayEventReceiver::getEvents(mEventTube, buffer, 8)) > 0) {
         for (int i=0 ; i<n ; i++) {
             if (buffer[i].header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+                mVsyncTimestamp = buffer[i].header.timestamp;
 #if INVALIDATE_ON_VSYNC
                 mHandler->dispatchInvalidate();
 #else
@@ -197,6 +199,12 @@ int MessageQueue::eventReceiver(int /*fd*/, int /*events*/) {
     return 1;
 }
 
+nsecs_t MessageQueue::takeVsyncTimestamp() {
+    const nsecs_t timestamp = mVsyncTimestamp;
+    mVsyncTimestamp = 0;
+    return timestamp;
+}
+
 // ---------------------------------------------------------------------------
 
 }; // namespace android
@@ -84,7 +84,7 @@ class MessageQueue {
     sp<IDisplayEventConnection> mEvents;
     sp<BitTube> mEventTube;
     sp<Handler> mHandler;
-
+    nsecs_t mVsyncTimestamp;
 
     static int cb_eventReceiver(int fd, int events, void* data);
     int eventReceiver(int fd, int events);
@@ -110,6 +110,9 @@ public:
     void refresh();
     // sends TRANSACTION message immediately
     void invalidateTransactionNow();
+    // returns the time of the last VSYNC event received and forgets it, or
+    // 0 if none was received since the last call
+    nsecs_t takeVsyncTimestamp();
 };
 
 // ---------------------------------------------------------------------------
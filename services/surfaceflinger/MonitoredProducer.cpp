@@ -84,6 +84,14 @@ status_t MonitoredProducer::queueBuffer(int slot, const QueueBufferInput& input,
     return mProducer->queueBuffer(slot, input, output);
 }
 
+status_t MonitoredProducer::queueAndDequeueBuffer(int slot,
+        const QueueBufferInput& input, QueueBufferOutput* output,
+        int* outSlot, sp<Fence>* outFence, uint32_t w, uint32_t h,
+        uint32_t format, uint32_t usage, status_t* outDequeueResult) {
+    return mProducer->queueAndDequeueBuffer(slot, input, output, outSlot,
+            outFence, w, h, format, usage, outDequeueResult);
+}
+
 void MonitoredProducer::cancelBuffer(int slot, const sp<Fence>& fence) {
     mProducer->cancelBuffer(slot, fence);
 }
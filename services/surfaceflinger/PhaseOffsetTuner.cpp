@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <utils/String8.h>
+
+#include "PhaseOffsetTuner.h"
+
+namespace android {
+
+// time left between the commit of a frame and the vsync, for scheduling
+// jitter; the refresh durations include the commit itself
+static const nsecs_t COMPOSITION_MARGIN = 1000000;
+
+// the offset moves later by this much at a time, at most once per interval
+static const nsecs_t RAISE_STEP = 500000;
+static const uint64_t RAISE_INTERVAL = 60;
+
+// a missed frame moves the offset earlier by this much, and keeps it from
+// moving later for a while
+static const nsecs_t MISS_STEP = 2000000;
+static const uint64_t MISS_HOLD = 600;
+
+PhaseOffsetTuner::PhaseOffsetTuner()
+    : mPeriod(0),
+      mMinOffset(0),
+      mMaxOffset(0),
+      mOffset(0),
+      mNumDurations(0),
+      mNextDuration(0),
+      mMissedFrame(false),
+      mFrame(0),
+      mLastChangeFrame(0),
+      mLastMissFrame(0),
+      mChanged(false),
+      mMinLateness(0),
+      mPresentedFrames(0),
+      mMissedFrames(0),
+      mNumDecisions(0),
+      mNextDecision(0) {
+}
+
+void PhaseOffsetTuner::configure(nsecs_t period, nsecs_t minOffset,
+        nsecs_t maxOffset, nsecs_t offset) {
+    Mutex::Autolock lock(mMutex);
+    mPeriod = period;
+    mMinOffset = minOffset;
+    mMaxOffset = maxOffset;
+    resetLocked(offset);
+}
+
+void PhaseOffsetTuner::addRefreshDuration(nsecs_t duration) {
+    Mutex::Autolock lock(mMutex);
+    mDurations[mNextDuration] = duration;
+    mNextDuration = (mNextDuration + 1) % NUM_DURATIONS;
+    if (mNumDurations < NUM_DURATIONS) {
+        mNumDurations++;
+    }
+}
+
+void PhaseOffsetTuner::addPresentTime(nsecs_t expectedPresent,
+        nsecs_t presentTime) {
+    Mutex::Autolock lock(mMutex);
+    const nsecs_t lateness = presentTime - expectedPresent;
+    if (!mPresentedFrames || lateness < mMinLateness) {
+        mMinLateness = lateness;
+    }
+    mPresentedFrames++;
+    if (lateness - mMinLateness > mPeriod / 2) {
+        mMissedFrames++;
+        mMissedFrame = true;
+    }
+}
+
+bool PhaseOffsetTuner::update(nsecs_t* outOffset) {
+    Mutex::Autolock lock(mMutex);
+    mFrame++;
+
+    if (mMissedFrame) {
+        mMissedFrame = false;
+        mLastMissFrame = mFrame;
+        setOffsetLocked(clampLocked(mOffset - MISS_STEP), REASON_MISSED_FRAME);
+    } else if (mNumDurations) {
+        // the latest offset that leaves the slowest recent composition
+        // enough time before the vsync
+        const nsecs_t target = mPeriod -
+                (getMaxDurationLocked() + COMPOSITION_MARGIN);
+        const bool holding = mLastMissFrame &&
+                mFrame - mLastMissFrame < MISS_HOLD;
+        if (target < mOffset) {
+            // leave a step of headroom, so that small variations in the
+            // composition time don't move the offset back and forth
+            setOffsetLocked(clampLocked(target - RAISE_STEP),
+                    REASON_EXPENSIVE);
+        } else if (target - mOffset >= RAISE_STEP && !holding &&
+                mNumDurations == NUM_DURATIONS &&
+                mFrame - mLastChangeFrame >= RAISE_INTERVAL) {
+            setOffsetLocked(clampLocked(mOffset + RAISE_STEP), REASON_CHEAP);
+        }
+    }
+
+    const bool changed = mChanged;
+    mChanged = false;
+    *outOffset = mOffset;
+    return changed;
+}
+
+nsecs_t PhaseOffsetTuner::getOffset() const {
+    Mutex::Autolock lock(mMutex);
+    return mOffset;
+}
+
+void PhaseOffsetTuner::resetLocked(nsecs_t offset) {
+    mOffset = clampLocked(offset);
+    mNumDurations = 0;
+    mNextDuration = 0;
+    mMissedFrame = false;
+    mLastChangeFrame = mFrame;
+    mLastMissFrame = 0;
+    mChanged = false;
+    mMinLateness = 0;
+    mPresentedFrames = 0;
+    mMissedFrames = 0;
+}
+
+nsecs_t PhaseOffsetTuner::clampLocked(nsecs_t offset) const {
+    const nsecs_t lo = mMinOffset > 0 ? mMinOffset : 0;
+    nsecs_t hi = mMaxOffset < mPeriod - 1 ? mMaxOffset : mPeriod - 1;
+    if (hi < lo) {
+        hi = lo;
+    }
+    return offset < lo ? lo : (offset > hi ? hi : offset);
+}
+
+nsecs_t PhaseOffsetTuner::getMaxDurationLocked() const {
+    nsecs_t maxDuration = 0;
+    for (size_t i = 0; i < mNumDurations; i++) {
+        if (mDurations[i] > maxDuration) {
+            maxDuration = mDurations[i];
+        }
+    }
+    return maxDuration;
+}
+
+void PhaseOffsetTuner::setOffsetLocked(nsecs_t offset, Reason reason) {
+    if (offset == mOffset) {
+        return;
+    }
+    Decision& decision(mDecisions[mNextDecision]);
+    decision.frame = mFrame;
+    decision.oldOffset = mOffset;
+    decision.newOffset = offset;
+    decision.maxDuration = getMaxDurationLocked();
+    decision.reason = reason;
+    mNextDecision = (mNextDecision + 1) % NUM_DECISIONS;
+    if (mNumDecisions < NUM_DECISIONS) {
+        mNumDecisions++;
+    }
+
+    mOffset = offset;
+    mLastChangeFrame = mFrame;
+    mChanged = true;
+}
+
+const char* PhaseOffsetTuner::reasonName(Reason reason) {
+    switch (reason) {
+        case REASON_CHEAP: return "cheap composition";
+        case REASON_EXPENSIVE: return "expensive composition";
+        case REASON_MISSED_FRAME: return "missed frame";
+    }
+    return "unknown";
+}
+
+void PhaseOffsetTuner::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("SF phase offset tuning: offset %" PRId64 " ns "
+            "(bounds %" PRId64 "..%" PRId64 " ns), composition max %.3fms "
+            "over %zu frames\n", mOffset, clampLocked(INT64_MIN),
+            clampLocked(INT64_MAX), getMaxDurationLocked() / 1000000.0,
+            mNumDurations);
+    result.appendFormat("  %" PRIu64 " of %" PRIu64 " presented frames "
+            "missed their vsync (present fence latency %.3fms)\n",
+            mMissedFrames, mPresentedFrames, mMinLateness / 1000000.0);
+    for (size_t i = 0; i < mNumDecisions; i++) {
+        const size_t idx = (mNextDecision + NUM_DECISIONS - mNumDecisions + i)
+                % NUM_DECISIONS;
+        const Decision& decision(mDecisions[idx]);
+        result.appendFormat("  frame %" PRIu64 ": %" PRId64 " -> %" PRId64
+                " ns, %s (composition max %.3fms)\n", decision.frame,
+                decision.oldOffset, decision.newOffset,
+                reasonName(decision.reason),
+                decision.maxDuration / 1000000.0);
+    }
+}
+
+}; // namespace android
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_PHASEOFFSETTUNER_H
+#define ANDROID_PHASEOFFSETTUNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class String8;
+
+// PhaseOffsetTuner picks the phase offset of SurfaceFlinger's vsync events
+// from how long the recent compositions took. SurfaceFlinger wakes up at
+// the offset after a vsync and must be done before the next one, so the
+// later it wakes up the lower the latency, but the less time composition
+// has. The offset is moved later, a step at a time, while the compositions
+// leave enough time before the next vsync, and moved earlier as soon as
+// they don't or a frame misses its vsync. It stays within the bounds it's
+// given, which are within a refresh period.
+//
+// SurfaceFlinger feeds it from its main thread; dump() may be called from
+// any thread.
+class PhaseOffsetTuner {
+public:
+    PhaseOffsetTuner();
+
+    // configure sets the refresh period and the range the offset is kept
+    // in, and starts over from offset, clamped to that range.
+    void configure(nsecs_t period, nsecs_t minOffset, nsecs_t maxOffset,
+            nsecs_t offset);
+
+    // addRefreshDuration records how long a refresh took, from the vsync
+    // event that woke SurfaceFlinger up to the commit of the frame
+    void addRefreshDuration(nsecs_t duration);
+
+    // addPresentTime records when a frame expected to be presented at the
+    // vsync at expectedPresent actually was. Displays may signal present
+    // fences a fixed number of refreshes later, so a frame counts as missed
+    // when it's over half a period later than the earliest frame seen.
+    void addPresentTime(nsecs_t expectedPresent, nsecs_t presentTime);
+
+    // update is called once per composition, after the samples of the
+    // composition were added. It returns true and sets *outOffset if the
+    // offset must change.
+    bool update(nsecs_t* outOffset);
+
+    nsecs_t getOffset() const;
+
+    void dump(String8& result) const;
+
+private:
+    enum Reason {
+        REASON_CHEAP,
+        REASON_EXPENSIVE,
+        REASON_MISSED_FRAME,
+    };
+
+    struct Decision {
+        uint64_t frame;
+        nsecs_t oldOffset;
+        nsecs_t newOffset;
+        nsecs_t maxDuration;
+        Reason reason;
+    };
+
+    enum { NUM_DURATIONS = 120 };
+    enum { NUM_DECISIONS = 16 };
+
+    void resetLocked(nsecs_t offset);
+    nsecs_t clampLocked(nsecs_t offset) const;
+    nsecs_t getMaxDurationLocked() const;
+    void setOffsetLocked(nsecs_t offset, Reason reason);
+
+    static const char* reasonName(Reason reason);
+
+    mutable Mutex mMutex;
+
+    nsecs_t mPeriod;
+    nsecs_t mMinOffset;
+    nsecs_t mMaxOffset;
+    nsecs_t mOffset;
+
+    // the durations of the last compositions, in a ring
+    nsecs_t mDurations[NUM_DURATIONS];
+    size_t mNumDurations;
+    size_t mNextDuration;
+
+    bool mMissedFrame;
+    uint64_t mFrame;
+    uint64_t mLastChangeFrame;
+    uint64_t mLastMissFrame;
+    bool mChanged;
+
+    nsecs_t mMinLateness;
+    uint64_t mPresentedFrames;
+    uint64_t mMissedFrames;
+
+    // the last decisions, in a ring
+    Decision mDecisions[NUM_DECISIONS];
+    size_t mNumDecisions;
+    size_t mNextDecision;
+};
+
+}; // namespace android
+
+#endif // ANDROID_PHASEOFFSETTUNER_H
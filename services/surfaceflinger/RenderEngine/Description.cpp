@@ -88,5 +88,19 @@ void Description::setColorMatrix(const mat4& mtx) {
     mColorMatrixEnabled = (mtx != identity);
 }
 
+bool Description::canBatchWith(const Description& other) const {
+    if (mTextureEnabled || other.mTextureEnabled) {
+        return false;
+    }
+    if (mColorMatrixEnabled != other.mColorMatrixEnabled ||
+            (mColorMatrixEnabled && mColorMatrix != other.mColorMatrix)) {
+        return false;
+    }
+    return mPlaneAlpha == other.mPlaneAlpha &&
+            mPremultipliedAlpha == other.mPremultipliedAlpha &&
+            mOpaque == other.mOpaque &&
+            memcmp(mColor, other.mColor, sizeof(mColor)) == 0 &&
+            mProjectionMatrix == other.mProjectionMatrix;
+}
 
 } /* namespace android */
@@ -67,6 +67,12 @@ public:
     void setProjectionMatrix(const mat4& mtx);
     void setColorMatrix(const mat4& mtx);
 
+    bool isTextureEnabled() const { return mTextureEnabled; }
+
+    // whether draws with this and other can share a single draw call,
+    // which is the case when neither is textured and all uniforms match
+    bool canBatchWith(const Description& other) const;
+
 private:
     bool mUniformsDirty;
 };
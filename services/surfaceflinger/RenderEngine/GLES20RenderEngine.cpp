@@ -21,11 +21,13 @@
 
 #include <ui/Rect.h>
 
+#include <utils/Log.h>
 #include <utils/String8.h>
 #include <utils/Trace.h>
 
 #include <cutils/compiler.h>
 #include <gui/ISurfaceComposer.h>
+#include <inttypes.h>
 #include <math.h>
 
 #include "GLES20RenderEngine.h"
@@ -40,7 +42,11 @@ namespace android {
 // ---------------------------------------------------------------------------
 
 GLES20RenderEngine::GLES20RenderEngine() :
-        mVpWidth(0), mVpHeight(0) {
+        mVpWidth(0), mVpHeight(0),
+        mBatchVertexCount(0), mBatchMeshes(0),
+        mVertexBuffer(0), mVertexBufferOffset(0),
+        mFrameCount(0), mTotalDrawCalls(0), mTotalMeshes(0),
+        mTotalVertexBytes(0) {
 
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxTextureSize);
     glGetIntegerv(GL_MAX_VIEWPORT_DIMS, mMaxViewportDims);
@@ -64,6 +70,11 @@ GLES20RenderEngine::GLES20RenderEngine() :
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0,
             GL_RGB, GL_UNSIGNED_SHORT_5_6_5, protTexData);
 
+    glGenBuffers(1, &mVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, VERTEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
     //mColorBlindnessCorrection = M;
 }
 
@@ -85,6 +96,8 @@ void GLES20RenderEngine::setViewportAndProjection(
         size_t vpw, size_t vph, Rect sourceCrop, size_t hwh, bool yswap,
         Transform::orientation_flags rotation) {
 
+    flushBatch();
+
     size_t l = sourceCrop.left;
     size_t r = sourceCrop.right;
 
@@ -131,10 +144,11 @@ void GLES20RenderEngine::setupLayerBlending(
     mState.setPlaneAlpha(alpha / 255.0f);
 
     if (alpha < 0xFF || !opaque) {
-        glEnable(GL_BLEND);
-        glBlendFunc(premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        mBlend.enabled = true;
+        mBlend.src = premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA;
+        mBlend.dst = GL_ONE_MINUS_SRC_ALPHA;
     } else {
-        glDisable(GL_BLEND);
+        mBlend.enabled = false;
     }
 }
 
@@ -146,10 +160,11 @@ void GLES20RenderEngine::setupDimLayerBlending(int alpha) {
     mState.disableTexture();
 
     if (alpha == 0xFF) {
-        glDisable(GL_BLEND);
+        mBlend.enabled = false;
     } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        mBlend.enabled = true;
+        mBlend.src = GL_ONE;
+        mBlend.dst = GL_ONE_MINUS_SRC_ALPHA;
     }
 }
 
@@ -180,12 +195,14 @@ void GLES20RenderEngine::disableTexturing() {
 }
 
 void GLES20RenderEngine::disableBlending() {
-    glDisable(GL_BLEND);
+    mBlend.enabled = false;
 }
 
 
 void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
         uint32_t* texName, uint32_t* fbName, uint32_t* status) {
+    flushBatch();
+
     GLuint tname, name;
     // turn our EGLImage into a texture
     glGenTextures(1, &tname);
@@ -203,6 +220,7 @@ void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
 }
 
 void GLES20RenderEngine::unbindFramebuffer(uint32_t texName, uint32_t fbName) {
+    flushBatch();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fbName);
     glDeleteTextures(1, &texName);
@@ -214,37 +232,163 @@ void GLES20RenderEngine::setupFillWithColor(float r, float g, float b, float a)
     mState.setOpaque(false);
     mState.setColor(r, g, b, a);
     mState.disableTexture();
-    glDisable(GL_BLEND);
+    mBlend.enabled = false;
 }
 
 void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
+    if (!mState.isTextureEnabled() && mesh.getVertexSize() == 2) {
+        if (mBatchMeshes &&
+                !(mBatchBlend == mBlend && mBatchState.canBatchWith(mState))) {
+            flushBatch();
+        }
+        if (!mBatchMeshes) {
+            mBatchState = mState;
+            mBatchBlend = mBlend;
+        }
+        appendToBatch(mesh);
+        return;
+    }
 
-    ProgramCache::getInstance().useProgram(mState);
+    // textured draws depend on texture bindings made outside of the engine,
+    // so they are never deferred
+    flushBatch();
+    drawVertices(mState, mBlend, mesh.getPrimitive(), mesh.getPositions(),
+            mesh.getVertexCount(), mesh.getVertexSize(),
+            mesh.getTexCoordsSize(), mesh.getByteStride());
+    mFrameStats.meshes++;
+}
+
+void GLES20RenderEngine::appendToBatch(const Mesh& mesh) {
+    const size_t count = mesh.getVertexCount();
+    if (count < 3) {
+        return;
+    }
+
+    // everything is converted to independent triangles
+    const size_t triangles = mesh.getPrimitive() == Mesh::TRIANGLES ?
+            count / 3 : count - 2;
+    const size_t needed = (mBatchVertexCount + triangles * 3) * 2;
+    if (mBatchVertices.size() < needed) {
+        mBatchVertices.resize(needed);
+    }
 
-    if (mesh.getTexCoordsSize()) {
+    const float* src = mesh.getPositions();
+    const size_t stride = mesh.getStride();
+    float* dst = mBatchVertices.editArray() + mBatchVertexCount * 2;
+    for (size_t t=0 ; t<triangles ; t++) {
+        size_t v[3];
+        switch (mesh.getPrimitive()) {
+            case Mesh::TRIANGLE_FAN:
+                v[0] = 0; v[1] = t + 1; v[2] = t + 2;
+                break;
+            case Mesh::TRIANGLE_STRIP:
+                v[0] = t; v[1] = t + 1; v[2] = t + 2;
+                break;
+            default:
+                v[0] = t*3; v[1] = t*3 + 1; v[2] = t*3 + 2;
+                break;
+        }
+        for (size_t i=0 ; i<3 ; i++) {
+            *dst++ = src[v[i] * stride];
+            *dst++ = src[v[i] * stride + 1];
+        }
+    }
+    mBatchVertexCount += triangles * 3;
+    mBatchMeshes++;
+}
+
+void GLES20RenderEngine::flushBatch() {
+    if (!mBatchMeshes) {
+        return;
+    }
+    drawVertices(mBatchState, mBatchBlend, GL_TRIANGLES,
+            mBatchVertices.array(), mBatchVertexCount, 2, 0, 2 * sizeof(float));
+    mFrameStats.meshes += mBatchMeshes;
+    mBatchVertexCount = 0;
+    mBatchMeshes = 0;
+}
+
+void GLES20RenderEngine::endFrame() {
+    flushBatch();
+    mLastFrameStats = mFrameStats;
+    mFrameCount++;
+    mTotalDrawCalls += mFrameStats.drawCalls;
+    mTotalMeshes += mFrameStats.meshes;
+    mTotalVertexBytes += mFrameStats.vertexBytes;
+    mFrameStats = FrameStats();
+}
+
+void GLES20RenderEngine::drawVertices(const Description& state,
+        const Blend& blend, GLenum primitive, const float* vertices,
+        size_t vertexCount, size_t vertexSize, size_t texCoordsSize,
+        size_t byteStride) {
+
+    if (blend.enabled) {
+        glEnable(GL_BLEND);
+        glBlendFunc(blend.src, blend.dst);
+    } else {
+        glDisable(GL_BLEND);
+    }
+
+    ProgramCache::getInstance().useProgram(state);
+
+    const size_t size = vertexCount * byteStride;
+    const GLvoid* positions = vertices;
+    const GLvoid* texCoords = vertices + vertexSize;
+    ssize_t offset = uploadVertices(vertices, size);
+    if (offset >= 0) {
+        positions = reinterpret_cast<const GLvoid*>(offset);
+        texCoords = reinterpret_cast<const GLvoid*>(
+                offset + vertexSize * sizeof(float));
+    }
+
+    if (texCoordsSize) {
         glEnableVertexAttribArray(Program::texCoords);
         glVertexAttribPointer(Program::texCoords,
-                mesh.getTexCoordsSize(),
+                texCoordsSize,
                 GL_FLOAT, GL_FALSE,
-                mesh.getByteStride(),
-                mesh.getTexCoords());
+                byteStride,
+                texCoords);
     }
 
     glVertexAttribPointer(Program::position,
-            mesh.getVertexSize(),
+            vertexSize,
             GL_FLOAT, GL_FALSE,
-            mesh.getByteStride(),
-            mesh.getPositions());
+            byteStride,
+            positions);
 
-    glDrawArrays(mesh.getPrimitive(), 0, mesh.getVertexCount());
+    glDrawArrays(primitive, 0, vertexCount);
 
-    if (mesh.getTexCoordsSize()) {
+    if (texCoordsSize) {
         glDisableVertexAttribArray(Program::texCoords);
     }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    mFrameStats.drawCalls++;
+    mFrameStats.vertexBytes += size;
+}
+
+ssize_t GLES20RenderEngine::uploadVertices(const float* data, size_t size) {
+    if (mVertexBuffer == 0 || size > VERTEX_BUFFER_SIZE) {
+        return -1;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mVertexBuffer);
+    if (mVertexBufferOffset + size > VERTEX_BUFFER_SIZE) {
+        // orphan the storage rather than waiting for the GPU to be done
+        // with the draws that use it
+        glBufferData(GL_ARRAY_BUFFER, VERTEX_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+        mVertexBufferOffset = 0;
+    }
+    const size_t offset = mVertexBufferOffset;
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    mVertexBufferOffset = (offset + size + 15) & ~15;
+    return offset;
 }
 
 void GLES20RenderEngine::beginGroup(const mat4& colorTransform) {
 
+    flushBatch();
+
     GLuint tname, name;
     // create the texture
     glGenTextures(1, &tname);
@@ -272,6 +416,8 @@ void GLES20RenderEngine::beginGroup(const mat4& colorTransform) {
 
 void GLES20RenderEngine::endGroup() {
 
+    flushBatch();
+
     const Group group(mGroupStack.top());
     mGroupStack.pop();
 
@@ -292,7 +438,7 @@ void GLES20RenderEngine::endGroup() {
     mState.setOpaque(false);
     mState.setTexture(texture);
     mState.setColorMatrix(group.colorTransform);
-    glDisable(GL_BLEND);
+    mBlend.enabled = false;
 
     Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
     Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
@@ -315,8 +461,96 @@ void GLES20RenderEngine::endGroup() {
     glDeleteTextures(1, &group.texture);
 }
 
+bool GLES20RenderEngine::createOffscreenTarget(uint32_t width,
+        uint32_t height, uint32_t* texName, uint32_t* fbName) {
+    flushBatch();
+
+    GLuint tname, name;
+    glGenTextures(1, &tname);
+    glBindTexture(GL_TEXTURE_2D, tname);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    glGenFramebuffers(1, &name);
+    glBindFramebuffer(GL_FRAMEBUFFER, name);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tname, 0);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    bindOffscreenTarget(0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        ALOGE("createOffscreenTarget: glCheckFramebufferStatus error %d", status);
+        glDeleteFramebuffers(1, &name);
+        glDeleteTextures(1, &tname);
+        return false;
+    }
+    *texName = tname;
+    *fbName = name;
+    return true;
+}
+
+void GLES20RenderEngine::deleteOffscreenTarget(uint32_t texName, uint32_t fbName) {
+    flushBatch();
+    glDeleteFramebuffers(1, &fbName);
+    glDeleteTextures(1, &texName);
+}
+
+void GLES20RenderEngine::bindOffscreenTarget(uint32_t fbName) {
+    flushBatch();
+    // going back to the current surface means going back to the group
+    // being rendered, if any
+    if (!fbName && !mGroupStack.isEmpty()) {
+        fbName = mGroupStack.top().fbo;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbName);
+}
+
+bool GLES20RenderEngine::beginDepthTest() {
+    flushBatch();
+    GLint depthBits = 0;
+    glGetIntegerv(GL_DEPTH_BITS, &depthBits);
+    if (!depthBits) {
+        return false;
+    }
+    glDepthMask(GL_TRUE);
+    glClearDepthf(1.0f);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_DEPTH_TEST);
+    return true;
+}
+
+void GLES20RenderEngine::setDepth(float depth, bool write) {
+    flushBatch();
+    // meshes are flat, so collapsing the depth range gives every fragment
+    // the same depth without touching the vertices or the shaders
+    glDepthRangef(depth, depth);
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+void GLES20RenderEngine::endDepthTest() {
+    flushBatch();
+    glDisable(GL_DEPTH_TEST);
+    glDepthRangef(0.0f, 1.0f);
+    glDepthMask(GL_TRUE);
+}
+
 void GLES20RenderEngine::dump(String8& result) {
     RenderEngine::dump(result);
+    ProgramCache::getInstance().dump(result);
+    result.appendFormat("Draws: last frame %u draw calls for %u meshes, "
+            "%zu vertex bytes\n",
+            mLastFrameStats.drawCalls, mLastFrameStats.meshes,
+            mLastFrameStats.vertexBytes);
+    if (mFrameCount) {
+        result.appendFormat("  average %.1f draw calls for %.1f meshes, "
+                "%.0f vertex bytes per frame (%" PRIu64 " frames)\n",
+                double(mTotalDrawCalls) / mFrameCount,
+                double(mTotalMeshes) / mFrameCount,
+                double(mTotalVertexBytes) / mFrameCount, mFrameCount);
+    }
 }
 
 // ---------------------------------------------------------------------------
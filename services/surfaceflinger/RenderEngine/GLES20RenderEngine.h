@@ -51,9 +51,59 @@ class GLES20RenderEngine : public RenderEngine {
         mat4 colorTransform;
     };
 
+    // Blending is applied when a draw is submitted, so that it's part of
+    // the state of deferred draws.
+    struct Blend {
+        bool enabled;
+        GLenum src;
+        GLenum dst;
+        Blend() : enabled(false), src(GL_ONE), dst(GL_ZERO) { }
+        bool operator == (const Blend& rhs) const {
+            return enabled == rhs.enabled &&
+                    (!enabled || (src == rhs.src && dst == rhs.dst));
+        }
+    };
+
     Description mState;
+    Blend mBlend;
     Vector<Group> mGroupStack;
 
+    // Consecutive untextured draws with the same state (dim layers, solid
+    // fills, wormhole) are merged into a single GL_TRIANGLES draw call
+    Description mBatchState;
+    Blend mBatchBlend;
+    Vector<float> mBatchVertices;
+    size_t mBatchVertexCount;
+    size_t mBatchMeshes;
+
+    // Vertex data is streamed through a ring in a single buffer object,
+    // which is orphaned when it wraps around
+    enum { VERTEX_BUFFER_SIZE = 256 * 1024 };
+    GLuint mVertexBuffer;
+    size_t mVertexBufferOffset;
+
+    // statistics
+    struct FrameStats {
+        uint32_t drawCalls;
+        uint32_t meshes;
+        size_t vertexBytes;
+        FrameStats() : drawCalls(0), meshes(0), vertexBytes(0) { }
+    };
+    FrameStats mFrameStats;
+    FrameStats mLastFrameStats;
+    uint64_t mFrameCount;
+    uint64_t mTotalDrawCalls;
+    uint64_t mTotalMeshes;
+    uint64_t mTotalVertexBytes;
+
+    void appendToBatch(const Mesh& mesh);
+    void drawVertices(const Description& state, const Blend& blend,
+            GLenum primitive, const float* vertices, size_t vertexCount,
+            size_t vertexSize, size_t texCoordsSize, size_t byteStride);
+    // returns the offset of data in the vertex buffer, or -1 if it must be
+    // drawn from client memory
+    ssize_t uploadVertices(const float* data, size_t size);
+
     virtual void bindImageAsFramebuffer(EGLImageKHR image,
             uint32_t* texName, uint32_t* fbName, uint32_t* status);
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName);
@@ -76,10 +126,21 @@ protected:
     virtual void disableBlending();
 
     virtual void drawMesh(const Mesh& mesh);
+    virtual void flushBatch();
+    virtual void endFrame();
 
     virtual void beginGroup(const mat4& colorTransform);
     virtual void endGroup();
 
+    virtual bool createOffscreenTarget(uint32_t width, uint32_t height,
+            uint32_t* texName, uint32_t* fbName);
+    virtual void deleteOffscreenTarget(uint32_t texName, uint32_t fbName);
+    virtual void bindOffscreenTarget(uint32_t fbName);
+
+    virtual bool beginDepthTest();
+    virtual void setDepth(float depth, bool write);
+    virtual void endDepthTest();
+
     virtual size_t getMaxTextureSize() const;
     virtual size_t getMaxViewportDims() const;
 };
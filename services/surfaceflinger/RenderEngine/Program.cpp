@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <GLES2/gl2ext.h>
+
 #include <log/log.h>
 
 #include "Program.h"
@@ -26,7 +28,7 @@
 namespace android {
 
 Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const char* fragment)
-        : mInitialized(false) {
+        : mInitialized(false), mProgram(0), mVertexShader(0), mFragmentShader(0) {
     GLuint vertexId = buildShader(vertex, GL_VERTEX_SHADER);
     GLuint fragmentId = buildShader(fragment, GL_FRAGMENT_SHADER);
     GLuint programId = glCreateProgram();
@@ -36,6 +38,28 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
     glBindAttribLocation(programId, texCoords, "texCoords");
     glLinkProgram(programId);
 
+    initialize(programId);
+    if (mInitialized) {
+        mVertexShader = vertexId;
+        mFragmentShader = fragmentId;
+    } else {
+        glDetachShader(programId, vertexId);
+        glDetachShader(programId, fragmentId);
+        glDeleteShader(vertexId);
+        glDeleteShader(fragmentId);
+    }
+}
+
+Program::Program(const ProgramCache::Key& /*needs*/, GLenum binaryFormat,
+        const void* binary, GLsizei length)
+        : mInitialized(false), mProgram(0), mVertexShader(0), mFragmentShader(0) {
+    // the attribute locations are part of the binary
+    GLuint programId = glCreateProgram();
+    glProgramBinaryOES(programId, binaryFormat, binary, length);
+    initialize(programId);
+}
+
+void Program::initialize(GLuint programId) {
     GLint status;
     glGetProgramiv(programId, GL_LINK_STATUS, &status);
     if (status != GL_TRUE) {
@@ -47,15 +71,9 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
             glGetProgramInfoLog(programId, infoLen, 0, &log[0]);
             ALOGE("%s", log);
         }
-        glDetachShader(programId, vertexId);
-        glDetachShader(programId, fragmentId);
-        glDeleteShader(vertexId);
-        glDeleteShader(fragmentId);
         glDeleteProgram(programId);
     } else {
         mProgram = programId;
-        mVertexShader = vertexId;
-        mFragmentShader = fragmentId;
         mInitialized = true;
 
         mColorMatrixLoc = glGetUniformLocation(programId, "colorMatrix");
@@ -74,12 +92,39 @@ Program::Program(const ProgramCache::Key& /*needs*/, const char* vertex, const c
 }
 
 Program::~Program() {
+    // programs are shared between the contexts of the cache, so this is
+    // fine on any of them
+    if (mInitialized) {
+        glDeleteProgram(mProgram);
+        glDeleteShader(mVertexShader);
+        glDeleteShader(mFragmentShader);
+    }
 }
 
 bool Program::isValid() const {
     return mInitialized;
 }
 
+bool Program::getBinary(GLenum* binaryFormat, Vector<uint8_t>* binary) const {
+    if (!mInitialized) {
+        return false;
+    }
+    GLint length = 0;
+    glGetProgramiv(mProgram, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return false;
+    }
+    binary->resize(length);
+    GLsizei written = 0;
+    glGetProgramBinaryOES(mProgram, length, &written, binaryFormat,
+            binary->editArray());
+    if (written <= 0) {
+        return false;
+    }
+    binary->resize(written);
+    return true;
+}
+
 void Program::use() {
     glUseProgram(mProgram);
 }
@@ -21,6 +21,8 @@
 
 #include <GLES2/gl2.h>
 
+#include <utils/Vector.h>
+
 #include "Description.h"
 #include "ProgramCache.h"
 
@@ -37,11 +39,18 @@ public:
     enum { position=0, texCoords=1 };
 
     Program(const ProgramCache::Key& needs, const char* vertex, const char* fragment);
+
+    /* Loads a program binary returned by getBinary() */
+    Program(const ProgramCache::Key& needs, GLenum binaryFormat,
+            const void* binary, GLsizei length);
     ~Program();
 
     /* whether this object is usable */
     bool isValid() const;
 
+    /* Retrieves the program binary (GL_OES_get_program_binary) */
+    bool getBinary(GLenum* binaryFormat, Vector<uint8_t>* binary) const;
+
     /* Binds this program to the GLES context */
     void use();
 
@@ -56,6 +65,8 @@ public:
 
 
 private:
+    // checks the link status and looks up the uniforms
+    void initialize(GLuint programId);
     GLuint buildShader(const char* source, GLenum type);
     String8& dumpShader(String8& result, GLenum type);
 
@@ -14,18 +14,137 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <log/log.h>
+
 #include <utils/String8.h>
 
 #include "ProgramCache.h"
 #include "Program.h"
 #include "Description.h"
+#include "GLExtensions.h"
 
 namespace android {
 // -----------------------------------------------------------------------------------------------
 
+// Program binary cache file
+static const char* programCacheFile = "/data/system/surfaceflinger_programs";
+static const char* programCacheFileMagic = "SFPC";
+static const size_t programCacheFileHeaderSize = 8;
+static const uint32_t programCacheVersion = 1;
+static const size_t maxProgramCacheFileSize = 4 * 1024 * 1024;
+
+static uint32_t crc32c(const uint8_t* buf, size_t len) {
+    const uint32_t polyBits = 0x82F63B78;
+    uint32_t r = 0;
+    for (size_t i = 0; i < len; i++) {
+        r ^= buf[i];
+        for (int j = 0; j < 8; j++) {
+            if (r & 1) {
+                r = (r >> 1) ^ polyBits;
+            } else {
+                r >>= 1;
+            }
+        }
+    }
+    return r;
+}
+
+static inline size_t align4(size_t size) {
+    return (size + 3) & ~3;
+}
+
+// -----------------------------------------------------------------------------------------------
+
+/*
+ * Compiles programs on its own context, which shares its objects with
+ * SurfaceFlinger's, then saves the binaries of the whole cache.
+ */
+class ProgramCache::CompilerThread : public Thread {
+public:
+    CompilerThread(ProgramCache& cache, EGLDisplay display,
+            EGLConfig contextConfig, EGLConfig surfaceConfig,
+            EGLContext sharedContext, const Vector<Key>& keys)
+        : Thread(false), mCache(cache), mDisplay(display),
+          mContextConfig(contextConfig), mSurfaceConfig(surfaceConfig),
+          mSharedContext(sharedContext), mKeys(keys) {
+    }
+
+private:
+    virtual bool threadLoop() {
+        EGLint contextAttributes[] = {
+                EGL_CONTEXT_CLIENT_VERSION, 2,
+                EGL_NONE, EGL_NONE
+        };
+        EGLContext context = eglCreateContext(mDisplay, mContextConfig,
+                mSharedContext, contextAttributes);
+        if (context == EGL_NO_CONTEXT) {
+            ALOGE("ProgramCache: can't create shared context (%#x)",
+                    eglGetError());
+            return false;
+        }
+        EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE, EGL_NONE };
+        EGLSurface surface = eglCreatePbufferSurface(mDisplay, mSurfaceConfig,
+                attribs);
+        if (surface == EGL_NO_SURFACE ||
+                !eglMakeCurrent(mDisplay, surface, surface, context)) {
+            ALOGE("ProgramCache: can't make pbuffer current (%#x)",
+                    eglGetError());
+            if (surface != EGL_NO_SURFACE) {
+                eglDestroySurface(mDisplay, surface);
+            }
+            eglDestroyContext(mDisplay, context);
+            return false;
+        }
+
+        size_t count = 0;
+        nsecs_t timeBefore = systemTime();
+        for (size_t i=0 ; i<mKeys.size() ; i++) {
+            // the program may have been loaded or needed already
+            if (mCache.getProgram(mKeys[i]) == NULL) {
+                Program* program = generateProgram(mKeys[i]);
+                // it must be complete before another context uses it
+                glFinish();
+                mCache.addProgram(mKeys[i], program);
+                count++;
+            }
+        }
+        nsecs_t timeAfter = systemTime();
+        {
+            Mutex::Autolock _l(mCache.mLock);
+            mCache.mBackgroundPrograms = count;
+            mCache.mBackgroundCompileTime = timeAfter - timeBefore;
+        }
+
+        mCache.saveBinaries();
+
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(mDisplay, surface);
+        eglDestroyContext(mDisplay, context);
+        eglReleaseThread();
+        return false;
+    }
+
+    ProgramCache& mCache;
+    EGLDisplay mDisplay;
+    EGLConfig mContextConfig;
+    EGLConfig mSurfaceConfig;
+    EGLContext mSharedContext;
+    Vector<Key> mKeys;
+};
+
+// -----------------------------------------------------------------------------------------------
+
 
 /*
  * A simple formatter class to automatically add the endl and
@@ -77,23 +196,27 @@ Formatter& dedent(Formatter& f) {
 
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
-    // Until surfaceflinger has a dependable blob cache on the filesystem,
-    // generate shaders on initialization so as to avoid jank.
-    primeCache();
+ProgramCache::ProgramCache()
+    : mHasProgramBinary(false),
+      mLoadedPrograms(0),
+      mLoadTime(0),
+      mBootPrograms(0),
+      mBootCompileTime(0),
+      mBackgroundPrograms(0),
+      mBackgroundCompileTime(0),
+      mFirstUsePrograms(0),
+      mFirstUseCompileTime(0),
+      mMaxFirstUseCompileTime(0),
+      mBinariesSaved(false) {
 }
 
 ProgramCache::~ProgramCache() {
 }
 
-void ProgramCache::primeCache() {
-    uint32_t shaderCount = 0;
+void ProgramCache::getPrimeKeys(Vector<Key>* keys, bool colorMatrix) {
     uint32_t keyMask = Key::BLEND_MASK | Key::OPACITY_MASK |
                        Key::PLANE_ALPHA_MASK | Key::TEXTURE_MASK;
-    // Prime the cache for all combinations of the above masks,
-    // leaving off the experimental color matrix mask options.
-
-    nsecs_t timeBefore = systemTime();
+    // all combinations of the above masks, with or without the color matrix
     for (uint32_t keyVal = 0; keyVal <= keyMask; keyVal++) {
         Key shaderKey;
         shaderKey.set(keyMask, keyVal);
@@ -103,16 +226,243 @@ void ProgramCache::primeCache() {
             tex != Key::TEXTURE_2D) {
             continue;
         }
-        Program* program = mCache.valueFor(shaderKey);
-        if (program == NULL) {
-            program = generateProgram(shaderKey);
-            mCache.add(shaderKey, program);
+        shaderKey.set(Key::COLOR_MATRIX_MASK,
+                colorMatrix ? Key::COLOR_MATRIX_ON : Key::COLOR_MATRIX_OFF);
+        keys->add(shaderKey);
+    }
+}
+
+void ProgramCache::primeCache(EGLDisplay display, EGLConfig contextConfig,
+        EGLConfig surfaceConfig, EGLContext context) {
+    // the binaries are only valid for the driver that produced them
+    const GLExtensions& extensions(GLExtensions::getInstance());
+    mDriverVersion = String8::format("%s\n%s\n%s", extensions.getVendor(),
+            extensions.getRenderer(), extensions.getVersion());
+    GLint binaryFormats = 0;
+    if (extensions.hasExtension("GL_OES_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &binaryFormats);
+    }
+    mHasProgramBinary = binaryFormats > 0;
+    loadBinaries();
+
+    // Generate the shaders needed by regular composition now, so as to
+    // avoid jank.
+    Vector<Key> keys;
+    getPrimeKeys(&keys, false);
+    uint32_t shaderCount = 0;
+    nsecs_t timeBefore = systemTime();
+    for (size_t i=0 ; i<keys.size() ; i++) {
+        if (getProgram(keys[i]) == NULL) {
+            addProgram(keys[i], generateProgram(keys[i]));
             shaderCount++;
         }
     }
     nsecs_t timeAfter = systemTime();
     float compileTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
     ALOGD("shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
+    {
+        Mutex::Autolock _l(mLock);
+        mBootPrograms = shaderCount;
+        mBootCompileTime = timeAfter - timeBefore;
+    }
+
+    // The color matrix variants are rarely needed and compiled in the
+    // background instead.
+    Vector<Key> backgroundKeys;
+    getPrimeKeys(&backgroundKeys, true);
+    mCompilerThread = new CompilerThread(*this, display, contextConfig,
+            surfaceConfig, context, backgroundKeys);
+    mCompilerThread->run("ProgramCache", PRIORITY_BACKGROUND);
+}
+
+Program* ProgramCache::getProgram(const Key& key) const {
+    Mutex::Autolock _l(mLock);
+    return mCache.valueFor(key);
+}
+
+void ProgramCache::addProgram(const Key& key, Program* program) {
+    Mutex::Autolock _l(mLock);
+    if (mCache.indexOfKey(key) >= 0) {
+        delete program;
+        return;
+    }
+    mCache.add(key, program);
+}
+
+void ProgramCache::loadBinaries() {
+    if (!mHasProgramBinary) {
+        return;
+    }
+
+    int fd = open(programCacheFile, O_RDONLY, 0);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            ALOGE("error opening program cache %s: %s (%d)", programCacheFile,
+                    strerror(errno), errno);
+        }
+        return;
+    }
+
+    nsecs_t timeBefore = systemTime();
+    struct stat statBuf;
+    if (fstat(fd, &statBuf) == -1 ||
+            size_t(statBuf.st_size) < programCacheFileHeaderSize ||
+            size_t(statBuf.st_size) > maxProgramCacheFileSize) {
+        ALOGE("program cache has a bad size");
+        close(fd);
+        return;
+    }
+    const size_t fileSize = statBuf.st_size;
+    uint8_t* buf = new uint8_t[fileSize];
+    ssize_t n = read(fd, buf, fileSize);
+    close(fd);
+    if (n != ssize_t(fileSize)) {
+        ALOGE("error reading program cache: %s (%d)", strerror(errno), errno);
+        delete [] buf;
+        return;
+    }
+
+    // Check the file magic and CRC
+    const uint8_t* data = buf + programCacheFileHeaderSize;
+    const uint8_t* const dataEnd = buf + fileSize;
+    uint32_t crc;
+    memcpy(&crc, buf + 4, sizeof(crc));
+    if (memcmp(buf, programCacheFileMagic, 4) != 0 ||
+            crc32c(data, dataEnd - data) != crc) {
+        ALOGE("program cache is corrupted");
+        delete [] buf;
+        return;
+    }
+
+    // version, driver and count
+    uint32_t header[2];
+    if (size_t(dataEnd - data) < sizeof(header)) {
+        delete [] buf;
+        return;
+    }
+    memcpy(header, data, sizeof(header));
+    data += sizeof(header);
+    const size_t driverLength = header[1];
+    if (header[0] != programCacheVersion ||
+            size_t(dataEnd - data) < align4(driverLength) + sizeof(uint32_t) ||
+            driverLength != mDriverVersion.length() ||
+            memcmp(data, mDriverVersion.string(), driverLength) != 0) {
+        // a different driver, or an older cache; it's rewritten later
+        ALOGI("program cache is out of date");
+        delete [] buf;
+        return;
+    }
+    data += align4(driverLength);
+    uint32_t count;
+    memcpy(&count, data, sizeof(count));
+    data += sizeof(count);
+
+    size_t loaded = 0;
+    for (uint32_t i=0 ; i<count ; i++) {
+        // key, binary format and length
+        uint32_t entry[3];
+        if (size_t(dataEnd - data) < sizeof(entry)) {
+            break;
+        }
+        memcpy(entry, data, sizeof(entry));
+        data += sizeof(entry);
+        if (size_t(dataEnd - data) < align4(entry[2])) {
+            break;
+        }
+        Key key;
+        key.mKey = entry[0];
+        Program* program = new Program(key, entry[1], data, entry[2]);
+        data += align4(entry[2]);
+        if (program->isValid()) {
+            addProgram(key, program);
+            loaded++;
+        } else {
+            // it's compiled again below
+            delete program;
+        }
+    }
+    delete [] buf;
+
+    nsecs_t timeAfter = systemTime();
+    Mutex::Autolock _l(mLock);
+    mLoadedPrograms = loaded;
+    mLoadTime = timeAfter - timeBefore;
+}
+
+void ProgramCache::saveBinaries() {
+    Vector<Key> keys;
+    Vector<Program*> programs;
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mHasProgramBinary || mLoadedPrograms == mCache.size()) {
+            // nothing new since it was loaded
+            return;
+        }
+        for (size_t i=0 ; i<mCache.size() ; i++) {
+            keys.add(mCache.keyAt(i));
+            programs.add(mCache.valueAt(i));
+        }
+    }
+
+    Vector<uint8_t> data;
+    uint32_t header[2] = { programCacheVersion, uint32_t(mDriverVersion.length()) };
+    data.appendArray(reinterpret_cast<const uint8_t*>(header), sizeof(header));
+    data.appendArray(reinterpret_cast<const uint8_t*>(mDriverVersion.string()),
+            mDriverVersion.length());
+    const uint8_t padding[4] = { 0, 0, 0, 0 };
+    data.appendArray(padding,
+            align4(mDriverVersion.length()) - mDriverVersion.length());
+    uint32_t count = 0;
+    const size_t countOffset = data.size();
+    data.appendArray(reinterpret_cast<const uint8_t*>(&count), sizeof(count));
+
+    Vector<uint8_t> binary;
+    for (size_t i=0 ; i<programs.size() ; i++) {
+        GLenum format;
+        if (!programs[i]->getBinary(&format, &binary)) {
+            continue;
+        }
+        uint32_t entry[3] = { keys[i].mKey, format, uint32_t(binary.size()) };
+        data.appendArray(reinterpret_cast<const uint8_t*>(entry), sizeof(entry));
+        data.appendArray(binary.array(), binary.size());
+        data.appendArray(padding, align4(binary.size()) - binary.size());
+        count++;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    const size_t dataSize = data.size();
+    uint8_t* buf = new uint8_t[programCacheFileHeaderSize + dataSize];
+    memcpy(buf + programCacheFileHeaderSize, data.array(), dataSize);
+    memcpy(buf + programCacheFileHeaderSize + countOffset, &count, sizeof(count));
+    memcpy(buf, programCacheFileMagic, 4);
+    uint32_t crc = crc32c(buf + programCacheFileHeaderSize, dataSize);
+    memcpy(buf + 4, &crc, sizeof(crc));
+
+    // write a temporary file first so that a crash can't leave a truncated
+    // cache behind
+    String8 tmpName(String8::format("%s.tmp", programCacheFile));
+    int fd = open(tmpName.string(), O_CREAT | O_TRUNC | O_WRONLY,
+            S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        ALOGE("error creating program cache %s: %s (%d)", tmpName.string(),
+                strerror(errno), errno);
+        delete [] buf;
+        return;
+    }
+    const size_t fileSize = programCacheFileHeaderSize + dataSize;
+    bool written = write(fd, buf, fileSize) == ssize_t(fileSize);
+    close(fd);
+    delete [] buf;
+    if (!written || rename(tmpName.string(), programCacheFile) == -1) {
+        ALOGE("error writing program cache: %s (%d)", strerror(errno), errno);
+        unlink(tmpName.string());
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mBinariesSaved = true;
 }
 
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
@@ -230,14 +580,28 @@ void ProgramCache::useProgram(const Description& description) {
     Key needs(computeKey(description));
 
      // look-up the program in the cache
-    Program* program = mCache.valueFor(needs);
+    Program* program = getProgram(needs);
     if (program == NULL) {
         // we didn't find our program, so generate one...
         nsecs_t time = -systemTime();
         program = generateProgram(needs);
-        mCache.add(needs, program);
         time += systemTime();
 
+        Mutex::Autolock _l(mLock);
+        ssize_t index = mCache.indexOfKey(needs);
+        if (index >= 0) {
+            // the compiler thread was faster
+            delete program;
+            program = mCache.valueAt(index);
+        } else {
+            mCache.add(needs, program);
+            mFirstUsePrograms++;
+            mFirstUseCompileTime += time;
+            if (time > mMaxFirstUseCompileTime) {
+                mMaxFirstUseCompileTime = time;
+            }
+        }
+
         //ALOGD(">>> generated new program: needs=%08X, time=%u ms (%d programs)",
         //        needs.mNeeds, uint32_t(ns2ms(time)), mCache.size());
     }
@@ -249,5 +613,20 @@ void ProgramCache::useProgram(const Description& description) {
     }
 }
 
+void ProgramCache::dump(String8& result) const {
+    Mutex::Autolock _l(mLock);
+    result.appendFormat("Program cache: %zu programs, binaries %s%s\n",
+            mCache.size(),
+            mHasProgramBinary ? "supported" : "not supported",
+            mBinariesSaved ? " (saved)" : "");
+    result.appendFormat("  boot: %zu loaded in %.3f ms, %zu compiled in %.3f ms\n",
+            mLoadedPrograms, mLoadTime / 1.0E6,
+            mBootPrograms, mBootCompileTime / 1.0E6);
+    result.appendFormat("  background: %zu compiled in %.3f ms\n",
+            mBackgroundPrograms, mBackgroundCompileTime / 1.0E6);
+    result.appendFormat("  first use: %zu compiled in %.3f ms (max %.3f ms)\n",
+            mFirstUsePrograms, mFirstUseCompileTime / 1.0E6,
+            mMaxFirstUseCompileTime / 1.0E6);
+}
 
 } /* namespace android */
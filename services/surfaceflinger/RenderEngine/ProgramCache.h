@@ -17,10 +17,15 @@
 #ifndef SF_RENDER_ENGINE_PROGRAMCACHE_H
 #define SF_RENDER_ENGINE_PROGRAMCACHE_H
 
+#include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
+#include <utils/Mutex.h>
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
 #include <utils/TypeHelpers.h>
 
 #include "Description.h"
@@ -29,7 +34,6 @@ namespace android {
 
 class Description;
 class Program;
-class String8;
 
 /*
  * This class generates GLSL programs suitable to handle a given
@@ -107,13 +111,27 @@ public:
     ProgramCache();
     ~ProgramCache();
 
+    // primeCache loads the program binaries saved by a previous boot and
+    // compiles the programs used by regular composition that are missing.
+    // The color matrix variants are compiled on a background thread, with a
+    // context that shares its objects with context, after which all the
+    // binaries are saved for the next boot. It must be called with context
+    // current; surfaceConfig is used to create the background pbuffer.
+    void primeCache(EGLDisplay display, EGLConfig contextConfig,
+            EGLConfig surfaceConfig, EGLContext context);
+
     // useProgram lookup a suitable program in the cache or generates one
     // if none can be found.
     void useProgram(const Description& description);
 
+    void dump(String8& result) const;
+
 private:
+    class CompilerThread;
+    friend class CompilerThread;
+
     // Generate shaders to populate the cache
-    void primeCache();
+    static void getPrimeKeys(Vector<Key>* keys, bool colorMatrix);
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
     // generates a program from the Key
@@ -123,9 +141,39 @@ private:
     // generates the fragment shader from the Key
     static String8 generateFragmentShader(const Key& needs);
 
+    // returns the cached program for key, or NULL
+    Program* getProgram(const Key& key) const;
+    // adds program to the cache, unless one was added for key already in
+    // which case program is deleted
+    void addProgram(const Key& key, Program* program);
+
+    // the binary cache file, which is only valid for the driver it was
+    // written with
+    void loadBinaries();
+    void saveBinaries();
+
+    // protects mCache, which is written to by the compiler thread
+    mutable Mutex mLock;
+
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+
+    bool mHasProgramBinary;
+    String8 mDriverVersion;
+    sp<CompilerThread> mCompilerThread;
+
+    // statistics, protected by mLock
+    size_t mLoadedPrograms;
+    nsecs_t mLoadTime;
+    size_t mBootPrograms;
+    nsecs_t mBootCompileTime;
+    size_t mBackgroundPrograms;
+    nsecs_t mBackgroundCompileTime;
+    size_t mFirstUsePrograms;
+    nsecs_t mFirstUseCompileTime;
+    nsecs_t mMaxFirstUseCompileTime;
+    bool mBinariesSaved;
 };
 
 
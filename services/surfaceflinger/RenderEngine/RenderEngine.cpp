@@ -24,6 +24,8 @@
 #include "GLES20RenderEngine.h"
 #include "GLExtensions.h"
 #include "Mesh.h"
+#include "ProgramCache.h"
+#include "Texture.h"
 
 EGLAPI const char* eglQueryStringImplementationANDROID(EGLDisplay dpy, EGLint name);
 
@@ -134,6 +136,12 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
     }
     engine->setEGLHandles(config, ctxt);
 
+    if (version >= GLES_VERSION_2_0) {
+        // this loads or compiles the programs while the context is current
+        ProgramCache::getInstance().primeCache(display, config, dummyConfig,
+                ctxt);
+    }
+
     ALOGI("OpenGL ES informations:");
     ALOGI("vendor    : %s", extensions.getVendor());
     ALOGI("renderer  : %s", extensions.getRenderer());
@@ -219,22 +227,58 @@ void RenderEngine::fillRegionWithColor(const Region& region, uint32_t height,
     drawMesh(mesh);
 }
 
+void RenderEngine::drawRegionWithTexture(const Region& region,
+        uint32_t height, const Texture& texture) {
+    const float w = texture.getWidth();
+    const float h = texture.getHeight();
+    size_t c;
+    Rect const* r = region.getArray(&c);
+    Mesh mesh(Mesh::TRIANGLES, c*6, 2, 2);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    Mesh::VertexArray<vec2> texCoord(mesh.getTexCoordArray<vec2>());
+    for (size_t i=0 ; i<c ; i++, r++) {
+        const vec2 lt(r->left, height - r->top);
+        const vec2 lb(r->left, height - r->bottom);
+        const vec2 rb(r->right, height - r->bottom);
+        const vec2 rt(r->right, height - r->top);
+        position[i*6 + 0] = lt;
+        position[i*6 + 1] = lb;
+        position[i*6 + 2] = rb;
+        position[i*6 + 3] = lt;
+        position[i*6 + 4] = rb;
+        position[i*6 + 5] = rt;
+        for (size_t j=0 ; j<6 ; j++) {
+            texCoord[i*6 + j] = vec2(position[i*6 + j].x / w,
+                    position[i*6 + j].y / h);
+        }
+    }
+    setupLayerTexturing(texture);
+    setupLayerBlending(true, false, 0xFF);
+    drawMesh(mesh);
+    disableBlending();
+    disableTexturing();
+}
+
 void RenderEngine::flush() {
+    flushBatch();
     glFlush();
 }
 
 void RenderEngine::clearWithColor(float red, float green, float blue, float alpha) {
+    flushBatch();
     glClearColor(red, green, blue, alpha);
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void RenderEngine::setScissor(
         uint32_t left, uint32_t bottom, uint32_t right, uint32_t top) {
+    flushBatch();
     glScissor(left, bottom, right, top);
     glEnable(GL_SCISSOR_TEST);
 }
 
 void RenderEngine::disableScissor() {
+    flushBatch();
     glDisable(GL_SCISSOR_TEST);
 }
 
@@ -247,6 +291,7 @@ void RenderEngine::deleteTextures(size_t count, uint32_t const* names) {
 }
 
 void RenderEngine::readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels) {
+    flushBatch();
     glReadPixels(l, b, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
@@ -364,8 +409,14 @@ public:
 };
 
 
+static bool sUseDepthBuffer = false;
+
+void RenderEngine::setUseDepthBuffer(bool use) {
+    sUseDepthBuffer = use;
+}
+
 static status_t selectEGLConfig(EGLDisplay display, EGLint format,
-    EGLint renderableType, EGLConfig* config) {
+    EGLint renderableType, EGLint depthSize, EGLConfig* config) {
     // select our EGLConfig. It must support EGL_RECORDABLE_ANDROID if
     // it is to be used with WIFI displays
     status_t err;
@@ -381,6 +432,9 @@ static status_t selectEGLConfig(EGLDisplay display, EGLint format,
         attribs[EGL_RED_SIZE]                   = 8;
         attribs[EGL_GREEN_SIZE]                 = 8;
         attribs[EGL_BLUE_SIZE]                  = 8;
+        if (depthSize) {
+            attribs[EGL_DEPTH_SIZE]             = depthSize;
+        }
         wantedAttribute                         = EGL_NONE;
         wantedAttributeValue                    = EGL_NONE;
     } else {
@@ -400,20 +454,32 @@ static status_t selectEGLConfig(EGLDisplay display, EGLint format,
     return err;
 }
 
+bool RenderEngine::hasEglExtension(EGLDisplay display, const char* name) {
+    return findExtension(
+            eglQueryStringImplementationANDROID(display, EGL_EXTENSIONS), name);
+}
+
 EGLConfig RenderEngine::chooseEglConfig(EGLDisplay display, int format) {
     status_t err;
     EGLConfig config;
 
-    // First try to get an ES2 config
-    err = selectEGLConfig(display, format, EGL_OPENGL_ES2_BIT, &config);
+    // First try to get an ES2 config, with a depth buffer if it's wanted
+    err = NAME_NOT_FOUND;
+    if (sUseDepthBuffer) {
+        err = selectEGLConfig(display, format, EGL_OPENGL_ES2_BIT, 16, &config);
+        ALOGW_IF(err != NO_ERROR, "no EGLConfig with a depth buffer found");
+    }
+    if (err != NO_ERROR) {
+        err = selectEGLConfig(display, format, EGL_OPENGL_ES2_BIT, 0, &config);
+    }
     if (err != NO_ERROR) {
         // If ES2 fails, try ES1
-        err = selectEGLConfig(display, format, EGL_OPENGL_ES_BIT, &config);
+        err = selectEGLConfig(display, format, EGL_OPENGL_ES_BIT, 0, &config);
         if (err != NO_ERROR) {
             // still didn't work, probably because we're on the emulator...
             // try a simplified query
             ALOGW("no suitable EGLConfig found, trying a simpler query");
-            err = selectEGLConfig(display, format, 0, &config);
+            err = selectEGLConfig(display, format, 0, 0, &config);
             if (err != NO_ERROR) {
                 // this EGL is too lame for android
                 LOG_ALWAYS_FATAL("no suitable EGLConfig found, giving up");
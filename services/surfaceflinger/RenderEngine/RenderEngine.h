@@ -62,6 +62,11 @@ public:
     static RenderEngine* create(EGLDisplay display, int hwcFormat);
 
     static EGLConfig chooseEglConfig(EGLDisplay display, int format);
+    // when set, chooseEglConfig prefers configs with a depth buffer, so
+    // that the depth test can be used when composing. It must be set
+    // before the engine and the display surfaces are created.
+    static void setUseDepthBuffer(bool use);
+    static bool hasEglExtension(EGLDisplay display, const char* name);
 
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
@@ -78,6 +83,10 @@ public:
     void genTextures(size_t count, uint32_t* names);
     void deleteTextures(size_t count, uint32_t const* names);
     void readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels);
+    // draws the given region of a texture the size of the viewport at the
+    // same place, blended over what's there as premultiplied alpha
+    void drawRegionWithTexture(const Region& region, uint32_t height,
+            const Texture& texture);
 
     class BindImageAsFramebuffer {
         RenderEngine& mEngine;
@@ -105,12 +114,42 @@ public:
     // drawing
     virtual void drawMesh(const Mesh& mesh) = 0;
 
+    // drawMesh may defer draws so that consecutive ones with the same state
+    // are merged. flushBatch submits them; it must be called before the
+    // target surface changes or anything waits on the GPU. endFrame is
+    // called before a frame is swapped; it flushes and accounts the frame.
+    virtual void flushBatch() { }
+    virtual void endFrame() { flushBatch(); }
+
     // grouping
     // creates a color-transform group, everything drawn in the group will be
     // transformed by the given color transform when endGroup() is called.
     virtual void beginGroup(const mat4& colorTransform) = 0;
     virtual void endGroup() = 0;
 
+    // offscreen targets
+    // an offscreen target is a texture that can be rendered into and keeps
+    // its content across frames. createOffscreenTarget returns false if
+    // the engine can't render offscreen. bindOffscreenTarget redirects
+    // rendering to the target, or back to the current surface if fbName
+    // is 0.
+    virtual bool createOffscreenTarget(uint32_t /* width */,
+            uint32_t /* height */, uint32_t* /* texName */,
+            uint32_t* /* fbName */) { return false; }
+    virtual void deleteOffscreenTarget(uint32_t /* texName */,
+            uint32_t /* fbName */) { }
+    virtual void bindOffscreenTarget(uint32_t /* fbName */) { }
+
+    // depth testing
+    // beginDepthTest clears the depth buffer of the current surface and
+    // enables the depth test; it returns false if the surface has no depth
+    // buffer or the engine doesn't support it. Until endDepthTest, every
+    // draw has the depth given to setDepth, is rejected where something
+    // nearer was drawn, and updates the depth buffer only if write is set.
+    virtual bool beginDepthTest() { return false; }
+    virtual void setDepth(float /* depth */, bool /* write */) { }
+    virtual void endDepthTest() { }
+
     // queries
     virtual size_t getMaxTextureSize() const = 0;
     virtual size_t getMaxViewportDims() const = 0;
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <gui/IGraphicBufferProducer.h>
+#include <gui/Surface.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "ScreenCaptureThread.h"
+#include "SurfaceFlinger.h"
+
+namespace android {
+
+const nsecs_t ScreenCaptureThread::OUTPUT_IDLE_TIMEOUT = s2ns(5);
+
+ScreenCaptureThread::Request::Request()
+    : reqWidth(0), reqHeight(0), minLayerZ(0), maxLayerZ(0),
+      useIdentityTransform(false), rotation(Transform::ROT_0),
+      requestTime(0), result(NO_ERROR), fenceFd(-1) {
+}
+
+ScreenCaptureThread::ScreenCaptureThread(const sp<SurfaceFlinger>& flinger)
+    : mFlinger(flinger),
+      mNumOutputs(0),
+      mNumCaptures(0),
+      mNumFailed(0),
+      mNumRejected(0),
+      mNumOutputsReused(0),
+      mTotalLatency(0),
+      mMaxLatency(0) {
+}
+
+ScreenCaptureThread::~ScreenCaptureThread() {
+}
+
+status_t ScreenCaptureThread::queueCapture(const Request& request) {
+    Mutex::Autolock lock(mMutex);
+    if (mQueued.size() + mReady.size() + mRendered.size() >=
+            MAX_PENDING_CAPTURES) {
+        mNumRejected++;
+        return WOULD_BLOCK;
+    }
+    Request queued(request);
+    queued.requestTime = systemTime();
+    mQueued.add(queued);
+    mCondition.signal();
+    return NO_ERROR;
+}
+
+void ScreenCaptureThread::takeReadyCaptures(Vector<Request>* outRequests) {
+    Mutex::Autolock lock(mMutex);
+    outRequests->appendVector(mReady);
+    mReady.clear();
+}
+
+void ScreenCaptureThread::onCapturesRendered(const Vector<Request>& requests) {
+    Mutex::Autolock lock(mMutex);
+    mRendered.appendVector(requests);
+    mCondition.signal();
+}
+
+bool ScreenCaptureThread::threadLoop() {
+    Vector<Request> queued;
+    Vector<Request> rendered;
+    {
+        Mutex::Autolock lock(mMutex);
+        while (mQueued.isEmpty() && mRendered.isEmpty()) {
+            if (mOutputs.isEmpty()) {
+                mCondition.wait(mMutex);
+            } else if (mCondition.waitRelative(mMutex, OUTPUT_IDLE_TIMEOUT) ==
+                    TIMED_OUT) {
+                break;
+            }
+        }
+        queued = mQueued;
+        mQueued.clear();
+        rendered = mRendered;
+        mRendered.clear();
+    }
+
+    for (size_t i = 0; i < rendered.size(); i++) {
+        finishCapture(rendered[i]);
+    }
+
+    Vector<Request> ready;
+    for (size_t i = 0; i < queued.size(); i++) {
+        Request& request(queued.editItemAt(i));
+        status_t err = prepareOutput(&request);
+        if (err == NO_ERROR) {
+            ready.add(request);
+        } else {
+            ALOGE("captureScreenAsync: can't get an output buffer (%d)", err);
+            Mutex::Autolock lock(mMutex);
+            mNumFailed++;
+        }
+    }
+
+    removeIdleOutputs(systemTime());
+
+    {
+        Mutex::Autolock lock(mMutex);
+        mReady.appendVector(ready);
+        mNumOutputs = mOutputs.size();
+    }
+    if (!ready.isEmpty()) {
+        // the captures are rendered at the next refresh
+        mFlinger->signalLayerUpdate();
+    }
+    return true;
+}
+
+status_t ScreenCaptureThread::prepareOutput(Request* request) {
+    ATRACE_CALL();
+    const nsecs_t now = systemTime();
+    sp<IBinder> binder(request->producer->asBinder());
+    sp<Surface> surface;
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        if (mOutputs[i].binder == binder) {
+            Output& output(mOutputs.editItemAt(i));
+            output.lastUsed = now;
+            surface = output.surface;
+            Mutex::Autolock lock(mMutex);
+            mNumOutputsReused++;
+            break;
+        }
+    }
+
+    if (surface == NULL) {
+        surface = new Surface(request->producer, false);
+        status_t err = native_window_api_connect(surface.get(),
+                NATIVE_WINDOW_API_EGL);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        if (mOutputs.size() >= MAX_OUTPUTS) {
+            // replace the least recently used output
+            size_t oldest = 0;
+            for (size_t i = 1; i < mOutputs.size(); i++) {
+                if (mOutputs[i].lastUsed < mOutputs[oldest].lastUsed) {
+                    oldest = i;
+                }
+            }
+            removeOutput(mOutputs[oldest].binder);
+        }
+        Output output;
+        output.binder = binder;
+        output.surface = surface;
+        output.lastUsed = now;
+        mOutputs.add(output);
+    }
+
+    ANativeWindow* window = surface.get();
+    uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
+                    GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+    int err = native_window_set_buffers_dimensions(window,
+            request->reqWidth, request->reqHeight);
+    err |= native_window_set_scaling_mode(window,
+            NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
+    err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+    err |= native_window_set_usage(window, usage);
+    if (err != NO_ERROR) {
+        removeOutput(binder);
+        return BAD_VALUE;
+    }
+
+    // A buffer that was queued by a previous capture has usually been
+    // released by now, so this rarely waits
+    ANativeWindowBuffer* buffer;
+    err = native_window_dequeue_buffer_and_wait(window, &buffer);
+    if (err != NO_ERROR) {
+        removeOutput(binder);
+        return err;
+    }
+    request->surface = surface;
+    request->buffer = GraphicBuffer::getSelf(buffer);
+    return NO_ERROR;
+}
+
+void ScreenCaptureThread::finishCapture(const Request& request) {
+    ATRACE_CALL();
+    ANativeWindow* window = request.surface.get();
+    status_t err;
+    if (request.result == NO_ERROR) {
+        // queueBuffer takes ownership of fenceFd
+        err = window->queueBuffer(window, request.buffer.get(),
+                request.fenceFd);
+    } else {
+        if (request.fenceFd >= 0) {
+            close(request.fenceFd);
+        }
+        err = window->cancelBuffer(window, request.buffer.get(), -1);
+    }
+    if (err != NO_ERROR) {
+        removeOutput(request.producer->asBinder());
+    }
+
+    const nsecs_t latency = systemTime() - request.requestTime;
+    Mutex::Autolock lock(mMutex);
+    if (request.result == NO_ERROR && err == NO_ERROR) {
+        mNumCaptures++;
+        mTotalLatency += latency;
+        if (latency > mMaxLatency) {
+            mMaxLatency = latency;
+        }
+    } else {
+        mNumFailed++;
+    }
+}
+
+void ScreenCaptureThread::removeOutput(const sp<IBinder>& binder) {
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        if (mOutputs[i].binder == binder) {
+            native_window_api_disconnect(mOutputs[i].surface.get(),
+                    NATIVE_WINDOW_API_EGL);
+            mOutputs.removeAt(i);
+            return;
+        }
+    }
+}
+
+void ScreenCaptureThread::removeIdleOutputs(nsecs_t now) {
+    for (size_t i = 0; i < mOutputs.size(); ) {
+        if (now - mOutputs[i].lastUsed >= OUTPUT_IDLE_TIMEOUT) {
+            removeOutput(mOutputs[i].binder);
+        } else {
+            i++;
+        }
+    }
+}
+
+void ScreenCaptureThread::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("Async screen captures: %" PRIu64 " done, %" PRIu64
+            " failed, %" PRIu64 " rejected, %zu pending\n",
+            mNumCaptures, mNumFailed, mNumRejected,
+            mQueued.size() + mReady.size() + mRendered.size());
+    result.appendFormat("  latency avg=%.3fms max=%.3fms, outputs=%zu "
+            "(reused %" PRIu64 " times)\n",
+            mNumCaptures ? mTotalLatency / 1000000.0 / mNumCaptures : 0.0,
+            mMaxLatency / 1000000.0, mNumOutputs, mNumOutputsReused);
+}
+
+}; // namespace android
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_SCREENCAPTURETHREAD_H
+#define ANDROID_SCREENCAPTURETHREAD_H
+
+#include <stddef.h>
+
+#include <ui/GraphicBuffer.h>
+#include <ui/Rect.h>
+
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "Transform.h"
+
+namespace android {
+
+class IBinder;
+class IGraphicBufferProducer;
+class String8;
+class Surface;
+class SurfaceFlinger;
+
+// ScreenCaptureThread handles the captures requested with
+// captureScreenAsync. All the interactions with the output producers, which
+// may block, happen on this thread:
+//  1. a binder thread queues the request with queueCapture and returns
+//  2. this thread dequeues an output buffer and asks for a refresh
+//  3. the main thread renders the ready captures after composing the
+//     displays (takeReadyCaptures/onCapturesRendered)
+//  4. this thread queues the output buffer with the rendering fence
+// The output Surfaces are kept connected between captures, so the buffers of
+// a producer that is used repeatedly aren't reallocated.
+class ScreenCaptureThread : public Thread {
+public:
+    struct Request {
+        Request();
+
+        sp<IBinder> display;
+        sp<IGraphicBufferProducer> producer;
+        Rect sourceCrop;
+        uint32_t reqWidth;
+        uint32_t reqHeight;
+        uint32_t minLayerZ;
+        uint32_t maxLayerZ;
+        bool useIdentityTransform;
+        Transform::orientation_flags rotation;
+
+        // set when the request is queued
+        nsecs_t requestTime;
+
+        // set by the capture thread once the output buffer is dequeued
+        sp<Surface> surface;
+        sp<GraphicBuffer> buffer;
+
+        // set by the main thread when the capture is rendered; fenceFd
+        // signals when rendering completes
+        status_t result;
+        int fenceFd;
+    };
+
+    ScreenCaptureThread(const sp<SurfaceFlinger>& flinger);
+    virtual ~ScreenCaptureThread();
+
+    // queueCapture queues a capture request and returns immediately. It
+    // returns WOULD_BLOCK if too many captures are pending.
+    status_t queueCapture(const Request& request);
+
+    // takeReadyCaptures moves the captures that have an output buffer to
+    // outRequests. Called on the main thread, which must then render them and
+    // hand them back with onCapturesRendered.
+    void takeReadyCaptures(Vector<Request>* outRequests);
+    void onCapturesRendered(const Vector<Request>& requests);
+
+    void dump(String8& result) const;
+
+private:
+    enum { MAX_PENDING_CAPTURES = 4 };
+    enum { MAX_OUTPUTS = 4 };
+
+    // Outputs that haven't been used for that long are disconnected, so that
+    // the producers' buffers aren't kept alive forever
+    static const nsecs_t OUTPUT_IDLE_TIMEOUT;
+
+    struct Output {
+        sp<IBinder> binder;
+        sp<Surface> surface;
+        nsecs_t lastUsed;
+    };
+
+    virtual bool threadLoop();
+
+    // prepareOutput connects to the producer of the request if needed and
+    // dequeues its output buffer.
+    status_t prepareOutput(Request* request);
+
+    // finishCapture queues the output buffer of a rendered capture, or
+    // cancels it if rendering failed.
+    void finishCapture(const Request& request);
+
+    void removeOutput(const sp<IBinder>& binder);
+    void removeIdleOutputs(nsecs_t now);
+
+    sp<SurfaceFlinger> mFlinger;
+
+    mutable Mutex mMutex;
+    Condition mCondition;
+
+    // protected by mMutex
+    Vector<Request> mQueued;
+    Vector<Request> mReady;
+    Vector<Request> mRendered;
+    size_t mNumOutputs;
+    uint64_t mNumCaptures;
+    uint64_t mNumFailed;
+    uint64_t mNumRejected;
+    uint64_t mNumOutputsReused;
+    nsecs_t mTotalLatency;
+    nsecs_t mMaxLatency;
+
+    // only accessed by the capture thread
+    Vector<Output> mOutputs;
+};
+
+}; // namespace android
+
+#endif // ANDROID_SCREENCAPTURETHREAD_H
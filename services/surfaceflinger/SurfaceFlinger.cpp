@@ -64,9 +64,11 @@
 #include "DisplayDevice.h"
 #include "DispSync.h"
 #include "EventControlThread.h"
+#include "HwcCommitThread.h"
 #include "EventThread.h"
 #include "Layer.h"
 #include "LayerDim.h"
+#include "ScreenCaptureThread.h"
 #include "SurfaceFlinger.h"
 
 #include "DisplayHardware/FramebufferSurface.h"
@@ -76,6 +78,7 @@
 #include "Effects/Daltonizer.h"
 
 #include "RenderEngine/RenderEngine.h"
+#include "RenderEngine/Texture.h"
 #include <cutils/compiler.h>
 
 #define DISPLAY_COUNT       1
@@ -113,8 +116,14 @@ namespace android {
 static const int64_t vsyncPhaseOffsetNs = VSYNC_EVENT_PHASE_OFFSET_NS;
 
 // This is the phase offset at which SurfaceFlinger's composition runs.
+// With debug.sf.tune_phase_offset set, it's only the starting point, and
+// mPhaseOffsetTuner moves it based on how long composition takes.
 static const int64_t sfVsyncPhaseOffsetNs = SF_VSYNC_EVENT_PHASE_OFFSET_NS;
 
+// how many frames' present fences are kept for tuning the phase offset
+// before giving up on the oldest one
+static const size_t MAX_TUNED_FRAMES = 4;
+
 // ---------------------------------------------------------------------------
 
 const String16 sHardwareTest("android.permission.HARDWARE_TEST");
@@ -136,6 +145,18 @@ SurfaceFlinger::SurfaceFlinger()
         mVisibleRegionsDirty(false),
         mHwWorkListDirty(false),
         mAnimCompositionPending(false),
+        mHwcCommitPending(false),
+        mPostCompositionPending(false),
+        mLatchUnsignaledBuffers(false),
+        mFlatteningThreshold(0),
+        mFrontToBackComposition(false),
+        mFrontToBackFrames(0),
+        mOpaqueLayerPixels(0),
+        mOpaqueVisiblePixels(0),
+        mPhaseOffsetTuning(false),
+        mRefreshExpectedPresent(0),
+        mRefreshVsyncTime(0),
+        mLastCommitTime(0),
         mDebugRegion(0),
         mDebugDDMS(0),
         mDebugDisableHWC(0),
@@ -162,6 +183,24 @@ SurfaceFlinger::SurfaceFlinger()
     property_get("debug.sf.showupdates", value, "0");
     mDebugRegion = atoi(value);
 
+    // latch buffers before their acquire fence signals, as we used to
+    property_get("debug.sf.latch_unsignaled", value, "0");
+    mLatchUnsignaledBuffers = atoi(value);
+
+    // how many frames layers must be unchanged before GLES composes them
+    // from an offscreen image, 0 (the default) to disable
+    property_get("debug.sf.flatten_frames", value, "0");
+    mFlatteningThreshold = atoi(value);
+
+    // draw opaque layers front to back with the depth test
+    property_get("debug.sf.front_to_back", value, "0");
+    mFrontToBackComposition = atoi(value);
+
+    // adjust the SF phase offset to the measured composition time, within
+    // the bounds set in init()
+    property_get("debug.sf.tune_phase_offset", value, "0");
+    mPhaseOffsetTuning = atoi(value);
+
     property_get("debug.sf.ddms", value, "0");
     mDebugDDMS = atoi(value);
     if (mDebugDDMS) {
@@ -317,10 +356,14 @@ void SurfaceFlinger::deleteTextureAsync(uint32_t texture) {
 
 class DispSyncSource : public VSyncSource, private DispSync::Callback {
 public:
-    DispSyncSource(DispSync* dispSync, nsecs_t phaseOffset, bool traceVsync,
-        const char* label) :
+    // deadlineOffset is the phase offset of SurfaceFlinger's own vsync
+    // events, which is when buffers are latched.
+    DispSyncSource(DispSync* dispSync, nsecs_t phaseOffset,
+        nsecs_t deadlineOffset, bool traceVsync, const char* label) :
             mValue(0),
+            mEnabled(false),
             mPhaseOffset(phaseOffset),
+            mDeadlineOffset(deadlineOffset),
             mTraceVsync(traceVsync),
             mVsyncOnLabel(String8::format("VsyncOn-%s", label)),
             mVsyncEventLabel(String8::format("VSYNC-%s", label)),
@@ -329,8 +372,10 @@ public:
     virtual ~DispSyncSource() {}
 
     virtual void setVSyncEnabled(bool enable) {
-        // Do NOT lock the mutex here so as to avoid any mutex ordering issues
+        // Do NOT lock mMutex here so as to avoid any mutex ordering issues
         // with locking it in the onDispSyncEvent callback.
+        Mutex::Autolock lock(mPhaseMutex);
+        mEnabled = enable;
         if (enable) {
             status_t err = mDispSync->addEventListener(mPhaseOffset,
                     static_cast<DispSync::Callback*>(this));
@@ -355,12 +400,35 @@ public:
         mCallback = callback;
     }
 
+    virtual void setPhaseOffset(nsecs_t phaseOffset, nsecs_t deadlineOffset) {
+        {
+            Mutex::Autolock lock(mMutex);
+            mDeadlineOffset = deadlineOffset;
+        }
+
+        Mutex::Autolock lock(mPhaseMutex);
+        if (phaseOffset == mPhaseOffset) {
+            return;
+        }
+        mPhaseOffset = phaseOffset;
+        if (mEnabled) {
+            status_t err = mDispSync->changePhaseOffset(
+                    static_cast<DispSync::Callback*>(this), mPhaseOffset);
+            if (err != NO_ERROR) {
+                ALOGE("error changing vsync offset: %s (%d)",
+                        strerror(-err), err);
+            }
+        }
+    }
+
 private:
     virtual void onDispSyncEvent(nsecs_t when) {
         sp<VSyncSource::Callback> callback;
+        nsecs_t deadlineOffset;
         {
             Mutex::Autolock lock(mMutex);
             callback = mCallback;
+            deadlineOffset = mDeadlineOffset;
 
             if (mTraceVsync) {
                 mValue = (mValue + 1) % 2;
@@ -369,13 +437,23 @@ private:
         }
 
         if (callback != NULL) {
-            callback->onVSyncEvent(when);
+            const nsecs_t nextVsync = mDispSync->computeNextEventTime(when, 0);
+            const nsecs_t deadline = mDispSync->computeNextEventTime(when,
+                    deadlineOffset);
+            callback->onVSyncEvent(when, nextVsync, deadline);
         }
     }
 
     int mValue;
 
-    const nsecs_t mPhaseOffset;
+    // mPhaseMutex protects mEnabled and mPhaseOffset. It's held while
+    // calling into mDispSync, which calls onDispSyncEvent without its own
+    // locks held, and onDispSyncEvent never takes it.
+    bool mEnabled;
+    nsecs_t mPhaseOffset;
+    Mutex mPhaseMutex;
+
+    nsecs_t mDeadlineOffset;
     const bool mTraceVsync;
     const String8 mVsyncOnLabel;
     const String8 mVsyncEventLabel;
@@ -402,6 +480,7 @@ void SurfaceFlinger::init() {
             *static_cast<HWComposer::EventHandler *>(this));
 
     // get a RenderEngine for the given display / config (can't fail)
+    RenderEngine::setUseDepthBuffer(mFrontToBackComposition);
     mRenderEngine = RenderEngine::create(mEGLDisplay, mHwc->getVisualID());
 
     // retrieve the EGL context that was selected/created
@@ -449,16 +528,47 @@ void SurfaceFlinger::init() {
 
     // start the EventThread
     sp<VSyncSource> vsyncSrc = new DispSyncSource(&mPrimaryDispSync,
-            vsyncPhaseOffsetNs, true, "app");
+            vsyncPhaseOffsetNs, sfVsyncPhaseOffsetNs, true, "app");
     mEventThread = new EventThread(vsyncSrc);
     sp<VSyncSource> sfVsyncSrc = new DispSyncSource(&mPrimaryDispSync,
-            sfVsyncPhaseOffsetNs, true, "sf");
+            sfVsyncPhaseOffsetNs, sfVsyncPhaseOffsetNs, true, "sf");
     mSFEventThread = new EventThread(sfVsyncSrc);
     mEventQueue.setEventThread(mSFEventThread);
 
     mEventControlThread = new EventControlThread(this);
     mEventControlThread->run("EventControl", PRIORITY_URGENT_DISPLAY);
 
+    mScreenCaptureThread = new ScreenCaptureThread(this);
+    mScreenCaptureThread->run("ScreenCapture", PRIORITY_DISPLAY);
+
+    // h/w composer 1.0 needs the current EGL surface in set(), so the
+    // commit stays on the main thread there. Latching still waits for the
+    // commit (see handleMessageInvalidate()), so only screen captures and
+    // GLES-only displays overlap it, and the thread is opt-in.
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.sf.hwc_commit_thread", value, "0");
+    if (atoi(value) && mHwc->initCheck() == NO_ERROR &&
+            mHwc->supportsFramebufferTarget()) {
+        mHwcCommitThread = new HwcCommitThread(this, *mHwc);
+        mHwcCommitThread->run("HwcCommit", PRIORITY_URGENT_DISPLAY);
+    }
+
+    if (mPhaseOffsetTuning) {
+        // by default the offset stays within the first half of the period,
+        // so that composition always has at least half a period
+        const nsecs_t period = mHwc->getRefreshPeriod(HWC_DISPLAY_PRIMARY);
+        property_get("debug.sf.phase_offset_min_ns", value, "0");
+        const nsecs_t minOffset = atoll(value);
+        property_get("debug.sf.phase_offset_max_ns", value, "0");
+        nsecs_t maxOffset = atoll(value);
+        if (maxOffset <= 0) {
+            maxOffset = period / 2;
+        }
+        mPhaseOffsetTuner.configure(period, minOffset, maxOffset,
+                sfVsyncPhaseOffsetNs);
+        setSfPhaseOffset(mPhaseOffsetTuner.getOffset());
+    }
+
     // set a fake vsync period if there is no HWComposer
     if (mHwc->initCheck() != NO_ERROR) {
         mPrimaryDispSync.setPeriod(16666667);
@@ -623,6 +733,7 @@ int SurfaceFlinger::getActiveConfig(const sp<IBinder>& display) {
 }
 
 void SurfaceFlinger::setActiveConfigInternal(const sp<DisplayDevice>& hw, int mode) {
+    waitForHwcCommit();
     ALOGD("Set active config mode=%d, type=%d flinger=%p", mode, hw->getDisplayType(),
           this);
     int32_t type = hw->getDisplayType();
@@ -850,17 +961,87 @@ void SurfaceFlinger::handleMessageTransaction() {
 
 void SurfaceFlinger::handleMessageInvalidate() {
     ATRACE_CALL();
+    // latching releases the previous buffers, which need the release fences
+    // of the last commit
+    waitForHwcCommit();
     handlePageFlip();
 }
 
 void SurfaceFlinger::handleMessageRefresh() {
     ATRACE_CALL();
+    waitForHwcCommit();
+    if (mPhaseOffsetTuning) {
+        mRefreshExpectedPresent = mPrimaryDispSync.computeNextRefresh(0);
+        // the refresh is measured from the SF vsync event that started it,
+        // so that latching buffers and committing the frame are included;
+        // refreshes that weren't started by one aren't measured
+        mRefreshVsyncTime = mEventQueue.takeVsyncTimestamp();
+    }
     preComposition();
     rebuildLayerStacks();
     setUpHWComposer();
     doDebugFlashRegions();
     doComposition();
-    postComposition();
+    doAsyncScreenCaptures();
+
+    // postComposition needs the present fence of this frame, so it's
+    // deferred until the commit thread is done with it, see
+    // onHwcCommitCompleted()
+    mPostCompositionPending = true;
+    if (!mHwcCommitPending) {
+        waitForHwcCommit();
+    }
+}
+
+void SurfaceFlinger::waitForHwcCommit() {
+    if (mHwcCommitPending) {
+        mHwcCommitPending = false;
+        mHwcCommitThread->waitForCommit(&mLastCommitTime);
+    }
+    if (mPostCompositionPending) {
+        mPostCompositionPending = false;
+        postComposition();
+    }
+}
+
+void SurfaceFlinger::onHwcCommitCompleted() {
+    class MessageHwcCommitCompleted : public MessageBase {
+        SurfaceFlinger* flinger;
+    public:
+        MessageHwcCommitCompleted(SurfaceFlinger* flinger)
+            : flinger(flinger) {
+        }
+        virtual bool handler() {
+            flinger->handleHwcCommitCompleted();
+            return true;
+        }
+    };
+    postMessageAsync(new MessageHwcCommitCompleted(this));
+}
+
+void SurfaceFlinger::handleHwcCommitCompleted() {
+    // a later refresh may have queued another commit in the meantime, which
+    // posts its own message when it completes
+    if (mHwcCommitPending && mHwcCommitThread->isCommitPending()) {
+        return;
+    }
+    waitForHwcCommit();
+}
+
+void SurfaceFlinger::tunePhaseOffset(nsecs_t refreshDuration) {
+    mPhaseOffsetTuner.addRefreshDuration(refreshDuration);
+    nsecs_t offset;
+    if (mPhaseOffsetTuner.update(&offset)) {
+        setSfPhaseOffset(offset);
+    }
+}
+
+void SurfaceFlinger::setSfPhaseOffset(nsecs_t offset) {
+    ATRACE_INT64("SfPhaseOffset", offset);
+    // the app events stay where they are, but the deadline sent along
+    // with them is when SF latches buffers
+    mSFEventThread->setPhaseOffset(offset, offset);
+    mEventThread->setPhaseOffset(vsyncPhaseOffsetNs, offset);
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -891,6 +1072,9 @@ void SurfaceFlinger::doDebugFlashRegions()
     }
 
     postFramebuffer();
+    // the flash frame must be committed before h/w composer is prepared
+    // again, and before doComposition() queues the next commit
+    waitForHwcCommit();
 
     if (mDebugRegion > 1) {
         usleep(mDebugRegion * 1000);
@@ -937,6 +1121,34 @@ void SurfaceFlinger::postComposition()
         }
     }
 
+    if (mPhaseOffsetTuning && presentFence->isValid()) {
+        // present fences may signal a few refreshes after the frame was
+        // committed, so they're checked at the following compositions
+        TunedFrame frame;
+        frame.presentFence = presentFence;
+        frame.expectedPresent = mRefreshExpectedPresent;
+        mTunedFrames.add(frame);
+        while (!mTunedFrames.isEmpty()) {
+            const TunedFrame& oldest(mTunedFrames[0]);
+            const nsecs_t presentTime = oldest.presentFence->getSignalTime();
+            if (presentTime == INT64_MAX) {
+                if (mTunedFrames.size() <= MAX_TUNED_FRAMES) {
+                    break;
+                }
+            } else if (presentTime > 0) {
+                mPhaseOffsetTuner.addPresentTime(oldest.expectedPresent,
+                        presentTime);
+            }
+            mTunedFrames.removeAt(0);
+        }
+    }
+
+    if (mPhaseOffsetTuning && mRefreshVsyncTime) {
+        // the frame was committed by now
+        tunePhaseOffset(mLastCommitTime - mRefreshVsyncTime);
+        mRefreshVsyncTime = 0;
+    }
+
     if (kIgnorePresentFences) {
         const sp<const DisplayDevice> hw(getDefaultDisplayDevice());
         if (hw->isDisplayOn()) {
@@ -976,7 +1188,8 @@ void SurfaceFlinger::rebuildLayerStacks() {
             const Rect bounds(hw->getBounds());
             if (hw->isDisplayOn()) {
                 SurfaceFlinger::computeVisibleRegions(layers,
-                        hw->getLayerStack(), dirtyRegion, opaqueRegion);
+                        hw->getLayerStack(), hw->getVisibleRegionCache(),
+                        dirtyRegion, opaqueRegion);
 
                 const size_t count = layers.size();
                 for (size_t i=0 ; i<count ; i++) {
@@ -991,6 +1204,11 @@ void SurfaceFlinger::rebuildLayerStacks() {
                         }
                     }
                 }
+            } else {
+                // other displays may change the regions of our layers
+                // while we're off
+                hw->getVisibleRegionCache().clear();
+                hw->getFlatteningCache().releaseTarget();
             }
             hw->setVisibleLayersSortedByZ(layersSortedByZ);
             hw->undefinedRegion.set(bounds);
@@ -1114,23 +1332,78 @@ void SurfaceFlinger::setUpHWComposer() {
 void SurfaceFlinger::doComposition() {
     ATRACE_CALL();
     const bool repaintEverything = android_atomic_and(0, &mRepaintEverything);
+    const nsecs_t start = systemTime();
+    HWComposer& hwc(getHwComposer());
+
+    // h/w composer commits all its displays at once, so the primary display
+    // is composed first to keep its GPU work from being queued behind the
+    // other displays', and the displays h/w composer doesn't handle are
+    // composed only once the commit is started.
+    Vector< sp<DisplayDevice> > hwcDisplays;
+    Vector< sp<DisplayDevice> > glesDisplays;
     for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
         const sp<DisplayDevice>& hw(mDisplays[dpy]);
-        if (hw->isDisplayOn()) {
-            // transform the dirty region into this screen's coordinate space
-            const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+        if (hw->getHwcDisplayId() < 0) {
+            glesDisplays.add(hw);
+        } else if (hw->getDisplayType() == DisplayDevice::DISPLAY_PRIMARY) {
+            hwcDisplays.insertAt(hw, 0);
+        } else {
+            hwcDisplays.add(hw);
+        }
+    }
 
-            // repaint the framebuffer (if needed)
-            doDisplayComposition(hw, dirtyRegion);
+    Vector<nsecs_t> composeTimes;
+    composeTimes.setCapacity(hwcDisplays.size());
+    for (size_t i=0 ; i<hwcDisplays.size() ; i++) {
+        composeTimes.add(composeDisplay(hwcDisplays[i], repaintEverything));
+    }
+    postFramebuffer();
 
-            hw->dirtyRegion.clear();
-            hw->flip(hw->swapRegion);
-            hw->swapRegion.clear();
+    const nsecs_t posted = systemTime();
+    for (size_t i=0 ; i<hwcDisplays.size() ; i++) {
+        const sp<DisplayDevice>& hw(hwcDisplays[i]);
+        if (hw->isDisplayOn()) {
+            hw->onFrameComposed(composeTimes[i], posted - start,
+                    hwc.hasGlesComposition(hw->getHwcDisplayId()));
         }
-        // inform the h/w that we're done compositing
-        hw->compositionComplete();
     }
-    postFramebuffer();
+
+    if (!glesDisplays.isEmpty()) {
+        Vector<HwcCommitThread::Display> displays;
+        for (size_t i=0 ; i<glesDisplays.size() ; i++) {
+            const sp<DisplayDevice>& hw(glesDisplays[i]);
+            const nsecs_t composeTime = composeDisplay(hw, repaintEverything);
+            if (hw->isDisplayOn()) {
+                hw->onFrameComposed(composeTime, systemTime() - start, true);
+            }
+            HwcCommitThread::Display display;
+            display.hw = hw;
+            display.layers = hw->getVisibleLayersSortedByZ();
+            displays.add(display);
+        }
+        // see postFramebuffer()
+        getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
+        HwcCommitThread::onFrameCommitted(hwc, displays);
+    }
+}
+
+nsecs_t SurfaceFlinger::composeDisplay(const sp<DisplayDevice>& hw,
+        bool repaintEverything) {
+    const nsecs_t start = systemTime();
+    if (hw->isDisplayOn()) {
+        // transform the dirty region into this screen's coordinate space
+        const Region dirtyRegion(hw->getDirtyRegion(repaintEverything));
+
+        // repaint the framebuffer (if needed)
+        doDisplayComposition(hw, dirtyRegion);
+
+        hw->dirtyRegion.clear();
+        hw->flip(hw->swapRegion);
+        hw->swapRegion.clear();
+    }
+    // inform the h/w that we're done compositing
+    hw->compositionComplete();
+    return systemTime() - start;
 }
 
 void SurfaceFlinger::postFramebuffer()
@@ -1141,38 +1414,51 @@ void SurfaceFlinger::postFramebuffer()
     mDebugInSwapBuffers = now;
 
     HWComposer& hwc(getHwComposer());
-    if (hwc.initCheck() == NO_ERROR) {
-        if (!hwc.supportsFramebufferTarget()) {
-            // EGL spec says:
-            //   "surface must be bound to the calling thread's current context,
-            //    for the current rendering API."
-            getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
+    Vector<HwcCommitThread::Display> displays;
+    displays.setCapacity(mDisplays.size());
+    bool hasVirtualDisplay = false;
+    for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
+        // the displays h/w composer doesn't handle are composed afterwards,
+        // see doComposition()
+        if (mDisplays[dpy]->getHwcDisplayId() < 0) {
+            continue;
+        }
+        HwcCommitThread::Display display;
+        display.hw = mDisplays[dpy];
+        display.layers = mDisplays[dpy]->getVisibleLayersSortedByZ();
+        displays.add(display);
+        if (mDisplays[dpy]->getDisplayType() >= DisplayDevice::DISPLAY_VIRTUAL) {
+            hasVirtualDisplay = true;
         }
-        hwc.commit();
     }
 
-    // make the default display current because the VirtualDisplayDevice code cannot
-    // deal with dequeueBuffer() being called outside of the composition loop; however
-    // the code below can call glFlush() which is allowed (and does in some case) call
-    // dequeueBuffer().
-    getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
-
-    for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
-        sp<const DisplayDevice> hw(mDisplays[dpy]);
-        const Vector< sp<Layer> >& currentLayers(hw->getVisibleLayersSortedByZ());
-        hw->onSwapBuffersCompleted(hwc);
-        const size_t count = currentLayers.size();
-        int32_t id = hw->getHwcDisplayId();
-        if (id >=0 && hwc.initCheck() == NO_ERROR) {
-            HWComposer::LayerListIterator cur = hwc.begin(id);
-            const HWComposer::LayerListIterator end = hwc.end(id);
-            for (size_t i = 0; cur != end && i < count; ++i, ++cur) {
-                currentLayers[i]->onLayerDisplayed(hw, &*cur);
-            }
-        } else {
-            for (size_t i = 0; i < count; i++) {
-                currentLayers[i]->onLayerDisplayed(hw, NULL);
+    if (mHwcCommitThread != NULL && !hasVirtualDisplay) {
+        // the commit thread doesn't use GL, and a VirtualDisplaySurface
+        // can't be used from two threads, so only frames without virtual
+        // displays backed by h/w composer are committed there
+        getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
+        mHwcCommitThread->queueCommit(displays);
+        mHwcCommitPending = true;
+    } else {
+        if (hwc.initCheck() == NO_ERROR) {
+            if (!hwc.supportsFramebufferTarget()) {
+                // EGL spec says:
+                //   "surface must be bound to the calling thread's current context,
+                //    for the current rendering API."
+                getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
             }
+            hwc.commit();
+        }
+        mLastCommitTime = systemTime();
+
+        // make the default display current because the VirtualDisplayDevice code cannot
+        // deal with dequeueBuffer() being called outside of the composition loop; however
+        // the code below can call glFlush() which is allowed (and does in some case) call
+        // dequeueBuffer().
+        getDefaultDisplayDevice()->makeCurrent(mEGLDisplay, mEGLContext);
+        HwcCommitThread::onFrameCommitted(hwc, displays);
+        if (mHwcCommitThread != NULL) {
+            mHwcCommitThread->onSynchronousCommit(systemTime() - now);
         }
     }
 
@@ -1189,6 +1475,10 @@ void SurfaceFlinger::handleTransaction(uint32_t transactionFlags)
 {
     ATRACE_CALL();
 
+    // display changes touch h/w composer, and removed layers may still be
+    // used by the commit thread
+    waitForHwcCommit();
+
     // here we keep a copy of the drawing state (that is the state that's
     // going to be overwritten by handleTransactionLocked()) outside of
     // mStateLock so that the side-effects of the State assignment
@@ -1528,13 +1818,15 @@ void SurfaceFlinger::commitTransaction()
 
 void SurfaceFlinger::computeVisibleRegions(
         const LayerVector& currentLayers, uint32_t layerStack,
+        VisibleRegionCache& cache,
         Region& outDirtyRegion, Region& outOpaqueRegion)
 {
     ATRACE_CALL();
 
-    Region aboveOpaqueLayers;
-    Region aboveCoveredLayers;
-    Region dirty;
+    Vector<Layer*> layers;
+    Vector<VisibleRegionCache::Input> inputs;
+    layers.setCapacity(currentLayers.size());
+    inputs.setCapacity(currentLayers.size());
 
     outDirtyRegion.clear();
 
@@ -1549,24 +1841,8 @@ void SurfaceFlinger::computeVisibleRegions(
         if (s.layerStack != layerStack)
             continue;
 
-        /*
-         * opaqueRegion: area of a surface that is fully opaque.
-         */
-        Region opaqueRegion;
-
-        /*
-         * visibleRegion: area of a surface that is visible on screen
-         * and not fully transparent. This is essentially the layer's
-         * footprint minus the opaque regions above it.
-         * Areas covered by a translucent surface are considered visible.
-         */
-        Region visibleRegion;
-
-        /*
-         * coveredRegion: area of a surface that is covered by all
-         * visible regions above it (which includes the translucent areas).
-         */
-        Region coveredRegion;
+        VisibleRegionCache::Input input;
+        input.id = uint32_t(layer->sequence);
 
         /*
          * transparentRegion: area of a surface that is hinted to be completely
@@ -1576,50 +1852,55 @@ void SurfaceFlinger::computeVisibleRegions(
          * beneath it. The hint may not be correct if apps don't respect the
          * SurfaceView restrictions (which, sadly, some don't).
          */
-        Region transparentRegion;
-
 
-        // handle hidden surfaces by setting the visible region to empty
+        // handle hidden surfaces by leaving the bounds empty
         if (CC_LIKELY(layer->isVisible())) {
             const bool translucent = !layer->isOpaque(s);
-            Rect bounds(s.transform.transform(layer->computeBounds()));
-            visibleRegion.set(bounds);
-            if (!visibleRegion.isEmpty()) {
+            input.bounds = s.transform.transform(layer->computeBounds());
+            if (!input.bounds.isEmpty()) {
                 // Remove the transparent area from the visible region
                 if (translucent) {
                     const Transform tr(s.transform);
                     if (tr.transformed()) {
                         if (tr.preserveRects()) {
                             // transform the transparent region
-                            transparentRegion = tr.transform(s.activeTransparentRegion);
-                        } else {
-                            // transformation too complex, can't do the
-                            // transparent region optimization.
-                            transparentRegion.clear();
+                            input.transparentRegion =
+                                    tr.transform(s.activeTransparentRegion);
                         }
+                        // otherwise the transformation is too complex, we
+                        // can't do the transparent region optimization.
                     } else {
-                        transparentRegion = s.activeTransparentRegion;
+                        input.transparentRegion = s.activeTransparentRegion;
                     }
                 }
 
-                // compute the opaque region
+                // the opaque region is the layer's footprint
                 const int32_t layerOrientation = s.transform.getOrientation();
-                if (s.alpha==255 && !translucent &&
-                        ((layerOrientation & Transform::ROT_INVALID) == false)) {
-                    // the opaque region is the layer's footprint
-                    opaqueRegion = visibleRegion;
-                }
+                input.opaque = s.alpha==255 && !translucent &&
+                        ((layerOrientation & Transform::ROT_INVALID) == false);
             }
         }
 
-        // Clip the covered region to the visible region
-        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+        layers.add(layer.get());
+        inputs.add(input);
+    }
 
-        // Update aboveCoveredLayers for next (lower) layer
-        aboveCoveredLayers.orSelf(visibleRegion);
+    // the layers above the first changed one have the same visible and
+    // covered regions as last time, so only their content can be dirty
+    const size_t first = cache.update(inputs);
+    for (i = 0; i < first; i++) {
+        Layer* layer = layers[i];
+        if (layer->contentDirty) {
+            outDirtyRegion.orSelf(layer->visibleRegion);
+            layer->contentDirty = false;
+        }
+    }
 
-        // subtract the opaque region covered by the layers above us
-        visibleRegion.subtractSelf(aboveOpaqueLayers);
+    Region dirty;
+    for (i = first; i < layers.size(); i++) {
+        Layer* layer = layers[i];
+        const VisibleRegionCache::Result& result(cache.getResult(i));
+        const Region& visibleRegion(result.visibleRegion);
 
         // compute this layer's dirty region
         if (layer->contentDirty) {
@@ -1641,28 +1922,25 @@ void SurfaceFlinger::computeVisibleRegions(
              * (2) handles areas that were not covered by anything but got
              * exposed because of a resize.
              */
-            const Region newExposed = visibleRegion - coveredRegion;
+            const Region newExposed = visibleRegion - result.coveredRegion;
             const Region oldVisibleRegion = layer->visibleRegion;
             const Region oldCoveredRegion = layer->coveredRegion;
             const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
             dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
         }
-        dirty.subtractSelf(aboveOpaqueLayers);
+        dirty.subtractSelf(result.aboveOpaqueRegion);
 
         // accumulate to the screen dirty region
         outDirtyRegion.orSelf(dirty);
 
-        // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
-
         // Store the visible region in screen space
         layer->setVisibleRegion(visibleRegion);
-        layer->setCoveredRegion(coveredRegion);
+        layer->setCoveredRegion(result.coveredRegion);
         layer->setVisibleNonTransparentRegion(
-                visibleRegion.subtract(transparentRegion));
+                result.visibleNonTransparentRegion);
     }
 
-    outOpaqueRegion = aboveOpaqueLayers;
+    outOpaqueRegion = cache.getOpaqueRegion();
 }
 
 void SurfaceFlinger::invalidateLayerStack(uint32_t layerStack,
@@ -1730,6 +2008,11 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
     // compute the invalid region
     hw->swapRegion.orSelf(dirtyRegion);
 
+    if (hw->hasBufferAge()) {
+        hw->addDamage(dirtyRegion);
+        hw->setCompositionSignature(computeCompositionSignature(hw));
+    }
+
     uint32_t flags = hw->getFlags();
     if (flags & DisplayDevice::SWAP_RECTANGLE) {
         // we can redraw only what's dirty, but since SWAP_RECTANGLE only
@@ -1743,6 +2026,14 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
             // This is needed because PARTIAL_UPDATES only takes one
             // rectangle instead of a region (see DisplayDevice::flip())
             dirtyRegion.set(hw->swapRegion.bounds());
+        } else if (hw->hasBufferAge() && !mDaltonize && !mHasColorMatrix &&
+                getHwComposer().hasGlesComposition(hw->getHwcDisplayId()) &&
+                hw->makeCurrent(mEGLDisplay, mEGLContext)) {
+            // we only need to redraw what changed since the back buffer was
+            // last displayed. (the color transforms always render the whole
+            // screen into an intermediate target)
+            dirtyRegion = hw->getBufferAgeRepaintRegion();
+            hw->swapRegion = dirtyRegion;
         } else {
             // we need to redraw everything (the whole screen)
             dirtyRegion.set(hw->bounds());
@@ -1770,6 +2061,24 @@ void SurfaceFlinger::doDisplayComposition(const sp<const DisplayDevice>& hw,
     hw->swapBuffers(getHwComposer());
 }
 
+uint32_t SurfaceFlinger::computeCompositionSignature(
+        const sp<const DisplayDevice>& hw)
+{
+    // FNV-1a over the layers and how h/w composer composes them
+    const int32_t id = hw->getHwcDisplayId();
+    HWComposer& hwc(getHwComposer());
+    HWComposer::LayerListIterator cur = hwc.begin(id);
+    const HWComposer::LayerListIterator end = hwc.end(id);
+    const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
+    uint32_t signature = 2166136261u;
+    for (size_t i=0 ; i<layers.size() && cur!=end ; ++i, ++cur) {
+        const uintptr_t key = reinterpret_cast<uintptr_t>(layers[i].get()) ^
+                uintptr_t(cur->getCompositionType());
+        signature = (signature ^ uint32_t(key)) * 16777619u;
+    }
+    return signature;
+}
+
 bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const Region& dirty)
 {
     RenderEngine& engine(getRenderEngine());
@@ -1778,6 +2087,7 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     HWComposer::LayerListIterator cur = hwc.begin(id);
     const HWComposer::LayerListIterator end = hwc.end(id);
 
+    size_t flattened = 0;
     bool hasGlesComposition = hwc.hasGlesComposition(id);
     if (hasGlesComposition) {
         if (!hw->makeCurrent(mEGLDisplay, mEGLContext)) {
@@ -1790,6 +2100,20 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             return false;
         }
 
+        // this must happen before the scissor is set up, since the cache is
+        // rendered in full
+        flattened = flattenStaticLayers(hw);
+
+        // when only part of the display is redrawn, everything we draw,
+        // including the clears below, must stay inside of it
+        const uint32_t height = hw->getHeight();
+        const Rect repaint(dirty.getBounds());
+        const bool partial = repaint != hw->getBounds();
+        if (partial) {
+            engine.setScissor(repaint.left, height - repaint.bottom,
+                    repaint.getWidth(), repaint.getHeight());
+        }
+
         // Never touch the framebuffer if we don't have any framebuffer layers
         const bool hasHwcComposition = hwc.hasHwcComposition(id);
         if (hasHwcComposition) {
@@ -1826,18 +2150,24 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             // scissor on the main display. It should never be needed
             // anyways (though in theory it could since the API allows it).
             const Rect& bounds(hw->getBounds());
-            const Rect& scissor(hw->getScissor());
+            Rect scissor(hw->getScissor());
             if (scissor != bounds) {
                 // scissor doesn't match the screen's dimensions, so we
                 // need to clear everything outside of it and enable
                 // the GL scissor so we don't draw anything where we shouldn't
+                if (partial) {
+                    scissor.intersect(repaint, &scissor);
+                }
 
                 // enable scissor for this frame
-                const uint32_t height = hw->getHeight();
                 engine.setScissor(scissor.left, height - scissor.bottom,
                         scissor.getWidth(), scissor.getHeight());
             }
         }
+    } else {
+        // nothing is flattened while h/w composer does the whole display,
+        // but the target must still be freed when it stays unused
+        hw->getFlatteningCache().onHwcComposition();
     }
 
     /*
@@ -1847,12 +2177,36 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
     const size_t count = layers.size();
     const Transform& tr = hw->getTransform();
-    if (cur != end) {
+
+    if (flattened) {
+        // the bottom layers are replaced by their flattened image where
+        // they're visible. The image holds them composed over transparent
+        // black, so blending it over the framebuffer leaves what drawing
+        // them in turn would have left, alpha included.
+        Region region;
+        for (size_t i=0 ; i<flattened ; ++i) {
+            region.orSelf(tr.transform(layers[i]->visibleRegion));
+        }
+        region.andSelf(dirty);
+        if (!region.isEmpty()) {
+            Texture texture(Texture::TEXTURE_2D,
+                    hw->getFlatteningCache().getTextureName());
+            texture.setDimensions(hw->getWidth(), hw->getHeight());
+            engine.drawRegionWithTexture(region, hw->getHeight(), texture);
+        }
+    }
+
+    if (mFrontToBackComposition && hasGlesComposition &&
+            engine.beginDepthTest()) {
+        doComposeSurfacesFrontToBack(hw, dirty, flattened);
+        engine.endDepthTest();
+    } else if (cur != end) {
         // we're using h/w composer
         for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
             const sp<Layer>& layer(layers[i]);
             const Region clip(dirty.intersect(tr.transform(layer->visibleRegion)));
-            if (!clip.isEmpty()) {
+            // the flattened layers were drawn above
+            if (i >= flattened && !clip.isEmpty()) {
                 switch (cur->getCompositionType()) {
                     case HWC_CURSOR_OVERLAY:
                     case HWC_OVERLAY: {
@@ -1883,7 +2237,7 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
         }
     } else {
         // we're not using h/w composer
-        for (size_t i=0 ; i<count ; ++i) {
+        for (size_t i=flattened ; i<count ; ++i) {
             const sp<Layer>& layer(layers[i]);
             const Region clip(dirty.intersect(
                     tr.transform(layer->visibleRegion)));
@@ -1898,6 +2252,164 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     return true;
 }
 
+static uint64_t getArea(const Region& region) {
+    uint64_t area = 0;
+    size_t count;
+    Rect const* rects = region.getArray(&count);
+    for (size_t i=0 ; i<count ; i++) {
+        area += uint64_t(rects[i].getWidth()) * uint64_t(rects[i].getHeight());
+    }
+    return area;
+}
+
+void SurfaceFlinger::doComposeSurfacesFrontToBack(
+        const sp<const DisplayDevice>& hw, const Region& dirty, size_t first)
+{
+    RenderEngine& engine(getRenderEngine());
+    const int32_t id = hw->getHwcDisplayId();
+    HWComposer& hwc(getHwComposer());
+    HWComposer::LayerListIterator cur = hwc.begin(id);
+    const HWComposer::LayerListIterator end = hwc.end(id);
+    const bool useHwc = cur != end;
+
+    const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
+    const Transform& tr = hw->getTransform();
+    const Rect bounds(dirty.getBounds());
+
+    // sort out what GLES does with each layer, the same way
+    // doComposeSurfaces() does
+    enum { SKIP, CLEAR, DRAW_OPAQUE, DRAW_BLENDED };
+    size_t count = layers.size();
+    Vector<int> ops;
+    ops.insertAt(SKIP, 0, count);
+    for (size_t i=0 ; i<count ; ++i) {
+        if (useHwc && cur == end) {
+            count = i;
+            break;
+        }
+        const sp<Layer>& layer(layers[i]);
+        const Layer::State& state(layer->getDrawingState());
+        const bool opaque = layer->isOpaque(state) && state.alpha == 0xFF;
+        const bool visible = i >= first &&
+                !dirty.intersect(tr.transform(layer->visibleRegion)).isEmpty();
+        const int32_t type = useHwc ?
+                cur->getCompositionType() : int32_t(HWC_FRAMEBUFFER);
+        if (visible && type == HWC_FRAMEBUFFER) {
+            ops.editItemAt(i) = opaque ? DRAW_OPAQUE : DRAW_BLENDED;
+        } else if (visible && (type == HWC_OVERLAY ||
+                type == HWC_CURSOR_OVERLAY)) {
+            if ((cur->getHints() & HWC_HINT_CLEAR_FB) && i && opaque) {
+                ops.editItemAt(i) = CLEAR;
+            }
+        }
+        if (useHwc) {
+            layer->setAcquireFence(hw, *cur);
+            ++cur;
+        }
+    }
+
+    // the topmost layer is the nearest; opaque layers and the holes
+    // punched for overlays are drawn first, from the top down, so that
+    // the depth test rejects everything they hide. The other layers are
+    // then blended from the bottom up, as usual, wherever they're not
+    // hidden.
+    for (size_t i=count ; i-- > 0 ; ) {
+        const int op = ops[i];
+        if (op != DRAW_OPAQUE && op != CLEAR) {
+            continue;
+        }
+        const sp<Layer>& layer(layers[i]);
+        const Region clip(dirty.intersect(tr.transform(layer->visibleRegion)));
+        engine.setDepth(float(count - i) / float(count + 1), true);
+        if (op == CLEAR) {
+            layer->clearWithOpenGL(hw, clip);
+        } else {
+            layer->draw(hw, clip);
+
+            const Layer::State& state(layer->getDrawingState());
+            Rect footprint(tr.transform(
+                    state.transform.transform(layer->computeBounds())));
+            if (footprint.intersect(bounds, &footprint)) {
+                mOpaqueLayerPixels += uint64_t(footprint.getWidth()) *
+                        uint64_t(footprint.getHeight());
+                mOpaqueVisiblePixels += getArea(clip);
+            }
+        }
+    }
+    for (size_t i=0 ; i<count ; ++i) {
+        if (ops[i] == DRAW_BLENDED) {
+            const sp<Layer>& layer(layers[i]);
+            const Region clip(dirty.intersect(
+                    tr.transform(layer->visibleRegion)));
+            engine.setDepth(float(count - i) / float(count + 1), false);
+            layer->draw(hw, clip);
+        }
+    }
+    mFrontToBackFrames++;
+}
+
+size_t SurfaceFlinger::flattenStaticLayers(const sp<const DisplayDevice>& hw)
+{
+    FlatteningCache& cache(hw->getFlatteningCache());
+    cache.setThreshold(mFlatteningThreshold);
+
+    const int32_t id = hw->getHwcDisplayId();
+    HWComposer& hwc(getHwComposer());
+    HWComposer::LayerListIterator cur = hwc.begin(id);
+    const HWComposer::LayerListIterator end = hwc.end(id);
+    const bool useHwc = cur != end;
+
+    const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
+    const size_t count = layers.size();
+    Vector<FlatteningCache::Input> inputs;
+    inputs.setCapacity(count);
+    for (size_t i=0 ; i<count ; ++i) {
+        const sp<Layer>& layer(layers[i]);
+        bool gles = !useHwc;
+        if (cur != end) {
+            gles = cur->getCompositionType() == HWC_FRAMEBUFFER;
+            ++cur;
+        }
+        FlatteningCache::Input input;
+        input.id = layer->sequence;
+        input.generation = layer->getContentGeneration();
+        input.flattenable = gles && layer->isFlattenable();
+        inputs.add(input);
+    }
+
+    bool render;
+    const size_t flattened = cache.update(inputs, &render);
+    if (!render) {
+        return flattened;
+    }
+
+    ATRACE_CALL();
+    RenderEngine& engine(getRenderEngine());
+    const uint32_t w = hw->getWidth();
+    const uint32_t h = hw->getHeight();
+    if (!cache.hasTarget(w, h)) {
+        uint32_t texName, fbName;
+        if (!engine.createOffscreenTarget(w, h, &texName, &fbName)) {
+            ALOGW("can't create a %ux%u offscreen target, layer flattening "
+                    "disabled", w, h);
+            mFlatteningThreshold = 0;
+            cache.releaseTarget();
+            return 0;
+        }
+        cache.setTarget(engine, w, h, texName, fbName);
+    }
+
+    // the layers are drawn entirely, as if the whole display was dirty
+    engine.bindOffscreenTarget(cache.getFramebufferName());
+    engine.clearWithColor(0, 0, 0, 0);
+    const Region bounds(hw->bounds());
+    for (size_t i=0 ; i<flattened ; ++i) {
+        layers[i]->draw(hw, bounds);
+    }
+    engine.bindOffscreenTarget(0);
+    return flattened;
+}
+
 void SurfaceFlinger::drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const {
     const int32_t height = hw->getHeight();
     RenderEngine& engine(getRenderEngine());
@@ -2078,10 +2590,15 @@ uint32_t SurfaceFlinger::setClientStateLocked(
         const sp<Client>& client,
         const layer_state_t& s)
 {
+    // only the fields flagged in what were sent by the client
+    const uint32_t what = s.what;
+    if (what == 0) {
+        return 0;
+    }
+
     uint32_t flags = 0;
     sp<Layer> layer(client->getLayerUser(s.surface));
     if (layer != 0) {
-        const uint32_t what = s.what;
         if (what & layer_state_t::ePositionChanged) {
             if (layer->setPosition(s.x, s.y))
                 flags |= eTraversalNeeded;
@@ -2283,6 +2800,7 @@ void SurfaceFlinger::initializeDisplays() {
 
 void SurfaceFlinger::setPowerModeInternal(const sp<DisplayDevice>& hw,
         int mode) {
+    waitForHwcCommit();
     ALOGD("Set power mode=%d, type=%d flinger=%p", mode, hw->getDisplayType(),
             this);
     int32_t type = hw->getDisplayType();
@@ -2559,6 +3077,24 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
         vsyncPhaseOffsetNs, sfVsyncPhaseOffsetNs, PRESENT_TIME_OFFSET_FROM_VSYNC_NS,
         mHwc->getRefreshPeriod(HWC_DISPLAY_PRIMARY));
     result.append("\n");
+    if (mPhaseOffsetTuning) {
+        mPhaseOffsetTuner.dump(result);
+    }
+
+    mScreenCaptureThread->dump(result);
+    if (mHwcCommitThread != NULL) {
+        mHwcCommitThread->dump(result);
+    }
+    if (mFrontToBackComposition) {
+        // the opaque layers are drawn entirely, but the depth test rejects
+        // the pixels outside of their visible region
+        result.appendFormat("Front-to-back composition: %" PRIu64 " frames, "
+                "%.1f%% of the opaque layer pixels rejected\n",
+                mFrontToBackFrames,
+                mOpaqueLayerPixels ? 100.0 *
+                        (mOpaqueLayerPixels - mOpaqueVisiblePixels) /
+                        mOpaqueLayerPixels : 0.0);
+    }
 
     /*
      * Dump the visible layer list
@@ -2716,6 +3252,7 @@ status_t SurfaceFlinger::onTransact(
             break;
         }
         case CAPTURE_SCREEN:
+        case CAPTURE_SCREEN_ASYNC:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -2975,6 +3512,24 @@ public:
 };
 
 
+// Converts a capture rotation to surfaceflinger's internal rotation type
+static Transform::orientation_flags getRotationFlags(
+        ISurfaceComposer::Rotation rotation) {
+    switch (rotation) {
+        case ISurfaceComposer::eRotateNone:
+            return Transform::ROT_0;
+        case ISurfaceComposer::eRotate90:
+            return Transform::ROT_90;
+        case ISurfaceComposer::eRotate180:
+            return Transform::ROT_180;
+        case ISurfaceComposer::eRotate270:
+            return Transform::ROT_270;
+        default:
+            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
+            return Transform::ROT_0;
+    }
+}
+
 status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
         const sp<IGraphicBufferProducer>& producer,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -3000,25 +3555,7 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     }
 
     // Convert to surfaceflinger's internal rotation type.
-    Transform::orientation_flags rotationFlags;
-    switch (rotation) {
-        case ISurfaceComposer::eRotateNone:
-            rotationFlags = Transform::ROT_0;
-            break;
-        case ISurfaceComposer::eRotate90:
-            rotationFlags = Transform::ROT_90;
-            break;
-        case ISurfaceComposer::eRotate180:
-            rotationFlags = Transform::ROT_180;
-            break;
-        case ISurfaceComposer::eRotate270:
-            rotationFlags = Transform::ROT_270;
-            break;
-        default:
-            rotationFlags = Transform::ROT_0;
-            ALOGE("Invalid rotation passed to captureScreen(): %d\n", rotation);
-            break;
-    }
+    Transform::orientation_flags rotationFlags(getRotationFlags(rotation));
 
     class MessageCaptureScreen : public MessageBase {
         SurfaceFlinger* flinger;
@@ -3085,6 +3622,139 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
     return res;
 }
 
+status_t SurfaceFlinger::captureScreenAsync(const sp<IBinder>& display,
+        const sp<IGraphicBufferProducer>& producer,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, ISurfaceComposer::Rotation rotation) {
+
+    if (CC_UNLIKELY(display == 0))
+        return BAD_VALUE;
+
+    if (CC_UNLIKELY(producer == 0))
+        return BAD_VALUE;
+
+    ScreenCaptureThread::Request request;
+    {
+        Mutex::Autolock _l(mStateLock);
+        sp<const DisplayDevice> hw(getDisplayDevice(display));
+        if (hw == NULL)
+            return NAME_NOT_FOUND;
+
+        // same as captureScreen; this is checked again when the capture is
+        // rendered
+        if (!producer->asBinder()->localBinder() &&
+                hw->getSecureLayerVisible()) {
+            ALOGW("FB is protected: PERMISSION_DENIED");
+            return PERMISSION_DENIED;
+        }
+
+        const uint32_t hw_w = hw->getWidth();
+        const uint32_t hw_h = hw->getHeight();
+        if ((reqWidth > hw_w) || (reqHeight > hw_h)) {
+            ALOGE("size mismatch (%d, %d) > (%d, %d)",
+                    reqWidth, reqHeight, hw_w, hw_h);
+            return BAD_VALUE;
+        }
+        request.reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
+        request.reqHeight = (!reqHeight) ? hw_h : reqHeight;
+    }
+
+    request.display = display;
+    request.producer = producer;
+    request.sourceCrop = sourceCrop;
+    request.minLayerZ = minLayerZ;
+    request.maxLayerZ = maxLayerZ;
+    request.useIdentityTransform = useIdentityTransform;
+    request.rotation = getRotationFlags(rotation);
+    return mScreenCaptureThread->queueCapture(request);
+}
+
+void SurfaceFlinger::doAsyncScreenCaptures() {
+    // the capture thread disconnects idle outputs on its own, which frees
+    // their buffers everywhere but here
+    pruneCaptureImages();
+
+    Vector<ScreenCaptureThread::Request> requests;
+    mScreenCaptureThread->takeReadyCaptures(&requests);
+    if (requests.isEmpty())
+        return;
+
+    ATRACE_CALL();
+    Mutex::Autolock _l(mStateLock);
+    for (size_t i=0 ; i<requests.size() ; i++) {
+        ScreenCaptureThread::Request& request(requests.editItemAt(i));
+        sp<const DisplayDevice> hw(getDisplayDevice(request.display));
+        if (hw == NULL) {
+            request.result = NAME_NOT_FOUND;
+            continue;
+        }
+        if (!request.producer->asBinder()->localBinder() &&
+                hw->getSecureLayerVisible()) {
+            ALOGW("FB is protected: PERMISSION_DENIED");
+            request.result = PERMISSION_DENIED;
+            continue;
+        }
+        EGLImageKHR image = getCaptureImage(request.buffer);
+        if (image == EGL_NO_IMAGE_KHR) {
+            request.result = BAD_VALUE;
+            continue;
+        }
+        request.result = renderCaptureLocked(hw, image, request.sourceCrop,
+                request.reqWidth, request.reqHeight,
+                request.minLayerZ, request.maxLayerZ,
+                request.useIdentityTransform, request.rotation,
+                &request.fenceFd);
+    }
+    mScreenCaptureThread->onCapturesRendered(requests);
+}
+
+void SurfaceFlinger::pruneCaptureImages() {
+    // drop the images of the buffers that nobody else references anymore,
+    // i.e. that were freed by their output
+    for (size_t i=0 ; i<mCaptureImages.size() ; ) {
+        if (mCaptureImages[i].buffer->getStrongCount() == 1) {
+            eglDestroyImageKHR(mEGLDisplay, mCaptureImages[i].image);
+            mCaptureImages.removeAt(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+EGLImageKHR SurfaceFlinger::getCaptureImage(const sp<GraphicBuffer>& buffer) {
+    // the cache is small; make room by dropping the least recently used
+    // images
+    const size_t MAX_CAPTURE_IMAGES = 8;
+    for (size_t i=0 ; i<mCaptureImages.size() ; ) {
+        if (mCaptureImages.size() >= MAX_CAPTURE_IMAGES &&
+                mCaptureImages[i].buffer != buffer) {
+            eglDestroyImageKHR(mEGLDisplay, mCaptureImages[i].image);
+            mCaptureImages.removeAt(i);
+        } else {
+            i++;
+        }
+    }
+
+    for (size_t i=0 ; i<mCaptureImages.size() ; i++) {
+        if (mCaptureImages[i].buffer == buffer) {
+            CaptureImage entry(mCaptureImages[i]);
+            mCaptureImages.removeAt(i);
+            mCaptureImages.add(entry);
+            return entry.image;
+        }
+    }
+
+    CaptureImage entry;
+    entry.buffer = buffer;
+    entry.image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, buffer->getNativeBuffer(), NULL);
+    if (entry.image != EGL_NO_IMAGE_KHR) {
+        mCaptureImages.add(entry);
+    }
+    return entry.image;
+}
+
 
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
@@ -3205,67 +3875,9 @@ status_t SurfaceFlinger::captureScreenImplLocked(
                 EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
                         EGL_NATIVE_BUFFER_ANDROID, buffer, NULL);
                 if (image != EGL_NO_IMAGE_KHR) {
-                    // this binds the given EGLImage as a framebuffer for the
-                    // duration of this scope.
-                    RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
-                    if (imageBond.getStatus() == NO_ERROR) {
-                        // this will in fact render into our dequeued buffer
-                        // via an FBO, which means we didn't have to create
-                        // an EGLSurface and therefore we're not
-                        // dependent on the context's EGLConfig.
-                        renderScreenImplLocked(
-                            hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
-                            useIdentityTransform, rotation);
-
-                        // Attempt to create a sync khr object that can produce a sync point. If that
-                        // isn't available, create a non-dupable sync object in the fallback path and
-                        // wait on it directly.
-                        EGLSyncKHR sync;
-                        if (!DEBUG_SCREENSHOTS) {
-                           sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
-                           // native fence fd will not be populated until flush() is done:
-                           getRenderEngine().flush();
-                        } else {
-                            sync = EGL_NO_SYNC_KHR;
-                        }
-                        if (sync != EGL_NO_SYNC_KHR) {
-                            // get the sync fd
-                            syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
-                            if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
-                                ALOGW("captureScreen: failed to dup sync khr object");
-                                syncFd = -1;
-                            }
-                            eglDestroySyncKHR(mEGLDisplay, sync);
-                        } else {
-                            // fallback path
-                            sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
-                            if (sync != EGL_NO_SYNC_KHR) {
-                                EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
-                                    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
-                                EGLint eglErr = eglGetError();
-                                if (result == EGL_TIMEOUT_EXPIRED_KHR) {
-                                    ALOGW("captureScreen: fence wait timed out");
-                                } else {
-                                    ALOGW_IF(eglErr != EGL_SUCCESS,
-                                            "captureScreen: error waiting on EGL fence: %#x", eglErr);
-                                }
-                                eglDestroySyncKHR(mEGLDisplay, sync);
-                            } else {
-                                ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
-                            }
-                        }
-                        if (DEBUG_SCREENSHOTS) {
-                            uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
-                            getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
-                            checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
-                                    hw, minLayerZ, maxLayerZ);
-                            delete [] pixels;
-                        }
-
-                    } else {
-                        ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
-                        result = INVALID_OPERATION;
-                    }
+                    result = renderCaptureLocked(hw, image, sourceCrop,
+                            reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                            useIdentityTransform, rotation, &syncFd);
                     // destroy our image
                     eglDestroyImageKHR(mEGLDisplay, image);
                 } else {
@@ -3283,6 +3895,83 @@ status_t SurfaceFlinger::captureScreenImplLocked(
     return result;
 }
 
+status_t SurfaceFlinger::renderCaptureLocked(
+        const sp<const DisplayDevice>& hw, EGLImageKHR image,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        int* outSyncFd)
+{
+    ATRACE_CALL();
+    status_t result = NO_ERROR;
+    int syncFd = -1;
+
+    // this binds the given EGLImage as a framebuffer for the
+    // duration of this scope.
+    RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
+    if (imageBond.getStatus() == NO_ERROR) {
+        // this will in fact render into our dequeued buffer
+        // via an FBO, which means we didn't have to create
+        // an EGLSurface and therefore we're not
+        // dependent on the context's EGLConfig.
+        renderScreenImplLocked(
+            hw, sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ, true,
+            useIdentityTransform, rotation);
+
+        // Attempt to create a sync khr object that can produce a sync point. If that
+        // isn't available, create a non-dupable sync object in the fallback path and
+        // wait on it directly.
+        EGLSyncKHR sync;
+        if (!DEBUG_SCREENSHOTS) {
+           sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+           // native fence fd will not be populated until flush() is done:
+           getRenderEngine().flush();
+        } else {
+            sync = EGL_NO_SYNC_KHR;
+        }
+        if (sync != EGL_NO_SYNC_KHR) {
+            // get the sync fd
+            syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+            if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+                ALOGW("captureScreen: failed to dup sync khr object");
+                syncFd = -1;
+            }
+            eglDestroySyncKHR(mEGLDisplay, sync);
+        } else {
+            // fallback path
+            sync = eglCreateSyncKHR(mEGLDisplay, EGL_SYNC_FENCE_KHR, NULL);
+            if (sync != EGL_NO_SYNC_KHR) {
+                EGLint result = eglClientWaitSyncKHR(mEGLDisplay, sync,
+                    EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 2000000000 /*2 sec*/);
+                EGLint eglErr = eglGetError();
+                if (result == EGL_TIMEOUT_EXPIRED_KHR) {
+                    ALOGW("captureScreen: fence wait timed out");
+                } else {
+                    ALOGW_IF(eglErr != EGL_SUCCESS,
+                            "captureScreen: error waiting on EGL fence: %#x", eglErr);
+                }
+                eglDestroySyncKHR(mEGLDisplay, sync);
+            } else {
+                ALOGW("captureScreen: error creating EGL fence: %#x", eglGetError());
+            }
+        }
+        if (DEBUG_SCREENSHOTS) {
+            uint32_t* pixels = new uint32_t[reqWidth*reqHeight];
+            getRenderEngine().readPixels(0, 0, reqWidth, reqHeight, pixels);
+            checkScreenshot(reqWidth, reqHeight, reqWidth, pixels,
+                    hw, minLayerZ, maxLayerZ);
+            delete [] pixels;
+        }
+
+    } else {
+        ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
+        result = INVALID_OPERATION;
+    }
+
+    *outSyncFd = syncFd;
+    return result;
+}
+
 void SurfaceFlinger::checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
         const sp<const DisplayDevice>& hw, uint32_t minLayerZ, uint32_t maxLayerZ) {
     if (DEBUG_SCREENSHOTS) {
@@ -52,6 +52,7 @@
 #include "DispSync.h"
 #include "FrameTracker.h"
 #include "MessageQueue.h"
+#include "PhaseOffsetTuner.h"
 
 #include "DisplayHardware/HWComposer.h"
 #include "Effects/Daltonizer.h"
@@ -69,6 +70,9 @@ class LayerDim;
 class Surface;
 class RenderEngine;
 class EventControlThread;
+class HwcCommitThread;
+class GraphicBuffer;
+class ScreenCaptureThread;
 
 // ---------------------------------------------------------------------------
 
@@ -139,6 +143,8 @@ private:
     friend class DisplayEventConnection;
     friend class Layer;
     friend class MonitoredProducer;
+    friend class HwcCommitThread;
+    friend class ScreenCaptureThread;
 
     // This value is specified in number of frames.  Log frame stats at most
     // every half hour.
@@ -215,6 +221,11 @@ private:
             Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, ISurfaceComposer::Rotation rotation);
+    virtual status_t captureScreenAsync(const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, ISurfaceComposer::Rotation rotation);
     virtual status_t getDisplayStats(const sp<IBinder>& display,
             DisplayStatInfo* stats);
     virtual status_t getDisplayConfigs(const sp<IBinder>& display,
@@ -333,6 +344,28 @@ private:
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, Transform::orientation_flags rotation);
 
+    // renderCaptureLocked renders a capture into image and returns a fence
+    // that signals when rendering completes in outSyncFd, or -1 if it has
+    // already completed.
+    status_t renderCaptureLocked(
+            const sp<const DisplayDevice>& hw, EGLImageKHR image,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation,
+            int* outSyncFd);
+
+    // doAsyncScreenCaptures renders the captures requested with
+    // captureScreenAsync whose output buffers are ready. Called on the main
+    // thread after composition.
+    void doAsyncScreenCaptures();
+
+    // getCaptureImage returns the EGLImage of an async capture output buffer.
+    // The images are cached since the output buffers are reused.
+    EGLImageKHR getCaptureImage(const sp<GraphicBuffer>& buffer);
+    // pruneCaptureImages destroys the cached images of the output buffers
+    // that were freed. Called at every composition.
+    void pruneCaptureImages();
+
     /* ------------------------------------------------------------------------
      * EGL
      */
@@ -377,19 +410,44 @@ private:
     void invalidateHwcGeometry();
     static void computeVisibleRegions(
             const LayerVector& currentLayers, uint32_t layerStack,
+            VisibleRegionCache& cache,
             Region& dirtyRegion, Region& opaqueRegion);
 
     void preComposition();
     void postComposition();
+    // waits for the frame queued on mHwcCommitThread to be committed, then
+    // runs the deferred postComposition
+    void waitForHwcCommit();
+    // called by mHwcCommitThread when a commit completed, runs the deferred
+    // postComposition on the main thread without waiting for the next frame
+    void onHwcCommitCompleted();
+    void handleHwcCommitCompleted();
+    // feeds mPhaseOffsetTuner with the time from the SF vsync event to the
+    // commit of the last frame and moves the vsync events if it picked a
+    // new SF phase offset
+    void tunePhaseOffset(nsecs_t refreshDuration);
+    void setSfPhaseOffset(nsecs_t offset);
     void rebuildLayerStacks();
     void setUpHWComposer();
     void doComposition();
     void doDebugFlashRegions();
     void doDisplayComposition(const sp<const DisplayDevice>& hw, const Region& dirtyRegion);
+    // composes and flips hw if it's on, and returns how long that took
+    nsecs_t composeDisplay(const sp<DisplayDevice>& hw, bool repaintEverything);
+
+    // identifies the set of layers h/w composer leaves to GLES on display hw
+    uint32_t computeCompositionSignature(const sp<const DisplayDevice>& hw);
 
     // compose surfaces for display hw. this fails if using GL and the surface
     // has been destroyed and is no longer valid.
     bool doComposeSurfaces(const sp<const DisplayDevice>& hw, const Region& dirty);
+    // renders the static bottom layers of the display into its flattening
+    // cache if needed, and returns how many are drawn from it
+    size_t flattenStaticLayers(const sp<const DisplayDevice>& hw);
+    // draws the GLES layers of the display above the first ones with the
+    // depth test, opaque layers front to back then the others back to front
+    void doComposeSurfacesFrontToBack(const sp<const DisplayDevice>& hw,
+            const Region& dirty, size_t first);
 
     void postFramebuffer();
     void drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const;
@@ -458,6 +516,8 @@ private:
     sp<EventThread> mEventThread;
     sp<EventThread> mSFEventThread;
     sp<EventControlThread> mEventControlThread;
+    sp<ScreenCaptureThread> mScreenCaptureThread;
+    sp<HwcCommitThread> mHwcCommitThread;
     EGLContext mEGLContext;
     EGLDisplay mEGLDisplay;
     sp<IBinder> mBuiltinDisplays[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
@@ -468,6 +528,34 @@ private:
     bool mVisibleRegionsDirty;
     bool mHwWorkListDirty;
     bool mAnimCompositionPending;
+    bool mHwcCommitPending;
+    bool mPostCompositionPending;
+    bool mLatchUnsignaledBuffers;
+    uint32_t mFlatteningThreshold;
+    bool mFrontToBackComposition;
+    uint64_t mFrontToBackFrames;
+    uint64_t mOpaqueLayerPixels;
+    uint64_t mOpaqueVisiblePixels;
+    bool mPhaseOffsetTuning;
+    // the vsync the refresh in progress targets, and the present fences of
+    // the last frames with the vsync each targeted, for mPhaseOffsetTuner
+    struct TunedFrame {
+        sp<Fence> presentFence;
+        nsecs_t expectedPresent;
+    };
+    nsecs_t mRefreshExpectedPresent;
+    Vector<TunedFrame> mTunedFrames;
+    // the time of the SF vsync event that started the refresh in progress,
+    // 0 if none did, and when the last frame was committed
+    nsecs_t mRefreshVsyncTime;
+    nsecs_t mLastCommitTime;
+
+    // EGLImages of the async capture output buffers, most recently used last
+    struct CaptureImage {
+        sp<GraphicBuffer> buffer;
+        EGLImageKHR image;
+    };
+    Vector<CaptureImage> mCaptureImages;
 
     // this may only be written from the main thread with mStateLock held
     // it may be read from other threads with mStateLock held
@@ -488,6 +576,7 @@ private:
     mutable MessageQueue mEventQueue;
     FrameTracker mAnimFrameTracker;
     DispSync mPrimaryDispSync;
+    PhaseOffsetTuner mPhaseOffsetTuner;
 
     // protected by mDestroyedLayerLock;
     mutable Mutex mDestroyedLayerLock;
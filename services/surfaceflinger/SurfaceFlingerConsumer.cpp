@@ -118,6 +118,23 @@ sp<NativeHandle> SurfaceFlingerConsumer::getSidebandStream() const {
     return mConsumer->getSidebandStream();
 }
 
+bool SurfaceFlingerConsumer::isFrontBufferReady(const DispSync& dispSync) {
+    Mutex::Autolock lock(mMutex);
+    if (mAbandoned) {
+        return true;
+    }
+    // the buffers acquiring at this expected present time drops don't
+    // matter, see updateTexImage()
+    sp<Fence> fence;
+    if (mConsumer->getFrontBufferFence(&fence,
+            computeExpectedPresent(dispSync)) != NO_ERROR) {
+        return true;
+    }
+    // getSignalTime() returns -1 if there is no fence or on error, in which
+    // case there is nothing to wait for
+    return fence->getSignalTime() != INT64_MAX;
+}
+
 // We need to determine the time when a buffer acquired now will be
 // displayed.  This can be calculated:
 //   time when previous buffer's actual-present fence was signaled
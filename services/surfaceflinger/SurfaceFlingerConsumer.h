@@ -67,6 +67,11 @@ public:
 
     sp<NativeHandle> getSidebandStream() const;
 
+    // Returns false if the buffer updateTexImage would latch, given
+    // dispSync, is still being rendered into by the producer, i.e. its
+    // acquire fence hasn't signaled yet.
+    bool isFrontBufferReady(const DispSync& dispSync);
+
 private:
     nsecs_t computeExpectedPresent(const DispSync& dispSync);
 
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <utils/String8.h>
+
+#include "VisibleRegionCache.h"
+
+namespace android {
+
+VisibleRegionCache::Input::Input()
+    : id(0), opaque(false) {
+}
+
+VisibleRegionCache::VisibleRegionCache()
+    : mUpdates(0),
+      mLayersUpdated(0),
+      mLayersRecomputed(0) {
+}
+
+size_t VisibleRegionCache::update(const Vector<Input>& inputs) {
+    const size_t count = inputs.size();
+    const size_t cached = mEntries.size();
+    mUpdates++;
+    mLayersUpdated += count;
+
+    // the layers above the first changed one keep their results
+    size_t first = 0;
+    while (first < count && first < cached &&
+            isSameInput(inputs[first], mEntries[first].input)) {
+        first++;
+    }
+    if (first == count && count == cached) {
+        return count;
+    }
+
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+    if (first < cached) {
+        aboveOpaqueLayers = mEntries[first].result.aboveOpaqueRegion;
+        aboveCoveredLayers = mEntries[first].aboveCoveredRegion;
+    } else {
+        aboveOpaqueLayers = mOpaqueRegion;
+        aboveCoveredLayers = mCoveredRegion;
+    }
+
+    if (count < cached) {
+        mEntries.removeItemsAt(count, cached - count);
+    } else if (count > cached) {
+        mEntries.insertAt(cached, count - cached);
+    }
+
+    for (size_t i = first; i < count; i++) {
+        Entry& entry(mEntries.editItemAt(i));
+        const Input& input(inputs[i]);
+        Result& result(entry.result);
+        entry.input = input;
+        result.aboveOpaqueRegion = aboveOpaqueLayers;
+        entry.aboveCoveredRegion = aboveCoveredLayers;
+
+        Region visibleRegion(input.bounds);
+        Region opaqueRegion;
+        if (input.opaque) {
+            opaqueRegion = visibleRegion;
+        }
+
+        // Clip the covered region to the visible region
+        result.coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
+
+        // Update aboveCoveredLayers for next (lower) layer
+        aboveCoveredLayers.orSelf(visibleRegion);
+
+        // subtract the opaque region covered by the layers above us
+        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        result.visibleRegion = visibleRegion;
+        result.visibleNonTransparentRegion =
+                visibleRegion.subtract(input.transparentRegion);
+
+        // Update aboveOpaqueLayers for next (lower) layer
+        aboveOpaqueLayers.orSelf(opaqueRegion);
+    }
+
+    mOpaqueRegion = aboveOpaqueLayers;
+    mCoveredRegion = aboveCoveredLayers;
+    mLayersRecomputed += count - first;
+    return first;
+}
+
+void VisibleRegionCache::clear() {
+    mEntries.clear();
+    mOpaqueRegion.clear();
+    mCoveredRegion.clear();
+}
+
+bool VisibleRegionCache::isSameInput(const Input& lhs, const Input& rhs) {
+    return lhs.id == rhs.id &&
+            lhs.bounds == rhs.bounds &&
+            lhs.opaque == rhs.opaque &&
+            isSameRegion(lhs.transparentRegion, rhs.transparentRegion);
+}
+
+bool VisibleRegionCache::isSameRegion(const Region& lhs, const Region& rhs) {
+    if (lhs.isEmpty() || rhs.isEmpty()) {
+        return lhs.isEmpty() && rhs.isEmpty();
+    }
+    // regions are kept in a canonical form, so equal regions are made of
+    // the same rectangles
+    size_t lhsCount, rhsCount;
+    Rect const* lhsRects = lhs.getArray(&lhsCount);
+    Rect const* rhsRects = rhs.getArray(&rhsCount);
+    if (lhsCount != rhsCount) {
+        return false;
+    }
+    if (lhsRects == rhsRects) {
+        return true;
+    }
+    for (size_t i = 0; i < lhsCount; i++) {
+        if (lhsRects[i] != rhsRects[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VisibleRegionCache::dump(String8& result) const {
+    result.appendFormat("   visible regions: %zu layers, %" PRIu64
+            " updates, %.1f of %.1f layers recomputed per update\n",
+            mEntries.size(), mUpdates,
+            mUpdates ? double(mLayersRecomputed) / mUpdates : 0.0,
+            mUpdates ? double(mLayersUpdated) / mUpdates : 0.0);
+}
+
+}; // namespace android
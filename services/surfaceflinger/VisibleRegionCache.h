@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VISIBLEREGIONCACHE_H
+#define ANDROID_VISIBLEREGIONCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include <utils/Vector.h>
+
+namespace android {
+
+class String8;
+
+// VisibleRegionCache computes the visible, covered and opaque regions of the
+// layers of a layer stack, and remembers the result of each layer together
+// with the opaque and covered regions accumulated above it. When update() is
+// given the same inputs as last time for the topmost layers, those layers
+// keep their results and the computation resumes at the first layer whose
+// inputs changed, so a change near the bottom of the stack is cheap.
+//
+// All the inputs and results are in layer stack space. This class is *NOT*
+// thread-safe; SurfaceFlinger keeps one per display and only uses it on the
+// main thread.
+class VisibleRegionCache {
+public:
+    struct Input {
+        Input();
+
+        // identifies the layer; a new layer must never reuse an id
+        uint32_t id;
+
+        // footprint of the layer, empty if the layer is hidden
+        Rect bounds;
+
+        // whether the whole footprint is opaque
+        bool opaque;
+
+        // area of the footprint the layer hints is fully transparent. This
+        // only affects the visibleNonTransparentRegion of the layer.
+        Region transparentRegion;
+    };
+
+    struct Result {
+        // footprint of the layer less the opaque regions above it
+        Region visibleRegion;
+
+        // part of the footprint covered by the layers above it, including
+        // their translucent areas
+        Region coveredRegion;
+
+        // visibleRegion less the transparent region hint
+        Region visibleNonTransparentRegion;
+
+        // opaque region of the layers above this one
+        Region aboveOpaqueRegion;
+    };
+
+    VisibleRegionCache();
+
+    // update computes the results for inputs, which are ordered from the
+    // topmost layer down. It returns the index of the first layer whose
+    // result was recomputed; the results of the layers above it are the
+    // ones of the previous update. It returns inputs.size() if nothing
+    // changed.
+    size_t update(const Vector<Input>& inputs);
+
+    // clear forgets the cached results, so that the next update recomputes
+    // every layer.
+    void clear();
+
+    size_t size() const { return mEntries.size(); }
+    const Result& getResult(size_t index) const {
+        return mEntries[index].result;
+    }
+
+    // getOpaqueRegion returns the opaque region of the whole layer stack
+    const Region& getOpaqueRegion() const { return mOpaqueRegion; }
+
+    void dump(String8& result) const;
+
+private:
+    struct Entry {
+        Input input;
+        Result result;
+
+        // visible region of the layers above this one
+        Region aboveCoveredRegion;
+    };
+
+    static bool isSameInput(const Input& lhs, const Input& rhs);
+    static bool isSameRegion(const Region& lhs, const Region& rhs);
+
+    Vector<Entry> mEntries;
+    Region mOpaqueRegion;
+    Region mCoveredRegion;
+
+    uint64_t mUpdates;
+    uint64_t mLayersUpdated;
+    uint64_t mLayersRecomputed;
+};
+
+}; // namespace android
+
+#endif // ANDROID_VISIBLEREGIONCACHE_H
@@ -7,7 +7,13 @@ LOCAL_MODULE := SurfaceFlinger_test
 LOCAL_MODULE_TAGS := tests
 
 LOCAL_SRC_FILES := \
+    FlatteningCache_test.cpp \
+    PhaseOffsetTuner_test.cpp \
     Transaction_test.cpp \
+    VisibleRegionCache_test.cpp \
+    ../FlatteningCache.cpp \
+    ../PhaseOffsetTuner.cpp \
+    ../VisibleRegionCache.cpp \
 
 LOCAL_SHARED_LIBRARIES := \
 	libEGL \
@@ -24,6 +30,7 @@ LOCAL_C_INCLUDES := \
     bionic/libstdc++/include \
     external/gtest/include \
     external/stlport/stlport \
+    $(LOCAL_PATH)/.. \
 
 # Build the binary to $(TARGET_OUT_DATA_NATIVE_TESTS)/$(LOCAL_MODULE)
 # to integrate with auto-test framework.
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FlatteningCache_test"
+//#define LOG_NDEBUG 0
+
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include "FlatteningCache.h"
+
+namespace android {
+
+class FlatteningCacheTest : public ::testing::Test {
+
+protected:
+    FlatteningCacheTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+        mCache.setThreshold(THRESHOLD);
+    }
+
+    ~FlatteningCacheTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    enum { THRESHOLD = 3 };
+
+    void createLayers(size_t count) {
+        mInputs.clear();
+        for (size_t i = 0; i < count; i++) {
+            FlatteningCache::Input input;
+            input.id = i + 1;
+            input.flattenable = true;
+            mInputs.add(input);
+        }
+    }
+
+    size_t update(bool* outRender) {
+        return mCache.update(mInputs, outRender);
+    }
+
+    // runs compositions until the cache renders, and returns how many
+    // layers it flattened
+    size_t updateUntilRendered() {
+        for (int i = 0; i <= THRESHOLD; i++) {
+            bool render;
+            const size_t flattened = update(&render);
+            if (render) {
+                return flattened;
+            }
+            EXPECT_EQ(0U, flattened);
+        }
+        return 0;
+    }
+
+    FlatteningCache mCache;
+    Vector<FlatteningCache::Input> mInputs;
+};
+
+TEST_F(FlatteningCacheTest, FlattensLayersUnchangedForThreshold) {
+    createLayers(5);
+    bool render;
+    for (int i = 0; i < THRESHOLD; i++) {
+        EXPECT_EQ(0U, update(&render));
+        EXPECT_FALSE(render);
+    }
+    EXPECT_EQ(5U, update(&render));
+    EXPECT_TRUE(render);
+
+    // the next compositions use the target as is
+    EXPECT_EQ(5U, update(&render));
+    EXPECT_FALSE(render);
+    EXPECT_EQ(5U, update(&render));
+    EXPECT_FALSE(render);
+}
+
+TEST_F(FlatteningCacheTest, FlattensOnlyBottomRun) {
+    createLayers(5);
+    // layers 2 and 4 are animating
+    mInputs.editItemAt(2).generation++;
+    bool render;
+    for (int i = 0; i < THRESHOLD; i++) {
+        update(&render);
+        mInputs.editItemAt(2).generation++;
+        mInputs.editItemAt(4).generation++;
+    }
+    EXPECT_EQ(2U, update(&render));
+    EXPECT_TRUE(render);
+
+    // h/w composer composes layer 1
+    mInputs.editItemAt(1).flattenable = false;
+    mInputs.editItemAt(2).generation++;
+    EXPECT_EQ(0U, update(&render));
+    EXPECT_FALSE(render);
+}
+
+TEST_F(FlatteningCacheTest, RendersAgainWhenFlattenedLayerChanges) {
+    createLayers(4);
+    ASSERT_EQ(4U, updateUntilRendered());
+
+    // a layer above the flattened ones changes: nothing to do
+    mInputs.add(FlatteningCache::Input());
+    mInputs.editTop().id = 5;
+    mInputs.editTop().flattenable = true;
+    bool render;
+    EXPECT_EQ(4U, update(&render));
+    EXPECT_FALSE(render);
+
+    // a flattened layer changes: it must be unchanged again for THRESHOLD
+    // compositions, the layers below it are flattened in the meantime
+    mInputs.editItemAt(3).generation++;
+    ASSERT_EQ(3U, updateUntilRendered());
+    for (int i = 0; i < THRESHOLD - 1; i++) {
+        EXPECT_EQ(3U, update(&render));
+        EXPECT_FALSE(render);
+    }
+
+    // once the changed layer and the new one are unchanged long enough,
+    // the run grows
+    EXPECT_EQ(5U, update(&render));
+    EXPECT_TRUE(render);
+}
+
+TEST_F(FlatteningCacheTest, RemovedLayerInvalidatesTarget) {
+    createLayers(4);
+    ASSERT_EQ(4U, updateUntilRendered());
+
+    mInputs.removeAt(1);
+    bool render;
+    EXPECT_EQ(0U, update(&render));
+    EXPECT_FALSE(render);
+}
+
+TEST_F(FlatteningCacheTest, SingleLayerIsNotFlattened) {
+    createLayers(2);
+    mInputs.editItemAt(1).flattenable = false;
+    bool render;
+    for (int i = 0; i < THRESHOLD * 2; i++) {
+        EXPECT_EQ(0U, update(&render));
+        EXPECT_FALSE(render);
+    }
+}
+
+TEST_F(FlatteningCacheTest, ThresholdZeroDisables) {
+    createLayers(4);
+    ASSERT_EQ(4U, updateUntilRendered());
+
+    mCache.setThreshold(0);
+    bool render;
+    EXPECT_EQ(0U, update(&render));
+    EXPECT_FALSE(render);
+}
+
+TEST_F(FlatteningCacheTest, InvalidateStartsOver) {
+    createLayers(4);
+    ASSERT_EQ(4U, updateUntilRendered());
+
+    mCache.invalidate();
+    ASSERT_EQ(4U, updateUntilRendered());
+}
+
+TEST_F(FlatteningCacheTest, HwcCompositionInvalidatesTarget) {
+    createLayers(4);
+    ASSERT_EQ(4U, updateUntilRendered());
+
+    // h/w composer draws the layers meanwhile, they're unchanged so the
+    // target is rendered again right away
+    mCache.onHwcComposition();
+    bool render;
+    EXPECT_EQ(4U, update(&render));
+    EXPECT_TRUE(render);
+}
+
+} // namespace android
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "PhaseOffsetTuner_test"
+//#define LOG_NDEBUG 0
+
+#include <utils/Log.h>
+
+#include <gtest/gtest.h>
+
+#include "PhaseOffsetTuner.h"
+
+namespace android {
+
+static const nsecs_t PERIOD = 16666667;
+static const nsecs_t MIN_OFFSET = 0;
+static const nsecs_t MAX_OFFSET = 8000000;
+static const nsecs_t INITIAL_OFFSET = 1000000;
+
+class PhaseOffsetTunerTest : public ::testing::Test {
+
+protected:
+    PhaseOffsetTunerTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+        mTuner.configure(PERIOD, MIN_OFFSET, MAX_OFFSET, INITIAL_OFFSET);
+    }
+
+    ~PhaseOffsetTunerTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    // runs compositions that take duration and returns the offset after
+    // them
+    nsecs_t compose(nsecs_t duration, int frames) {
+        nsecs_t offset = mTuner.getOffset();
+        for (int i = 0; i < frames; i++) {
+            mTuner.addRefreshDuration(duration);
+            mTuner.update(&offset);
+        }
+        return offset;
+    }
+
+    PhaseOffsetTuner mTuner;
+};
+
+TEST_F(PhaseOffsetTunerTest, CheapCompositionRaisesOffsetGradually) {
+    // not before a full window of samples
+    EXPECT_EQ(INITIAL_OFFSET, compose(2000000, 60));
+
+    const nsecs_t first = compose(2000000, 100);
+    EXPECT_GT(first, INITIAL_OFFSET);
+    EXPECT_LE(first, INITIAL_OFFSET + 1000000);
+
+    // eventually up to the upper bound
+    EXPECT_EQ(MAX_OFFSET, compose(2000000, 3000));
+}
+
+TEST_F(PhaseOffsetTunerTest, RaisedOffsetLeavesTimeForComposition) {
+    // 10ms refreshes leave room for an offset below 16.7 - 10 - margin
+    const nsecs_t offset = compose(10000000, 3000);
+    EXPECT_GT(offset, INITIAL_OFFSET);
+    EXPECT_LE(offset + 10000000, PERIOD);
+}
+
+TEST_F(PhaseOffsetTunerTest, ExpensiveCompositionLowersOffsetAtOnce) {
+    ASSERT_EQ(MAX_OFFSET, compose(2000000, 3000));
+
+    nsecs_t offset;
+    mTuner.addRefreshDuration(12000000);
+    EXPECT_TRUE(mTuner.update(&offset));
+    EXPECT_LT(offset + 12000000, PERIOD);
+
+    // the slow composition stays in the window for a while, so the offset
+    // keeps leaving room for it
+    EXPECT_LT(compose(2000000, 100) + 12000000, PERIOD);
+}
+
+TEST_F(PhaseOffsetTunerTest, OffsetStaysWithinBounds) {
+    EXPECT_EQ(MIN_OFFSET, compose(30000000, 10));
+    EXPECT_EQ(MAX_OFFSET, compose(100000, 5000));
+}
+
+TEST_F(PhaseOffsetTunerTest, MissedFrameLowersOffsetAndHoldsIt) {
+    ASSERT_EQ(MAX_OFFSET, compose(2000000, 3000));
+
+    // presented on time: nothing changes
+    mTuner.addPresentTime(100000000, 100000000 + 500000);
+    EXPECT_EQ(MAX_OFFSET, compose(2000000, 1));
+
+    // presented a vsync late
+    mTuner.addPresentTime(200000000, 200000000 + PERIOD);
+    nsecs_t offset;
+    mTuner.addRefreshDuration(2000000);
+    EXPECT_TRUE(mTuner.update(&offset));
+    EXPECT_LT(offset, MAX_OFFSET);
+
+    // the offset isn't raised again right away
+    EXPECT_EQ(offset, compose(2000000, 300));
+    EXPECT_EQ(MAX_OFFSET, compose(2000000, 3000));
+}
+
+TEST_F(PhaseOffsetTunerTest, UpdateReportsChangesOnce) {
+    nsecs_t offset;
+    mTuner.addRefreshDuration(30000000);
+    EXPECT_TRUE(mTuner.update(&offset));
+    EXPECT_EQ(MIN_OFFSET, offset);
+    mTuner.addRefreshDuration(30000000);
+    EXPECT_FALSE(mTuner.update(&offset));
+    EXPECT_EQ(MIN_OFFSET, offset);
+}
+
+TEST_F(PhaseOffsetTunerTest, ConfigureClampsInitialOffset) {
+    mTuner.configure(PERIOD, MIN_OFFSET, MAX_OFFSET, -2000000);
+    EXPECT_EQ(MIN_OFFSET, mTuner.getOffset());
+    mTuner.configure(PERIOD, MIN_OFFSET, PERIOD * 2, PERIOD);
+    EXPECT_EQ(PERIOD - 1, mTuner.getOffset());
+}
+
+} // namespace android
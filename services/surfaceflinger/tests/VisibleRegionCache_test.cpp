@@ -0,0 +1,273 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "VisibleRegionCache_test"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+
+#include <utils/Log.h>
+#include <utils/Timers.h>
+
+#include <gtest/gtest.h>
+
+#include "VisibleRegionCache.h"
+
+namespace android {
+
+class VisibleRegionCacheTest : public ::testing::Test {
+
+protected:
+    VisibleRegionCacheTest() : mSeed(1) {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~VisibleRegionCacheTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    enum { SCREEN_WIDTH = 1080, SCREEN_HEIGHT = 1920 };
+
+    // A simple LCG, so that every run uses the same scenes
+    uint32_t random(uint32_t max) {
+        mSeed = mSeed * 1103515245 + 12345;
+        return (mSeed >> 8) % max;
+    }
+
+    VisibleRegionCache::Input randomLayer(uint32_t id) {
+        VisibleRegionCache::Input input;
+        input.id = id;
+        const int32_t left = random(SCREEN_WIDTH);
+        const int32_t top = random(SCREEN_HEIGHT);
+        input.bounds = Rect(left, top,
+                left + 1 + random(SCREEN_WIDTH / 2),
+                top + 1 + random(SCREEN_HEIGHT / 2));
+        input.opaque = random(2);
+        if (!input.opaque && random(4) == 0) {
+            input.transparentRegion.set(Rect(left, top,
+                    left + input.bounds.width() / 2,
+                    top + input.bounds.height() / 2));
+        }
+        return input;
+    }
+
+    // Builds a scene like a busy home screen: a wallpaper at the bottom
+    // and windows and widgets on top of it
+    void createScene(size_t layerCount, Vector<VisibleRegionCache::Input>*
+            outInputs) {
+        outInputs->clear();
+        for (size_t i = 1; i < layerCount; i++) {
+            outInputs->add(randomLayer(sNextId++));
+        }
+        VisibleRegionCache::Input wallpaper;
+        wallpaper.id = sNextId++;
+        wallpaper.bounds = Rect(SCREEN_WIDTH, SCREEN_HEIGHT);
+        wallpaper.opaque = true;
+        outInputs->add(wallpaper);
+    }
+
+    static bool isSameRegion(const Region& lhs, const Region& rhs) {
+        return lhs.subtract(rhs).isEmpty() && rhs.subtract(lhs).isEmpty();
+    }
+
+    // Checks that the cache gives the same results as a full computation
+    static void expectSameResults(const VisibleRegionCache& cache,
+            const Vector<VisibleRegionCache::Input>& inputs) {
+        VisibleRegionCache reference;
+        ASSERT_EQ(0U, reference.update(inputs));
+        ASSERT_EQ(reference.size(), cache.size());
+        for (size_t i = 0; i < inputs.size(); i++) {
+            const VisibleRegionCache::Result& expected(reference.getResult(i));
+            const VisibleRegionCache::Result& actual(cache.getResult(i));
+            EXPECT_TRUE(isSameRegion(expected.visibleRegion,
+                    actual.visibleRegion)) << "layer " << i;
+            EXPECT_TRUE(isSameRegion(expected.coveredRegion,
+                    actual.coveredRegion)) << "layer " << i;
+            EXPECT_TRUE(isSameRegion(expected.visibleNonTransparentRegion,
+                    actual.visibleNonTransparentRegion)) << "layer " << i;
+            EXPECT_TRUE(isSameRegion(expected.aboveOpaqueRegion,
+                    actual.aboveOpaqueRegion)) << "layer " << i;
+        }
+        EXPECT_TRUE(isSameRegion(reference.getOpaqueRegion(),
+                cache.getOpaqueRegion()));
+    }
+
+    uint32_t mSeed;
+    static uint32_t sNextId;
+};
+
+uint32_t VisibleRegionCacheTest::sNextId = 1;
+
+TEST_F(VisibleRegionCacheTest, ComputesVisibleAndCoveredRegions) {
+    Vector<VisibleRegionCache::Input> inputs;
+    VisibleRegionCache::Input dialog;
+    dialog.id = 1;
+    dialog.bounds = Rect(100, 100, 300, 300);
+    dialog.opaque = false;
+    dialog.transparentRegion.set(Rect(100, 100, 300, 150));
+    inputs.add(dialog);
+    VisibleRegionCache::Input window;
+    window.id = 2;
+    window.bounds = Rect(0, 0, 200, 200);
+    window.opaque = true;
+    inputs.add(window);
+    VisibleRegionCache::Input wallpaper;
+    wallpaper.id = 3;
+    wallpaper.bounds = Rect(400, 400);
+    wallpaper.opaque = true;
+    inputs.add(wallpaper);
+
+    VisibleRegionCache cache;
+    ASSERT_EQ(0U, cache.update(inputs));
+    ASSERT_EQ(3U, cache.size());
+
+    EXPECT_TRUE(isSameRegion(Region(dialog.bounds),
+            cache.getResult(0).visibleRegion));
+    EXPECT_TRUE(cache.getResult(0).coveredRegion.isEmpty());
+    EXPECT_TRUE(isSameRegion(Region(Rect(100, 150, 300, 300)),
+            cache.getResult(0).visibleNonTransparentRegion));
+
+    // the translucent dialog covers the window but doesn't hide it
+    EXPECT_TRUE(isSameRegion(Region(window.bounds),
+            cache.getResult(1).visibleRegion));
+    EXPECT_TRUE(isSameRegion(Region(Rect(100, 100, 200, 200)),
+            cache.getResult(1).coveredRegion));
+
+    // the opaque window hides part of the wallpaper
+    EXPECT_TRUE(isSameRegion(Region(wallpaper.bounds) - Region(window.bounds),
+            cache.getResult(2).visibleRegion));
+    EXPECT_TRUE(isSameRegion(Region(window.bounds),
+            cache.getResult(2).aboveOpaqueRegion));
+    EXPECT_TRUE(isSameRegion(Region(wallpaper.bounds),
+            cache.getOpaqueRegion()));
+}
+
+TEST_F(VisibleRegionCacheTest, RecomputesFromTopmostChangedLayer) {
+    Vector<VisibleRegionCache::Input> inputs;
+    createScene(20, &inputs);
+    VisibleRegionCache cache;
+    ASSERT_EQ(0U, cache.update(inputs));
+
+    // Nothing changed
+    EXPECT_EQ(inputs.size(), cache.update(inputs));
+
+    // A layer moved
+    inputs.editItemAt(12).bounds.offsetBy(10, 10);
+    EXPECT_EQ(12U, cache.update(inputs));
+    ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+
+    // The transparent region hint changed
+    inputs.editItemAt(7).transparentRegion.set(Rect(5, 5));
+    EXPECT_EQ(7U, cache.update(inputs));
+    ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+
+    // A layer was removed, and another one replaced by a new layer
+    inputs.removeAt(15);
+    inputs.editItemAt(16).id = sNextId++;
+    EXPECT_EQ(15U, cache.update(inputs));
+    ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+
+    // Layers were added at the bottom
+    inputs.add(randomLayer(sNextId++));
+    inputs.add(randomLayer(sNextId++));
+    EXPECT_EQ(inputs.size() - 2, cache.update(inputs));
+    ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+
+    cache.clear();
+    EXPECT_EQ(0U, cache.update(inputs));
+}
+
+TEST_F(VisibleRegionCacheTest, RandomChangesMatchFullComputation) {
+    Vector<VisibleRegionCache::Input> inputs;
+    createScene(50, &inputs);
+    VisibleRegionCache cache;
+    cache.update(inputs);
+
+    for (int i = 0; i < 200; i++) {
+        const size_t index = random(inputs.size());
+        switch (random(4)) {
+            case 0:
+                inputs.editItemAt(index).bounds.offsetBy(
+                        random(41) - 20, random(41) - 20);
+                break;
+            case 1:
+                inputs.editItemAt(index).opaque = !inputs[index].opaque;
+                break;
+            case 2:
+                if (inputs.size() > 1) {
+                    inputs.removeAt(index);
+                }
+                break;
+            case 3:
+                inputs.insertAt(randomLayer(sNextId++), index);
+                break;
+        }
+        cache.update(inputs);
+        ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+    }
+}
+
+// Prints the cost of a full computation against an incremental one when a
+// single layer moves, for scenes of 10 to 200 layers.
+TEST_F(VisibleRegionCacheTest, IncrementalUpdateBenchmark) {
+    const size_t layerCounts[] = { 10, 25, 50, 100, 200 };
+    const int ITERATIONS = 200;
+
+    for (size_t c = 0; c < sizeof(layerCounts) / sizeof(layerCounts[0]);
+            c++) {
+        const size_t layerCount = layerCounts[c];
+        Vector<VisibleRegionCache::Input> inputs;
+        createScene(layerCount, &inputs);
+        VisibleRegionCache cache;
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < ITERATIONS; i++) {
+            cache.clear();
+            cache.update(inputs);
+        }
+        const nsecs_t full = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+        // move the top, middle and bottom window in turn, the way an
+        // animation would
+        const size_t moved[] = { 0, layerCount / 2, layerCount - 2 };
+        nsecs_t incremental[3];
+        for (size_t m = 0; m < 3; m++) {
+            VisibleRegionCache::Input& input(inputs.editItemAt(moved[m]));
+            start = systemTime(SYSTEM_TIME_MONOTONIC);
+            for (int i = 0; i < ITERATIONS; i++) {
+                input.bounds.offsetBy(i & 1 ? -1 : 1, 0);
+                ASSERT_EQ(moved[m], cache.update(inputs));
+            }
+            incremental[m] = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        }
+        ASSERT_NO_FATAL_FAILURE(expectSameResults(cache, inputs));
+
+        printf("[          ] %3zu layers: full %7.2f us, moving top %7.2f us, "
+                "middle %7.2f us, bottom %7.2f us\n", layerCount,
+                full / 1000.0 / ITERATIONS,
+                incremental[0] / 1000.0 / ITERATIONS,
+                incremental[1] / 1000.0 / ITERATIONS,
+                incremental[2] / 1000.0 / ITERATIONS);
+    }
+}
+
+} // namespace android
@@ -31,7 +31,15 @@ int receiver(int fd, int events, void* data)
     while ((n = q->getEvents(buffer, 1)) > 0) {
         for (int i=0 ; i<n ; i++) {
             if (buffer[i].header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
-                printf("event vsync: count=%d\t", buffer[i].vsync.count);
+                printf("event vsync: count=%d missed=%d\t",
+                        buffer[i].vsync.count, buffer[i].vsync.missed);
+                if (buffer[i].vsync.expectedVsync) {
+                    printf("next vsync in %f ms, deadline in %f ms\t",
+                            float(buffer[i].vsync.expectedVsync -
+                                    buffer[i].header.timestamp) / ms2ns(1),
+                            float(buffer[i].vsync.deadline -
+                                    buffer[i].header.timestamp) / ms2ns(1));
+                }
             }
             if (oldTimeStamp) {
                 float t = float(buffer[i].header.timestamp - oldTimeStamp) / s2ns(1);
@@ -56,6 +64,7 @@ int main(int argc, char** argv)
             &myDisplayEvent);
 
     myDisplayEvent.setVsyncRate(1);
+    myDisplayEvent.setVsyncCoalescing(true);
 
     do {
         //printf("about to poll...\n");